@@ -112,3 +112,26 @@ void EnzymeXLADialect::initialize() {
   // #include "src/enzyme_ad/jax/Dialect/EnzymeXLAOpsTypes.cpp.inc"
   //      >();
 }
+
+std::shared_ptr<const FrozenRewritePatternSet>
+EnzymeXLADialect::getOrCreatePatternSet(
+    StringRef key, function_ref<FailureOr<FrozenRewritePatternSet>()> build) {
+  std::lock_guard<std::mutex> lock(patternSetMutex);
+  auto found = patternSetCache.find(key);
+  if (found != patternSetCache.end())
+    return found->second;
+
+  FailureOr<FrozenRewritePatternSet> patterns = build();
+  if (failed(patterns))
+    return nullptr;
+  auto frozen =
+      std::make_shared<const FrozenRewritePatternSet>(std::move(*patterns));
+  patternSetCache[key] = frozen;
+  return frozen;
+}
+
+void EnzymeXLADialect::withStageFingerPrints(
+    StringRef stage, function_ref<void(FingerPrintMap &)> fn) {
+  std::lock_guard<std::mutex> lock(stageFingerPrintMutex);
+  fn(stageFingerPrints[stage]);
+}
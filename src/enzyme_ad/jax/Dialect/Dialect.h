@@ -10,7 +10,15 @@
 #ifndef ENZYMEXLA_DIALECT_H
 #define ENZYMEXLA_DIALECT_H
 
+#include "mlir/IR/BuiltinAttributes.h"
 #include "mlir/IR/Dialect.h"
+#include "mlir/IR/OperationSupport.h"
+#include "mlir/Rewrite/FrozenRewritePatternSet.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+
+#include <mutex>
 
 // #define GET_ATTRDEF_CLASSES
 // #include "src/enzyme_ad/jax/Dialect/EnzymeXLAAttrEnums.h.inc"
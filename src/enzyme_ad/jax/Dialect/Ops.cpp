@@ -192,6 +192,24 @@ void JITCallOp::getEffects(
   addMemoryEffectsFromAttr(effects, effectsAttr);
 }
 
+// Returns true if the callee never writes through argument `idx`, either
+// because it is annotated as such or because mark-func-memory-effects proved
+// that it only reads it and does not capture it.
+static bool isReadOnlyArg(FunctionOpInterface fn, unsigned idx) {
+  if (fn.front().getArgument(idx).use_empty() ||
+      fn.getArgAttr(idx, LLVMDialect::getReadonlyAttrName()) ||
+      fn.getArgAttr(idx, LLVMDialect::getReadnoneAttrName()))
+    return true;
+
+  auto effects =
+      fn.getArgAttrOfType<ArrayAttr>(idx, "enzymexla.memory_effects");
+  if (!effects || !fn.getArgAttr(idx, "enzymexla.nocapture"))
+    return false;
+  return llvm::none_of(effects, [](Attribute attr) {
+    return cast<StringAttr>(attr).getValue() == "write";
+  });
+}
+
 /// Replace cast(subindex(x, InterimType), FinalType) with subindex(x,
 /// FinalType)
 template <typename OpTy>
@@ -217,11 +235,7 @@ public:
       auto alias = cast<OutputOperandAliasAttr>(alias_attr);
       auto operandIndex = alias.getOperandIndex();
 
-      auto operand = fn.front().getArgument(operandIndex);
-      bool readonly =
-          operand.use_empty() ||
-          fn.getArgAttr(operandIndex, LLVMDialect::getReadonlyAttrName()) ||
-          fn.getArgAttr(operandIndex, LLVMDialect::getReadnoneAttrName());
+      bool readonly = isReadOnlyArg(fn, operandIndex);
 
       if (readonly) {
 
@@ -239,13 +253,9 @@ public:
       auto alias = cast<OutputOperandAliasAttr>(en.value());
       auto operandIndex = alias.getOperandIndex();
 
-      auto operand = fn.front().getArgument(operandIndex);
       assert(launchOp.getInputs()[operandIndex].getType() ==
              launchOp.getResultTypes()[idx]);
-      bool readonly =
-          operand.use_empty() ||
-          fn.getArgAttr(operandIndex, LLVMDialect::getReadonlyAttrName()) ||
-          fn.getArgAttr(operandIndex, LLVMDialect::getReadnoneAttrName());
+      bool readonly = isReadOnlyArg(fn, operandIndex);
 
       if (readonly) {
         continue;
@@ -271,11 +281,7 @@ public:
       auto alias = cast<OutputOperandAliasAttr>(alias_attr);
       auto operandIndex = alias.getOperandIndex();
 
-      auto operand = fn.front().getArgument(operandIndex);
-      bool readonly =
-          operand.use_empty() ||
-          fn.getArgAttr(operandIndex, LLVMDialect::getReadonlyAttrName()) ||
-          fn.getArgAttr(operandIndex, LLVMDialect::getReadnoneAttrName());
+      bool readonly = isReadOnlyArg(fn, operandIndex);
 
       if (readonly) {
         replacements.push_back(launchOp.getInputs()[operandIndex]);
@@ -57,6 +57,7 @@ LogicalResult WhileLoopInfo::computeInfo() {
 
   start = op->getOperand(induct.getArgNumber());
   limit = cond.getOperand(1);
+  inductionVariable = loopBodyBlock->getArgument(induct.getArgNumber());
 
   return success();
 }
@@ -92,6 +93,8 @@ int64_t WhileLoopInfo::getConstantNumIters() {
   if (step < 0 && limit > start)
     return 0;
 
+  if (step > 0)
+    return (limit - start + step - 1) / step;
   return (limit - start) / step;
 }
 
@@ -9,21 +9,19 @@
 
 #include "stablehlo/dialect/StablehloOps.h"
 
-using namespace mlir;
-using namespace mlir::stablehlo;
-
 namespace mlir {
 
 namespace enzyme {
 
 struct WhileLoopInfo {
-  WhileOp op;
+  stablehlo::WhileOp op;
 
   mlir::Value start; // guaranteed to dominate the while op
   mlir::Value limit; // not guaranteed to dominate the while op
   mlir::Value step;  // not guaranteed to dominate the while op
+  mlir::BlockArgument inductionVariable; // argument of the body block
 
-  WhileLoopInfo(WhileOp op_) : op(op_) {}
+  WhileLoopInfo(stablehlo::WhileOp op_) : op(op_) {}
 
   LogicalResult computeInfo();
 
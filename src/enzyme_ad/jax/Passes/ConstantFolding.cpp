@@ -0,0 +1,914 @@
+//===- ConstantFolding.cpp - Native constant folding of StableHLO ops -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Elements are read from and written to the raw attribute buffers through
+// small typed accessors, so the per-element loops are plain arithmetic the
+// compiler can vectorize. f16 and bf16 values are computed in f32 and rounded
+// back after every operation.
+//===----------------------------------------------------------------------===//
+
+#include "src/enzyme_ad/jax/Passes/ConstantFolding.h"
+
+#include "stablehlo/dialect/ChloOps.h"
+#include "stablehlo/dialect/StablehloOps.h"
+#include "llvm/ADT/TypeSwitch.h"
+#include "llvm/ADT/bit.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+using namespace mlir;
+using namespace mlir::enzyme;
+
+namespace {
+
+//===----------------------------------------------------------------------===//
+// Element storage
+//===----------------------------------------------------------------------===//
+
+float halfToFloat(uint16_t h) {
+  uint32_t sign = uint32_t(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  if (exp == 0) {
+    float val = std::ldexp(float(mant), -24);
+    return sign ? -val : val;
+  }
+  if (exp == 0x1f)
+    return llvm::bit_cast<float>(sign | 0x7f800000 | (mant << 13));
+  return llvm::bit_cast<float>(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+uint16_t floatToHalf(float f) {
+  uint32_t x = llvm::bit_cast<uint32_t>(f);
+  uint16_t sign = (x >> 16) & 0x8000;
+  uint32_t absx = x & 0x7fffffff;
+  // Inf and NaN, keeping NaNs quiet.
+  if (absx >= 0x7f800000)
+    return sign | 0x7c00 |
+           (absx > 0x7f800000 ? 0x200 | ((absx >> 13) & 0x3ff) : 0);
+  // Values from 65520 on round to infinity.
+  if (absx >= 0x477ff000)
+    return sign | 0x7c00;
+  // Subnormal results are multiples of 2^-24.
+  if (absx < 0x38800000)
+    return sign |
+           uint16_t(std::nearbyint(llvm::bit_cast<float>(absx) * 16777216.0f));
+  uint32_t h = (absx >> 13) - (112 << 10);
+  uint32_t rest = absx & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+    h++;
+  return sign | h;
+}
+
+float bfloatToFloat(uint16_t b) {
+  return llvm::bit_cast<float>(uint32_t(b) << 16);
+}
+
+uint16_t floatToBFloat(float f) {
+  uint32_t x = llvm::bit_cast<uint32_t>(f);
+  if (std::isnan(f))
+    return (x >> 16) | 0x40;
+  x += 0x7fff + ((x >> 16) & 1);
+  return x >> 16;
+}
+
+template <typename T> struct NativeElement {
+  using Storage = T;
+  using Compute = T;
+  static Compute load(const char *ptr) {
+    T val;
+    memcpy(&val, ptr, sizeof(T));
+    return val;
+  }
+  static void store(char *ptr, Compute val) { memcpy(ptr, &val, sizeof(T)); }
+  static Compute round(Compute val) { return val; }
+};
+
+template <float (*toFloat)(uint16_t), uint16_t (*fromFloat)(float)>
+struct HalfElement {
+  using Storage = uint16_t;
+  using Compute = float;
+  static Compute load(const char *ptr) {
+    uint16_t val;
+    memcpy(&val, ptr, sizeof(val));
+    return toFloat(val);
+  }
+  static void store(char *ptr, Compute val) {
+    uint16_t bits = fromFloat(val);
+    memcpy(ptr, &bits, sizeof(bits));
+  }
+  static Compute round(Compute val) { return toFloat(fromFloat(val)); }
+};
+
+using F16Element = HalfElement<halfToFloat, floatToHalf>;
+using BF16Element = HalfElement<bfloatToFloat, floatToBFloat>;
+
+enum class ElementKind {
+  F16,
+  BF16,
+  F32,
+  F64,
+  I1,
+  SI8,
+  SI16,
+  SI32,
+  SI64,
+  UI8,
+  UI16,
+  UI32,
+  UI64
+};
+
+std::optional<ElementKind> getElementKind(Type type) {
+  if (type.isF16())
+    return ElementKind::F16;
+  if (type.isBF16())
+    return ElementKind::BF16;
+  if (type.isF32())
+    return ElementKind::F32;
+  if (type.isF64())
+    return ElementKind::F64;
+  auto intType = dyn_cast<IntegerType>(type);
+  if (!intType)
+    return std::nullopt;
+  bool isUnsigned = intType.isUnsigned();
+  switch (intType.getWidth()) {
+  case 1:
+    return ElementKind::I1;
+  case 8:
+    return isUnsigned ? ElementKind::UI8 : ElementKind::SI8;
+  case 16:
+    return isUnsigned ? ElementKind::UI16 : ElementKind::SI16;
+  case 32:
+    return isUnsigned ? ElementKind::UI32 : ElementKind::SI32;
+  case 64:
+    return isUnsigned ? ElementKind::UI64 : ElementKind::SI64;
+  default:
+    return std::nullopt;
+  }
+}
+
+// Calls `fn` with a default-constructed element accessor for `kind`.
+template <typename Fn> auto dispatch(ElementKind kind, Fn &&fn) {
+  switch (kind) {
+  case ElementKind::F16:
+    return fn(F16Element());
+  case ElementKind::BF16:
+    return fn(BF16Element());
+  case ElementKind::F32:
+    return fn(NativeElement<float>());
+  case ElementKind::F64:
+    return fn(NativeElement<double>());
+  case ElementKind::I1:
+    return fn(NativeElement<bool>());
+  case ElementKind::SI8:
+    return fn(NativeElement<int8_t>());
+  case ElementKind::SI16:
+    return fn(NativeElement<int16_t>());
+  case ElementKind::SI32:
+    return fn(NativeElement<int32_t>());
+  case ElementKind::SI64:
+    return fn(NativeElement<int64_t>());
+  case ElementKind::UI8:
+    return fn(NativeElement<uint8_t>());
+  case ElementKind::UI16:
+    return fn(NativeElement<uint16_t>());
+  case ElementKind::UI32:
+    return fn(NativeElement<uint32_t>());
+  case ElementKind::UI64:
+    return fn(NativeElement<uint64_t>());
+  }
+  llvm_unreachable("unknown element kind");
+}
+
+// Size in bytes of an element in the raw buffers, or 0 if unsupported.
+// Complex numbers are supported for data movement only.
+size_t getElementBytes(Type type) {
+  if (auto complex = dyn_cast<ComplexType>(type))
+    return 2 * getElementBytes(complex.getElementType());
+  auto kind = getElementKind(type);
+  if (!kind)
+    return 0;
+  return dispatch(*kind, [](auto elt) {
+    return sizeof(typename decltype(elt)::Storage);
+  });
+}
+
+// Raw elements of a constant, with i1 values unpacked to one byte each. A
+// splat holds a single element.
+class RawBuffer {
+public:
+  explicit RawBuffer(DenseElementsAttr attr) : splat(attr.isSplat()) {
+    if (!attr.getElementType().isInteger(1)) {
+      raw = attr.getRawData();
+      return;
+    }
+    if (splat) {
+      bytes.push_back(attr.getSplatValue<bool>());
+    } else {
+      bytes.reserve(attr.getNumElements());
+      for (bool val : attr.getValues<bool>())
+        bytes.push_back(val);
+    }
+    raw = ArrayRef<char>(bytes.data(), bytes.size());
+  }
+  RawBuffer(const RawBuffer &) = delete;
+
+  const char *data() const { return raw.data(); }
+  bool isSplat() const { return splat; }
+  // Distance in bytes between consecutive elements.
+  size_t step(size_t elementBytes) const { return splat ? 0 : elementBytes; }
+
+private:
+  bool splat;
+  std::vector<char> bytes;
+  ArrayRef<char> raw;
+};
+
+DenseElementsAttr makeFromRaw(ShapedType type, ArrayRef<char> data) {
+  if (type.getElementType().isInteger(1)) {
+    ArrayRef<bool> values(reinterpret_cast<const bool *>(data.data()),
+                          data.size());
+    if (values.size() == 1)
+      return DenseElementsAttr::get(type, values[0]);
+    return DenseElementsAttr::get(type, values);
+  }
+  return DenseElementsAttr::getFromRawBuffer(type, data);
+}
+
+SmallVector<int64_t> getRowMajorStrides(ArrayRef<int64_t> shape) {
+  SmallVector<int64_t> strides(shape.size(), 1);
+  for (int64_t i = (int64_t)shape.size() - 2; i >= 0; --i)
+    strides[i] = strides[i + 1] * shape[i + 1];
+  return strides;
+}
+
+template <size_t Bytes>
+void copyElements(char *dst, int64_t dstStride, const char *src,
+                  int64_t srcStride, int64_t count) {
+  for (int64_t i = 0; i < count; ++i)
+    memcpy(dst + i * dstStride * Bytes, src + i * srcStride * Bytes, Bytes);
+}
+
+// Copies one element for every index of `shape`, from and to the element
+// offsets given by the per-dimension strides.
+void stridedCopy(ArrayRef<int64_t> shape, const char *src, int64_t srcOffset,
+                 ArrayRef<int64_t> srcStrides, char *dst, int64_t dstOffset,
+                 ArrayRef<int64_t> dstStrides, size_t elementBytes) {
+  if (llvm::is_contained(shape, 0))
+    return;
+  if (shape.empty()) {
+    memcpy(dst + dstOffset * elementBytes, src + srcOffset * elementBytes,
+           elementBytes);
+    return;
+  }
+
+  int64_t rank = shape.size();
+  int64_t inner = shape.back();
+  int64_t srcInner = srcStrides.back(), dstInner = dstStrides.back();
+  SmallVector<int64_t> idx(rank - 1, 0);
+  while (true) {
+    const char *s = src + srcOffset * elementBytes;
+    char *d = dst + dstOffset * elementBytes;
+    if (srcInner == 1 && dstInner == 1) {
+      memcpy(d, s, inner * elementBytes);
+    } else {
+      switch (elementBytes) {
+      case 1:
+        copyElements<1>(d, dstInner, s, srcInner, inner);
+        break;
+      case 2:
+        copyElements<2>(d, dstInner, s, srcInner, inner);
+        break;
+      case 4:
+        copyElements<4>(d, dstInner, s, srcInner, inner);
+        break;
+      case 8:
+        copyElements<8>(d, dstInner, s, srcInner, inner);
+        break;
+      case 16:
+        copyElements<16>(d, dstInner, s, srcInner, inner);
+        break;
+      default:
+        llvm_unreachable("unexpected element size");
+      }
+    }
+
+    int64_t dim = rank - 2;
+    for (; dim >= 0; --dim) {
+      srcOffset += srcStrides[dim];
+      dstOffset += dstStrides[dim];
+      if (++idx[dim] < shape[dim])
+        break;
+      srcOffset -= srcStrides[dim] * shape[dim];
+      dstOffset -= dstStrides[dim] * shape[dim];
+      idx[dim] = 0;
+    }
+    if (dim < 0)
+      return;
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Elementwise operations
+//===----------------------------------------------------------------------===//
+
+enum class ElementwiseKind {
+  // Unary
+  Neg,
+  Abs,
+  Sqrt,
+  Rsqrt,
+  Exp,
+  Expm1,
+  Log,
+  Log1p,
+  Sine,
+  Cosine,
+  Tan,
+  Tanh,
+  Logistic,
+  Ceil,
+  Floor,
+  Round,
+  RoundNearestEven,
+  Sign,
+  Cbrt,
+  Not,
+  IsFinite,
+  // Binary
+  Add,
+  Subtract,
+  Multiply,
+  Divide,
+  Remainder,
+  Max,
+  Min,
+  Power,
+  Atan2,
+  And,
+  Or,
+  Xor
+};
+
+std::optional<ElementwiseKind> getElementwiseKind(Operation *op) {
+  using K = ElementwiseKind;
+  return llvm::TypeSwitch<Operation *, std::optional<ElementwiseKind>>(op)
+      .Case([](stablehlo::NegOp) { return K::Neg; })
+      .Case([](stablehlo::AbsOp) { return K::Abs; })
+      .Case([](stablehlo::SqrtOp) { return K::Sqrt; })
+      .Case([](stablehlo::RsqrtOp) { return K::Rsqrt; })
+      .Case([](stablehlo::ExpOp) { return K::Exp; })
+      .Case([](stablehlo::Expm1Op) { return K::Expm1; })
+      .Case([](stablehlo::LogOp) { return K::Log; })
+      .Case([](stablehlo::Log1pOp) { return K::Log1p; })
+      .Case([](stablehlo::SineOp) { return K::Sine; })
+      .Case([](stablehlo::CosineOp) { return K::Cosine; })
+      .Case([](stablehlo::TanOp) { return K::Tan; })
+      .Case([](stablehlo::TanhOp) { return K::Tanh; })
+      .Case([](stablehlo::LogisticOp) { return K::Logistic; })
+      .Case([](stablehlo::CeilOp) { return K::Ceil; })
+      .Case([](stablehlo::FloorOp) { return K::Floor; })
+      .Case([](stablehlo::RoundOp) { return K::Round; })
+      .Case([](stablehlo::RoundNearestEvenOp) { return K::RoundNearestEven; })
+      .Case([](stablehlo::SignOp) { return K::Sign; })
+      .Case([](stablehlo::CbrtOp) { return K::Cbrt; })
+      .Case([](stablehlo::NotOp) { return K::Not; })
+      .Case([](stablehlo::IsFiniteOp) { return K::IsFinite; })
+      .Case([](stablehlo::AddOp) { return K::Add; })
+      .Case([](stablehlo::SubtractOp) { return K::Subtract; })
+      .Case([](stablehlo::MulOp) { return K::Multiply; })
+      .Case([](stablehlo::DivOp) { return K::Divide; })
+      .Case([](stablehlo::RemOp) { return K::Remainder; })
+      .Case([](stablehlo::MaxOp) { return K::Max; })
+      .Case([](stablehlo::MinOp) { return K::Min; })
+      .Case([](stablehlo::PowOp) { return K::Power; })
+      .Case([](stablehlo::Atan2Op) { return K::Atan2; })
+      .Case([](stablehlo::AndOp) { return K::And; })
+      .Case([](stablehlo::OrOp) { return K::Or; })
+      .Case([](stablehlo::XorOp) { return K::Xor; })
+      .Default([](Operation *) { return std::nullopt; });
+}
+
+// Returns the function computing `kind` on a single element of compute type
+// `T`, wrapped in `use`, or false if unsupported for `T`.
+template <typename T, typename UseFn>
+bool withUnaryFn(ElementwiseKind kind, UseFn &&use) {
+  using K = ElementwiseKind;
+  if constexpr (std::is_floating_point_v<T>) {
+    switch (kind) {
+    case K::Neg:
+      return use([](T x) { return -x; });
+    case K::Abs:
+      return use([](T x) { return std::fabs(x); });
+    case K::Sqrt:
+      return use([](T x) { return std::sqrt(x); });
+    case K::Rsqrt:
+      return use([](T x) { return T(1) / std::sqrt(x); });
+    case K::Exp:
+      return use([](T x) { return std::exp(x); });
+    case K::Expm1:
+      return use([](T x) { return std::expm1(x); });
+    case K::Log:
+      return use([](T x) { return std::log(x); });
+    case K::Log1p:
+      return use([](T x) { return std::log1p(x); });
+    case K::Sine:
+      return use([](T x) { return std::sin(x); });
+    case K::Cosine:
+      return use([](T x) { return std::cos(x); });
+    case K::Tan:
+      return use([](T x) { return std::tan(x); });
+    case K::Tanh:
+      return use([](T x) { return std::tanh(x); });
+    case K::Logistic:
+      return use([](T x) { return T(1) / (T(1) + std::exp(-x)); });
+    case K::Ceil:
+      return use([](T x) { return std::ceil(x); });
+    case K::Floor:
+      return use([](T x) { return std::floor(x); });
+    case K::Round:
+      return use([](T x) { return std::round(x); });
+    case K::RoundNearestEven:
+      return use([](T x) { return std::nearbyint(x); });
+    case K::Sign:
+      return use([](T x) {
+        if (std::isnan(x) || x == T(0))
+          return x;
+        return x > T(0) ? T(1) : T(-1);
+      });
+    case K::Cbrt:
+      return use([](T x) { return std::cbrt(x); });
+    default:
+      return false;
+    }
+  } else if constexpr (std::is_same_v<T, bool>) {
+    if (kind == K::Not)
+      return use([](bool x) { return !x; });
+    return false;
+  } else {
+    using U = std::make_unsigned_t<T>;
+    switch (kind) {
+    case K::Neg:
+      return use([](T x) { return T(U(0) - U(x)); });
+    case K::Abs:
+      if constexpr (std::is_signed_v<T>)
+        return use([](T x) { return x < 0 ? T(U(0) - U(x)) : x; });
+      return false;
+    case K::Sign:
+      if constexpr (std::is_signed_v<T>)
+        return use([](T x) { return T((x > 0) - (x < 0)); });
+      return false;
+    case K::Not:
+      return use([](T x) { return T(~x); });
+    default:
+      return false;
+    }
+  }
+}
+
+template <typename T, typename UseFn>
+bool withBinaryFn(ElementwiseKind kind, UseFn &&use) {
+  using K = ElementwiseKind;
+  if constexpr (std::is_floating_point_v<T>) {
+    switch (kind) {
+    case K::Add:
+      return use([](T x, T y) { return x + y; });
+    case K::Subtract:
+      return use([](T x, T y) { return x - y; });
+    case K::Multiply:
+      return use([](T x, T y) { return x * y; });
+    case K::Divide:
+      return use([](T x, T y) { return x / y; });
+    case K::Remainder:
+      return use([](T x, T y) { return std::fmod(x, y); });
+    case K::Power:
+      return use([](T x, T y) { return std::pow(x, y); });
+    case K::Atan2:
+      return use([](T x, T y) { return std::atan2(x, y); });
+    // IEEE maximum/minimum: NaN propagating, -0 < +0.
+    case K::Max:
+      return use([](T x, T y) {
+        if (std::isnan(x) || std::isnan(y))
+          return std::numeric_limits<T>::quiet_NaN();
+        if (x == y)
+          return std::signbit(x) ? y : x;
+        return x > y ? x : y;
+      });
+    case K::Min:
+      return use([](T x, T y) {
+        if (std::isnan(x) || std::isnan(y))
+          return std::numeric_limits<T>::quiet_NaN();
+        if (x == y)
+          return std::signbit(x) ? x : y;
+        return x < y ? x : y;
+      });
+    default:
+      return false;
+    }
+  } else if constexpr (std::is_same_v<T, bool>) {
+    switch (kind) {
+    case K::And:
+    case K::Min:
+      return use([](bool x, bool y) { return x && y; });
+    case K::Or:
+    case K::Max:
+      return use([](bool x, bool y) { return x || y; });
+    case K::Xor:
+      return use([](bool x, bool y) { return x != y; });
+    default:
+      return false;
+    }
+  } else {
+    // Wrap around on overflow; division by zero and signed overflow follow
+    // the StableHLO specification.
+    using U = std::make_unsigned_t<T>;
+    switch (kind) {
+    case K::Add:
+      return use([](T x, T y) { return T(U(x) + U(y)); });
+    case K::Subtract:
+      return use([](T x, T y) { return T(U(x) - U(y)); });
+    case K::Multiply:
+      return use([](T x, T y) { return T(U(x) * U(y)); });
+    case K::Divide:
+      return use([](T x, T y) {
+        if (y == 0)
+          return T(~U(0));
+        if (std::is_signed_v<T> && x == std::numeric_limits<T>::min() &&
+            y == T(-1))
+          return x;
+        return T(x / y);
+      });
+    case K::Remainder:
+      return use([](T x, T y) {
+        if (y == 0)
+          return x;
+        if (std::is_signed_v<T> && x == std::numeric_limits<T>::min() &&
+            y == T(-1))
+          return T(0);
+        return T(x % y);
+      });
+    case K::Max:
+      return use([](T x, T y) { return x > y ? x : y; });
+    case K::Min:
+      return use([](T x, T y) { return x < y ? x : y; });
+    case K::And:
+      return use([](T x, T y) { return T(x & y); });
+    case K::Or:
+      return use([](T x, T y) { return T(x | y); });
+    case K::Xor:
+      return use([](T x, T y) { return T(x ^ y); });
+    default:
+      return false;
+    }
+  }
+}
+
+template <typename Elt>
+bool foldUnary(ElementwiseKind kind, const RawBuffer &in, char *out,
+               int64_t count) {
+  using T = typename Elt::Compute;
+  constexpr size_t bytes = sizeof(typename Elt::Storage);
+  size_t step = in.step(bytes);
+  return withUnaryFn<T>(kind, [&](auto fn) {
+    const char *src = in.data();
+    for (int64_t i = 0; i < count; ++i)
+      Elt::store(out + i * bytes, fn(Elt::load(src + i * step)));
+    return true;
+  });
+}
+
+template <typename Elt>
+bool foldBinary(ElementwiseKind kind, const RawBuffer &lhs,
+                const RawBuffer &rhs, char *out, int64_t count) {
+  using T = typename Elt::Compute;
+  constexpr size_t bytes = sizeof(typename Elt::Storage);
+  size_t lhsStep = lhs.step(bytes), rhsStep = rhs.step(bytes);
+  return withBinaryFn<T>(kind, [&](auto fn) {
+    const char *lhsData = lhs.data(), *rhsData = rhs.data();
+    for (int64_t i = 0; i < count; ++i)
+      Elt::store(out + i * bytes, fn(Elt::load(lhsData + i * lhsStep),
+                                     Elt::load(rhsData + i * rhsStep)));
+    return true;
+  });
+}
+
+} // namespace
+
+DenseElementsAttr
+mlir::enzyme::constFoldElementwise(Operation *op,
+                                   ArrayRef<DenseElementsAttr> operands) {
+  auto kind = getElementwiseKind(op);
+  if (!kind || operands.empty() || operands.size() > 2 ||
+      operands.size() != op->getNumOperands())
+    return {};
+  auto resultType = dyn_cast<RankedTensorType>(op->getResult(0).getType());
+  if (!resultType || !resultType.hasStaticShape())
+    return {};
+
+  Type elementType = operands[0].getElementType();
+  auto elementKind = getElementKind(elementType);
+  if (!elementKind)
+    return {};
+  for (auto operand : operands)
+    if (operand.getElementType() != elementType)
+      return {};
+
+  bool allSplat =
+      llvm::all_of(operands, [](auto attr) { return attr.isSplat(); });
+  int64_t count = allSplat ? 1 : resultType.getNumElements();
+
+  RawBuffer in(operands[0]);
+  SmallVector<char> out;
+  if (*kind == ElementwiseKind::IsFinite) {
+    if (!isa<FloatType>(elementType))
+      return {};
+    out.resize(count);
+    dispatch(*elementKind, [&](auto elt) {
+      using Elt = decltype(elt);
+      using T = typename Elt::Compute;
+      constexpr size_t bytes = sizeof(typename Elt::Storage);
+      size_t step = in.step(bytes);
+      if constexpr (std::is_floating_point_v<T>)
+        for (int64_t i = 0; i < count; ++i)
+          out[i] = std::isfinite(Elt::load(in.data() + i * step));
+      return true;
+    });
+    return makeFromRaw(resultType, out);
+  }
+
+  if (resultType.getElementType() != elementType)
+    return {};
+  size_t bytes = getElementBytes(elementType);
+  out.resize(count * bytes);
+  bool folded = dispatch(*elementKind, [&](auto elt) {
+    using Elt = decltype(elt);
+    if (operands.size() == 1)
+      return foldUnary<Elt>(*kind, in, out.data(), count);
+    RawBuffer rhs(operands[1]);
+    return foldBinary<Elt>(*kind, in, rhs, out.data(), count);
+  });
+  if (!folded)
+    return {};
+  return makeFromRaw(resultType, out);
+}
+
+//===----------------------------------------------------------------------===//
+// Data movement
+//===----------------------------------------------------------------------===//
+
+DenseElementsAttr mlir::enzyme::constFoldBroadcastInDim(
+    DenseElementsAttr operand, ArrayRef<int64_t> dims, ShapedType resultType) {
+  if (operand.isSplat())
+    return operand.resizeSplat(resultType);
+  size_t bytes = getElementBytes(operand.getElementType());
+  if (!bytes || !resultType.hasStaticShape())
+    return {};
+
+  RawBuffer in(operand);
+  auto inShape = operand.getType().getShape();
+  auto inStrides = getRowMajorStrides(inShape);
+  SmallVector<int64_t> srcStrides(resultType.getRank(), 0);
+  for (auto [idx, dim] : llvm::enumerate(dims))
+    if (inShape[idx] != 1)
+      srcStrides[dim] = inStrides[idx];
+
+  SmallVector<char> out(resultType.getNumElements() * bytes);
+  stridedCopy(resultType.getShape(), in.data(), 0, srcStrides, out.data(), 0,
+              getRowMajorStrides(resultType.getShape()), bytes);
+  return makeFromRaw(resultType, out);
+}
+
+DenseElementsAttr mlir::enzyme::constFoldTranspose(
+    DenseElementsAttr operand, ArrayRef<int64_t> permutation,
+    ShapedType resultType) {
+  if (operand.isSplat())
+    return operand.resizeSplat(resultType);
+  size_t bytes = getElementBytes(operand.getElementType());
+  if (!bytes || !resultType.hasStaticShape())
+    return {};
+
+  RawBuffer in(operand);
+  auto inStrides = getRowMajorStrides(operand.getType().getShape());
+  SmallVector<int64_t> srcStrides;
+  for (int64_t dim : permutation)
+    srcStrides.push_back(inStrides[dim]);
+
+  SmallVector<char> out(resultType.getNumElements() * bytes);
+  stridedCopy(resultType.getShape(), in.data(), 0, srcStrides, out.data(), 0,
+              getRowMajorStrides(resultType.getShape()), bytes);
+  return makeFromRaw(resultType, out);
+}
+
+DenseElementsAttr mlir::enzyme::constFoldSlice(DenseElementsAttr operand,
+                                               ArrayRef<int64_t> startIndices,
+                                               ArrayRef<int64_t> strides,
+                                               ShapedType resultType) {
+  if (operand.isSplat())
+    return operand.resizeSplat(resultType);
+  size_t bytes = getElementBytes(operand.getElementType());
+  if (!bytes || !resultType.hasStaticShape())
+    return {};
+
+  RawBuffer in(operand);
+  auto inStrides = getRowMajorStrides(operand.getType().getShape());
+  int64_t srcOffset = 0;
+  SmallVector<int64_t> srcStrides;
+  for (auto [start, stride, inStride] :
+       llvm::zip(startIndices, strides, inStrides)) {
+    srcOffset += start * inStride;
+    srcStrides.push_back(stride * inStride);
+  }
+
+  SmallVector<char> out(resultType.getNumElements() * bytes);
+  stridedCopy(resultType.getShape(), in.data(), srcOffset, srcStrides,
+              out.data(), 0, getRowMajorStrides(resultType.getShape()), bytes);
+  return makeFromRaw(resultType, out);
+}
+
+DenseElementsAttr mlir::enzyme::constFoldPad(
+    DenseElementsAttr operand, DenseElementsAttr paddingValue,
+    ArrayRef<int64_t> edgePaddingLow, ArrayRef<int64_t> edgePaddingHigh,
+    ArrayRef<int64_t> interiorPadding, ShapedType resultType) {
+  size_t bytes = getElementBytes(operand.getElementType());
+  if (!bytes || !resultType.hasStaticShape() ||
+      paddingValue.getElementType() != operand.getElementType())
+    return {};
+  if (llvm::any_of(edgePaddingLow, [](int64_t pad) { return pad < 0; }) ||
+      llvm::any_of(edgePaddingHigh, [](int64_t pad) { return pad < 0; }))
+    return {};
+
+  RawBuffer in(operand), pad(paddingValue);
+  int64_t numElements = resultType.getNumElements();
+  SmallVector<char> out(numElements * bytes);
+  if (numElements == 0)
+    return makeFromRaw(resultType, out);
+
+  // Fill with the padding value, doubling the initialized prefix each time.
+  memcpy(out.data(), pad.data(), bytes);
+  for (size_t filled = bytes; filled < out.size(); filled *= 2)
+    memcpy(out.data() + filled, out.data(),
+           std::min(filled, out.size() - filled));
+
+  auto inShape = operand.getType().getShape();
+  auto outStrides = getRowMajorStrides(resultType.getShape());
+  SmallVector<int64_t> srcStrides = getRowMajorStrides(inShape);
+  if (in.isSplat())
+    srcStrides.assign(srcStrides.size(), 0);
+  int64_t dstOffset = 0;
+  SmallVector<int64_t> dstStrides;
+  for (auto [low, interior, outStride] :
+       llvm::zip(edgePaddingLow, interiorPadding, outStrides)) {
+    dstOffset += low * outStride;
+    dstStrides.push_back((interior + 1) * outStride);
+  }
+  stridedCopy(inShape, in.data(), 0, srcStrides, out.data(), dstOffset,
+              dstStrides, bytes);
+  return makeFromRaw(resultType, out);
+}
+
+DenseElementsAttr
+mlir::enzyme::constFoldConcatenate(ArrayRef<DenseElementsAttr> operands,
+                                   int64_t dimension, ShapedType resultType) {
+  if (operands.empty() || !resultType.hasStaticShape())
+    return {};
+  size_t bytes = getElementBytes(operands[0].getElementType());
+  if (!bytes)
+    return {};
+
+  auto outStrides = getRowMajorStrides(resultType.getShape());
+  SmallVector<char> out(resultType.getNumElements() * bytes);
+  int64_t offset = 0;
+  for (auto operand : operands) {
+    if (operand.getElementType() != operands[0].getElementType())
+      return {};
+    RawBuffer in(operand);
+    auto inShape = operand.getType().getShape();
+    SmallVector<int64_t> srcStrides = getRowMajorStrides(inShape);
+    if (in.isSplat())
+      srcStrides.assign(srcStrides.size(), 0);
+    stridedCopy(inShape, in.data(), 0, srcStrides, out.data(),
+                offset * outStrides[dimension], outStrides, bytes);
+    offset += inShape[dimension];
+  }
+  return makeFromRaw(resultType, out);
+}
+
+//===----------------------------------------------------------------------===//
+// Reductions
+//===----------------------------------------------------------------------===//
+
+DenseElementsAttr mlir::enzyme::constFoldReduce(Operation *combiner,
+                                                DenseElementsAttr operand,
+                                                DenseElementsAttr initValue,
+                                                ArrayRef<int64_t> dims,
+                                                ShapedType resultType) {
+  auto kind = getElementwiseKind(combiner);
+  Type elementType = operand.getElementType();
+  auto elementKind = getElementKind(elementType);
+  if (!kind || !elementKind || !resultType.hasStaticShape() ||
+      initValue.getElementType() != elementType ||
+      resultType.getElementType() != elementType)
+    return {};
+  // The order in which a reduction combines elements is unspecified. Integer
+  // arithmetic, min, max and the logical ops do not depend on it, float sums
+  // and products do: those are folded sequentially in row-major order, like
+  // the StableHLO interpreter, and may differ in rounding from a backend that
+  // reassociates them.
+  switch (*kind) {
+  case ElementwiseKind::Add:
+  case ElementwiseKind::Multiply:
+  case ElementwiseKind::Max:
+  case ElementwiseKind::Min:
+  case ElementwiseKind::And:
+  case ElementwiseKind::Or:
+    break;
+  default:
+    return {};
+  }
+
+  auto inShape = operand.getType().getShape();
+  RawBuffer in(operand), init(initValue);
+  int64_t numResults = resultType.getNumElements();
+  SmallVector<char> out;
+
+  // Every result combines the same number of copies of a splat, computed by
+  // repeated doubling: n * x for add, x^n for mul and x for the others. This
+  // reassociates, so float sums and products take the sequential path below.
+  bool reassociates =
+      isa<FloatType>(elementType) &&
+      (*kind == ElementwiseKind::Add || *kind == ElementwiseKind::Multiply);
+  if (operand.isSplat() && numResults != 0 && !reassociates) {
+    int64_t count = 1;
+    for (int64_t dim : dims)
+      count *= inShape[dim];
+    bool folded = dispatch(*elementKind, [&](auto elt) {
+      using Elt = decltype(elt);
+      using T = typename Elt::Compute;
+      constexpr size_t bytes = sizeof(typename Elt::Storage);
+      return withBinaryFn<T>(*kind, [&](auto fn) {
+        T acc = Elt::load(init.data());
+        T power = Elt::load(in.data());
+        for (int64_t n = count; n != 0; n >>= 1) {
+          if (n & 1)
+            acc = Elt::round(fn(acc, power));
+          power = Elt::round(fn(power, power));
+        }
+        out.resize(bytes);
+        Elt::store(out.data(), acc);
+        return true;
+      });
+    });
+    if (!folded)
+      return {};
+    return makeFromRaw(resultType, out);
+  }
+
+  auto outStrides = getRowMajorStrides(resultType.getShape());
+  // Offset in the result when moving along each input dimension.
+  SmallVector<int64_t> accStrides(inShape.size(), 0);
+  for (int64_t dim = 0, outDim = 0; dim < (int64_t)inShape.size(); ++dim) {
+    if (llvm::is_contained(dims, dim))
+      continue;
+    accStrides[dim] = outStrides[outDim++];
+  }
+
+  int64_t numInputs = operand.getType().getNumElements();
+  bool folded = dispatch(*elementKind, [&](auto elt) {
+    using Elt = decltype(elt);
+    using T = typename Elt::Compute;
+    constexpr size_t bytes = sizeof(typename Elt::Storage);
+    return withBinaryFn<T>(*kind, [&](auto fn) {
+      SmallVector<T> acc(numResults, Elt::load(init.data()));
+      size_t step = in.step(bytes);
+      SmallVector<int64_t> idx(inShape.size(), 0);
+      int64_t accOffset = 0;
+      for (int64_t i = 0; i < numInputs; ++i) {
+        acc[accOffset] =
+            Elt::round(fn(acc[accOffset], Elt::load(in.data() + i * step)));
+        for (int64_t dim = inShape.size() - 1; dim >= 0; --dim) {
+          accOffset += accStrides[dim];
+          if (++idx[dim] < inShape[dim])
+            break;
+          accOffset -= accStrides[dim] * inShape[dim];
+          idx[dim] = 0;
+        }
+      }
+      out.resize(numResults * bytes);
+      for (int64_t i = 0; i < numResults; ++i)
+        Elt::store(out.data() + i * bytes, acc[i]);
+      return true;
+    });
+  });
+  if (!folded)
+    return {};
+  return makeFromRaw(resultType, out);
+}
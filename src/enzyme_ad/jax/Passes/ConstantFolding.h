@@ -0,0 +1,66 @@
+//===- ConstantFolding.h - Native constant folding of StableHLO ops -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Folding routines working directly on the raw storage of DenseElementsAttr,
+// used by the const-prop patterns in place of the StableHLO reference
+// interpreter. Each function returns a null attribute if the element type or
+// operation is not supported, in which case callers fall back to the
+// interpreter.
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "mlir/IR/BuiltinAttributes.h"
+#include "mlir/IR/BuiltinTypes.h"
+#include "mlir/IR/Operation.h"
+
+namespace mlir {
+namespace enzyme {
+
+/// Folds the unary or binary elementwise `op` given the constant values of its
+/// operands.
+DenseElementsAttr constFoldElementwise(Operation *op,
+                                       ArrayRef<DenseElementsAttr> operands);
+
+DenseElementsAttr constFoldBroadcastInDim(DenseElementsAttr operand,
+                                          ArrayRef<int64_t> dims,
+                                          ShapedType resultType);
+
+DenseElementsAttr constFoldTranspose(DenseElementsAttr operand,
+                                     ArrayRef<int64_t> permutation,
+                                     ShapedType resultType);
+
+DenseElementsAttr constFoldSlice(DenseElementsAttr operand,
+                                 ArrayRef<int64_t> startIndices,
+                                 ArrayRef<int64_t> strides,
+                                 ShapedType resultType);
+
+/// Only non-negative edge padding is supported.
+DenseElementsAttr constFoldPad(DenseElementsAttr operand,
+                               DenseElementsAttr paddingValue,
+                               ArrayRef<int64_t> edgePaddingLow,
+                               ArrayRef<int64_t> edgePaddingHigh,
+                               ArrayRef<int64_t> interiorPadding,
+                               ShapedType resultType);
+
+DenseElementsAttr constFoldConcatenate(ArrayRef<DenseElementsAttr> operands,
+                                       int64_t dimension,
+                                       ShapedType resultType);
+
+/// Reduces `operand` over `dims` starting from `initValue`, combining
+/// elements with the binary elementwise operation `combiner` (e.g. the
+/// stablehlo.add in the body of a reduction). Only add, mul, min, max, and
+/// and or are supported; splats are reduced in closed form.
+DenseElementsAttr constFoldReduce(Operation *combiner,
+                                  DenseElementsAttr operand,
+                                  DenseElementsAttr initValue,
+                                  ArrayRef<int64_t> dims,
+                                  ShapedType resultType);
+
+} // namespace enzyme
+} // namespace mlir
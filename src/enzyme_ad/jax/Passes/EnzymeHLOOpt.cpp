@@ -24,12 +24,16 @@
 #include "mlir/IR/PatternMatch.h"
 #include "mlir/Pass/PassManager.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
+#include "mlir/Transforms/RegionUtils.h"
 #include "shardy/dialect/sdy/ir/utils.h"
 #include "src/enzyme_ad/jax/Dialect/Dialect.h"
 #include "src/enzyme_ad/jax/Dialect/Ops.h"
+#include "src/enzyme_ad/jax/Implementations/WhileLoopInfo.h"
+#include "src/enzyme_ad/jax/Passes/ConstantFolding.h"
 #include "src/enzyme_ad/jax/Passes/EnzymeHLOPatterns.h"
 #include "src/enzyme_ad/jax/Passes/Passes.h"
 #include "src/enzyme_ad/jax/Passes/StructuredTensors.h"
+#include "src/enzyme_ad/jax/Passes/SymbolicShapes.h"
 #include "src/enzyme_ad/jax/Utils.h"
 #include "stablehlo/dialect/Base.h"
 #include "stablehlo/dialect/ChloOps.h"
@@ -73,6 +77,18 @@ bool anyPadSizesNegative(stablehlo::PadOp pad) {
   return false;
 }
 
+// Checks done by the checked patterns on every match attempt, precomputed by
+// CheckedPatternScope for one greedy rewrite.
+struct mlir::enzyme::CheckedPatternState final {
+  // Whether a function within or around the rewritten op may disable
+  // patterns. If not, the patterns skip looking up their enclosing function.
+  bool anyDisabled = true;
+
+  static thread_local CheckedPatternState *current;
+};
+
+thread_local CheckedPatternState *CheckedPatternState::current = nullptr;
+
 namespace {
 
 llvm::SmallVector<int64_t> getInversePermutation(ArrayRef<int64_t> perm) {
@@ -337,6 +353,14 @@ LogicalResult failIfFuncOpInterfaceHasAttr(Operation *op, StringRef attrName,
 static constexpr StringRef kDisablePatternAttrName =
     "enzymexla.disable_hlo_opts";
 
+LogicalResult failIfPatternsDisabled(Operation *op,
+                                     PatternRewriter &rewriter) {
+  auto *state = CheckedPatternState::current;
+  if (state && !state->anyDisabled)
+    return success();
+  return failIfFuncOpInterfaceHasAttr(op, kDisablePatternAttrName, rewriter);
+}
+
 template <typename OpTy, typename Child>
 struct CheckedOpRewritePattern : public OpRewritePattern<OpTy> {
   using Base = OpRewritePattern<OpTy>;
@@ -344,8 +368,7 @@ struct CheckedOpRewritePattern : public OpRewritePattern<OpTy> {
 
   LogicalResult
   matchAndRewrite(OpTy op, PatternRewriter &rewriter) const override final {
-    LogicalResult res =
-        failIfFuncOpInterfaceHasAttr(op, kDisablePatternAttrName, rewriter);
+    LogicalResult res = failIfPatternsDisabled(op, rewriter);
     if (res.failed())
       return res;
 
@@ -369,8 +392,7 @@ struct CheckedOpTraitRewritePattern : public OpTraitRewritePattern<TraitType> {
   LogicalResult
   matchAndRewrite(Operation *op,
                   PatternRewriter &rewriter) const override final {
-    LogicalResult res =
-        failIfFuncOpInterfaceHasAttr(op, kDisablePatternAttrName, rewriter);
+    LogicalResult res = failIfPatternsDisabled(op, rewriter);
     if (res.failed())
       return res;
 
@@ -405,6 +427,8 @@ struct NoopSlice final
     : CheckedOpRewritePattern<stablehlo::SliceOp, NoopSlice> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::SliceOp op,
                                     PatternRewriter &rewriter) const {
     auto type = dyn_cast<RankedTensorType>(op.getType());
@@ -512,18 +536,52 @@ struct DynamicSliceToStatic final
   }
 };
 
+// A real_dynamic_slice from zero up to the sizes of its operand with unit
+// strides, e.g. with get_dimension_size of the operand as limits.
+struct NoopRealDynamicSlice final
+    : CheckedOpRewritePattern<stablehlo::RealDynamicSliceOp,
+                              NoopRealDynamicSlice> {
+  using CheckedOpRewritePattern::CheckedOpRewritePattern;
+
+  bool supportsDynamicShapes() { return true; }
+
+  LogicalResult matchAndRewriteImpl(stablehlo::RealDynamicSliceOp op,
+                                    PatternRewriter &rewriter) const {
+    DenseIntElementsAttr starts, strides;
+    if (!matchPattern(op.getStartIndices(), m_Constant(&starts)) ||
+        !matchPattern(op.getStrides(), m_Constant(&strides)))
+      return failure();
+    if (!llvm::all_of(starts.getValues<APInt>(),
+                      [](const APInt &start) { return start.isZero(); }) ||
+        !llvm::all_of(strides.getValues<APInt>(),
+                      [](const APInt &stride) { return stride.isOne(); }))
+      return failure();
+
+    auto limits = getSymbolicShapeFromTensor(op.getLimitIndices());
+    if (!limits || *limits != getSymbolicShape(op.getOperand()))
+      return failure();
+    rewriter.replaceOp(op, rewriter.createOrFold<tensor::CastOp>(
+                               op.getLoc(), op.getType(), op.getOperand()));
+    return success();
+  }
+};
+
 struct DynamicUpdateSliceElim final
     : CheckedOpRewritePattern<stablehlo::DynamicUpdateSliceOp,
                               DynamicUpdateSliceElim> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::DynamicUpdateSliceOp op,
                                     PatternRewriter &rewriter) const {
     auto type = dyn_cast<RankedTensorType>(op.getType());
     if (!type)
       return failure();
 
-    if (op.getUpdate().getType() != type)
+    // The update must cover the whole operand, dynamic sizes are compared by
+    // the value they originate from.
+    if (getSymbolicShape(op.getUpdate()) != getSymbolicShape(op.getOperand()))
       return failure();
 
     for (auto start : op.getStartIndices()) {
@@ -535,7 +593,8 @@ struct DynamicUpdateSliceElim final
       if (startv != 0)
         return failure();
     }
-    rewriter.replaceOp(op, op.getUpdate());
+    rewriter.replaceOp(op, rewriter.createOrFold<tensor::CastOp>(
+                               op.getLoc(), type, op.getUpdate()));
     return success();
   }
 };
@@ -3432,6 +3491,8 @@ struct ConvertConvertFloat final
     : CheckedOpRewritePattern<stablehlo::ConvertOp, ConvertConvertFloat> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::ConvertOp op,
                                     PatternRewriter &rewriter) const {
     auto conv0 = op.getOperand().getDefiningOp<stablehlo::ConvertOp>();
@@ -4317,9 +4378,34 @@ struct PadSimplify final
       : CheckedOpRewritePattern(context, benefit, generatedNames),
         max_constant_expansion(max_constant_expansion) {}
 
+  // Only the removal of a noop pad applies to dynamic shapes, the constant
+  // folds below materialize the result type and require it to be static.
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::PadOp op,
                                     PatternRewriter &rewriter) const {
+    if (op.getType().hasStaticShape() &&
+        op.getOperand().getType().hasStaticShape() &&
+        matchAndRewriteConstant(op, rewriter).succeeded())
+      return success();
+
+    for (auto &&[low, high, inner] :
+         llvm::zip(op.getEdgePaddingLow(), op.getEdgePaddingHigh(),
+                   op.getInteriorPadding())) {
+      if (low != 0)
+        return failure();
+      if (high != 0)
+        return failure();
+      if (inner != 0)
+        return failure();
+    }
+    rewriter.replaceOp(op, rewriter.createOrFold<tensor::CastOp>(
+                               op.getLoc(), op.getType(), op.getOperand()));
+    return success();
+  }
 
+  LogicalResult matchAndRewriteConstant(stablehlo::PadOp op,
+                                        PatternRewriter &rewriter) const {
     if (matchPattern(op.getOperand(), m_AnyZeroFloat())) {
       if (matchPattern(op.getPaddingValue(), m_AnyZeroFloat())) {
         rewriter.replaceOpWithNewOp<stablehlo::ConstantOp>(
@@ -4346,7 +4432,13 @@ struct PadSimplify final
         for (auto sz : op.getType().getShape())
           size *= sz;
         if (size < max_constant_expansion) {
-          auto ten = stablehlo::constantOp(inp);
+          if (auto out = constFoldPad(inp, pv, op.getEdgePaddingLow(),
+                                      op.getEdgePaddingHigh(),
+                                      op.getInteriorPadding(), op.getType())) {
+            rewriter.replaceOpWithNewOp<stablehlo::ConstantOp>(
+                op, op.getType(), out);
+            return success();
+          }
           auto out = fromTensor(stablehlo::padOp(
               stablehlo::constantOp(inp), stablehlo::constantOp(pv),
               stablehlo::Sizes(op.getEdgePaddingLow()),
@@ -4358,19 +4450,7 @@ struct PadSimplify final
         }
       }
     }
-
-    for (auto &&[low, high, inner] :
-         llvm::zip(op.getEdgePaddingLow(), op.getEdgePaddingHigh(),
-                   op.getInteriorPadding())) {
-      if (low != 0)
-        return failure();
-      if (high != 0)
-        return failure();
-      if (inner != 0)
-        return failure();
-    }
-    rewriter.replaceOp(op, op.getOperand());
-    return success();
+    return failure();
   }
 };
 
@@ -5439,6 +5519,8 @@ struct ConcatFuse final
     : CheckedOpRewritePattern<stablehlo::ConcatenateOp, ConcatFuse> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::ConcatenateOp op,
                                     PatternRewriter &rewriter) const {
     if (op->getNumOperands() == 1 &&
@@ -5623,6 +5705,12 @@ LogicalResult binaryConstProp(Operation *op, PatternRewriter &rewriter) {
       !llvm::hasSingleElement(op->getResult(0).getUsers()))
     return failure();
 
+  if (auto folded = constFoldElementwise(op, {lhsAttr, rhsAttr})) {
+    rewriter.replaceOpWithNewOp<stablehlo::ConstantOp>(
+        op, op->getResultTypes()[0], folded);
+    return success();
+  }
+
   if (lhsAttr.isSplat() && rhsAttr.isSplat()) {
     ty = RankedTensorType::get(
         {}, cast<ShapedType>(op->getResultTypes()[0]).getElementType());
@@ -5679,6 +5767,12 @@ LogicalResult unaryConstProp(Operation *op, PatternRewriter &rewriter) {
       !llvm::hasSingleElement(op->getResult(0).getUsers()))
     return failure();
 
+  if (auto folded = constFoldElementwise(op, inputAttr)) {
+    rewriter.replaceOpWithNewOp<stablehlo::ConstantOp>(
+        op, op->getResultTypes()[0], folded);
+    return success();
+  }
+
   if (inputAttr.isSplat()) {
     ty = RankedTensorType::get(
         {}, cast<ShapedType>(op->getResultTypes()[0]).getElementType());
@@ -5840,6 +5934,13 @@ struct ConcatConstProp final
       if (size >= max_constant_expansion)
         return failure();
 
+      if (auto out = constFoldConcatenate(constants, op.getDimension(),
+                                          op.getType())) {
+        rewriter.replaceOpWithNewOp<stablehlo::ConstantOp>(op, op.getType(),
+                                                           out);
+        return success();
+      }
+
       SmallVector<stablehlo::Tensor> inps;
       for (auto &c : constants)
         inps.push_back(stablehlo::constantOp(c));
@@ -5853,6 +5954,54 @@ struct ConcatConstProp final
   }
 };
 
+struct ReduceConstProp final
+    : CheckedOpRewritePattern<stablehlo::ReduceOp, ReduceConstProp> {
+  using CheckedOpRewritePattern::CheckedOpRewritePattern;
+  size_t max_constant_expansion;
+  ReduceConstProp(size_t max_constant_expansion, MLIRContext *context,
+                  PatternBenefit benefit = 1,
+                  ArrayRef<StringRef> generatedNames = {})
+      : CheckedOpRewritePattern(context, benefit, generatedNames),
+        max_constant_expansion(max_constant_expansion) {}
+
+  LogicalResult matchAndRewriteImpl(stablehlo::ReduceOp op,
+                                    PatternRewriter &rewriter) const {
+    if (op.getInputs().size() != 1)
+      return failure();
+
+    DenseElementsAttr inp, init;
+    if (!matchPattern(op.getInputs()[0], m_Constant(&inp)) ||
+        !matchPattern(op.getInitValues()[0], m_Constant(&init)))
+      return failure();
+    // Splats are folded in closed form, except float ones which are combined
+    // element by element (see constFoldReduce).
+    if ((!inp.isSplat() || isa<FloatType>(inp.getElementType())) &&
+        inp.getNumElements() >= max_constant_expansion)
+      return failure();
+
+    // The body must be a single binary op combining the two block arguments.
+    Block &body = op.getBody().front();
+    if (!llvm::hasNItems(body, 2))
+      return failure();
+    Operation *combiner = &body.front();
+    auto ret = dyn_cast<stablehlo::ReturnOp>(body.getTerminator());
+    if (!ret || ret->getNumOperands() != 1 ||
+        ret->getOperand(0) != combiner->getResult(0) ||
+        combiner->getNumOperands() != 2 ||
+        !llvm::is_contained(combiner->getOperands(), body.getArgument(0)) ||
+        !llvm::is_contained(combiner->getOperands(), body.getArgument(1)))
+      return failure();
+
+    auto out = constFoldReduce(combiner, inp, init, op.getDimensions(),
+                               cast<ShapedType>(op.getResult(0).getType()));
+    if (!out)
+      return failure();
+    rewriter.replaceOpWithNewOp<stablehlo::ConstantOp>(
+        op, op.getResult(0).getType(), out);
+    return success();
+  }
+};
+
 struct ReshapeEmptyBroadcast final
     : CheckedOpRewritePattern<stablehlo::ReshapeOp, ReshapeEmptyBroadcast> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
@@ -7124,10 +7273,13 @@ struct SliceSimplify
           out =
               DenseIntOrFPElementsAttr::getFromRawBuffer(op.getType(), values);
         } else {
-          auto ten = stablehlo::constantOp(inp);
-          out = fromTensor(stablehlo::sliceOp(
-              ten, stablehlo::Sizes(op.getStartIndices()),
-              stablehlo::Sizes(op.getStrides()), op.getType()));
+          out = constFoldSlice(inp, op.getStartIndices(), op.getStrides(),
+                               op.getType());
+          if (!out)
+            out = fromTensor(stablehlo::sliceOp(
+                stablehlo::constantOp(inp),
+                stablehlo::Sizes(op.getStartIndices()),
+                stablehlo::Sizes(op.getStrides()), op.getType()));
         }
       }
       rewriter.replaceOpWithNewOp<stablehlo::ConstantOp>(op, op.getType(), out);
@@ -7166,9 +7318,12 @@ struct BroadcastInDimSimplify
           size *= sz;
         if (size >= max_constant_expansion)
           return failure();
-        auto ten = stablehlo::constantOp(inp);
-        out = fromTensor(stablehlo::broadcastInDimOp(
-            ten, stablehlo::Axes(op.getBroadcastDimensions()), op.getType()));
+        out = constFoldBroadcastInDim(inp, op.getBroadcastDimensions(),
+                                      op.getType());
+        if (!out)
+          out = fromTensor(stablehlo::broadcastInDimOp(
+              stablehlo::constantOp(inp),
+              stablehlo::Axes(op.getBroadcastDimensions()), op.getType()));
       }
 
       rewriter.replaceOpWithNewOp<stablehlo::ConstantOp>(op, op.getType(), out);
@@ -8029,9 +8184,11 @@ struct TransposeSimplify
       if (inp.isSplat()) {
         out = inp.resizeSplat(op.getType());
       } else {
-        out = fromTensor(stablehlo::transposeOp(
-            stablehlo::constantOp(inp), stablehlo::Axes(op.getPermutation()),
-            op.getType()));
+        out = constFoldTranspose(inp, op.getPermutation(), op.getType());
+        if (!out)
+          out = fromTensor(stablehlo::transposeOp(
+              stablehlo::constantOp(inp), stablehlo::Axes(op.getPermutation()),
+              op.getType()));
       }
       rewriter.replaceOpWithNewOp<stablehlo::ConstantOp>(op, op.getType(), out);
       return success();
@@ -8187,6 +8344,8 @@ struct TransposeTranspose
   using CheckedOpRewritePattern<stablehlo::TransposeOp,
                                 TransposeTranspose>::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::TransposeOp op,
                                     PatternRewriter &rewriter) const {
     auto operand = op.getOperand();
@@ -8693,6 +8852,269 @@ struct DotTranspose
   }
 };
 
+// Reorders chains of single-use matrix products, e.g. A·B·C·v from JAX code,
+// into the parenthesization with the fewest flops using the classic matrix
+// chain dynamic program. All products must share the same leading batch
+// dimensions and contract one dimension per side. Operands used transposed,
+// through the contracting dimensions or a transpose of the two minor
+// dimensions, are rebuilt with the matching contracting dimensions.
+struct DotChainReorder final
+    : CheckedOpRewritePattern<stablehlo::DotGeneralOp, DotChainReorder> {
+  using CheckedOpRewritePattern::CheckedOpRewritePattern;
+
+  enum class FactorKind { Matrix, RowVector, ColVector };
+
+  struct Factor {
+    Value value;
+    // The factor is the transpose of the two minor dimensions of `value`.
+    bool transposed;
+    FactorKind kind;
+    int64_t rows, cols;
+  };
+
+  struct Chain {
+    int64_t numBatch;
+    ArrayRef<int64_t> batchShape;
+    ArrayAttr precision;
+    stablehlo::DotAlgorithmAttr algorithm;
+    SmallVector<Factor> factors;
+    SmallVector<stablehlo::DotGeneralOp> dots;
+  };
+
+  // Returns the number of leading batch dimensions if `dot` multiplies two
+  // (batched) matrices or vectors, -1 otherwise.
+  static int64_t getNumBatchDims(stablehlo::DotGeneralOp dot) {
+    auto dims = dot.getDotDimensionNumbers();
+    auto lhsBatch = dims.getLhsBatchingDimensions();
+    auto rhsBatch = dims.getRhsBatchingDimensions();
+    if (lhsBatch.size() != rhsBatch.size() ||
+        dims.getLhsContractingDimensions().size() != 1 ||
+        dims.getRhsContractingDimensions().size() != 1)
+      return -1;
+    for (auto [idx, lhsDim, rhsDim] : llvm::enumerate(lhsBatch, rhsBatch))
+      if (lhsDim != (int64_t)idx || rhsDim != (int64_t)idx)
+        return -1;
+
+    int64_t numBatch = lhsBatch.size();
+    auto lhsTy = dot.getLhs().getType(), rhsTy = dot.getRhs().getType();
+    auto resTy = dot.getType();
+    if (!lhsTy.hasStaticShape() || !rhsTy.hasStaticShape() ||
+        lhsTy.getRank() < numBatch + 1 || lhsTy.getRank() > numBatch + 2 ||
+        rhsTy.getRank() < numBatch + 1 || rhsTy.getRank() > numBatch + 2 ||
+        lhsTy.getElementType() != resTy.getElementType() ||
+        rhsTy.getElementType() != resTy.getElementType())
+      return -1;
+    return numBatch;
+  }
+
+  static bool isChainDot(stablehlo::DotGeneralOp dot, const Chain &chain) {
+    return getNumBatchDims(dot) == chain.numBatch &&
+           dot.getPrecisionConfigAttr() == chain.precision &&
+           dot.getAlgorithmAttr() == chain.algorithm &&
+           dot.getType().getShape().take_front(chain.numBatch) ==
+               chain.batchShape;
+  }
+
+  static void flip(Factor &factor) {
+    std::swap(factor.rows, factor.cols);
+    switch (factor.kind) {
+    case FactorKind::Matrix:
+      factor.transposed = !factor.transposed;
+      break;
+    case FactorKind::RowVector:
+      factor.kind = FactorKind::ColVector;
+      break;
+    case FactorKind::ColVector:
+      factor.kind = FactorKind::RowVector;
+      break;
+    }
+  }
+
+  static void addOperand(Value value, bool transposed, FactorKind kind,
+                         Chain &chain) {
+    int64_t numBatch = chain.numBatch;
+    if (kind == FactorKind::Matrix && value.hasOneUse()) {
+      if (auto inner = value.getDefiningOp<stablehlo::DotGeneralOp>()) {
+        if (isChainDot(inner, chain) &&
+            inner.getType().getRank() == numBatch + 2) {
+          collect(inner, transposed, chain);
+          return;
+        }
+      }
+      if (auto transpose = value.getDefiningOp<stablehlo::TransposeOp>()) {
+        auto perm = transpose.getPermutation();
+        bool swapsMinor = perm.size() == (size_t)numBatch + 2 &&
+                          perm[numBatch] == numBatch + 1 &&
+                          perm[numBatch + 1] == numBatch;
+        for (int64_t i = 0; i < numBatch; i++)
+          swapsMinor &= perm[i] == i;
+        if (swapsMinor) {
+          addOperand(transpose.getOperand(), !transposed, kind, chain);
+          return;
+        }
+      }
+    }
+
+    auto shape = cast<RankedTensorType>(value.getType()).getShape();
+    Factor factor{value, transposed, kind, 1, 1};
+    switch (kind) {
+    case FactorKind::Matrix:
+      factor.rows = shape[numBatch + (transposed ? 1 : 0)];
+      factor.cols = shape[numBatch + (transposed ? 0 : 1)];
+      break;
+    case FactorKind::RowVector:
+      factor.cols = shape[numBatch];
+      break;
+    case FactorKind::ColVector:
+      factor.rows = shape[numBatch];
+      break;
+    }
+    chain.factors.push_back(factor);
+  }
+
+  // Appends the factors of the product computed by `dot`, or of its
+  // transpose.
+  static void collect(stablehlo::DotGeneralOp dot, bool transposed,
+                      Chain &chain) {
+    chain.dots.push_back(dot);
+    int64_t numBatch = chain.numBatch;
+    auto dims = dot.getDotDimensionNumbers();
+    size_t start = chain.factors.size();
+
+    if (dot.getLhs().getType().getRank() == numBatch + 1)
+      addOperand(dot.getLhs(), false, FactorKind::RowVector, chain);
+    else
+      addOperand(dot.getLhs(),
+                 dims.getLhsContractingDimensions()[0] == numBatch,
+                 FactorKind::Matrix, chain);
+
+    if (dot.getRhs().getType().getRank() == numBatch + 1)
+      addOperand(dot.getRhs(), false, FactorKind::ColVector, chain);
+    else
+      addOperand(dot.getRhs(),
+                 dims.getRhsContractingDimensions()[0] == numBatch + 1,
+                 FactorKind::Matrix, chain);
+
+    if (transposed) {
+      std::reverse(chain.factors.begin() + start, chain.factors.end());
+      for (auto &factor : llvm::drop_begin(chain.factors, start))
+        flip(factor);
+    }
+  }
+
+  // Flops of `dot` per batch element.
+  static double getCost(stablehlo::DotGeneralOp dot, int64_t batchSize) {
+    auto dims = dot.getDotDimensionNumbers();
+    double contracted =
+        dot.getLhs().getType().getShape()[dims.getLhsContractingDimensions()[0]];
+    return (double)dot.getLhs().getType().getNumElements() / batchSize *
+           dot.getRhs().getType().getNumElements() / batchSize / contracted;
+  }
+
+  LogicalResult matchAndRewriteImpl(stablehlo::DotGeneralOp op,
+                                    PatternRewriter &rewriter) const {
+    int64_t numBatch = getNumBatchDims(op);
+    if (numBatch < 0)
+      return failure();
+
+    Chain chain;
+    chain.numBatch = numBatch;
+    chain.batchShape = op.getType().getShape().take_front(numBatch);
+    chain.precision = op.getPrecisionConfigAttr();
+    chain.algorithm = op.getAlgorithmAttr();
+
+    // Leave inner products of a longer chain to the outermost product.
+    if (op.getType().getRank() == numBatch + 2 && op->hasOneUse())
+      if (auto user = dyn_cast<stablehlo::DotGeneralOp>(*op->user_begin()))
+        if (isChainDot(user, chain))
+          return failure();
+
+    collect(op, false, chain);
+    auto &factors = chain.factors;
+    int64_t n = factors.size();
+    if (n < 3)
+      return failure();
+
+    int64_t batchSize = 1;
+    for (auto dim : chain.batchShape)
+      batchSize *= dim;
+    SmallVector<int64_t> p{factors[0].rows};
+    for (auto &factor : factors) {
+      if (factor.rows != p.back() || factor.cols == 0 || factor.rows == 0 ||
+          batchSize == 0)
+        return failure();
+      p.push_back(factor.cols);
+    }
+
+    // cost[i][j] is the minimal cost of multiplying factors i..j, split[i][j]
+    // the last factor of the left subproduct.
+    SmallVector<SmallVector<double>> cost(n, SmallVector<double>(n, 0));
+    SmallVector<SmallVector<int64_t>> split(n, SmallVector<int64_t>(n, 0));
+    for (int64_t len = 2; len <= n; len++) {
+      for (int64_t i = 0; i + len <= n; i++) {
+        int64_t j = i + len - 1;
+        cost[i][j] = std::numeric_limits<double>::infinity();
+        for (int64_t s = i; s < j; s++) {
+          double c = cost[i][s] + cost[s + 1][j] +
+                     (double)p[i] * p[s + 1] * p[j + 1];
+          if (c < cost[i][j]) {
+            cost[i][j] = c;
+            split[i][j] = s;
+          }
+        }
+      }
+    }
+
+    double current = 0;
+    for (auto dot : chain.dots)
+      current += getCost(dot, batchSize);
+    if (cost[0][n - 1] >= current)
+      return failure();
+
+    SmallVector<int64_t> batchDims =
+        llvm::to_vector(llvm::seq<int64_t>(0, numBatch));
+    Type elementType = op.getType().getElementType();
+
+    std::function<Factor(int64_t, int64_t)> build = [&](int64_t i,
+                                                         int64_t j) {
+      if (i == j)
+        return factors[i];
+      Factor lhs = build(i, split[i][j]);
+      Factor rhs = build(split[i][j] + 1, j);
+
+      int64_t lhsContract =
+          lhs.kind == FactorKind::Matrix && !lhs.transposed ? numBatch + 1
+                                                            : numBatch;
+      int64_t rhsContract =
+          rhs.kind == FactorKind::Matrix && rhs.transposed ? numBatch + 1
+                                                           : numBatch;
+      SmallVector<int64_t> shape(chain.batchShape);
+      if (lhs.kind == FactorKind::Matrix)
+        shape.push_back(lhs.rows);
+      if (rhs.kind == FactorKind::Matrix)
+        shape.push_back(rhs.cols);
+
+      auto dims = stablehlo::DotDimensionNumbersAttr::get(
+          op.getContext(), batchDims, batchDims, {lhsContract}, {rhsContract});
+      Value dot = rewriter.create<stablehlo::DotGeneralOp>(
+          op.getLoc(), RankedTensorType::get(shape, elementType), lhs.value,
+          rhs.value, dims, chain.precision, chain.algorithm);
+
+      FactorKind kind = FactorKind::Matrix;
+      if (lhs.kind == FactorKind::RowVector)
+        kind = FactorKind::RowVector;
+      else if (rhs.kind == FactorKind::ColVector)
+        kind = FactorKind::ColVector;
+      return Factor{dot, false, kind, lhs.rows, rhs.cols};
+    };
+
+    Value result = build(0, n - 1).value;
+    assert(result.getType() == op.getType());
+    rewriter.replaceOp(op, result);
+    return success();
+  }
+};
+
 struct BroadcastReduce
     : public CheckedOpRewritePattern<stablehlo::ReduceOp, BroadcastReduce> {
   using CheckedOpRewritePattern<stablehlo::ReduceOp,
@@ -10582,6 +11004,29 @@ struct SliceReshapeSlice final
 };
 } // namespace
 
+CheckedPatternScope::CheckedPatternScope(Operation *root)
+    : state(std::make_unique<CheckedPatternState>()),
+      previous(CheckedPatternState::current) {
+  auto isDisabled = [](Operation *op) {
+    return isa<FunctionOpInterface>(op) &&
+           op->hasAttrOfType<UnitAttr>(kDisablePatternAttrName);
+  };
+  state->anyDisabled = false;
+  for (Operation *op = root; op && !state->anyDisabled; op = op->getParentOp())
+    state->anyDisabled = isDisabled(op);
+  if (!state->anyDisabled)
+    state->anyDisabled = root->walk([&](Operation *op) {
+                               return isDisabled(op) ? WalkResult::interrupt()
+                                                     : WalkResult::advance();
+                             })
+                             .wasInterrupted();
+  CheckedPatternState::current = state.get();
+}
+
+CheckedPatternScope::~CheckedPatternScope() {
+  CheckedPatternState::current = previous;
+}
+
 // Rewritten from
 // https:github.com/openxla/stablehlo/blob/4f180d3c2236a15f82f29aad1b47f6ea2c14fc52/stablehlo/reference/Ops.cpp#L1381
 // using https://openxla.org/xla/operation_semantics#gather
@@ -12274,6 +12719,8 @@ struct DynamicBroadcastInDimOpNotActuallyDynamic final
                               DynamicBroadcastInDimOpNotActuallyDynamic> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::DynamicBroadcastInDimOp op,
                                     PatternRewriter &rewriter) const {
     RankedTensorType operandType = op.getOperand().getType();
@@ -12307,6 +12754,8 @@ struct ChainedDynamicBroadcastInDimCanonicalization final
                               ChainedDynamicBroadcastInDimCanonicalization> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::DynamicBroadcastInDimOp bcast,
                                     PatternRewriter &rewriter) const {
     auto precedingBcast =
@@ -12335,13 +12784,25 @@ struct DynamicBroadcastInDimAllDimsNonExpanding final
                               DynamicBroadcastInDimAllDimsNonExpanding> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::DynamicBroadcastInDimOp op,
                                     PatternRewriter &rewriter) const {
     RankedTensorType type = op.getType();
 
-    if (!op.getKnownNonexpandingDimensions() ||
-        static_cast<int64_t>(op.getKnownNonexpandingDimensions()->size()) !=
-            type.getRank()) {
+    // Broadcasting to the shape the operand already has, e.g. to the
+    // get_dimension_size of its own dimensions, is also non-expanding.
+    bool sameShape = false;
+    if (auto dims = getSymbolicShapeFromTensor(op.getOutputDimensions())) {
+      sameShape = llvm::equal(op.getBroadcastDimensions(),
+                              llvm::seq<int64_t>(0, type.getRank())) &&
+                  *dims == getSymbolicShape(op.getOperand());
+    }
+
+    if (!sameShape &&
+        (!op.getKnownNonexpandingDimensions() ||
+         static_cast<int64_t>(op.getKnownNonexpandingDimensions()->size()) !=
+             type.getRank())) {
       return rewriter.notifyMatchFailure(
           op, "known_nonexpanding_dimensions don't cover all output dims");
     }
@@ -12357,6 +12818,8 @@ struct NoopReduceOpCanon final
     : CheckedOpRewritePattern<stablehlo::ReduceOp, NoopReduceOpCanon> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::ReduceOp op,
                                     PatternRewriter &rewriter) const {
     // No dimensions to reduce.
@@ -12374,6 +12837,10 @@ struct NoopReduceOpCanon final
             return result.getParentRegion() == retRegion;
           }))
         return failure();
+      if (llvm::any_of(op.getResultTypes(), [](Type type) {
+            return !cast<RankedTensorType>(type).hasStaticShape();
+          }))
+        return failure();
 
       SmallVector<Value> vals;
       DenseI64ArrayAttr empty = rewriter.getDenseI64ArrayAttr({});
@@ -12392,6 +12859,8 @@ struct EmptyReduceOpCanon final
     : CheckedOpRewritePattern<stablehlo::ReduceOp, EmptyReduceOpCanon> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::ReduceOp op,
                                     PatternRewriter &rewriter) const {
     // We require all reduce shapes to be the same, up to the element types, so
@@ -12440,15 +12909,32 @@ struct DynamicReshapeOpCanon final
                               DynamicReshapeOpCanon> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::DynamicReshapeOp op,
                                     PatternRewriter &rewriter) const {
     // This is a noop when the output type is already a static shape.
     RankedTensorType type = op.getType();
-    if (!type.hasStaticShape())
-      return failure();
+    if (type.hasStaticShape()) {
+      rewriter.replaceOpWithNewOp<stablehlo::ReshapeOp>(op, type,
+                                                        op.getOperand());
+      return success();
+    }
 
-    rewriter.replaceOpWithNewOp<stablehlo::ReshapeOp>(op, type,
-                                                      op.getOperand());
+    // Only the element order matters to a reshape of a reshape.
+    if (auto prev =
+            op.getOperand().getDefiningOp<stablehlo::DynamicReshapeOp>()) {
+      rewriter.modifyOpInPlace(
+          op, [&]() { op.getOperandMutable().assign(prev.getOperand()); });
+      return success();
+    }
+
+    // Reshaping to the shape of the operand itself.
+    auto dims = getSymbolicShapeFromTensor(op.getOutputShape());
+    if (!dims || *dims != getSymbolicShape(op.getOperand()))
+      return failure();
+    rewriter.replaceOp(op, rewriter.createOrFold<tensor::CastOp>(
+                               op.getLoc(), type, op.getOperand()));
     return success();
   }
 };
@@ -12458,6 +12944,8 @@ struct GetTupleElementOpCanon final
                               GetTupleElementOpCanon> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::GetTupleElementOp op,
                                     PatternRewriter &rewriter) const {
     auto tuple = op.getOperand().getDefiningOp<stablehlo::TupleOp>();
@@ -12474,6 +12962,8 @@ struct RealOpCanon final
     : CheckedOpRewritePattern<stablehlo::RealOp, RealOpCanon> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::RealOp op,
                                     PatternRewriter &rewriter) const {
     auto elTy = op.getOperand().getType().getElementType();
@@ -12495,10 +12985,14 @@ struct ImagOpCanon final
     : CheckedOpRewritePattern<stablehlo::ImagOp, ImagOpCanon> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::ImagOp op,
                                     PatternRewriter &rewriter) const {
     auto elTy = op.getOperand().getType().getElementType();
     if (!isa<ComplexType>(elTy)) {
+      if (!op.getType().hasStaticShape())
+        return failure();
       rewriter.replaceOp(op, rewriter.create<stablehlo::ConstantOp>(
                                  op->getLoc(), makeAttr(op.getType(), 0)));
       return success();
@@ -12518,6 +13012,8 @@ struct ConjComplexNegate final
     : CheckedOpRewritePattern<chlo::ConjOp, ConjComplexNegate> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(chlo::ConjOp op,
                                     PatternRewriter &rewriter) const {
     auto complex = op.getOperand().getDefiningOp<stablehlo::ComplexOp>();
@@ -12539,17 +13035,24 @@ struct GetDimensionSizeOpCanon final
                               GetDimensionSizeOpCanon> {
   using CheckedOpRewritePattern::CheckedOpRewritePattern;
 
+  bool supportsDynamicShapes() { return true; }
+
   LogicalResult matchAndRewriteImpl(stablehlo::GetDimensionSizeOp op,
                                     PatternRewriter &rewriter) const {
-    // Fold get_dimension_size when the queried dim is statically known.
-    RankedTensorType operandTy = op.getOperand().getType();
-
-    int64_t dimSize = operandTy.getDimSize(op.getDimension());
-    if (dimSize < 0)
-      return failure();
+    // Fold get_dimension_size when the queried dim is statically known, and
+    // otherwise query the value the dimension originates from, so that equal
+    // sizes become the same value.
+    SymbolicDim dim = getSymbolicDim(op.getOperand(), op.getDimension());
+    if (!dim.isStatic()) {
+      if (dim.source == op.getOperand())
+        return failure();
+      rewriter.replaceOpWithNewOp<stablehlo::GetDimensionSizeOp>(
+          op, op.getType(), dim.source, dim.dim);
+      return success();
+    }
 
     auto elemTy = cast<IntegerType>(op.getType().getElementType());
-    IntegerAttr elemVal = rewriter.getIntegerAttr(elemTy, dimSize);
+    IntegerAttr elemVal = rewriter.getIntegerAttr(elemTy, dim.size);
     rewriter.replaceOpWithNewOp<stablehlo::ConstantOp>(
         op, DenseElementsAttr::get(op.getType(), elemVal));
     return success();
@@ -15061,6 +15564,905 @@ struct WhileInductionReduction
   }
 };
 
+// Returns the loop invariant `value`, computed in the body of `whileOp` from
+// values defined outside of it, as a value defined before the loop.
+static Value hoistLoopInvariant(Value value, stablehlo::WhileOp whileOp,
+                                IRMapping &hoisted, PatternRewriter &rewriter) {
+  if (definedOutside(value, whileOp))
+    return value;
+  if (Value mapped = hoisted.lookupOrNull(value))
+    return mapped;
+  Operation *def = value.getDefiningOp();
+  assert(def && def->getNumRegions() == 0 && isPure(def) &&
+         "expected a pure loop invariant computation");
+  for (Value operand : def->getOperands())
+    hoisted.map(operand,
+                hoistLoopInvariant(operand, whileOp, hoisted, rewriter));
+  return rewriter.clone(*def, hoisted)->getResult(0);
+}
+
+// Returns the identity of the associative combiner `op` as a constant of
+// `type`, or null if there is none.
+static DenseElementsAttr getCombinerIdentity(Operation *op,
+                                             RankedTensorType type) {
+  Type elemType = type.getElementType();
+  if (auto floatType = dyn_cast<FloatType>(elemType)) {
+    const llvm::fltSemantics &sem = floatType.getFloatSemantics();
+    APFloat value(sem);
+    if (isa<stablehlo::AddOp>(op))
+      value = APFloat::getZero(sem);
+    else if (isa<stablehlo::MulOp>(op))
+      value = APFloat::getOne(sem);
+    else if (isa<stablehlo::MaxOp>(op))
+      value = APFloat::getInf(sem, /*Negative=*/true);
+    else if (isa<stablehlo::MinOp>(op))
+      value = APFloat::getInf(sem);
+    else
+      return nullptr;
+    return DenseElementsAttr::get(type, ArrayRef<APFloat>(value));
+  }
+
+  auto intType = dyn_cast<IntegerType>(elemType);
+  if (!intType)
+    return nullptr;
+  unsigned width = intType.getWidth();
+  bool isSigned = width > 1 && !intType.isUnsigned();
+  APInt value;
+  if (isa<stablehlo::AddOp, stablehlo::OrOp>(op))
+    value = APInt::getZero(width);
+  else if (isa<stablehlo::MulOp>(op))
+    value = APInt(width, 1);
+  else if (isa<stablehlo::AndOp>(op))
+    value = APInt::getAllOnes(width);
+  else if (isa<stablehlo::MaxOp>(op))
+    value = isSigned ? APInt::getSignedMinValue(width) : APInt::getZero(width);
+  else if (isa<stablehlo::MinOp>(op))
+    value =
+        isSigned ? APInt::getSignedMaxValue(width) : APInt::getAllOnes(width);
+  else
+    return nullptr;
+  return DenseElementsAttr::get(type, ArrayRef<APInt>(value));
+}
+
+// Bounds of a while loop with a constant trip count.
+struct WhileLoopBounds {
+  stablehlo::WhileOp op;
+  BlockArgument iv;
+  int64_t start;
+  int64_t step;
+  int64_t numIters;
+};
+
+// Returns the bounds of `whileOp` if it iterates a positive constant number of
+// times with a positive step.
+static std::optional<WhileLoopBounds>
+getConstantLoopBounds(stablehlo::WhileOp whileOp) {
+  WhileLoopInfo info(whileOp);
+  if (failed(info.computeInfo()) || !info.isConstant())
+    return std::nullopt;
+  WhileLoopBounds bounds{whileOp, info.inductionVariable,
+                         *info.getConstantStart(), *info.getConstantStep(),
+                         info.getConstantNumIters()};
+  if (bounds.step <= 0 || bounds.numIters <= 0)
+    return std::nullopt;
+  return bounds;
+}
+
+// Returns c if `index` is iv + c in every iteration.
+static std::optional<int64_t>
+getInductionOffset(Value index, const WhileLoopBounds &bounds) {
+  if (index == bounds.iv)
+    return 0;
+
+  Operation *def = index.getDefiningOp();
+  if (auto convert = dyn_cast_or_null<stablehlo::ConvertOp>(def)) {
+    if (!isa<IntegerType>(convert.getOperand().getType().getElementType()))
+      return std::nullopt;
+    return getInductionOffset(convert.getOperand(), bounds);
+  }
+
+  if (isa_and_nonnull<stablehlo::AddOp, stablehlo::SubtractOp>(def)) {
+    APInt constant;
+    if (matchPattern(def->getOperand(1), m_ConstantInt(&constant))) {
+      auto offset = getInductionOffset(def->getOperand(0), bounds);
+      if (!offset)
+        return std::nullopt;
+      return isa<stablehlo::AddOp>(def) ? *offset + constant.getSExtValue()
+                                        : *offset - constant.getSExtValue();
+    }
+    if (isa<stablehlo::AddOp>(def) &&
+        matchPattern(def->getOperand(0), m_ConstantInt(&constant))) {
+      auto offset = getInductionOffset(def->getOperand(1), bounds);
+      if (!offset)
+        return std::nullopt;
+      return *offset + constant.getSExtValue();
+    }
+    return std::nullopt;
+  }
+
+  // Negative indices are wrapped with select(i < 0, i + n, i), which is i
+  // if it is never negative.
+  if (auto select = dyn_cast_or_null<stablehlo::SelectOp>(def)) {
+    auto compare = select.getPred().getDefiningOp<stablehlo::CompareOp>();
+    if (!compare ||
+        compare.getComparisonDirection() !=
+            stablehlo::ComparisonDirection::LT ||
+        compare.getLhs() != select.getOnFalse() ||
+        !matchPattern(compare.getRhs(), m_Zero()))
+      return std::nullopt;
+    auto offset = getInductionOffset(select.getOnFalse(), bounds);
+    if (!offset || bounds.start + *offset < 0)
+      return std::nullopt;
+    return offset;
+  }
+  return std::nullopt;
+}
+
+// For a slice of `sliceShape` at `indices` into a tensor of `shape`, returns
+// the dimension indexed by the induction variable and the start indices of
+// the first iteration, if the slices of all iterations are in bounds.
+static std::optional<std::pair<int64_t, SmallVector<int64_t>>>
+getInductionStarts(ValueRange indices, ArrayRef<int64_t> sliceShape,
+                   ArrayRef<int64_t> shape, const WhileLoopBounds &bounds) {
+  int64_t dim = -1;
+  SmallVector<int64_t> starts;
+  for (auto [i, index] : llvm::enumerate(indices)) {
+    APInt constant;
+    if (matchPattern(index, m_ConstantInt(&constant))) {
+      int64_t start = constant.getSExtValue();
+      if (start < 0 || start + sliceShape[i] > shape[i])
+        return std::nullopt;
+      starts.push_back(start);
+      continue;
+    }
+
+    auto offset = getInductionOffset(index, bounds);
+    if (!offset || dim != -1 || sliceShape[i] != 1)
+      return std::nullopt;
+    dim = i;
+    int64_t first = bounds.start + *offset;
+    int64_t last = first + (bounds.numIters - 1) * bounds.step;
+    if (first < 0 || last >= shape[i])
+      return std::nullopt;
+    starts.push_back(first);
+  }
+  if (dim == -1)
+    return std::nullopt;
+  return std::make_pair(dim, starts);
+}
+
+// Rewrites loops accumulating into a loop-carried value with an associative
+// combiner
+//   acc = acc op f(x[i], ...)
+// where f is elementwise and x[i] are slices of loop invariant tensors at the
+// induction variable, into a stablehlo.reduce of f applied to the slices of
+// all iterations at once. If the loop also writes every partial result to a
+// buffer
+//   out = dynamic_update_slice(out, acc, i)
+// the buffer is computed by a prefix scan with a stablehlo.reduce_window.
+// Floating point sums and products are only rewritten if
+// `allowFloatReassociation`, as the reduction reassociates them.
+struct WhileReduceScan final
+    : CheckedOpRewritePattern<stablehlo::WhileOp, WhileReduceScan> {
+  using CheckedOpRewritePattern::CheckedOpRewritePattern;
+
+  WhileReduceScan(bool allowFloatReassociation, MLIRContext *ctx,
+                  PatternBenefit benefit = 1)
+      : CheckedOpRewritePattern(ctx, benefit),
+        allowFloatReassociation(allowFloatReassociation) {}
+
+  // A value of the loop body stacked over all iterations along `dim`. The
+  // value of a single iteration has `dim` removed if `dropped`, and of size 1
+  // otherwise.
+  struct Layout {
+    int64_t dim;
+    bool dropped;
+
+    bool operator==(const Layout &other) const {
+      return dim == other.dim && dropped == other.dropped;
+    }
+    bool operator!=(const Layout &other) const { return !(*this == other); }
+  };
+
+  // Layouts of the analyzed values, nullopt for loop invariant ones.
+  using LayoutMap = DenseMap<Value, std::optional<Layout>>;
+
+  // A write of the partial results to the loop-carried buffer `idx`.
+  struct ScanWrite {
+    unsigned idx;
+    stablehlo::DynamicUpdateSliceOp dus;
+    SmallVector<int64_t> starts;
+  };
+
+  LogicalResult matchAndRewriteImpl(stablehlo::WhileOp whileOp,
+                                    PatternRewriter &rewriter) const {
+    auto loopBounds = getConstantLoopBounds(whileOp);
+    if (!loopBounds)
+      return failure();
+    const WhileLoopBounds &bounds = *loopBounds;
+
+    Block &body = whileOp.getBody().front();
+    auto yield = cast<stablehlo::ReturnOp>(body.getTerminator());
+
+    for (unsigned idx = 0; idx < body.getNumArguments(); idx++) {
+      BlockArgument acc = body.getArgument(idx);
+      if (acc == bounds.iv || !acc.hasOneUse() ||
+          !whileOp.getCond().getArgument(idx).use_empty())
+        continue;
+
+      Operation *combiner = *acc.user_begin();
+      if (!isa<stablehlo::AddOp, stablehlo::MulOp, stablehlo::MaxOp,
+               stablehlo::MinOp, stablehlo::AndOp, stablehlo::OrOp>(
+              combiner) ||
+          combiner->getResult(0) != yield.getOperand(idx))
+        continue;
+      Value update = combiner->getOperand(0) == acc ? combiner->getOperand(1)
+                                                    : combiner->getOperand(0);
+
+      auto accType = cast<RankedTensorType>(acc.getType());
+      if (!allowFloatReassociation &&
+          !isa<IntegerType>(accType.getElementType()) &&
+          isa<stablehlo::AddOp, stablehlo::MulOp>(combiner))
+        continue;
+      auto scalarType = RankedTensorType::get({}, accType.getElementType());
+      DenseElementsAttr identity = getCombinerIdentity(combiner, scalarType);
+      if (!identity)
+        continue;
+
+      LayoutMap layouts;
+      auto layout = analyze(update, bounds, layouts);
+      if (failed(layout) || !*layout)
+        continue;
+
+      // Besides the loop-carried value, partial results may only be written
+      // to a buffer.
+      Value partial = combiner->getResult(0);
+      std::optional<ScanWrite> scan;
+      bool legal = true;
+      for (OpOperand &use : partial.getUses()) {
+        if (use.getOwner() == yield) {
+          legal &= use.getOperandNumber() == idx;
+          continue;
+        }
+        if (scan) {
+          legal = false;
+          break;
+        }
+        scan = matchScanWrite(use.getOwner(), partial, **layout, bounds);
+        legal &= scan.has_value();
+      }
+      if (!legal)
+        continue;
+
+      rewrite(whileOp, idx, combiner, update, **layout, identity, scan, bounds,
+              layouts, rewriter);
+      return success();
+    }
+    return failure();
+  }
+
+private:
+  bool allowFloatReassociation;
+
+  static SmallVector<int64_t> getStackedShape(ArrayRef<int64_t> shape,
+                                              Layout layout,
+                                              int64_t numIters) {
+    SmallVector<int64_t> stacked(shape);
+    if (layout.dropped)
+      stacked.insert(stacked.begin() + layout.dim, numIters);
+    else
+      stacked[layout.dim] = numIters;
+    return stacked;
+  }
+
+  // Returns the layout of `value` stacked over the iterations, nullopt if it
+  // is loop invariant, or failure if it cannot be stacked.
+  FailureOr<std::optional<Layout>> analyze(Value value,
+                                           const WhileLoopBounds &bounds,
+                                           LayoutMap &layouts) const {
+    if (auto it = layouts.find(value); it != layouts.end())
+      return it->second;
+
+    if (definedOutside(value, bounds.op) || matchPattern(value, m_Constant())) {
+      layouts[value] = std::nullopt;
+      return std::optional<Layout>();
+    }
+
+    Operation *def = value.getDefiningOp();
+    if (!def || def->getNumResults() != 1 || def->getNumRegions() != 0 ||
+        !isPure(def))
+      return failure();
+
+    std::optional<Layout> layout;
+    if (auto slice = dyn_cast<stablehlo::DynamicSliceOp>(def)) {
+      if (!definedOutside(slice.getOperand(), bounds.op))
+        return failure();
+      auto starts = getInductionStarts(
+          slice.getStartIndices(), slice.getSliceSizes(),
+          slice.getOperand().getType().getShape(), bounds);
+      if (!starts)
+        return failure();
+      layout = Layout{starts->first, /*dropped=*/false};
+    } else {
+      for (Value operand : def->getOperands()) {
+        auto operandLayout = analyze(operand, bounds, layouts);
+        if (failed(operandLayout))
+          return failure();
+        if (!*operandLayout)
+          continue;
+        if (layout && *layout != **operandLayout)
+          return failure();
+        layout = *operandLayout;
+      }
+
+      if (layout) {
+        if (auto reshape = dyn_cast<stablehlo::ReshapeOp>(def)) {
+          // Only dropping the unit dimension of the iterations is supported.
+          if (layout->dropped)
+            return failure();
+          SmallVector<int64_t> shape(
+              reshape.getOperand().getType().getShape());
+          shape.erase(shape.begin() + layout->dim);
+          if (ArrayRef<int64_t>(shape) != reshape.getType().getShape())
+            return failure();
+          layout->dropped = true;
+        } else if (!def->hasTrait<OpTrait::Elementwise>()) {
+          return failure();
+        }
+      }
+    }
+
+    layouts[value] = layout;
+    return layout;
+  }
+
+  // Returns the write of `partial` to a loop-carried buffer at the induction
+  // variable in `user`, if its stacked value can be written all at once.
+  static std::optional<ScanWrite>
+  matchScanWrite(Operation *user, Value partial, Layout layout,
+                 const WhileLoopBounds &bounds) {
+    if (bounds.step != 1)
+      return std::nullopt;
+
+    Value update = partial;
+    if (auto reshape = dyn_cast<stablehlo::ReshapeOp>(user)) {
+      if (!reshape->hasOneUse())
+        return std::nullopt;
+      update = reshape;
+      user = *reshape->user_begin();
+    }
+    auto dus = dyn_cast<stablehlo::DynamicUpdateSliceOp>(user);
+    if (!dus || dus.getUpdate() != update || !dus->hasOneUse())
+      return std::nullopt;
+
+    auto buffer = dyn_cast<BlockArgument>(dus.getOperand());
+    if (!buffer || buffer.getOwner() != bounds.iv.getOwner() ||
+        !buffer.hasOneUse() ||
+        !bounds.op.getCond().getArgument(buffer.getArgNumber()).use_empty())
+      return std::nullopt;
+    OpOperand &yielded = *dus->use_begin();
+    if (yielded.getOwner() != buffer.getOwner()->getTerminator() ||
+        yielded.getOperandNumber() != buffer.getArgNumber())
+      return std::nullopt;
+
+    auto updateType = cast<RankedTensorType>(update.getType());
+    auto starts =
+        getInductionStarts(dus.getStartIndices(), updateType.getShape(),
+                           dus.getOperand().getType().getShape(), bounds);
+    if (!starts || starts->first != layout.dim)
+      return std::nullopt;
+
+    // The stacked partial results must be the stacked updates.
+    auto partialType = cast<RankedTensorType>(partial.getType());
+    SmallVector<int64_t> stackedUpdates(updateType.getShape());
+    stackedUpdates[layout.dim] = bounds.numIters;
+    if (getStackedShape(partialType.getShape(), layout, bounds.numIters) !=
+        stackedUpdates)
+      return std::nullopt;
+
+    return ScanWrite{buffer.getArgNumber(), dus, starts->second};
+  }
+
+  // Computes the value of `value` for all iterations, before the loop.
+  Value stack(Value value, const WhileLoopBounds &bounds,
+              const LayoutMap &layouts, IRMapping &hoisted,
+              DenseMap<Value, Value> &stacked,
+              PatternRewriter &rewriter) const {
+    if (Value result = stacked.lookup(value))
+      return result;
+
+    Layout layout = *layouts.lookup(value);
+    Operation *def = value.getDefiningOp();
+    auto type = cast<RankedTensorType>(value.getType());
+    auto stackedType = RankedTensorType::get(
+        getStackedShape(type.getShape(), layout, bounds.numIters),
+        type.getElementType());
+
+    Value result;
+    if (auto slice = dyn_cast<stablehlo::DynamicSliceOp>(def)) {
+      ArrayRef<int64_t> sizes = slice.getSliceSizes();
+      SmallVector<int64_t> starts =
+          getInductionStarts(slice.getStartIndices(), sizes,
+                             slice.getOperand().getType().getShape(), bounds)
+              ->second;
+      SmallVector<int64_t> limits, strides(sizes.size(), 1);
+      for (auto [start, size] : llvm::zip(starts, sizes))
+        limits.push_back(start + size);
+      limits[layout.dim] =
+          starts[layout.dim] + (bounds.numIters - 1) * bounds.step + 1;
+      strides[layout.dim] = bounds.step;
+      result = rewriter.create<stablehlo::SliceOp>(
+          def->getLoc(), slice.getOperand(), starts, limits, strides);
+    } else if (isa<stablehlo::ReshapeOp>(def)) {
+      result = stack(def->getOperand(0), bounds, layouts, hoisted, stacked,
+                     rewriter);
+    } else {
+      SmallVector<Value> operands;
+      for (Value operand : def->getOperands()) {
+        if (layouts.lookup(operand)) {
+          operands.push_back(
+              stack(operand, bounds, layouts, hoisted, stacked, rewriter));
+          continue;
+        }
+        // Broadcast loop invariant operands over the iterations.
+        auto operandType = cast<RankedTensorType>(operand.getType());
+        SmallVector<int64_t> dims;
+        for (int64_t i = 0; i < operandType.getRank(); i++)
+          dims.push_back(layout.dropped && i >= layout.dim ? i + 1 : i);
+        operands.push_back(rewriter.create<stablehlo::BroadcastInDimOp>(
+            def->getLoc(),
+            RankedTensorType::get(getStackedShape(operandType.getShape(),
+                                                  layout, bounds.numIters),
+                                  operandType.getElementType()),
+            hoistLoopInvariant(operand, bounds.op, hoisted, rewriter), dims));
+      }
+      result = rewriter
+                   .create(def->getLoc(), def->getName().getIdentifier(),
+                           operands, TypeRange(stackedType), def->getAttrs())
+                   ->getResult(0);
+    }
+    stacked[value] = result;
+    return result;
+  }
+
+  // Fills the body of a reduction or reduce_window with `combiner`.
+  static void buildCombinerBody(Region &region, Operation *combiner,
+                                RankedTensorType scalarType,
+                                PatternRewriter &rewriter) {
+    OpBuilder::InsertionGuard guard(rewriter);
+    Location loc = combiner->getLoc();
+    auto *block = rewriter.createBlock(&region);
+    block->addArgument(scalarType, loc);
+    block->addArgument(scalarType, loc);
+    rewriter.setInsertionPointToStart(block);
+    Operation *combined = rewriter.create(
+        loc, combiner->getName().getIdentifier(), block->getArguments(),
+        TypeRange(scalarType));
+    rewriter.create<stablehlo::ReturnOp>(loc, combined->getResults());
+  }
+
+  void rewrite(stablehlo::WhileOp whileOp, unsigned idx, Operation *combiner,
+               Value update, Layout layout, DenseElementsAttr identity,
+               const std::optional<ScanWrite> &scan,
+               const WhileLoopBounds &bounds, const LayoutMap &layouts,
+               PatternRewriter &rewriter) const {
+    Location loc = whileOp.getLoc();
+    Block &body = whileOp.getBody().front();
+    auto accType = cast<RankedTensorType>(body.getArgument(idx).getType());
+    auto scalarType = cast<RankedTensorType>(identity.getType());
+    OperationName combinerName = combiner->getName();
+    Value init = whileOp.getOperand(idx);
+
+    rewriter.setInsertionPoint(whileOp);
+    IRMapping hoisted;
+    DenseMap<Value, Value> stacked;
+    Value updates = stack(update, bounds, layouts, hoisted, stacked, rewriter);
+    auto stackedType = cast<RankedTensorType>(updates.getType());
+    Value identityValue =
+        rewriter.create<stablehlo::ConstantOp>(loc, scalarType, identity);
+
+    if (!whileOp.getResult(idx).use_empty()) {
+      SmallVector<int64_t> reducedShape(stackedType.getShape());
+      reducedShape.erase(reducedShape.begin() + layout.dim);
+      auto reduce = rewriter.create<stablehlo::ReduceOp>(
+          loc,
+          TypeRange(RankedTensorType::get(reducedShape,
+                                          accType.getElementType())),
+          ValueRange(updates), ValueRange(identityValue),
+          rewriter.getDenseI64ArrayAttr({layout.dim}));
+      buildCombinerBody(reduce.getBody(), combiner, scalarType, rewriter);
+
+      Value total = reduce.getResult(0);
+      if (!layout.dropped)
+        total = rewriter.create<stablehlo::ReshapeOp>(loc, accType, total);
+      Operation *result =
+          rewriter.create(loc, combinerName.getIdentifier(),
+                          ValueRange{init, total}, TypeRange(accType));
+      rewriter.replaceAllUsesWith(whileOp.getResult(idx), result->getResult(0));
+    }
+
+    if (scan) {
+      // Inclusive prefix scan along the iterations.
+      int64_t rank = stackedType.getRank();
+      SmallVector<int64_t> window(rank, 1), padding(2 * rank, 0);
+      window[layout.dim] = bounds.numIters;
+      padding[2 * layout.dim] = bounds.numIters - 1;
+      auto reduceWindow = rewriter.create<stablehlo::ReduceWindowOp>(
+          loc, TypeRange(stackedType), ValueRange(updates),
+          ValueRange(identityValue), rewriter.getDenseI64ArrayAttr(window),
+          DenseI64ArrayAttr(), DenseI64ArrayAttr(), DenseI64ArrayAttr(),
+          DenseIntElementsAttr::get(
+              RankedTensorType::get({rank, 2}, rewriter.getI64Type()),
+              padding));
+      buildCombinerBody(reduceWindow.getBody(), combiner, scalarType,
+                        rewriter);
+
+      SmallVector<int64_t> dims;
+      for (int64_t i = 0; i < accType.getRank(); i++)
+        dims.push_back(layout.dropped && i >= layout.dim ? i + 1 : i);
+      Value initStacked = rewriter.create<stablehlo::BroadcastInDimOp>(
+          loc, stackedType, init, dims);
+      Operation *partials = rewriter.create(
+          loc, combinerName.getIdentifier(),
+          ValueRange{initStacked, reduceWindow.getResult(0)},
+          TypeRange(stackedType));
+
+      SmallVector<Value> starts;
+      for (auto [start, index] :
+           llvm::zip(scan->starts, scan->dus.getStartIndices())) {
+        auto indexType = cast<RankedTensorType>(index.getType());
+        starts.push_back(rewriter.create<stablehlo::ConstantOp>(
+            loc, indexType, cast<ElementsAttr>(makeAttr(indexType, start))));
+      }
+      Value written = rewriter.create<stablehlo::DynamicUpdateSliceOp>(
+          loc, whileOp.getOperand(scan->idx), partials->getResult(0), starts);
+      rewriter.replaceAllUsesWith(whileOp.getResult(scan->idx), written);
+    }
+
+    // The loop now leaves the accumulator and buffer unchanged, for the
+    // remaining computation to be removed as dead.
+    auto yield = cast<stablehlo::ReturnOp>(body.getTerminator());
+    rewriter.modifyOpInPlace(yield, [&] {
+      yield->setOperand(idx, body.getArgument(idx));
+      if (scan)
+        yield->setOperand(scan->idx, body.getArgument(scan->idx));
+    });
+  }
+};
+
+// Replaces a loop whose iterations are independent, as they only write slice
+// i of loop-carried buffers,
+//   out = dynamic_update_slice(out, f(x[i], ..., i), i)
+// by f batched over all iterations through the BatchOpInterface. The buffers
+// may not be read in the loop and all other loop-carried values must be left
+// unchanged by it. Slices of loop invariant tensors at the induction variable
+// are passed to f stacked over the iterations, other loop invariant values are
+// broadcast.
+struct WhileToBatch final
+    : CheckedOpRewritePattern<stablehlo::WhileOp, WhileToBatch> {
+  using CheckedOpRewritePattern::CheckedOpRewritePattern;
+
+  // A loop-carried buffer written at the induction variable.
+  struct BufferWrite {
+    unsigned idx;
+    stablehlo::DynamicUpdateSliceOp dus;
+    int64_t dim;
+    SmallVector<int64_t> starts;
+  };
+
+  // An operand of a single iteration: the induction variable, a loop
+  // invariant value, or a slice at the induction variable along `dim`.
+  struct IterationOperand {
+    Value value;
+    stablehlo::DynamicSliceOp slice;
+    int64_t dim = -1;
+    SmallVector<int64_t> starts;
+  };
+
+  LogicalResult matchAndRewriteImpl(stablehlo::WhileOp whileOp,
+                                    PatternRewriter &rewriter) const {
+    // Writes of consecutive iterations must be contiguous.
+    auto loopBounds = getConstantLoopBounds(whileOp);
+    if (!loopBounds || loopBounds->step != 1)
+      return failure();
+    const WhileLoopBounds &bounds = *loopBounds;
+    int64_t numIters = bounds.numIters;
+
+    Block &body = whileOp.getBody().front();
+    auto yield = cast<stablehlo::ReturnOp>(body.getTerminator());
+
+    SmallVector<BufferWrite> writes;
+    for (unsigned idx = 0; idx < body.getNumArguments(); idx++) {
+      BlockArgument arg = body.getArgument(idx);
+      if (arg == bounds.iv || yield.getOperand(idx) == arg)
+        continue;
+      auto write = matchBufferWrite(arg, yield.getOperand(idx), bounds);
+      if (!write)
+        return failure();
+      writes.push_back(*write);
+    }
+    if (writes.empty())
+      return failure();
+
+    // Collect the ops computing a single iteration and their operands.
+    SmallPtrSet<Operation *, 8> ops;
+    SmallVector<Value> constants;
+    SmallVector<IterationOperand> operands;
+    DenseSet<Value> seen;
+    SmallVector<Value> worklist;
+    for (const BufferWrite &write : writes)
+      worklist.push_back(write.dus.getUpdate());
+    while (!worklist.empty()) {
+      Value value = worklist.pop_back_val();
+      if (!seen.insert(value).second)
+        continue;
+
+      if (value == bounds.iv) {
+        operands.push_back(IterationOperand{value});
+        continue;
+      }
+      if (getLoopInvariant(value, whileOp)) {
+        if (definedOutside(value, whileOp) && matchPattern(value, m_Constant()))
+          constants.push_back(value);
+        else
+          operands.push_back(IterationOperand{value});
+        continue;
+      }
+
+      Operation *def = value.getDefiningOp();
+      if (!def || def->getBlock() != &body)
+        return failure();
+      if (auto slice = dyn_cast<stablehlo::DynamicSliceOp>(def)) {
+        if (getLoopInvariant(slice.getOperand(), whileOp)) {
+          if (auto starts = getInductionStarts(
+                  slice.getStartIndices(), slice.getSliceSizes(),
+                  slice.getOperand().getType().getShape(), bounds)) {
+            operands.push_back(IterationOperand{value, slice, starts->first,
+                                                starts->second});
+            continue;
+          }
+        }
+      }
+
+      if (!isMemoryEffectFree(def))
+        return failure();
+      // Ops with regions are only batched through their interface.
+      if (def->getNumRegions() != 0 && !isa<BatchOpInterface>(def))
+        return failure();
+      llvm::SetVector<Value> capturedValues;
+      getUsedValuesDefinedAbove(def->getRegions(), capturedValues);
+      if (!capturedValues.empty())
+        return failure();
+      if (ops.insert(def).second)
+        for (Value operand : def->getOperands())
+          worklist.push_back(operand);
+    }
+
+    // Broadcast loop invariant values may not take more memory than the
+    // values the loop reads and writes.
+    int64_t broadcastSize = 0, accessedSize = 0;
+    for (const IterationOperand &operand : operands) {
+      int64_t size =
+          numIters *
+          cast<RankedTensorType>(operand.value.getType()).getNumElements();
+      if (operand.slice)
+        accessedSize += size;
+      else if (operand.value != bounds.iv)
+        broadcastSize += size;
+    }
+    for (const BufferWrite &write : writes)
+      accessedSize +=
+          numIters * write.dus.getUpdate().getType().getNumElements();
+    if (broadcastSize > accessedSize)
+      return failure();
+
+    auto modOp = whileOp->getParentOfType<ModuleOp>();
+    if (!modOp)
+      return failure();
+
+    // Outline a single iteration.
+    SmallVector<Type> argTypes, resultTypes;
+    for (const IterationOperand &operand : operands)
+      argTypes.push_back(operand.value.getType());
+    for (const BufferWrite &write : writes)
+      resultTypes.push_back(write.dus.getUpdate().getType());
+
+    // Everything up to the batching of the iteration is created before the
+    // loop and in new functions, and erased if the batching fails.
+    SymbolTable symbolTable(modOp);
+    SmallPtrSet<Operation *, 16> moduleOps;
+    for (Operation &op : *modOp.getBody())
+      moduleOps.insert(&op);
+    Operation *beforeLoop = whileOp->getPrevNode();
+
+    func::FuncOp func;
+    {
+      OpBuilder::InsertionGuard guard(rewriter);
+      rewriter.setInsertionPointToStart(modOp.getBody());
+      func = rewriter.create<func::FuncOp>(
+          whileOp.getLoc(), "enzymexla_unbatched_WhileToBatch",
+          rewriter.getFunctionType(argTypes, resultTypes));
+      func.setPrivate();
+      // Renames the function if the name is already taken.
+      rewriter.modifyOpInPlace(func, [&] { symbolTable.insert(func); });
+
+      Block &entryBlock = *func.addEntryBlock();
+      rewriter.setInsertionPointToStart(&entryBlock);
+      IRMapping mapper;
+      for (auto [operand, arg] :
+           llvm::zip(operands, entryBlock.getArguments()))
+        mapper.map(operand.value, arg);
+      for (Value constant : constants)
+        rewriter.clone(*constant.getDefiningOp(), mapper);
+      for (Operation &op : body.without_terminator())
+        if (ops.contains(&op))
+          rewriter.clone(op, mapper);
+
+      SmallVector<Value> results;
+      for (const BufferWrite &write : writes)
+        results.push_back(mapper.lookup(write.dus.getUpdate()));
+      rewriter.create<func::ReturnOp>(whileOp.getLoc(), results);
+    }
+
+    // Stack the operands of all iterations before the loop.
+    Location loc = whileOp.getLoc();
+    rewriter.setInsertionPoint(whileOp);
+    IRMapping hoisted;
+    SmallVector<Value> batchOperands;
+    for (const IterationOperand &operand : operands) {
+      auto type = cast<RankedTensorType>(operand.value.getType());
+      SmallVector<int64_t> batchedShape = {numIters};
+      llvm::append_range(batchedShape, type.getShape());
+      auto batchedType =
+          RankedTensorType::get(batchedShape, type.getElementType());
+
+      if (operand.value == bounds.iv) {
+        Value iota = rewriter.create<stablehlo::IotaOp>(loc, batchedType, 0);
+        if (bounds.start != 0)
+          iota = rewriter.create<stablehlo::AddOp>(
+              loc, iota,
+              rewriter.create<stablehlo::ConstantOp>(
+                  loc, batchedType,
+                  cast<ElementsAttr>(makeAttr(batchedType, bounds.start))));
+        batchOperands.push_back(iota);
+        continue;
+      }
+
+      if (!operand.slice) {
+        SmallVector<int64_t> dims =
+            llvm::to_vector(llvm::seq<int64_t>(1, type.getRank() + 1));
+        batchOperands.push_back(rewriter.create<stablehlo::BroadcastInDimOp>(
+            loc, batchedType,
+            hoistLoopInvariant(getLoopInvariant(operand.value, whileOp),
+                               whileOp, hoisted, rewriter),
+            dims));
+        continue;
+      }
+
+      // Slice all iterations at once, and move the iterations to the front.
+      Value source = hoistLoopInvariant(
+          getLoopInvariant(operand.slice.getOperand(), whileOp), whileOp,
+          hoisted, rewriter);
+      SmallVector<int64_t> limits, strides(type.getRank(), 1);
+      for (auto [start, size] : llvm::zip(operand.starts, type.getShape()))
+        limits.push_back(start + size);
+      limits[operand.dim] = operand.starts[operand.dim] + numIters;
+      Value stacked = rewriter.create<stablehlo::SliceOp>(
+          loc, source, operand.starts, limits, strides);
+      if (operand.dim != 0) {
+        SmallVector<int64_t> perm = {operand.dim};
+        for (int64_t i = 0; i < type.getRank(); i++)
+          if (i != operand.dim)
+            perm.push_back(i);
+        stacked = rewriter.create<stablehlo::TransposeOp>(loc, stacked, perm);
+      }
+      batchOperands.push_back(
+          rewriter.create<stablehlo::ReshapeOp>(loc, batchedType, stacked));
+    }
+
+    SmallVector<Type> batchedResultTypes;
+    for (Type type : resultTypes) {
+      auto tensorType = cast<RankedTensorType>(type);
+      SmallVector<int64_t> shape = {numIters};
+      llvm::append_range(shape, tensorType.getShape());
+      batchedResultTypes.push_back(
+          RankedTensorType::get(shape, tensorType.getElementType()));
+    }
+    auto batchOp = rewriter.create<enzyme::BatchOp>(
+        loc, batchedResultTypes,
+        mlir::FlatSymbolRefAttr::get(func.getSymNameAttr()),
+        ValueRange(batchOperands), rewriter.getDenseI64ArrayAttr({numIters}));
+
+    // Write the updates of all iterations at once.
+    SmallVector<Value> written;
+    for (auto [write, batched] : llvm::zip(writes, batchOp->getResults())) {
+      auto updateType = write.dus.getUpdate().getType();
+      SmallVector<int64_t> shape = {numIters};
+      for (int64_t i = 0; i < updateType.getRank(); i++)
+        if (i != write.dim)
+          shape.push_back(updateType.getDimSize(i));
+      Value updates = rewriter.create<stablehlo::ReshapeOp>(
+          loc, RankedTensorType::get(shape, updateType.getElementType()),
+          batched);
+      if (write.dim != 0) {
+        SmallVector<int64_t> perm;
+        for (int64_t i = 0; i < updateType.getRank(); i++)
+          perm.push_back(i < write.dim ? i + 1 : (i == write.dim ? 0 : i));
+        updates = rewriter.create<stablehlo::TransposeOp>(loc, updates, perm);
+      }
+
+      SmallVector<Value> starts;
+      for (auto [start, index] :
+           llvm::zip(write.starts, write.dus.getStartIndices())) {
+        auto indexType = cast<RankedTensorType>(index.getType());
+        starts.push_back(rewriter.create<stablehlo::ConstantOp>(
+            loc, indexType, cast<ElementsAttr>(makeAttr(indexType, start))));
+      }
+      written.push_back(rewriter.create<stablehlo::DynamicUpdateSliceOp>(
+          loc, whileOp.getOperand(write.idx), updates, starts));
+    }
+
+    std::map<enzyme::batchutils::BatchCacheKey, FunctionOpInterface>
+        batchedFunctionCache;
+    if (failed(enzyme::batchutils::batchOperation(
+            rewriter, batchOp, cast<FunctionOpInterface>(func.getOperation()),
+            batchedFunctionCache))) {
+      while (whileOp->getPrevNode() != beforeLoop)
+        rewriter.eraseOp(whileOp->getPrevNode());
+      for (Operation &op :
+           llvm::make_early_inc_range(llvm::reverse(*modOp.getBody())))
+        if (!moduleOps.contains(&op))
+          rewriter.eraseOp(&op);
+      return failure();
+    }
+
+    for (auto [write, value] : llvm::zip(writes, written))
+      rewriter.replaceAllUsesWith(whileOp.getResult(write.idx), value);
+
+    // The loop now leaves the buffers unchanged, for the remaining
+    // computation to be removed as dead.
+    rewriter.modifyOpInPlace(yield, [&] {
+      for (const BufferWrite &write : writes)
+        yield->setOperand(write.idx, body.getArgument(write.idx));
+    });
+    return success();
+  }
+
+private:
+  // Returns the value before the loop of `value` if it is the same in all
+  // iterations, as it is defined outside of the loop or an unchanged
+  // loop-carried value.
+  static Value getLoopInvariant(Value value, stablehlo::WhileOp whileOp) {
+    if (definedOutside(value, whileOp))
+      return value;
+    auto arg = dyn_cast<BlockArgument>(value);
+    Block &body = whileOp.getBody().front();
+    if (!arg || arg.getOwner() != &body)
+      return nullptr;
+    auto yield = cast<stablehlo::ReturnOp>(body.getTerminator());
+    if (yield.getOperand(arg.getArgNumber()) != arg)
+      return nullptr;
+    return whileOp.getOperand(arg.getArgNumber());
+  }
+
+  static std::optional<BufferWrite>
+  matchBufferWrite(BlockArgument arg, Value yielded,
+                   const WhileLoopBounds &bounds) {
+    auto dus = yielded.getDefiningOp<stablehlo::DynamicUpdateSliceOp>();
+    if (!dus || dus.getOperand() != arg || !arg.hasOneUse() ||
+        !dus->hasOneUse() ||
+        !bounds.op.getCond().getArgument(arg.getArgNumber()).use_empty())
+      return std::nullopt;
+    auto starts = getInductionStarts(dus.getStartIndices(),
+                                     dus.getUpdate().getType().getShape(),
+                                     dus.getOperand().getType().getShape(),
+                                     bounds);
+    if (!starts)
+      return std::nullopt;
+    return BufferWrite{arg.getArgNumber(), dus, starts->first, starts->second};
+  }
+};
+
 // TODO: this is not valid in general but presumes the inner structure is valid
 // from the input
 struct WhileConcat
@@ -15949,8 +17351,7 @@ struct ZeroExtentTensorCanon final : RewritePattern {
 
   LogicalResult matchAndRewrite(Operation *op,
                                 PatternRewriter &rewriter) const {
-    auto disabledByAttr =
-        failIfFuncOpInterfaceHasAttr(op, kDisablePatternAttrName, rewriter);
+    auto disabledByAttr = failIfPatternsDisabled(op, rewriter);
     if (disabledByAttr.failed())
       return disabledByAttr;
 
@@ -16021,12 +17422,17 @@ struct ReorderElementwiseAndShapeOp final
                                 .clone(getElementTypeOrSelf(result.getType()));
 
     // Reorder the operation and rewire the inputs/outputs.
-    op->moveBefore(definingOp);
-    definingOp->getResult(0).setType(result.getType());
+    rewriter.moveOpBefore(op, definingOp);
+    rewriter.modifyOpInPlace(definingOp, [&] {
+      definingOp->getResult(0).setType(result.getType());
+    });
     rewriter.replaceAllUsesWith(result, definingOp->getResult(0));
-    result.setType(intermediateType);
-    op->setOperands(input);
-    definingOp->setOperands(result);
+    rewriter.modifyOpInPlace(op, [&] {
+      result.setType(intermediateType);
+      op->setOperands(input);
+    });
+    rewriter.modifyOpInPlace(definingOp,
+                             [&] { definingOp->setOperands(result); });
     return success();
   }
 };
@@ -20457,6 +21863,190 @@ struct SplitConvolutionIntoReverseConvolution final
   }
 };
 
+// Computes long convolutions through the convolution theorem. The padded
+// input and the reversed kernel are transformed with real FFTs over the
+// spatial dimensions, contracted over the input features in the frequency
+// domain and transformed back, which takes O(N log N) instead of O(N K)
+// operations. This only pays off for large kernels, as the cost model checks.
+struct ConvolutionToFFT final
+    : public CheckedOpRewritePattern<stablehlo::ConvolutionOp,
+                                     ConvolutionToFFT> {
+  using CheckedOpRewritePattern::CheckedOpRewritePattern;
+
+  // Direct convolutions are heavily tuned, so the spectral form must need
+  // this many times fewer operations.
+  static constexpr double kMinSpeedup = 4;
+
+  LogicalResult matchAndRewriteImpl(stablehlo::ConvolutionOp op,
+                                    PatternRewriter &rewriter) const {
+    auto lhsType = cast<RankedTensorType>(op.getLhs().getType());
+    auto rhsType = cast<RankedTensorType>(op.getRhs().getType());
+    auto resultType = cast<RankedTensorType>(op.getType());
+    Type elemType = resultType.getElementType();
+    if (!(elemType.isF32() || elemType.isF64()) ||
+        lhsType.getElementType() != elemType ||
+        rhsType.getElementType() != elemType)
+      return rewriter.notifyMatchFailure(op, "unsupported element type");
+    if (!lhsType.hasStaticShape() || !rhsType.hasStaticShape() ||
+        !resultType.hasStaticShape())
+      return rewriter.notifyMatchFailure(op, "dynamic shapes");
+
+    if (op.getFeatureGroupCount() != 1 || op.getBatchGroupCount() != 1)
+      return rewriter.notifyMatchFailure(op, "grouped convolution");
+    auto isOne = [](int64_t value) { return value == 1; };
+    if (!llvm::all_of(op.getWindowStrides().value_or(ArrayRef<int64_t>()),
+                      isOne) ||
+        !llvm::all_of(op.getLhsDilation().value_or(ArrayRef<int64_t>()),
+                      isOne) ||
+        !llvm::all_of(op.getRhsDilation().value_or(ArrayRef<int64_t>()),
+                      isOne))
+      return rewriter.notifyMatchFailure(op, "strided or dilated convolution");
+    if (llvm::any_of(op.getWindowReversal().value_or(ArrayRef<bool>()),
+                     [](bool reversed) { return reversed; }))
+      return rewriter.notifyMatchFailure(op, "window reversal");
+
+    auto convDims = op.getDimensionNumbers();
+    auto inputSpatialDims = convDims.getInputSpatialDimensions();
+    auto kernelSpatialDims = convDims.getKernelSpatialDimensions();
+    auto outputSpatialDims = convDims.getOutputSpatialDimensions();
+    int64_t numSpatial = inputSpatialDims.size();
+    if (numSpatial < 1 || numSpatial > 3)
+      return rewriter.notifyMatchFailure(op, "unsupported FFT rank");
+
+    SmallVector<int64_t> paddingLow(numSpatial, 0), paddingHigh(numSpatial, 0);
+    if (auto padding = op.getPadding()) {
+      auto values = llvm::to_vector(padding->getValues<int64_t>());
+      for (int64_t i = 0; i < numSpatial; i++) {
+        paddingLow[i] = values[2 * i];
+        paddingHigh[i] = values[2 * i + 1];
+      }
+    }
+
+    // Without strides the output covers every window in the padded input,
+    // so circular convolutions of the padded input length do not wrap
+    // around for any output element.
+    SmallVector<int64_t> fftLength, kernelSizes, outputSizes;
+    for (int64_t i = 0; i < numSpatial; i++) {
+      fftLength.push_back(lhsType.getDimSize(inputSpatialDims[i]) +
+                          paddingLow[i] + paddingHigh[i]);
+      kernelSizes.push_back(rhsType.getDimSize(kernelSpatialDims[i]));
+      outputSizes.push_back(resultType.getDimSize(outputSpatialDims[i]));
+      if (kernelSizes[i] < 1 ||
+          outputSizes[i] != fftLength[i] - kernelSizes[i] + 1)
+        return rewriter.notifyMatchFailure(op, "unexpected output size");
+    }
+
+    double batch = lhsType.getDimSize(convDims.getInputBatchDimension());
+    double inFeatures =
+        lhsType.getDimSize(convDims.getInputFeatureDimension());
+    double outFeatures =
+        rhsType.getDimSize(convDims.getKernelOutputFeatureDimension());
+    double fftSize = 1, kernelSize = 1, outputSize = 1;
+    for (int64_t i = 0; i < numSpatial; i++) {
+      fftSize *= fftLength[i];
+      kernelSize *= kernelSizes[i];
+      outputSize *= outputSizes[i];
+    }
+    double spectrumSize =
+        fftSize / fftLength.back() * (fftLength.back() / 2 + 1);
+    double directCost =
+        batch * inFeatures * outFeatures * outputSize * kernelSize;
+    double numTransforms =
+        batch * inFeatures + inFeatures * outFeatures + batch * outFeatures;
+    double spectralCost = numTransforms * fftSize * std::log2(fftSize) +
+                          4 * batch * inFeatures * outFeatures * spectrumSize;
+    if (directCost < kMinSpeedup * spectralCost)
+      return rewriter.notifyMatchFailure(op, "direct convolution is cheaper");
+
+    Location loc = op.getLoc();
+    auto transpose = [&](Value value, ArrayRef<int64_t> perm) -> Value {
+      if (llvm::equal(perm, llvm::seq<int64_t>(0, perm.size())))
+        return value;
+      return rewriter.create<stablehlo::TransposeOp>(loc, value, perm);
+    };
+
+    // Inputs as [batch, features, spatial...] and kernels as
+    // [output features, input features, spatial...].
+    SmallVector<int64_t> lhsPerm = {convDims.getInputBatchDimension(),
+                                    convDims.getInputFeatureDimension()};
+    llvm::append_range(lhsPerm, inputSpatialDims);
+    SmallVector<int64_t> rhsPerm = {
+        convDims.getKernelOutputFeatureDimension(),
+        convDims.getKernelInputFeatureDimension()};
+    llvm::append_range(rhsPerm, kernelSpatialDims);
+    Value lhs = transpose(op.getLhs(), lhsPerm);
+    Value rhs = transpose(op.getRhs(), rhsPerm);
+
+    auto zero = rewriter.create<stablehlo::ConstantOp>(
+        loc, rewriter.getZeroAttr(RankedTensorType::get({}, elemType)));
+    SmallVector<int64_t> interior(numSpatial + 2, 0);
+    if (llvm::any_of(paddingLow, [](int64_t pad) { return pad != 0; }) ||
+        llvm::any_of(paddingHigh, [](int64_t pad) { return pad != 0; })) {
+      SmallVector<int64_t> low = {0, 0}, high = {0, 0};
+      llvm::append_range(low, paddingLow);
+      llvm::append_range(high, paddingHigh);
+      lhs = rewriter.create<stablehlo::PadOp>(loc, lhs, zero, low, high,
+                                              interior);
+    }
+
+    // The convolution op computes a correlation, which is a convolution with
+    // the reversed kernel ending at the last kernel element.
+    SmallVector<int64_t> spatialDims =
+        llvm::to_vector(llvm::seq<int64_t>(2, numSpatial + 2));
+    rhs = rewriter.create<stablehlo::ReverseOp>(loc, rhs, spatialDims);
+    SmallVector<int64_t> kernelLow(numSpatial + 2, 0), kernelHigh = {0, 0};
+    for (int64_t i = 0; i < numSpatial; i++)
+      kernelHigh.push_back(fftLength[i] - kernelSizes[i]);
+    rhs = rewriter.create<stablehlo::PadOp>(loc, rhs, zero, kernelLow,
+                                            kernelHigh, interior);
+
+    Value lhsSpectrum = rewriter.create<stablehlo::FftOp>(
+        loc, lhs, stablehlo::FftType::RFFT, fftLength);
+    Value rhsSpectrum = rewriter.create<stablehlo::FftOp>(
+        loc, rhs, stablehlo::FftType::RFFT, fftLength);
+
+    // Contract the input features for every frequency, which gives
+    // [frequencies..., batch, output features].
+    auto spectrumType = cast<RankedTensorType>(lhsSpectrum.getType());
+    SmallVector<int64_t> productShape =
+        llvm::to_vector(spectrumType.getShape().drop_front(2));
+    productShape.push_back(spectrumType.getDimSize(0));
+    productShape.push_back(
+        cast<RankedTensorType>(rhsSpectrum.getType()).getDimSize(0));
+    auto dotDims = stablehlo::DotDimensionNumbersAttr::get(
+        op.getContext(), spatialDims, spatialDims, {1}, {1});
+    Value product = rewriter.create<stablehlo::DotGeneralOp>(
+        loc,
+        RankedTensorType::get(productShape, spectrumType.getElementType()),
+        lhsSpectrum, rhsSpectrum, dotDims, op.getPrecisionConfigAttr(),
+        /*algorithm=*/nullptr);
+    SmallVector<int64_t> productPerm = {numSpatial, numSpatial + 1};
+    llvm::append_range(productPerm, llvm::seq<int64_t>(0, numSpatial));
+    product = transpose(product, productPerm);
+
+    Value result = rewriter.create<stablehlo::FftOp>(
+        loc, product, stablehlo::FftType::IRFFT, fftLength);
+    auto fullType = cast<RankedTensorType>(result.getType());
+    SmallVector<int64_t> starts = {0, 0}, limits = {fullType.getDimSize(0),
+                                                    fullType.getDimSize(1)};
+    SmallVector<int64_t> strides(numSpatial + 2, 1);
+    for (int64_t i = 0; i < numSpatial; i++) {
+      starts.push_back(kernelSizes[i] - 1);
+      limits.push_back(kernelSizes[i] - 1 + outputSizes[i]);
+    }
+    result = rewriter.create<stablehlo::SliceOp>(loc, result, starts, limits,
+                                                 strides);
+
+    SmallVector<int64_t> resultPerm(numSpatial + 2);
+    resultPerm[convDims.getOutputBatchDimension()] = 0;
+    resultPerm[convDims.getOutputFeatureDimension()] = 1;
+    for (int64_t i = 0; i < numSpatial; i++)
+      resultPerm[outputSpatialDims[i]] = i + 2;
+    rewriter.replaceOp(op, transpose(result, resultPerm));
+    return success();
+  }
+};
+
 struct ScatterMultiplySimplify final
     : public CheckedOpRewritePattern<stablehlo::MulOp,
                                      ScatterMultiplySimplify> {
@@ -21741,6 +23331,306 @@ struct DiagonalTensorDotGeneralRewrite final
   }
 };
 
+// Rewrites dot_general with a structured matrix operand S, as found by
+// getMatrixBand and detectOneHotRows, into cheaper ops:
+//   S zero                -> zero result
+//   S banded, width w     -> sum over the w diagonals of S of the diagonal
+//                            times the other operand shifted along its
+//                            contracting dimension
+//   S one-hot rows        -> gather of the rows of the other operand
+// The banded form is only used when it does less work than the dense product.
+struct StructuredMatrixDotGeneral final
+    : CheckedOpRewritePattern<stablehlo::DotGeneralOp,
+                              StructuredMatrixDotGeneral> {
+  using CheckedOpRewritePattern::CheckedOpRewritePattern;
+
+  // Wider bands are left to the dense product.
+  static constexpr int64_t kMaxBandWidth = 8;
+
+  LogicalResult matchAndRewriteImpl(stablehlo::DotGeneralOp op,
+                                    PatternRewriter &rewriter) const {
+    for (bool structuredIsLhs : {true, false})
+      if (succeeded(rewriteStructured(op, structuredIsLhs, rewriter)))
+        return success();
+    return failure();
+  }
+
+private:
+  LogicalResult rewriteStructured(stablehlo::DotGeneralOp op,
+                                  bool structuredIsLhs,
+                                  PatternRewriter &rewriter) const {
+    auto dimNumbers = op.getDotDimensionNumbers();
+    Value structured = structuredIsLhs ? op.getLhs() : op.getRhs();
+    Value other = structuredIsLhs ? op.getRhs() : op.getLhs();
+    ArrayRef<int64_t> sBatch = structuredIsLhs
+                                   ? dimNumbers.getLhsBatchingDimensions()
+                                   : dimNumbers.getRhsBatchingDimensions();
+    ArrayRef<int64_t> sContract =
+        structuredIsLhs ? dimNumbers.getLhsContractingDimensions()
+                        : dimNumbers.getRhsContractingDimensions();
+    ArrayRef<int64_t> oBatch = structuredIsLhs
+                                   ? dimNumbers.getRhsBatchingDimensions()
+                                   : dimNumbers.getLhsBatchingDimensions();
+    ArrayRef<int64_t> oContract =
+        structuredIsLhs ? dimNumbers.getRhsContractingDimensions()
+                        : dimNumbers.getLhsContractingDimensions();
+
+    auto sType = cast<RankedTensorType>(structured.getType());
+    auto oType = cast<RankedTensorType>(other.getType());
+    auto resultType = cast<RankedTensorType>(op.getType());
+    int64_t rank = sType.getRank();
+    int64_t numBatch = sBatch.size();
+    if (rank != numBatch + 2 || sContract.size() != 1 ||
+        !llvm::equal(sBatch, llvm::seq<int64_t>(0, numBatch)))
+      return failure();
+    if (sType.getElementType() != resultType.getElementType() ||
+        oType.getElementType() != resultType.getElementType())
+      return failure();
+
+    int64_t sc = sContract[0];
+    int64_t sf = sc == rank - 1 ? rank - 2 : rank - 1;
+    int64_t oc = oContract[0];
+    int64_t nc = sType.getDimSize(sc);
+    int64_t nf = sType.getDimSize(sf);
+
+    // Order of the result in terms of the dimensions of the other operand,
+    // where its contracting dimension is replaced by the free one of S.
+    SmallVector<int64_t> oFree;
+    for (int64_t i = 0; i < oType.getRank(); i++)
+      if (i != oc && !llvm::is_contained(oBatch, i))
+        oFree.push_back(i);
+    SmallVector<int64_t> resultPerm(oBatch);
+    if (structuredIsLhs) {
+      resultPerm.push_back(oc);
+      resultPerm.append(oFree);
+    } else {
+      resultPerm.append(oFree);
+      resultPerm.push_back(oc);
+    }
+
+    MatrixBand band = getMatrixBand(structured);
+    if (band.isZero()) {
+      rewriter.replaceOpWithNewOp<stablehlo::ConstantOp>(
+          op, resultType, cast<ElementsAttr>(makeAttr(resultType, 0)));
+      return success();
+    }
+
+    // Offsets (contracting index) - (free index) of the non-zero entries.
+    int64_t lower = band.lower, upper = band.upper;
+    if (sc == rank - 2) {
+      lower = -band.upper;
+      upper = -band.lower;
+    }
+
+    int64_t batchSize = 1, freeSize = 1;
+    for (int64_t i = 0; i < numBatch; i++)
+      batchSize *= sType.getDimSize(i);
+    for (int64_t i : oFree)
+      freeSize *= oType.getDimSize(i);
+
+    Value diagonal;
+    if (band.isDiagonal() && numBatch == 0) {
+      if (auto scatter = structured.getDefiningOp<stablehlo::ScatterOp>())
+        if (!detectDiagonalTensor(scatter, &diagonal).ok())
+          diagonal = nullptr;
+    }
+
+    int64_t width = upper - lower + 1;
+    int64_t denseCost = batchSize * nf * nc * freeSize;
+    int64_t extractCost = diagonal ? 0 : batchSize * nf * nc;
+    int64_t bandedCost = width * (extractCost + 2 * batchSize * nf * freeSize);
+    if (width <= kMaxBandWidth && bandedCost < denseCost) {
+      Value result = buildBanded(op, structured, other, sc, sf, oc, oBatch,
+                                 lower, upper, diagonal, rewriter);
+      replaceWithPermuted(op, result, resultPerm, rewriter);
+      return success();
+    }
+
+    if (numBatch == 0 && sc == 1 && oBatch.empty()) {
+      if (auto indices = detectOneHotRows(structured)) {
+        // The gathered rows come first, followed by the free dimensions.
+        SmallVector<int64_t> gatherPerm;
+        if (structuredIsLhs)
+          gatherPerm.push_back(0);
+        for (int64_t i = 1; i <= (int64_t)oFree.size(); i++)
+          gatherPerm.push_back(i);
+        if (!structuredIsLhs)
+          gatherPerm.push_back(0);
+        Value result = buildGather(op, *indices, other, oc, nc, rewriter);
+        replaceWithPermuted(op, result, gatherPerm, rewriter);
+        return success();
+      }
+    }
+    return failure();
+  }
+
+  // Returns sum_o broadcast(diag_o(S)) * shift_o(X), in the dimension order of
+  // X with its contracting dimension replaced by the free dimension of S.
+  Value buildBanded(stablehlo::DotGeneralOp op, Value structured, Value other,
+                    int64_t sc, int64_t sf, int64_t oc,
+                    ArrayRef<int64_t> oBatch, int64_t lower, int64_t upper,
+                    Value diagonal, PatternRewriter &rewriter) const {
+    Location loc = op.getLoc();
+    auto sType = cast<RankedTensorType>(structured.getType());
+    auto oType = cast<RankedTensorType>(other.getType());
+    Type elemType = sType.getElementType();
+    int64_t nc = sType.getDimSize(sc);
+    int64_t nf = sType.getDimSize(sf);
+
+    SmallVector<int64_t> termShape(oType.getShape());
+    termShape[oc] = nf;
+    auto termType = RankedTensorType::get(termShape, elemType);
+    SmallVector<int64_t> diagonalDims(oBatch);
+    diagonalDims.push_back(oc);
+
+    auto scalarType = RankedTensorType::get({}, elemType);
+    Value zero = rewriter.create<stablehlo::ConstantOp>(
+        loc, scalarType, cast<ElementsAttr>(makeAttr(scalarType, 0)));
+
+    Value sum;
+    for (int64_t offset = lower; offset <= upper; offset++) {
+      Value diag =
+          diagonal ? diagonal
+                   : extractDiagonal(loc, structured, sc, sf, offset, rewriter);
+
+      // shifted[.., i, ..] = X[.., i + offset, ..], zero when out of range.
+      Value shifted = other;
+      int64_t low = -offset, high = nf - nc + offset;
+      if (low != 0 || high != 0) {
+        SmallVector<int64_t> lows(oType.getRank(), 0);
+        SmallVector<int64_t> highs(oType.getRank(), 0);
+        SmallVector<int64_t> interior(oType.getRank(), 0);
+        lows[oc] = low;
+        highs[oc] = high;
+        shifted = rewriter.create<stablehlo::PadOp>(loc, other, zero, lows,
+                                                    highs, interior);
+      }
+
+      Value scale = rewriter.create<stablehlo::BroadcastInDimOp>(
+          loc, termType, diag, diagonalDims);
+      Value term = rewriter.create<stablehlo::MulOp>(loc, scale, shifted);
+      sum = sum ? rewriter.create<stablehlo::AddOp>(loc, sum, term) : term;
+    }
+    return sum;
+  }
+
+  // Returns d[b.., i] = S[b.., i, i + offset] indexed by the free dimension of
+  // S, with zeros where i + offset is out of range.
+  Value extractDiagonal(Location loc, Value structured, int64_t sc, int64_t sf,
+                        int64_t offset, PatternRewriter &rewriter) const {
+    auto sType = cast<RankedTensorType>(structured.getType());
+    Type elemType = sType.getElementType();
+    auto indexType = RankedTensorType::get(sType.getShape(),
+                                           rewriter.getIntegerType(64));
+
+    Value contractIdx = rewriter.create<stablehlo::IotaOp>(loc, indexType, sc);
+    Value freeIdx = rewriter.create<stablehlo::IotaOp>(loc, indexType, sf);
+    Value diff =
+        rewriter.create<stablehlo::SubtractOp>(loc, contractIdx, freeIdx);
+    Value offsetCst = rewriter.create<stablehlo::ConstantOp>(
+        loc, indexType, cast<ElementsAttr>(makeAttr(indexType, offset)));
+    Value mask = rewriter.create<stablehlo::CompareOp>(
+        loc, diff, offsetCst, stablehlo::ComparisonDirection::EQ);
+    Value zeros = rewriter.create<stablehlo::ConstantOp>(
+        loc, sType, cast<ElementsAttr>(makeAttr(sType, 0)));
+    Value masked =
+        rewriter.create<stablehlo::SelectOp>(loc, mask, structured, zeros);
+
+    SmallVector<int64_t> diagShape;
+    for (int64_t i = 0; i < sType.getRank(); i++)
+      if (i != sc)
+        diagShape.push_back(sType.getDimSize(i));
+    auto diagType = RankedTensorType::get(diagShape, elemType);
+    auto scalarType = RankedTensorType::get({}, elemType);
+    Value zero = rewriter.create<stablehlo::ConstantOp>(
+        loc, scalarType, cast<ElementsAttr>(makeAttr(scalarType, 0)));
+
+    auto reduce = rewriter.create<stablehlo::ReduceOp>(
+        loc, TypeRange(diagType), ValueRange(masked), ValueRange(zero),
+        rewriter.getDenseI64ArrayAttr({sc}));
+    {
+      OpBuilder::InsertionGuard guard(rewriter);
+      auto *block = rewriter.createBlock(&reduce.getBody());
+      block->addArgument(scalarType, loc);
+      block->addArgument(scalarType, loc);
+      rewriter.setInsertionPointToStart(block);
+      rewriter.create<stablehlo::ReturnOp>(
+          loc, ValueRange(rewriter.create<stablehlo::AddOp>(
+                   loc, block->getArgument(0), block->getArgument(1))));
+    }
+    return reduce.getResult(0);
+  }
+
+  // Returns X[.., indices[i], ..] with the gathered dimension in place of the
+  // contracting dimension of X, and zeros for out of range indices.
+  Value buildGather(stablehlo::DotGeneralOp op, Value indices, Value other,
+                    int64_t oc, int64_t nc, PatternRewriter &rewriter) const {
+    Location loc = op.getLoc();
+    auto oType = cast<RankedTensorType>(other.getType());
+    auto indicesType = cast<RankedTensorType>(indices.getType());
+    int64_t n = indicesType.getDimSize(0);
+    int64_t oRank = oType.getRank();
+
+    Value startIndices = rewriter.create<stablehlo::ReshapeOp>(
+        loc, RankedTensorType::get({n, 1}, indicesType.getElementType()),
+        indices);
+
+    SmallVector<int64_t> offsetDims, sliceSizes(oType.getShape());
+    SmallVector<int64_t> gatheredShape = {n};
+    for (int64_t i = 0; i < oRank; i++) {
+      if (i == oc)
+        continue;
+      offsetDims.push_back(offsetDims.size() + 1);
+      gatheredShape.push_back(oType.getDimSize(i));
+    }
+    sliceSizes[oc] = 1;
+    auto gatheredType =
+        RankedTensorType::get(gatheredShape, oType.getElementType());
+
+    Value gathered = rewriter.create<stablehlo::GatherOp>(
+        loc, other, startIndices,
+        stablehlo::GatherDimensionNumbersAttr::get(
+            op.getContext(), offsetDims,
+            /*collapsedSliceDims=*/{oc},
+            /*operandBatchingDims=*/{},
+            /*startIndicesBatchingDims=*/{},
+            /*startIndexMap=*/{oc},
+            /*indexVectorDim=*/1),
+        rewriter.getDenseI64ArrayAttr(sliceSizes),
+        /*indicesAreSorted=*/rewriter.getBoolAttr(false));
+
+    // Gather clamps out of range indices, where the one-hot row is all zeros.
+    Value lowerBound = rewriter.create<stablehlo::ConstantOp>(
+        loc, indicesType, cast<ElementsAttr>(makeAttr(indicesType, 0)));
+    Value upperBound = rewriter.create<stablehlo::ConstantOp>(
+        loc, indicesType, cast<ElementsAttr>(makeAttr(indicesType, nc)));
+    Value inRange = rewriter.create<stablehlo::AndOp>(
+        loc,
+        rewriter.create<stablehlo::CompareOp>(
+            loc, indices, lowerBound, stablehlo::ComparisonDirection::GE),
+        rewriter.create<stablehlo::CompareOp>(
+            loc, indices, upperBound, stablehlo::ComparisonDirection::LT));
+    Value mask = rewriter.create<stablehlo::BroadcastInDimOp>(
+        loc, RankedTensorType::get(gatheredShape, rewriter.getI1Type()),
+        inRange, ArrayRef<int64_t>({0}));
+    Value zeros = rewriter.create<stablehlo::ConstantOp>(
+        loc, gatheredType, cast<ElementsAttr>(makeAttr(gatheredType, 0)));
+    return rewriter.create<stablehlo::SelectOp>(loc, mask, gathered, zeros);
+  }
+
+  // Replaces `op` with `value` transposed by `resultPerm`.
+  void replaceWithPermuted(stablehlo::DotGeneralOp op, Value value,
+                           ArrayRef<int64_t> resultPerm,
+                           PatternRewriter &rewriter) const {
+    if (llvm::equal(resultPerm, llvm::seq<int64_t>(0, resultPerm.size()))) {
+      rewriter.replaceOp(op, value);
+      return;
+    }
+    rewriter.replaceOpWithNewOp<stablehlo::TransposeOp>(op, op.getType(),
+                                                        value, resultPerm);
+  }
+};
+
 // pred ? trues : falses --> pred
 // pred ? falses : trues --> !pred
 struct SelectSimplify
@@ -22823,6 +24713,13 @@ void mlir::transform::addConcatConstProp(RewritePatternSet &patterns,
   patterns.insert<ConcatConstProp>(maxConstantExpansion, &context, benefit);
 }
 
+void mlir::transform::addReduceConstProp(RewritePatternSet &patterns,
+                                         int64_t maxConstantExpansion,
+                                         MLIRContext &context,
+                                         PatternBenefit benefit) {
+  patterns.insert<ReduceConstProp>(maxConstantExpansion, &context, benefit);
+}
+
 void mlir::transform::addPadSimplify(RewritePatternSet &patterns,
                                      int64_t maxConstantExpansion,
                                      MLIRContext &context,
@@ -22915,6 +24812,13 @@ void mlir::transform::addNoNanAddSubSimplify(RewritePatternSet &patterns,
                                        benefit);
 }
 
+void mlir::transform::addWhileReduceScan(RewritePatternSet &patterns,
+                                         bool allowFloatReassociation,
+                                         MLIRContext &context,
+                                         PatternBenefit benefit) {
+  patterns.insert<WhileReduceScan>(allowFloatReassociation, &context, benefit);
+}
+
 void mlir::transform::addNoNanCompareSimplify(RewritePatternSet &patterns,
                                               bool allowOnFloatingPointMath,
                                               MLIRContext &context,
@@ -23064,7 +24968,8 @@ struct EnzymeHLOOptPass
         ShiftRightLogicalSimplify, NegativePadToSlice, SliceSimplify,
         ConvertSimplify, TransposeSimplify, DotGeneralSimplify,
         DotGeneralReshape, DiagonalTensorDotGeneralRewrite,
-        DynamicSliceToStatic, DynamicUpdateSliceElim, ReduceToReshape,
+        StructuredMatrixDotGeneral, DynamicSliceToStatic,
+        DynamicUpdateSliceElim, ReduceToReshape,
         BroadcastToReshape, ReshapeEmptyBroadcast, BroadcastReshape,
         ConstPropThroughBarrier, ReplaceNegAddWithSubtract, SignAbsSimplify,
         AbsPositiveSimplify, SimplifyBoundary<enzymexla::ExtendOp>,
@@ -23079,7 +24984,7 @@ struct EnzymeHLOOptPass
                                                     PatternBenefit(65000));
 
     patterns.add<IotaSimplify, BroadcastInDimSimplify, ConcatConstProp,
-                 DynamicUpdateSliceConstProp, PadSimplify>(
+                 DynamicUpdateSliceConstProp, PadSimplify, ReduceConstProp>(
         max_constant_expansion, context, PatternBenefit(65000));
 
     patterns.add<
@@ -23186,11 +25091,12 @@ struct EnzymeHLOOptPass
                  ConvolutionPad>(context);
 
     if (passses & 512) {
-      patterns.add<TransposeDotReorder, DotTranspose, ConvolutionTranspose,
-                   TransposeConvolution, EinsumTranspose, TransposeEinsum,
-                   ConvertConvertFloat, ConcatToPad, ConcatAppendingReshape,
-                   ReshapeIota, DUSDUS, DUSDUSConcat, DUSConcat, DUSPad,
-                   SliceDUSToConcat, ConcatConcatToDUS>(context);
+      patterns.add<TransposeDotReorder, DotTranspose, DotChainReorder,
+                   ConvolutionTranspose, TransposeConvolution, EinsumTranspose,
+                   TransposeEinsum, ConvertConvertFloat, ConcatToPad,
+                   ConcatAppendingReshape, ReshapeIota, DUSDUS, DUSDUSConcat,
+                   DUSConcat, DUSPad, SliceDUSToConcat,
+                   ConcatConcatToDUS>(context);
       patterns.add<LICM<stablehlo::DynamicUpdateSliceOp>>(false, context);
     }
 
@@ -23341,6 +25247,7 @@ struct EnzymeHLOOptPass
         ImagOpCanon,
         MergeConsecutiveReshapes,
         NoopReduceOpCanon,
+        NoopRealDynamicSlice,
         RealOpCanon,
         ReorderElementwiseAndShapeOp,
         ReshapeOpCanon,
@@ -23423,6 +25330,7 @@ struct EnzymeHLOOptPass
     GreedyRewriteConfig config;
     config.setMaxIterations(max_iterations);
     config.setUseTopDownTraversal(top_down);
+    CheckedPatternScope scope(getOperation());
     if (failed(applyPatternsAndFoldGreedily(getOperation(), std::move(patterns),
                                             config))) {
       signalPassFailure();
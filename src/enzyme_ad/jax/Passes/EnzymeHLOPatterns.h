@@ -6,10 +6,14 @@
 //
 //===----------------------------------------------------------------------===//
 
+#pragma once
+
+#include <memory>
 #include <stdint.h>
 
 namespace mlir {
 class MLIRContext;
+class Operation;
 class PatternBenefit;
 class RewritePatternSet;
 } // namespace mlir
@@ -39,11 +43,17 @@ void addNoNanDivSimplify(RewritePatternSet &patterns,
 void addNoNanZeroBasePowSimplify(RewritePatternSet &patterns,
                                  bool allowOnFloatingPointMath,
                                  MLIRContext &context, PatternBenefit benefit);
+void addWhileReduceScan(RewritePatternSet &patterns,
+                        bool allowFloatReassociation, MLIRContext &context,
+                        PatternBenefit benefit);
 void addIotaSimplify(RewritePatternSet &patterns, int64_t maxConstantExpansion,
                      MLIRContext &context, PatternBenefit benefit);
 void addConcatConstProp(RewritePatternSet &patterns,
                         int64_t maxConstantExpansion, MLIRContext &context,
                         PatternBenefit benefit);
+void addReduceConstProp(RewritePatternSet &patterns,
+                        int64_t maxConstantExpansion, MLIRContext &context,
+                        PatternBenefit benefit);
 void addPadSimplify(RewritePatternSet &patterns, int64_t maxConstantExpansion,
                     MLIRContext &context, PatternBenefit benefit);
 void addDynamicUpdateSliceConstProp(RewritePatternSet &patterns,
@@ -100,3 +110,21 @@ void addSelfMulToConvolutionLike(RewritePatternSet &patterns,
                                  MLIRContext &context, PatternBenefit benefit);
 
 } // namespace mlir::transform
+
+namespace mlir::enzyme {
+struct CheckedPatternState;
+
+/// Precomputes, for one greedy rewrite of `root`, whether any function may
+/// disable the enzyme-hlo patterns through `enzymexla.disable_hlo_opts`. If
+/// none does, the patterns skip looking up their enclosing function on every
+/// match attempt. Patterns applied outside of such a scope do the full check.
+class CheckedPatternScope {
+public:
+  explicit CheckedPatternScope(Operation *root);
+  ~CheckedPatternScope();
+
+private:
+  std::unique_ptr<CheckedPatternState> state;
+  CheckedPatternState *previous;
+};
+} // namespace mlir::enzyme
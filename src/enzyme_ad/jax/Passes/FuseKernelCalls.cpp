@@ -0,0 +1,618 @@
+//===- FuseKernelCalls.cpp - Fuse consecutive kernel calls ---------------- //
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a pass that fuses consecutive enzymexla.kernel_call
+// operations with the same launch configuration into a single kernel.
+//===----------------------------------------------------------------------===//
+
+#include "src/enzyme_ad/jax/Dialect/Ops.h"
+#include "src/enzyme_ad/jax/Passes/Passes.h"
+
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/LLVMIR/NVVMDialect.h"
+#include "mlir/IR/Dominance.h"
+#include "mlir/IR/IRMapping.h"
+#include "mlir/IR/Matchers.h"
+#include "mlir/Interfaces/SideEffectInterfaces.h"
+#include "stablehlo/dialect/StablehloOps.h"
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/Debug.h"
+
+#include <array>
+
+#define DEBUG_TYPE "fuse-kernel-calls"
+
+namespace mlir {
+namespace enzyme {
+#define GEN_PASS_DEF_FUSEKERNELCALLSPASS
+#include "src/enzyme_ad/jax/Passes/Passes.h.inc"
+} // namespace enzyme
+} // namespace mlir
+
+using namespace mlir;
+using namespace mlir::enzyme;
+using namespace mlir::enzymexla;
+
+namespace {
+
+// Returns the (gridx, gridy, gridz, blockx, blocky, blockz, shmem) launch
+// configuration of `call` if all of it is constant.
+static std::optional<SmallVector<int64_t, 7>>
+getLaunchConfig(enzymexla::KernelCallOp call) {
+  SmallVector<int64_t, 7> config;
+  for (Value val : {call.getGridx(), call.getGridy(), call.getGridz(),
+                    call.getBlockx(), call.getBlocky(), call.getBlockz(),
+                    call.getShmem()}) {
+    DenseIntElementsAttr attr;
+    if (!matchPattern(val, m_Constant(&attr)) || attr.getNumElements() != 1)
+      return std::nullopt;
+    config.push_back((*attr.begin()).getSExtValue());
+  }
+  return config;
+}
+
+// Maps every result of `call` to the operand it aliases, or fails if some
+// result does not alias an operand.
+static LogicalResult getResultAliases(enzymexla::KernelCallOp call,
+                                      SmallVectorImpl<int64_t> &aliases) {
+  aliases.assign(call.getNumResults(), -1);
+  for (auto attr : call.getOutputOperandAliases()) {
+    auto alias = cast<stablehlo::OutputOperandAliasAttr>(attr);
+    if (!alias.getOperandTupleIndices().empty() ||
+        alias.getOutputTupleIndices().size() > 1)
+      return failure();
+    size_t idx = alias.getOutputTupleIndices().empty()
+                     ? 0
+                     : alias.getOutputTupleIndices()[0];
+    if (idx >= aliases.size())
+      return failure();
+    aliases[idx] = alias.getOperandIndex();
+  }
+  return success(!llvm::is_contained(aliases, -1));
+}
+
+// Returns true if `fn` or any function it calls contains an operation that
+// prevents running it back to back with another kernel in the same thread:
+// synchronization or warp-level operations (threads leaving the first kernel
+// early would reach them in the second one), and accesses to mutable globals
+// such as shared memory.
+static bool hasUnfusableOps(FunctionOpInterface fn,
+                            SymbolTableCollection &symbolTable,
+                            SmallPtrSetImpl<Operation *> &seen) {
+  if (!seen.insert(fn).second)
+    return false;
+  auto res = fn->walk([&](Operation *op) {
+    if (isa<NVVM::NVVMDialect, gpu::GPUDialect>(op->getDialect()) &&
+        !isMemoryEffectFree(op))
+      return WalkResult::interrupt();
+    if (auto addr = dyn_cast<LLVM::AddressOfOp>(op)) {
+      auto global = addr.getGlobal(symbolTable);
+      if (!global || !global.getConstant())
+        return WalkResult::interrupt();
+    }
+    if (auto call = dyn_cast<CallOpInterface>(op)) {
+      auto callee = dyn_cast_or_null<FunctionOpInterface>(
+          call.resolveCallableInTable(&symbolTable));
+      if (!callee)
+        return WalkResult::interrupt();
+      if (!callee.isExternal() && hasUnfusableOps(callee, symbolTable, seen))
+        return WalkResult::interrupt();
+    }
+    return WalkResult::advance();
+  });
+  return res.wasInterrupted();
+}
+
+// A load or store through a kernel pointer argument, either directly or
+// through a single-index getelementptr.
+struct Access {
+  Type elementType;
+  Value index;
+  int64_t constantIndex;
+  Type accessType;
+  bool write;
+};
+
+// Collects all accesses through `arg`, failing if the pointer is used for
+// anything else.
+static LogicalResult collectAccesses(BlockArgument arg,
+                                     SmallVectorImpl<Access> &accesses) {
+  auto addAccess = [&](Operation *user, Value ptr, Type elementType,
+                       Value index, int64_t constantIndex) {
+    if (auto load = dyn_cast<LLVM::LoadOp>(user)) {
+      if (load.getVolatile_() ||
+          load.getOrdering() != LLVM::AtomicOrdering::not_atomic)
+        return failure();
+      accesses.push_back({elementType ? elementType : load.getType(), index,
+                          constantIndex, load.getType(), false});
+      return success();
+    }
+    if (auto store = dyn_cast<LLVM::StoreOp>(user)) {
+      if (store.getValue() == ptr || store.getVolatile_() ||
+          store.getOrdering() != LLVM::AtomicOrdering::not_atomic)
+        return failure();
+      Type ty = store.getValue().getType();
+      accesses.push_back(
+          {elementType ? elementType : ty, index, constantIndex, ty, true});
+      return success();
+    }
+    return failure();
+  };
+
+  for (Operation *user : arg.getUsers()) {
+    auto gep = dyn_cast<LLVM::GEPOp>(user);
+    if (!gep) {
+      if (failed(addAccess(user, arg, nullptr, nullptr, 0)))
+        return failure();
+      continue;
+    }
+    if (gep.getBase() != arg || gep.getRawConstantIndices().size() != 1)
+      return failure();
+    Value index;
+    int64_t constantIndex = gep.getRawConstantIndices()[0];
+    if (constantIndex == LLVM::GEPOp::kDynamicIndex) {
+      index = gep.getDynamicIndices()[0];
+      constantIndex = 0;
+    }
+    for (Operation *gepUser : gep->getUsers())
+      if (failed(addAccess(gepUser, gep, gep.getElemType(), index,
+                           constantIndex)))
+        return failure();
+  }
+  return success();
+}
+
+// Decides whether two values, possibly computed in different kernels, are
+// equal for the same thread. Kernel arguments are equal if they are bound to
+// the same operand of the fused call.
+struct ThreadValueEquivalence {
+  DenseMap<Value, Value> argOperands;
+
+  bool equivalent(Value a, Value b, unsigned depth = 0) const {
+    if (a == b)
+      return true;
+    if (a.getType() != b.getType() || depth > 16)
+      return false;
+
+    if (isa<BlockArgument>(a) || isa<BlockArgument>(b)) {
+      auto opA = argOperands.lookup(a);
+      return opA && opA == argOperands.lookup(b);
+    }
+
+    auto resA = cast<OpResult>(a), resB = cast<OpResult>(b);
+    Operation *opA = resA.getOwner(), *opB = resB.getOwner();
+    if (resA.getResultNumber() != resB.getResultNumber() ||
+        opA->getName() != opB->getName() ||
+        opA->getAttrDictionary() != opB->getAttrDictionary() ||
+        opA->getNumOperands() != opB->getNumOperands() ||
+        opA->getNumRegions() != 0 || opB->getNumRegions() != 0 ||
+        !isMemoryEffectFree(opA) || !isMemoryEffectFree(opB))
+      return false;
+    for (auto [operandA, operandB] :
+         llvm::zip(opA->getOperands(), opB->getOperands()))
+      if (!equivalent(operandA, operandB, depth + 1))
+        return false;
+    return true;
+  }
+
+  bool equivalent(const Access &a, const Access &b) const {
+    if (a.elementType != b.elementType || a.accessType != b.accessType ||
+        a.constantIndex != b.constantIndex || !a.index != !b.index)
+      return false;
+    return !a.index || equivalent(a.index, b.index);
+  }
+};
+
+// An integer as an affine function of the thread and block ids,
+// `constant + sum(coeffs[i] * id[i])` for the ids (tid.x, tid.y, tid.z,
+// ctaid.x, ctaid.y, ctaid.z).
+struct ThreadAffine {
+  int64_t constant = 0;
+  std::array<int64_t, 6> coeffs = {};
+};
+
+// Extent of every id of ThreadAffine, for the launch configuration `config`.
+static std::array<int64_t, 6> getIdExtents(ArrayRef<int64_t> config) {
+  return {config[3], config[4], config[5], config[0], config[1], config[2]};
+}
+
+static std::optional<ThreadAffine> getThreadAffine(Value value,
+                                                   ArrayRef<int64_t> config,
+                                                   unsigned depth = 0) {
+  if (depth > 16 || !value.getType().isIntOrIndex())
+    return std::nullopt;
+
+  auto id = [](unsigned idx) {
+    ThreadAffine res;
+    res.coeffs[idx] = 1;
+    return res;
+  };
+  auto constant = [](int64_t val) {
+    ThreadAffine res;
+    res.constant = val;
+    return res;
+  };
+
+  APInt cst;
+  if (matchPattern(value, m_ConstantInt(&cst)))
+    return constant(cst.getSExtValue());
+
+  Operation *op = value.getDefiningOp();
+  if (!op)
+    return std::nullopt;
+
+  if (isa<NVVM::ThreadIdXOp>(op))
+    return id(0);
+  if (isa<NVVM::ThreadIdYOp>(op))
+    return id(1);
+  if (isa<NVVM::ThreadIdZOp>(op))
+    return id(2);
+  if (isa<NVVM::BlockIdXOp>(op))
+    return id(3);
+  if (isa<NVVM::BlockIdYOp>(op))
+    return id(4);
+  if (isa<NVVM::BlockIdZOp>(op))
+    return id(5);
+  if (isa<NVVM::BlockDimXOp>(op))
+    return constant(config[3]);
+  if (isa<NVVM::BlockDimYOp>(op))
+    return constant(config[4]);
+  if (isa<NVVM::BlockDimZOp>(op))
+    return constant(config[5]);
+  if (isa<NVVM::GridDimXOp>(op))
+    return constant(config[0]);
+  if (isa<NVVM::GridDimYOp>(op))
+    return constant(config[1]);
+  if (isa<NVVM::GridDimZOp>(op))
+    return constant(config[2]);
+  if (auto tid = dyn_cast<gpu::ThreadIdOp>(op))
+    return id((unsigned)tid.getDimension());
+  if (auto bid = dyn_cast<gpu::BlockIdOp>(op))
+    return id(3 + (unsigned)bid.getDimension());
+  if (auto bdim = dyn_cast<gpu::BlockDimOp>(op))
+    return constant(config[3 + (unsigned)bdim.getDimension()]);
+  if (auto gdim = dyn_cast<gpu::GridDimOp>(op))
+    return constant(config[(unsigned)gdim.getDimension()]);
+
+  // The ids and their products with the launch sizes are non-negative, and
+  // results are checked to fit their type below, so extensions are exact.
+  if (isa<LLVM::ZExtOp, LLVM::SExtOp, arith::ExtUIOp, arith::ExtSIOp,
+          arith::IndexCastOp, arith::IndexCastUIOp>(op))
+    return getThreadAffine(op->getOperand(0), config, depth + 1);
+
+  if (op->getNumOperands() != 2)
+    return std::nullopt;
+  auto lhs = getThreadAffine(op->getOperand(0), config, depth + 1);
+  auto rhs = getThreadAffine(op->getOperand(1), config, depth + 1);
+  if (!lhs || !rhs)
+    return std::nullopt;
+
+  auto isConstant = [](const ThreadAffine &val) {
+    return llvm::all_of(val.coeffs, [](int64_t c) { return c == 0; });
+  };
+  auto scale = [](ThreadAffine val, int64_t factor) {
+    val.constant *= factor;
+    for (int64_t &c : val.coeffs)
+      c *= factor;
+    return val;
+  };
+
+  ThreadAffine res;
+  if (isa<LLVM::AddOp, arith::AddIOp, LLVM::SubOp, arith::SubIOp>(op)) {
+    int64_t sign = isa<LLVM::SubOp, arith::SubIOp>(op) ? -1 : 1;
+    res.constant = lhs->constant + sign * rhs->constant;
+    for (unsigned i = 0; i < 6; i++)
+      res.coeffs[i] = lhs->coeffs[i] + sign * rhs->coeffs[i];
+  } else if (isa<LLVM::MulOp, arith::MulIOp>(op)) {
+    if (isConstant(*rhs))
+      res = scale(*lhs, rhs->constant);
+    else if (isConstant(*lhs))
+      res = scale(*rhs, lhs->constant);
+    else
+      return std::nullopt;
+  } else if (isa<LLVM::ShlOp, arith::ShLIOp>(op)) {
+    if (!isConstant(*rhs) || rhs->constant < 0 || rhs->constant > 30)
+      return std::nullopt;
+    res = scale(*lhs, int64_t(1) << rhs->constant);
+  } else {
+    return std::nullopt;
+  }
+
+  // Give up if the value may wrap around in its type.
+  unsigned width = value.getType().isIndex()
+                       ? 64
+                       : value.getType().getIntOrFloatBitWidth();
+  auto extents = getIdExtents(config);
+  __int128 bound = res.constant < 0 ? -(__int128)res.constant : res.constant;
+  for (unsigned i = 0; i < 6; i++) {
+    __int128 c = res.coeffs[i];
+    bound += (c < 0 ? -c : c) * (extents[i] - 1);
+  }
+  if (width < 2 || width > 64 || bound >= ((__int128)1 << (width - 1)))
+    return std::nullopt;
+  return res;
+}
+
+// Whether no two threads of the launch `config` get the same value of `val`.
+// The dimensions sorted by coefficient must form a mixed radix: every
+// coefficient exceeds the largest distance reachable with the smaller ones.
+static bool isInjective(const ThreadAffine &val, ArrayRef<int64_t> config) {
+  auto extents = getIdExtents(config);
+  SmallVector<std::pair<int64_t, int64_t>, 6> dims;
+  for (unsigned i = 0; i < 6; i++) {
+    if (extents[i] <= 1)
+      continue;
+    if (val.coeffs[i] == 0)
+      return false;
+    dims.emplace_back(std::abs(val.coeffs[i]), extents[i]);
+  }
+  llvm::sort(dims);
+  int64_t span = 0;
+  for (auto [coeff, extent] : dims) {
+    if (coeff <= span)
+      return false;
+    span += coeff * (extent - 1);
+  }
+  return true;
+}
+
+static bool mayWrite(FunctionOpInterface fn, unsigned idx) {
+  auto effects =
+      fn.getArgAttrOfType<ArrayAttr>(idx, "enzymexla.memory_effects");
+  if (!effects)
+    return true;
+  return llvm::any_of(effects, [](Attribute attr) {
+    return cast<StringAttr>(attr).getValue() == "write";
+  });
+}
+
+struct FuseKernelCallsPass
+    : public enzyme::impl::FuseKernelCallsPassBase<FuseKernelCallsPass> {
+  using FuseKernelCallsPassBase::FuseKernelCallsPassBase;
+
+  // Returns the next kernel call after `call` if only operations without
+  // memory effects separate them.
+  static enzymexla::KernelCallOp getNextCall(enzymexla::KernelCallOp call) {
+    for (Operation *op = call->getNextNode(); op; op = op->getNextNode()) {
+      if (auto next = dyn_cast<enzymexla::KernelCallOp>(op))
+        return next;
+      if (!isMemoryEffectFree(op))
+        return nullptr;
+    }
+    return nullptr;
+  }
+
+  static bool hasUnsupportedAttrs(enzymexla::KernelCallOp call) {
+    return call.getOperandLayoutsAttr() || call.getResultLayoutsAttr() ||
+           call.getArgAttrsAttr() || call.getResAttrsAttr();
+  }
+
+  LogicalResult fuse(enzymexla::KernelCallOp first,
+                     enzymexla::KernelCallOp second,
+                     SymbolTableCollection &symbolTable,
+                     DominanceInfo &domInfo) {
+    auto config = getLaunchConfig(first);
+    if (!config || config != getLaunchConfig(second) || config->back() != 0)
+      return failure();
+
+    if (hasUnsupportedAttrs(first) || hasUnsupportedAttrs(second) ||
+        first.getBackendConfig() != second.getBackendConfig())
+      return failure();
+
+    auto fnFirst = dyn_cast_or_null<LLVM::LLVMFuncOp>(
+        symbolTable.lookupNearestSymbolFrom(first, first.getFnAttr()));
+    auto fnSecond = dyn_cast_or_null<LLVM::LLVMFuncOp>(
+        symbolTable.lookupNearestSymbolFrom(second, second.getFnAttr()));
+    if (!fnFirst || !fnSecond || fnFirst.isExternal() ||
+        fnSecond.isExternal() || fnFirst.isVarArg() || fnSecond.isVarArg() ||
+        fnFirst.getCConv() != fnSecond.getCConv() ||
+        fnFirst.getNumArguments() != first.getInputs().size() ||
+        fnSecond.getNumArguments() != second.getInputs().size())
+      return failure();
+
+    SmallVector<int64_t> firstAliases, secondAliases;
+    if (failed(getResultAliases(first, firstAliases)) ||
+        failed(getResultAliases(second, secondAliases)))
+      return failure();
+
+    {
+      SmallPtrSet<Operation *, 4> seen;
+      if (hasUnfusableOps(fnFirst, symbolTable, seen) ||
+          hasUnfusableOps(fnSecond, symbolTable, seen))
+        return failure();
+    }
+
+    // Bind the arguments of the second kernel: results of the first call
+    // become the buffer they alias, everything else must be available before
+    // the first call and gets a new argument.
+    SmallVector<Value> inputs(first.getInputs());
+    SmallVector<int64_t> secondArgToFused;
+    SmallVector<std::tuple<unsigned, unsigned, OpResult>> shared;
+    SmallPtrSet<Value, 4> seenShared;
+    for (auto [idx, input] : llvm::enumerate(second.getInputs())) {
+      auto res = dyn_cast<OpResult>(input);
+      if (res && res.getOwner() == first) {
+        if (!seenShared.insert(res).second)
+          return failure();
+        unsigned operand = firstAliases[res.getResultNumber()];
+        secondArgToFused.push_back(operand);
+        shared.emplace_back(operand, idx, res);
+        continue;
+      }
+      if (!domInfo.properlyDominates(input, first))
+        return failure();
+      secondArgToFused.push_back(inputs.size());
+      inputs.push_back(input);
+    }
+
+    ThreadValueEquivalence equiv;
+    for (auto [idx, arg] : llvm::enumerate(fnFirst.getArguments()))
+      equiv.argOperands[arg] = first.getInputs()[idx];
+    for (auto [idx, arg] : llvm::enumerate(fnSecond.getArguments()))
+      equiv.argOperands[arg] = inputs[secondArgToFused[idx]];
+
+    // Every thread must only read elements of a shared buffer that it wrote
+    // itself, otherwise the fused kernel would race with other threads still
+    // executing the first kernel.
+    auto writes = [](ArrayRef<Access> accesses) {
+      return llvm::any_of(accesses, [](const Access &a) { return a.write; });
+    };
+    for (auto [firstIdx, secondIdx, result] : shared) {
+      SmallVector<Access> firstAccesses, secondAccesses;
+      bool analyzable =
+          succeeded(collectAccesses(fnFirst.getArgument(firstIdx),
+                                    firstAccesses)) &&
+          succeeded(collectAccesses(fnSecond.getArgument(secondIdx),
+                                    secondAccesses));
+      bool firstWrites =
+          analyzable ? writes(firstAccesses) : mayWrite(fnFirst, firstIdx);
+      bool secondWrites =
+          analyzable ? writes(secondAccesses) : mayWrite(fnSecond, secondIdx);
+
+      // Writes of the second kernel are only visible through its aliased
+      // result, and must not be observed by other users of the first result.
+      if (secondWrites &&
+          (!llvm::is_contained(secondAliases, (int64_t)secondIdx) ||
+           !result.hasOneUse()))
+        return failure();
+      if (!firstWrites && !secondWrites)
+        continue;
+      if (!analyzable)
+        return failure();
+
+      firstAccesses.append(secondAccesses);
+      for (const Access &access : firstAccesses)
+        if (!equiv.equivalent(firstAccesses.front(), access))
+          return failure();
+
+      // The common index must also differ between threads, a constant index
+      // or one depending only on the block would be shared by several
+      // threads.
+      const Access &access = firstAccesses.front();
+      std::optional<ThreadAffine> index;
+      if (access.index)
+        index = getThreadAffine(access.index, *config);
+      else
+        index = ThreadAffine();
+      if (!index || !isInjective(*index, *config))
+        return failure();
+    }
+
+    // Create the fused kernel, running the body of the first kernel and then
+    // the body of the second one.
+    OpBuilder builder(&getContext());
+    SmallVector<Type> argTypes(fnFirst.getArgumentTypes());
+    for (auto [idx, arg] : llvm::enumerate(fnSecond.getArguments()))
+      if (secondArgToFused[idx] >= (int64_t)first.getInputs().size())
+        argTypes.push_back(arg.getType());
+
+    auto fnType = LLVM::LLVMFunctionType::get(
+        LLVM::LLVMVoidType::get(&getContext()), argTypes);
+    auto fused = builder.create<LLVM::LLVMFuncOp>(
+        fnFirst.getLoc(),
+        (fnFirst.getName() + "$fused$" + fnSecond.getName()).str(), fnType,
+        LLVM::Linkage::Internal, /*dsoLocal*/ false, fnFirst.getCConv());
+    symbolTable.getSymbolTable(getOperation())
+        .insert(fused, fnFirst->getIterator());
+
+    Block *entry = fused.addEntryBlock(builder);
+    IRMapping mapFirst, mapSecond;
+    for (auto [idx, arg] : llvm::enumerate(fnFirst.getArguments()))
+      mapFirst.map(arg, entry->getArgument(idx));
+    for (auto [idx, arg] : llvm::enumerate(fnSecond.getArguments()))
+      mapSecond.map(arg, entry->getArgument(secondArgToFused[idx]));
+    fnFirst.getBody().cloneInto(&fused.getBody(), mapFirst);
+    fnSecond.getBody().cloneInto(&fused.getBody(), mapSecond);
+    Block *entryFirst = mapFirst.lookup(&fnFirst.getBody().front());
+    Block *entrySecond = mapSecond.lookup(&fnSecond.getBody().front());
+
+    builder.setInsertionPointToEnd(entry);
+    builder.create<LLVM::BrOp>(fused.getLoc(), ValueRange(), entryFirst);
+    for (Block &block : llvm::make_range(entryFirst->getIterator(),
+                                         entrySecond->getIterator())) {
+      Operation *term = block.getTerminator();
+      if (!isa<LLVM::ReturnOp, LLVM::UnreachableOp>(term))
+        continue;
+      builder.setInsertionPoint(term);
+      builder.create<LLVM::BrOp>(term->getLoc(), ValueRange(), entrySecond);
+      term->erase();
+    }
+
+    // Results of the second call that alias a shared buffer are replaced by
+    // the corresponding result of the first call.
+    SmallVector<Type> resultTypes(first.getResultTypes());
+    SmallVector<int64_t> resultOperands(firstAliases);
+    SmallVector<int64_t> secondResultToFused;
+    for (auto [idx, operand] : llvm::enumerate(secondAliases)) {
+      int64_t fusedOperand = secondArgToFused[operand];
+      auto it = llvm::find(resultOperands, fusedOperand);
+      if (it != resultOperands.end()) {
+        secondResultToFused.push_back(it - resultOperands.begin());
+        continue;
+      }
+      secondResultToFused.push_back(resultTypes.size());
+      resultTypes.push_back(second.getResult(idx).getType());
+      resultOperands.push_back(fusedOperand);
+    }
+
+    SmallVector<Attribute> outputAliases;
+    for (auto [idx, operand] : llvm::enumerate(resultOperands)) {
+      SmallVector<int64_t> tupleIndices;
+      if (resultOperands.size() != 1)
+        tupleIndices.push_back(idx);
+      outputAliases.push_back(stablehlo::OutputOperandAliasAttr::get(
+          &getContext(), tupleIndices, operand, {}));
+    }
+
+    UnitAttr sideEffectFree = first.getXlaSideEffectFreeAttr() &&
+                                      second.getXlaSideEffectFreeAttr()
+                                  ? first.getXlaSideEffectFreeAttr()
+                                  : nullptr;
+
+    builder.setInsertionPoint(first);
+    auto fusedCall = builder.create<enzymexla::KernelCallOp>(
+        first.getLoc(), resultTypes, fused.getName(), first.getGridx(),
+        first.getGridy(), first.getGridz(), first.getBlockx(),
+        first.getBlocky(), first.getBlockz(), first.getShmem(), inputs,
+        first.getBackendConfigAttr(), /*operandLayouts*/ nullptr,
+        /*resultLayouts*/ nullptr, /*argAttrs*/ nullptr, /*resAttrs*/ nullptr,
+        builder.getArrayAttr(outputAliases), sideEffectFree);
+
+    for (auto [idx, res] : llvm::enumerate(second.getResults()))
+      res.replaceAllUsesWith(fusedCall.getResult(secondResultToFused[idx]));
+    second.erase();
+    first->replaceAllUsesWith(
+        fusedCall.getResults().take_front(first.getNumResults()));
+    first.erase();
+
+    LLVM_DEBUG(llvm::dbgs() << "fused kernels into " << fused.getName()
+                            << "\n");
+    return success();
+  }
+
+  void runOnOperation() override {
+    SymbolTableCollection symbolTable;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      DominanceInfo domInfo(getOperation());
+      getOperation()->walk([&](enzymexla::KernelCallOp call) {
+        auto next = getNextCall(call);
+        if (!next || failed(fuse(call, next, symbolTable, domInfo)))
+          return WalkResult::advance();
+        changed = true;
+        return WalkResult::interrupt();
+      });
+    }
+  }
+};
+
+} // end anonymous namespace
@@ -0,0 +1,145 @@
+//===- IncrementalPipeline.cpp - Skip pipelines on unchanged functions --- ===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a pass running a nested pipeline on every function of
+// a module, skipping functions that did not change since they last went
+// through the same pipeline.
+//===----------------------------------------------------------------------===//
+
+#include "src/enzyme_ad/jax/Dialect/Dialect.h"
+#include "src/enzyme_ad/jax/Passes/Passes.h"
+
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/SymbolTable.h"
+#include "mlir/Interfaces/CallInterfaces.h"
+#include "mlir/Interfaces/FunctionInterfaces.h"
+#include "mlir/Pass/PassManager.h"
+#include "mlir/Pass/PassRegistry.h"
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+
+#define DEBUG_TYPE "incremental-pipeline"
+
+namespace mlir {
+namespace enzyme {
+#define GEN_PASS_DEF_INCREMENTALPIPELINEPASS
+#include "src/enzyme_ad/jax/Passes/Passes.h.inc"
+} // namespace enzyme
+} // namespace mlir
+
+using namespace mlir;
+using namespace mlir::enzyme;
+
+namespace {
+
+struct IncrementalPipelinePass
+    : public enzyme::impl::IncrementalPipelinePassBase<
+          IncrementalPipelinePass> {
+  using IncrementalPipelinePassBase::IncrementalPipelinePassBase;
+
+  void getDependentDialects(DialectRegistry &registry) const override {
+    IncrementalPipelinePassBase::getDependentDialects(registry);
+    OpPassManager pm;
+    if (succeeded(parsePassPipeline(pipeline, pm, llvm::nulls())))
+      pm.getDependentDialects(registry);
+  }
+
+  LogicalResult initialize(MLIRContext *context) override {
+    return parsePassPipeline(pipeline, dynamicPM);
+  }
+
+  void runOnOperation() override {
+    auto *dialect =
+        getContext().getLoadedDialect<enzymexla::EnzymeXLADialect>();
+    ModuleOp module = getOperation();
+
+    SmallVector<FunctionOpInterface> funcs;
+    SmallVector<Operation *> others;
+    for (Operation &op : module.getOps()) {
+      auto fn = dyn_cast<FunctionOpInterface>(&op);
+      if (fn && !fn.isExternal())
+        funcs.push_back(fn);
+      else
+        others.push_back(&op);
+    }
+
+    // Forget functions that are gone, so that a new operation allocated at
+    // the same address is not mistaken for them.
+    llvm::SmallDenseSet<Operation *> live;
+    for (auto fn : funcs)
+      live.insert(fn);
+    dialect->withStageFingerPrints(pipeline, [&](auto &fingerPrints) {
+      SmallVector<Operation *> dead;
+      for (auto &entry : fingerPrints)
+        if (!live.contains(entry.first))
+          dead.push_back(entry.first);
+      for (Operation *op : dead)
+        fingerPrints.erase(op);
+    });
+
+    // The nested pipeline cannot modify operations outside of the function it
+    // runs on, but callees are updated as their own pipelines run.
+    SymbolTableCollection symbolTable;
+    auto getFingerPrint = [&](FunctionOpInterface fn) {
+      enzymexla::EnzymeXLADialect::StageFingerPrint res;
+      res.moduleAttrs = module->getAttrDictionary();
+      res.ops.emplace_back(fn);
+      for (Operation *op : others)
+        res.ops.emplace_back(op);
+
+      SmallVector<Operation *> worklist = {fn};
+      llvm::SmallPtrSet<Operation *, 4> seen = {fn};
+      while (!worklist.empty()) {
+        worklist.pop_back_val()->walk([&](CallOpInterface call) {
+          Operation *callee = call.resolveCallableInTable(&symbolTable);
+          if (!callee || !isa<FunctionOpInterface>(callee) ||
+              callee->getParentOp() != module || !seen.insert(callee).second)
+            return;
+          worklist.push_back(callee);
+          if (!cast<FunctionOpInterface>(callee).isExternal())
+            res.ops.emplace_back(callee);
+        });
+      }
+      return res;
+    };
+
+    for (auto fn : funcs) {
+      auto before = getFingerPrint(fn);
+      bool unchanged = false;
+      dialect->withStageFingerPrints(pipeline, [&](auto &fingerPrints) {
+        auto found = fingerPrints.find(fn);
+        unchanged = found != fingerPrints.end() && found->second == before;
+      });
+      if (unchanged) {
+        ++numSkipped;
+        continue;
+      }
+
+      if (failed(runPipeline(dynamicPM, fn)))
+        return signalPassFailure();
+      ++numRun;
+
+      // Only a run that left the function as it was shows that the pipeline
+      // reached a fixpoint on it, a changed function may simplify further
+      // when the stage runs again.
+      auto after = getFingerPrint(fn);
+      dialect->withStageFingerPrints(pipeline, [&](auto &fingerPrints) {
+        if (after == before)
+          fingerPrints.insert_or_assign(fn, std::move(after));
+        else
+          fingerPrints.erase(fn);
+      });
+    }
+  }
+
+private:
+  OpPassManager dynamicPM;
+};
+
+} // end anonymous namespace
@@ -1045,21 +1045,23 @@ struct LowerJITPass
                 mlir::stablehlo::CustomCallApiVersion::API_VERSION_TYPED_FFI),
             /*calledcomputations*/ nullptr, operand_layouts, result_layouts,
             output_operand_aliases);
-      else if (backend == "cpu")
+      else if (backend == "cpu") {
+        std::string name = asyncCPU ? "enzymexla_compile_cpu_async"
+                                    : "enzymexla_compile_cpu";
+        if (hasReturn)
+          name += "_with_error";
         replacement = rewriter.create<stablehlo::CustomCallOp>(
             op.getLoc(), op.getResultTypes(), op.getInputs(),
-            hasReturn
-                ? rewriter.getStringAttr("enzymexla_compile_cpu_with_error")
-                : rewriter.getStringAttr("enzymexla_compile_cpu"),
+            rewriter.getStringAttr(name),
             /* has_side_effect*/ hasSideEffectAttr,
-            /*backend_config*/ backendstr,
+            /*backend_config*/ dattr,
             /* api_version*/
             CustomCallApiVersionAttr::get(
                 rewriter.getContext(),
-                mlir::stablehlo::CustomCallApiVersion::
-                    API_VERSION_STATUS_RETURNING_UNIFIED),
+                mlir::stablehlo::CustomCallApiVersion::API_VERSION_TYPED_FFI),
             /*calledcomputations*/ nullptr, operand_layouts, result_layouts,
             output_operand_aliases);
+      }
 
       op.replaceAllUsesWith(replacement);
       op.erase();
@@ -24,10 +24,17 @@
 #include "mlir/Dialect/LLVMIR/NVVMDialect.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "mlir/Analysis/Liveness.h"
 #include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/ControlFlow/IR/ControlFlowOps.h"
 #include "mlir/Dialect/Func/IR/FuncOps.h"
 #include "mlir/Dialect/GPU/IR/GPUDialect.h"
 #include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+
+#include "AlwaysInliner.h"
+
+#include <map>
 
 #define DEBUG_TYPE "lower-kernel"
 
@@ -47,10 +54,129 @@ using namespace enzymexla;
 
 using namespace stablehlo;
 
+// The launch sizes of a kernel call: grid x, y, z, block x, y, z and the
+// dynamic shared memory in bytes. Sizes that are not constants are read at
+// runtime from scalar buffers passed after the kernel operands.
+struct LaunchSizes {
+  static constexpr unsigned kBlockX = 3, kShmem = 6, kNumSizes = 7;
+
+  size_t constants[kNumSizes] = {};
+  Value runtime[kNumSizes] = {};
+
+  bool isDynamic(unsigned i) const { return static_cast<bool>(runtime[i]); }
+
+  // The integer type of the tensor holding the dynamic size `i`.
+  IntegerType getRuntimeType(unsigned i) const {
+    return cast<IntegerType>(
+        cast<RankedTensorType>(runtime[i].getType()).getElementType());
+  }
+
+  // The kernel_call operands of the dynamic sizes among `which`.
+  SmallVector<Value> getRuntimeOperands(ArrayRef<unsigned> which) const {
+    SmallVector<Value> operands;
+    for (unsigned i : which)
+      if (isDynamic(i))
+        operands.push_back(runtime[i]);
+    return operands;
+  }
+};
+
+// Functions generated for kernel calls, by kernel and launch sizes among
+// the sizes the backend uses. Dynamic sizes are function arguments, so all
+// calls with the same constant sizes, and the same integer types of the
+// dynamic ones, share one function.
+class KernelCallCache {
+public:
+  using Key = std::pair<Operation *, SmallVector<int64_t, 7>>;
+
+  static Key getKey(FunctionOpInterface op, const LaunchSizes &sizes,
+                    ArrayRef<unsigned> which) {
+    Key key{op, {}};
+    for (unsigned i : which)
+      key.second.push_back(
+          sizes.isDynamic(i) ? -(int64_t)sizes.getRuntimeType(i).getWidth()
+                             : (int64_t)sizes.constants[i]);
+    return key;
+  }
+
+  StringRef lookup(const Key &key) const {
+    auto found = cache.find(key);
+    return found == cache.end() ? StringRef() : StringRef(found->second);
+  }
+
+  void insert(Key key, StringRef callName) {
+    cache.emplace(std::move(key), callName.str());
+  }
+
+private:
+  std::map<Key, std::string> cache;
+};
+
+// Appends a pointer argument to `func` for every dynamic size of `which`,
+// and returns the corresponding kernel_call operands.
+static SmallVector<Value> addRuntimeSizeArguments(func::FuncOp func,
+                                                  const LaunchSizes &sizes,
+                                                  ArrayRef<unsigned> which,
+                                                  Type ptrTy,
+                                                  SmallVector<Value> &args) {
+  Block &entry = func.getBody().front();
+  SmallVector<Type> inputs = llvm::to_vector(func.getArgumentTypes());
+  args.assign(LaunchSizes::kNumSizes, nullptr);
+  for (unsigned i : which) {
+    if (!sizes.isDynamic(i))
+      continue;
+    inputs.push_back(ptrTy);
+    args[i] = entry.addArgument(ptrTy, func.getLoc());
+  }
+  func.setFunctionType(FunctionType::get(func.getContext(), inputs, {}));
+  return sizes.getRuntimeOperands(which);
+}
+
+// Replaces `kcall` by a jit_call of `callName`, passing the runtime launch
+// sizes `sizeOperands` after the kernel operands.
+static void replaceWithJITCall(enzymexla::KernelCallOp kcall,
+                               StringRef callName, ValueRange sizeOperands) {
+  OpBuilder rewriter(kcall);
+  SmallVector<Value> inputs = llvm::to_vector(kcall.getInputs());
+  llvm::append_range(inputs, sizeOperands);
+
+  Attribute operandLayouts = kcall.getOperandLayoutsAttr();
+  ArrayAttr argAttrs = kcall.getArgAttrsAttr();
+  if (!sizeOperands.empty()) {
+    if (auto layouts = dyn_cast_or_null<ArrayAttr>(operandLayouts)) {
+      SmallVector<Attribute> newLayouts = llvm::to_vector(layouts);
+      newLayouts.append(sizeOperands.size(),
+                        DenseIntElementsAttr::get(
+                            RankedTensorType::get({0}, rewriter.getIndexType()),
+                            ArrayRef<int64_t>()));
+      operandLayouts = rewriter.getArrayAttr(newLayouts);
+    }
+    if (argAttrs) {
+      SmallVector<Attribute> newArgAttrs = llvm::to_vector(argAttrs);
+      newArgAttrs.append(sizeOperands.size(), rewriter.getDictionaryAttr({}));
+      argAttrs = rewriter.getArrayAttr(newArgAttrs);
+    }
+  }
+
+  auto replacement = rewriter.create<enzymexla::JITCallOp>(
+      kcall.getLoc(), kcall.getResultTypes(),
+      mlir::FlatSymbolRefAttr::get(kcall.getContext(), callName), inputs,
+      kcall.getBackendConfigAttr(), operandLayouts,
+      kcall.getResultLayoutsAttr(), argAttrs, kcall.getResAttrsAttr(),
+      kcall.getOutputOperandAliasesAttr(), kcall.getXlaSideEffectFreeAttr());
+  kcall.replaceAllUsesWith(replacement);
+  kcall.erase();
+}
+
 bool CompileGPUKernel(SymbolTableCollection &symbolTable, mlir::Location loc,
-                      FunctionOpInterface op, size_t gridx, size_t gridy,
-                      size_t gridz, size_t blockx, size_t blocky, size_t blockz,
-                      size_t shmem, enzymexla::KernelCallOp kcall) {
+                      FunctionOpInterface op, const LaunchSizes &sizes,
+                      KernelCallCache &cache, enzymexla::KernelCallOp kcall) {
+  static constexpr unsigned usedSizes[] = {0, 1, 2, 3, 4, 5, 6};
+  auto key = KernelCallCache::getKey(op, sizes, usedSizes);
+  if (StringRef callName = cache.lookup(key); !callName.empty()) {
+    replaceWithJITCall(kcall, callName, sizes.getRuntimeOperands(usedSizes));
+    return true;
+  }
 
   OpBuilder builder(op);
 
@@ -198,26 +324,61 @@ bool CompileGPUKernel(SymbolTableCollection &symbolTable, mlir::Location loc,
 
   auto idx = builder.getIntegerType(64);
   auto i32 = builder.getIntegerType(32);
+
+  // The runtime sizes live in device memory, copy them to the host. The
+  // copies are synchronous and happen on every launch with dynamic sizes,
+  // since the host needs the sizes to launch the kernel; constant sizes
+  // avoid them.
+  SmallVector<Value> sizeArgs;
+  SmallVector<Value> sizeOperands = addRuntimeSizeArguments(
+      func, sizes, usedSizes, LLVM::LLVMPointerType::get(kcall.getContext(), 1),
+      sizeArgs);
+  auto getSize = [&](unsigned i, Type type) -> Value {
+    if (!sizes.isDynamic(i))
+      return builder.create<arith::ConstantIntOp>(loc, type,
+                                                  sizes.constants[i]);
+    IntegerType sizeType = sizes.getRuntimeType(i);
+    auto deviceSize = builder.create<enzymexla::Pointer2MemrefOp>(
+        loc,
+        MemRefType::get({1}, sizeType, MemRefLayoutAttrInterface{},
+                        builder.getI64IntegerAttr(1)),
+        sizeArgs[i]);
+    auto hostSize =
+        builder.create<memref::AllocaOp>(loc, MemRefType::get({1}, sizeType));
+    builder.create<enzymexla::MemcpyOp>(
+        loc, (mlir::Type) nullptr, ValueRange(), hostSize, deviceSize,
+        builder.create<arith::ConstantIndexOp>(loc, sizeType.getWidth() / 8));
+    Value zero = builder.create<arith::ConstantIndexOp>(loc, 0);
+    Value size = builder.create<memref::LoadOp>(loc, hostSize, zero);
+    unsigned width = type.getIntOrFloatBitWidth();
+    if (sizeType.getWidth() < width)
+      size = builder.create<arith::ExtUIOp>(loc, type, size);
+    else if (sizeType.getWidth() > width)
+      size = builder.create<arith::TruncIOp>(loc, type, size);
+    return size;
+  };
+
   gpu::KernelDim3 gridSize{
-      builder.create<arith::ConstantIntOp>(loc, idx, gridx),
-      builder.create<arith::ConstantIntOp>(loc, idx, gridy),
-      builder.create<arith::ConstantIntOp>(loc, idx, gridz),
+      getSize(0, idx),
+      getSize(1, idx),
+      getSize(2, idx),
   };
 
   gpu::KernelDim3 blockSize{
-      builder.create<arith::ConstantIntOp>(loc, idx, blockx),
-      builder.create<arith::ConstantIntOp>(loc, idx, blocky),
-      builder.create<arith::ConstantIntOp>(loc, idx, blockz),
+      getSize(3, idx),
+      getSize(4, idx),
+      getSize(5, idx),
   };
 
-  auto dynshmem = builder.create<arith::ConstantIntOp>(loc, i32, shmem);
+  auto dynshmem = getSize(LaunchSizes::kShmem, i32);
 
   Value stream = builder.create<enzymexla::GetStreamOp>(
       loc, gpu::AsyncTokenType::get(kcall.getContext()));
 
-  builder.create<gpu::LaunchFuncOp>(loc, gpufunc, gridSize, blockSize, dynshmem,
-                                    entryBlock.getArguments(), stream.getType(),
-                                    ValueRange(stream));
+  builder.create<gpu::LaunchFuncOp>(
+      loc, gpufunc, gridSize, blockSize, dynshmem,
+      entryBlock.getArguments().take_front(gpuTy.getNumInputs()),
+      stream.getType(), ValueRange(stream));
 
   builder.create<mlir::func::ReturnOp>(loc);
 
@@ -226,23 +387,248 @@ bool CompileGPUKernel(SymbolTableCollection &symbolTable, mlir::Location loc,
     op->getParentOp()->setAttr(gpu::GPUDialect::getContainerModuleAttrName(),
                                UnitAttr::get(kcall.getContext()));
 
-  OpBuilder rewriter(kcall);
-  auto replacement = rewriter.create<enzymexla::JITCallOp>(
-      kcall.getLoc(), kcall.getResultTypes(),
-      mlir::FlatSymbolRefAttr::get(kcall.getContext(), callName),
-      kcall.getInputs(), kcall.getBackendConfigAttr(),
-      kcall.getOperandLayoutsAttr(), kcall.getResultLayoutsAttr(),
-      kcall.getArgAttrsAttr(), kcall.getResAttrsAttr(),
-      kcall.getOutputOperandAliasesAttr(), kcall.getXlaSideEffectFreeAttr());
-  kcall.replaceAllUsesWith(replacement);
-  kcall.erase();
+  cache.insert(std::move(key), callName);
+  replaceWithJITCall(kcall, callName, sizeOperands);
   return true;
 };
 
+// Whether `op` may synchronize or exchange data between the threads of a
+// block or warp. Apart from reading special registers such as the thread id,
+// NVVM ops are barriers, warp shuffles, votes, matches and other collectives
+// under names that vary between versions, so all of them are assumed to.
+static bool mayCommunicate(Operation *op) {
+  if (isa<gpu::BarrierOp, gpu::ShuffleOp, gpu::AllReduceOp,
+          gpu::SubgroupReduceOp, LLVM::InlineAsmOp>(op))
+    return true;
+  if (isa<NVVM::NVVMDialect>(op->getDialect()))
+    return !op->getName().getStringRef().starts_with("nvvm.read.ptx.sreg.");
+  if (auto intr = dyn_cast<LLVM::CallIntrinsicOp>(op))
+    return intr.getIntrin().starts_with("llvm.nvvm.");
+  return false;
+}
+
+// Threads of a block that synchronize or exchange registers cannot run one
+// after another within a lane loop. Calls that cannot be resolved, and
+// declarations other than the libdevice math functions, may communicate.
+static bool hasThreadCommunication(SymbolTableCollection &symbolTable,
+                                   FunctionOpInterface op) {
+  SmallVector<Operation *> worklist = {op};
+  SmallPtrSet<Operation *, 4> done;
+  while (!worklist.empty()) {
+    Operation *cur = worklist.pop_back_val();
+    if (!done.insert(cur).second)
+      continue;
+    auto result = cur->walk([&](Operation *nested) {
+      if (mayCommunicate(nested))
+        return WalkResult::interrupt();
+      auto call = dyn_cast<CallOpInterface>(nested);
+      if (!call)
+        return WalkResult::advance();
+      auto callee = dyn_cast_or_null<FunctionOpInterface>(
+          call.resolveCallable(&symbolTable));
+      if (!callee)
+        return WalkResult::interrupt();
+      if (callee.isExternal() && !callee.getName().starts_with("__nv_"))
+        return WalkResult::interrupt();
+      worklist.push_back(callee);
+      return WalkResult::advance();
+    });
+    if (result.wasInterrupted())
+      return true;
+  }
+  return false;
+}
+
+// The dynamic shared memory of a kernel is an unsized shared array, whose
+// size is given at launch.
+static bool isDynamicSharedMemory(LLVM::GlobalOp glob) {
+  auto AT = dyn_cast<LLVM::LLVMArrayType>(glob.getGlobalType());
+  return AT && AT.getNumElements() == 0;
+}
+
+// Collects the barriers and globals in the shared address space used by the
+// kernel `op` and the functions it calls. Records in `blockLocalFns` whether
+// each of those uses them, directly or through its own callees.
+static void collectBlockLocalState(SymbolTableCollection &symbolTable,
+                                   FunctionOpInterface op,
+                                   SmallVectorImpl<LLVM::GlobalOp> &globals,
+                                   bool &hasBarrier,
+                                   DenseMap<Operation *, bool> &blockLocalFns) {
+  SmallVector<FunctionOpInterface> fns = {op};
+  DenseMap<Operation *, SmallVector<Operation *>> callees;
+  blockLocalFns[op] = false;
+  for (size_t i = 0; i < fns.size(); i++) {
+    Operation *fn = fns[i];
+    fn->walk([&](Operation *nested) {
+      if (isa<NVVM::Barrier0Op, gpu::BarrierOp>(nested)) {
+        hasBarrier = blockLocalFns[fn] = true;
+        return;
+      }
+      if (auto addr = dyn_cast<LLVM::AddressOfOp>(nested)) {
+        if (addr.getType().getAddressSpace() != 3)
+          return;
+        if (auto glob = addr.getGlobal(symbolTable)) {
+          if (!llvm::is_contained(globals, glob))
+            globals.push_back(glob);
+          blockLocalFns[fn] = true;
+        }
+        return;
+      }
+      auto call = dyn_cast<CallOpInterface>(nested);
+      if (!call)
+        return;
+      auto callee = dyn_cast_or_null<FunctionOpInterface>(
+          call.resolveCallable(&symbolTable));
+      if (!callee || callee.isExternal())
+        return;
+      callees[fn].push_back(callee);
+      if (blockLocalFns.try_emplace(callee, false).second)
+        fns.push_back(callee);
+    });
+  }
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (Operation *fn : fns) {
+      if (blockLocalFns[fn] || !llvm::any_of(callees[fn], [&](Operation *c) {
+            return blockLocalFns[c];
+          }))
+        continue;
+      blockLocalFns[fn] = changed = true;
+    }
+  }
+}
+
+// Splits the kernel body run by a thread at its barriers, for the phases of
+// the block to run the thread up to its next barrier. The body stops at each
+// barrier, yielding its number, and starts after the barrier `resumeAt`, or
+// yields -1 again without running if the thread already returned. As
+// the values live after a barrier no longer dominate it, they are kept in
+// slots of each thread allocated before the `phases`, stored where they are
+// defined and loaded in the blocks using them.
+static LogicalResult splitAtBarriers(scf::ExecuteRegionOp executeRegion,
+                                     Value resumeAt, Value threadId,
+                                     Value numThreads, scf::WhileOp phases) {
+  Region &body = executeRegion.getRegion();
+  SmallVector<Operation *> barriers;
+  auto result = executeRegion->walk([&](Operation *op) {
+    if (!isa<NVVM::Barrier0Op, gpu::BarrierOp>(op))
+      return WalkResult::advance();
+    if (op->getParentRegion() != &body)
+      return WalkResult::interrupt();
+    barriers.push_back(op);
+    return WalkResult::advance();
+  });
+  if (result.wasInterrupted())
+    return failure();
+
+  Location loc = executeRegion.getLoc();
+  auto i32 = IntegerType::get(loc.getContext(), 32);
+  SmallVector<Block *> resumeBlocks;
+  for (Operation *barrier : barriers) {
+    Block *after = barrier->getBlock()->splitBlock(barrier->getNextNode());
+    OpBuilder rewriter(barrier);
+    Value number = rewriter.create<arith::ConstantIntOp>(
+        barrier->getLoc(), i32, resumeBlocks.size() + 1);
+    rewriter.create<scf::YieldOp>(barrier->getLoc(), number);
+    barrier->erase();
+    resumeBlocks.push_back(after);
+  }
+
+  Liveness liveness(executeRegion);
+  SmallVector<Value> spilled;
+  auto spill = [&](Value value) {
+    if (llvm::any_of(resumeBlocks, [&](Block *block) {
+          return liveness.getLiveIn(block).count(value);
+        }))
+      spilled.push_back(value);
+  };
+  for (Block &block : body) {
+    for (Value arg : block.getArguments())
+      spill(arg);
+    for (Operation &op : block)
+      for (Value res : op.getResults())
+        spill(res);
+  }
+  if (!llvm::all_of(spilled, [](Value value) {
+        return MemRefType::isValidElementType(value.getType());
+      }))
+    return failure();
+
+  OpBuilder slots(phases);
+  for (Value value : spilled) {
+    Value slot = slots.create<memref::AllocaOp>(
+        loc, MemRefType::get({ShapedType::kDynamic}, value.getType()),
+        numThreads);
+    Block *def = value.getParentBlock();
+    auto rewriter = OpBuilder::atBlockBegin(def);
+    if (Operation *defOp = value.getDefiningOp())
+      rewriter.setInsertionPointAfter(defOp);
+    rewriter.create<memref::StoreOp>(loc, value, slot, threadId);
+
+    DenseMap<Block *, Value> loads;
+    for (OpOperand &use : llvm::make_early_inc_range(value.getUses())) {
+      Block *user = body.findAncestorBlockInRegion(*use.getOwner()->getBlock());
+      if (user == def)
+        continue;
+      Value &load = loads[user];
+      if (!load)
+        load = OpBuilder::atBlockBegin(user).create<memref::LoadOp>(
+            loc, slot, threadId);
+      use.set(load);
+    }
+  }
+
+  // Threads that returned in an earlier phase wait for the others.
+  Block *done = new Block();
+  body.push_back(done);
+  auto doneBuilder = OpBuilder::atBlockBegin(done);
+  doneBuilder.create<scf::YieldOp>(
+      loc, ValueRange(doneBuilder.create<arith::ConstantIntOp>(loc, i32, -1)));
+
+  // Dispatch to where the thread stopped from a new entry block.
+  Block *entry = &body.front();
+  Block *dispatch = new Block();
+  body.push_front(dispatch);
+  SmallVector<int32_t> cases = {-1};
+  SmallVector<Block *> destinations = {done};
+  for (auto [i, block] : llvm::enumerate(resumeBlocks)) {
+    cases.push_back(i + 1);
+    destinations.push_back(block);
+  }
+  SmallVector<ValueRange> operands(destinations.size(), ValueRange());
+  OpBuilder::atBlockBegin(dispatch).create<cf::SwitchOp>(
+      loc, resumeAt, entry, ValueRange(), cases, destinations, operands);
+  return success();
+}
+
 bool CompileCPUKernel(SymbolTableCollection &symbolTable, mlir::Location loc,
-                      FunctionOpInterface op, size_t gridx, size_t gridy,
-                      size_t gridz, size_t blockx, size_t blocky, size_t blockz,
-                      size_t shmem, enzymexla::KernelCallOp kcall) {
+                      FunctionOpInterface op, const LaunchSizes &sizes,
+                      size_t vectorWidth, KernelCallCache &cache,
+                      enzymexla::KernelCallOp kcall) {
+  // Globals in the shared address space and barriers are local to a block.
+  // Kernels using them, directly or in their callees, run the threads of each
+  // block in a nested parallel loop, over copies of the shared globals
+  // allocated on the stack for the block.
+  SmallVector<LLVM::GlobalOp> sharedGlobals;
+  bool hasBarrier = false;
+  DenseMap<Operation *, bool> blockLocalFns;
+  collectBlockLocalState(symbolTable, op, sharedGlobals, hasBarrier,
+                         blockLocalFns);
+  bool hasDynamicShared = llvm::any_of(sharedGlobals, isDynamicSharedMemory);
+  bool blockLocal = hasBarrier || !sharedGlobals.empty();
+
+  // Only the grid and block sizes are used on the cpu, and the shared memory
+  // size for kernels with dynamic shared memory.
+  SmallVector<unsigned> usedSizes = {0, 1, 2, 3, 4, 5};
+  if (hasDynamicShared)
+    usedSizes.push_back(LaunchSizes::kShmem);
+  auto key = KernelCallCache::getKey(op, sizes, usedSizes);
+  if (StringRef callName = cache.lookup(key); !callName.empty()) {
+    replaceWithJITCall(kcall, callName, sizes.getRuntimeOperands(usedSizes));
+    return true;
+  }
+
   OpBuilder builder(op);
 
   FunctionType gpuTy0 = dyn_cast<FunctionType>(op.getFunctionType());
@@ -271,88 +657,294 @@ bool CompileCPUKernel(SymbolTableCollection &symbolTable, mlir::Location loc,
   auto &entryBlock = *func.addEntryBlock();
   builder.setInsertionPointToStart(&entryBlock);
 
+  SmallVector<Value> sizeArgs;
+  SmallVector<Value> sizeOperands = addRuntimeSizeArguments(
+      func, sizes, usedSizes, LLVM::LLVMPointerType::get(kcall.getContext()),
+      sizeArgs);
+
+  auto getSize = [&](unsigned i) -> Value {
+    if (!sizes.isDynamic(i))
+      return builder.create<arith::ConstantIndexOp>(loc, sizes.constants[i]);
+    Value size = builder.create<LLVM::LoadOp>(loc, sizes.getRuntimeType(i),
+                                              sizeArgs[i]);
+    return builder.create<arith::IndexCastUIOp>(loc, builder.getIndexType(),
+                                                size);
+  };
+
   SmallVector<mlir::Value> inits;
   SmallVector<mlir::Value> finals;
   SmallVector<mlir::Value> incs;
-  for (auto val : {gridx, gridy, gridz, blockx, blocky, blockz}) {
+  for (unsigned i = 0; i < 6; i++) {
     inits.push_back(builder.create<arith::ConstantIndexOp>(loc, 0));
     incs.push_back(builder.create<arith::ConstantIndexOp>(loc, 1));
-    finals.push_back(builder.create<arith::ConstantIndexOp>(loc, val));
+    finals.push_back(getSize(i));
+  }
+  Value shmemSize;
+  if (hasDynamicShared)
+    shmemSize = getSize(LaunchSizes::kShmem);
+  Value blockx = finals[LaunchSizes::kBlockX];
+
+  // Consecutive threads along x mostly access consecutive addresses. Run
+  // groups of them as the lanes of an innermost loop that LLVM vectorizes,
+  // predicating the lanes past the block size.
+  bool dynamicBlockX = sizes.isDynamic(LaunchSizes::kBlockX);
+  size_t constBlockX = sizes.constants[LaunchSizes::kBlockX];
+  if (vectorWidth > 1 && ((!dynamicBlockX && constBlockX <= 1) ||
+                          hasThreadCommunication(symbolTable, op)))
+    vectorWidth = 0;
+  Value width;
+  if (vectorWidth > 1) {
+    width = builder.create<arith::ConstantIndexOp>(loc, vectorWidth);
+    finals[LaunchSizes::kBlockX] =
+        builder.create<arith::CeilDivUIOp>(loc, blockx, width);
   }
 
   IRMapping map;
-  map.map(op.getArguments(), entryBlock.getArguments());
+  map.map(op.getArguments(),
+          entryBlock.getArguments().take_front(op.getNumArguments()));
 
   auto context = loc.getContext();
-  SmallVector<AffineMap> idMaps, zeroMaps;
-  auto zeroMap = AffineMap::getConstantMap(0, context);
-  zeroMaps.insert(zeroMaps.begin(), 6, zeroMap);
-  for (unsigned i = 0; i < 6; i++) {
-    auto idMap = AffineMap::get(0, 6, getAffineSymbolExpr(i, context));
-    idMaps.push_back(idMap);
-  }
+  auto createParallel = [&](ValueRange ubs, TypeRange resultTypes = {},
+                            ArrayRef<arith::AtomicRMWKind> reductions = {}) {
+    SmallVector<AffineMap> idMaps, zeroMaps;
+    auto zeroMap = AffineMap::getConstantMap(0, context);
+    zeroMaps.insert(zeroMaps.begin(), ubs.size(), zeroMap);
+    for (unsigned i = 0; i < ubs.size(); i++) {
+      auto idMap =
+          AffineMap::get(0, ubs.size(), getAffineSymbolExpr(i, context));
+      idMaps.push_back(idMap);
+    }
 
-  SmallVector<int64_t> steps(6, 1);
-  auto par = builder.create<affine::AffineParallelOp>(
-      loc, TypeRange(), ArrayRef<arith::AtomicRMWKind>(), zeroMaps,
-      ValueRange(), idMaps, finals, steps);
+    SmallVector<int64_t> steps(ubs.size(), 1);
+    auto par = builder.create<affine::AffineParallelOp>(
+        loc, resultTypes, reductions, zeroMaps, ValueRange(), idMaps, ubs,
+        steps);
+    builder.setInsertionPointToStart(&par.getRegion().front());
+    return par;
+  };
 
-  builder.create<mlir::func::ReturnOp>(loc);
+  SmallVector<Value> ids;
+  llvm::StringMap<Value> sharedMems;
+  Value numThreads, threadId, resume, resumeAt;
+  scf::WhileOp phases;
+  if (!blockLocal) {
+    auto par = createParallel(finals);
+    ids = llvm::to_vector(par.getIVs());
+    builder.setInsertionPointAfter(par);
+    builder.create<mlir::func::ReturnOp>(loc);
+    builder.setInsertionPointToStart(&par.getRegion().front());
+  } else {
+    auto blocks = createParallel(ValueRange(finals).take_front(3));
+    llvm::append_range(ids, blocks.getIVs());
+    builder.setInsertionPointAfter(blocks);
+    builder.create<mlir::func::ReturnOp>(loc);
+    builder.setInsertionPointToStart(&blocks.getRegion().front());
 
-  builder.setInsertionPointToStart(&par.getRegion().front());
-  auto executeRegion =
-      builder.create<scf::ExecuteRegionOp>(loc, ArrayRef<mlir::Type>());
+    // Release the shared memory of each block when it is done.
+    auto scope = builder.create<memref::AllocaScopeOp>(loc, TypeRange());
+    builder.createBlock(&scope.getBodyRegion());
+    builder.create<memref::AllocaScopeReturnOp>(loc);
+    builder.setInsertionPointToStart(&scope.getBodyRegion().front());
+
+    auto ptrTy = LLVM::LLVMPointerType::get(context);
+    for (LLVM::GlobalOp glob : sharedGlobals) {
+      Type elType = glob.getGlobalType();
+      Value count;
+      if (isDynamicSharedMemory(glob)) {
+        elType = builder.getI8Type();
+        count = builder.create<arith::IndexCastUIOp>(
+            loc, builder.getI64Type(), shmemSize);
+      } else {
+        count = builder.create<LLVM::ConstantOp>(loc, builder.getI64Type(), 1);
+      }
+      // Shared memory without an alignment is aligned to 16 bytes on device.
+      sharedMems[glob.getSymName()] = builder.create<LLVM::AllocaOp>(
+          loc, ptrTy, elType, count, glob.getAlignment().value_or(16));
+    }
+
+    if (!hasBarrier) {
+      auto threads = createParallel(ValueRange(finals).take_back(3));
+      llvm::append_range(ids, threads.getIVs());
+    } else {
+      // The threads of a block run in phases, each running every thread up to
+      // its next barrier or return. The next phase resumes the threads after
+      // the barrier they stopped at, until all of them returned.
+      auto linearize = [&](ValueRange tids) -> Value {
+        Value id = builder.create<arith::MulIOp>(loc, tids[2], finals[4]);
+        id = builder.create<arith::AddIOp>(loc, id, tids[1]);
+        id = builder.create<arith::MulIOp>(loc, id, finals[3]);
+        return builder.create<arith::AddIOp>(loc, id, tids[0]);
+      };
+      auto i32 = builder.getI32Type();
+      numThreads = builder.create<arith::MulIOp>(
+          loc, builder.create<arith::MulIOp>(loc, finals[3], finals[4]),
+          finals[5]);
+      resume = builder.create<memref::AllocaOp>(
+          loc, MemRefType::get({ShapedType::kDynamic}, i32), numThreads);
+      auto start = createParallel(ValueRange(finals).take_back(3));
+      Value startId = linearize(start.getIVs());
+      builder.create<memref::StoreOp>(
+          loc, builder.create<arith::ConstantIntOp>(loc, i32, 0), resume,
+          startId);
+      builder.setInsertionPointAfter(start);
+
+      phases = builder.create<scf::WhileOp>(loc, TypeRange(), ValueRange());
+      builder.createBlock(&phases.getAfter());
+      builder.create<scf::YieldOp>(loc);
+      builder.createBlock(&phases.getBefore());
+      Type i1 = builder.getI1Type();
+      auto threads = createParallel(ValueRange(finals).take_back(3),
+                                    ArrayRef<Type>(i1),
+                                    arith::AtomicRMWKind::ori);
+      llvm::append_range(ids, threads.getIVs());
+      builder.setInsertionPointAfter(threads);
+      builder.create<scf::ConditionOp>(loc, threads.getResult(0),
+                                       ValueRange());
+
+      builder.setInsertionPointToStart(threads.getBody());
+      threadId = linearize(threads.getIVs());
+      resumeAt = builder.create<memref::LoadOp>(loc, resume, threadId);
+    }
+  }
+  SmallVector<Value> threadIds(ids.begin() + 3, ids.end());
+
+  if (vectorWidth > 1) {
+    auto lanes = builder.create<scf::ForOp>(loc, inits[3], width, incs[3]);
+    auto vectorize = LLVM::LoopVectorizeAttr::get(
+        context, /*disable=*/builder.getBoolAttr(false),
+        /*predicateEnable=*/builder.getBoolAttr(true),
+        /*scalableEnable=*/nullptr,
+        /*width=*/builder.getI32IntegerAttr(vectorWidth),
+        /*followupVectorized=*/nullptr, /*followupEpilogue=*/nullptr,
+        /*followupAll=*/nullptr);
+    lanes->setAttr(LLVM::LLVMDialect::getLoopAnnotationAttrName(),
+                   LLVM::LoopAnnotationAttr::get(
+                       context, /*disableNonforced=*/nullptr, vectorize,
+                       /*interleave=*/nullptr, /*unroll=*/nullptr,
+                       /*unrollAndJam=*/nullptr, /*licm=*/nullptr,
+                       /*distribute=*/nullptr, /*pipeline=*/nullptr,
+                       /*peeled=*/nullptr, /*unswitch=*/nullptr,
+                       /*mustProgress=*/nullptr, /*isVectorized=*/nullptr,
+                       /*startLoc=*/nullptr, /*endLoc=*/nullptr,
+                       /*parallelAccesses=*/{}));
+
+    builder.setInsertionPointToStart(lanes.getBody());
+    ids[3] = builder.create<arith::AddIOp>(
+        loc, builder.create<arith::MulIOp>(loc, threadIds[0], width),
+        lanes.getInductionVar());
+    if (dynamicBlockX || constBlockX % vectorWidth != 0) {
+      auto inBlock = builder.create<arith::CmpIOp>(
+          loc, arith::CmpIPredicate::ult, ids[3], blockx);
+      auto ifOp = builder.create<scf::IfOp>(loc, inBlock);
+      builder.setInsertionPointToStart(ifOp.thenBlock());
+    }
+  }
+  // With barriers, the kernel body returns the number of the barrier the
+  // thread stopped at, or -1 once it returned.
+  SmallVector<Type> stopTypes;
+  if (hasBarrier)
+    stopTypes.push_back(builder.getI32Type());
+  auto executeRegion = builder.create<scf::ExecuteRegionOp>(loc, stopTypes);
 
   op.getFunctionBody().cloneInto(&executeRegion.getRegion(), map);
 
-  executeRegion->walk([](LLVM::ReturnOp op) {
-    OpBuilder rewriter(op);
-    rewriter.create<scf::YieldOp>(op.getLoc());
-    op.erase();
-  });
+  if (hasBarrier) {
+    // Record where each thread stopped, and whether any is still running.
+    Value stopped = executeRegion.getResult(0);
+    builder.create<memref::StoreOp>(loc, stopped, resume, threadId);
+    Value running = builder.create<arith::CmpIOp>(
+        loc, arith::CmpIPredicate::ne, stopped,
+        builder.create<arith::ConstantIntOp>(loc, stopped.getType(), -1));
+    builder.create<affine::AffineYieldOp>(loc, running);
+  }
 
-  executeRegion->walk([](func::ReturnOp op) {
-    OpBuilder rewriter(op);
-    rewriter.create<scf::YieldOp>(op.getLoc());
-    op.erase();
-  });
+  auto fail = [&](const Twine &message) {
+    func.erase();
+    kcall->emitError(message);
+    return false;
+  };
+
+  // Calls to functions using barriers or shared memory are inlined, so that
+  // those are rewritten for the block running them below.
+  for (size_t depth = 0;; depth++) {
+    SmallVector<CallOpInterface> calls;
+    executeRegion->walk([&](CallOpInterface call) {
+      if (blockLocalFns.lookup(call.resolveCallable(&symbolTable)))
+        calls.push_back(call);
+    });
+    if (calls.empty())
+      break;
+    if (depth > blockLocalFns.size())
+      return fail("Cannot lower recursive calls using barriers or shared "
+                  "memory to the cpu");
+    for (CallOpInterface call : calls) {
+      if (call->getParentRegion() != &executeRegion.getRegion())
+        return fail("Cannot lower a call using barriers or shared memory "
+                    "nested in a region to the cpu");
+      auto callee =
+          cast<CallableOpInterface>(call.resolveCallable(&symbolTable));
+      AlwaysInlinerInterface interface(context);
+      if (failed(inlineCall(interface, cloneCallback, call, callee,
+                            callee.getCallableRegion(),
+                            /*shouldCloneInlinedRegion=*/true)))
+        return fail("Failed to inline a call using barriers or shared memory");
+      call->erase();
+    }
+  }
 
-  executeRegion->walk([](LLVM::UnreachableOp op) {
-    OpBuilder rewriter(op);
-    rewriter.create<scf::YieldOp>(op.getLoc());
-    op.erase();
+  auto yieldReturned = [&](Operation *ret) {
+    OpBuilder rewriter(ret);
+    SmallVector<Value> stopped;
+    if (hasBarrier)
+      stopped.push_back(rewriter.create<arith::ConstantIntOp>(
+          ret->getLoc(), rewriter.getI32Type(), -1));
+    rewriter.create<scf::YieldOp>(ret->getLoc(), stopped);
+    ret->erase();
+  };
+  executeRegion->walk([&](LLVM::ReturnOp op) { yieldReturned(op); });
+  executeRegion->walk([&](func::ReturnOp op) { yieldReturned(op); });
+  executeRegion->walk([&](LLVM::UnreachableOp op) { yieldReturned(op); });
+
+  // shared memory
+  executeRegion->walk([&](LLVM::AddressOfOp addrOp) {
+    auto found = sharedMems.find(addrOp.getGlobalName());
+    if (found == sharedMems.end())
+      return;
+    OpBuilder rewriter(addrOp);
+    rewriter.replaceOpWithNewOp<LLVM::AddrSpaceCastOp>(
+        addrOp, addrOp.getType(), found->second);
   });
 
   // block idx
   executeRegion->walk([&](NVVM::BlockIdXOp idxOp) {
     OpBuilder rewriter(idxOp);
     auto rep = rewriter.create<arith::IndexCastUIOp>(
-        op.getLoc(), idxOp.getType(), par.getIVs()[0]);
+        op.getLoc(), idxOp.getType(), ids[0]);
     idxOp.replaceAllUsesWith(rep.getResult());
     idxOp.erase();
   });
   executeRegion->walk([&](NVVM::BlockIdYOp idxOp) {
     OpBuilder rewriter(idxOp);
     auto rep = rewriter.create<arith::IndexCastUIOp>(
-        op.getLoc(), idxOp.getType(), par.getIVs()[1]);
+        op.getLoc(), idxOp.getType(), ids[1]);
     idxOp.replaceAllUsesWith(rep.getResult());
     idxOp.erase();
   });
   executeRegion->walk([&](NVVM::BlockIdZOp idxOp) {
     OpBuilder rewriter(idxOp);
     auto rep = rewriter.create<arith::IndexCastUIOp>(
-        op.getLoc(), idxOp.getType(), par.getIVs()[2]);
+        op.getLoc(), idxOp.getType(), ids[2]);
     idxOp.replaceAllUsesWith(rep.getResult());
     idxOp.erase();
   });
   executeRegion->walk([&](gpu::BlockIdOp idxOp) {
     Value val = nullptr;
     if (idxOp.getDimension() == gpu::Dimension::x)
-      val = par.getIVs()[0];
+      val = ids[0];
     else if (idxOp.getDimension() == gpu::Dimension::y)
-      val = par.getIVs()[1];
+      val = ids[1];
     else if (idxOp.getDimension() == gpu::Dimension::z)
-      val = par.getIVs()[2];
+      val = ids[2];
     else
       llvm_unreachable("illegal dimension");
     idxOp.replaceAllUsesWith(val);
@@ -363,48 +955,45 @@ bool CompileCPUKernel(SymbolTableCollection &symbolTable, mlir::Location loc,
   executeRegion->walk([&](NVVM::ThreadIdXOp idxOp) {
     OpBuilder rewriter(idxOp);
     auto rep = rewriter.create<arith::IndexCastUIOp>(
-        op.getLoc(), idxOp.getType(), par.getIVs()[3]);
+        op.getLoc(), idxOp.getType(), ids[3]);
     idxOp.replaceAllUsesWith(rep.getResult());
     idxOp.erase();
   });
   executeRegion->walk([&](NVVM::ThreadIdYOp idxOp) {
     OpBuilder rewriter(idxOp);
     auto rep = rewriter.create<arith::IndexCastUIOp>(
-        op.getLoc(), idxOp.getType(), par.getIVs()[4]);
+        op.getLoc(), idxOp.getType(), ids[4]);
     idxOp.replaceAllUsesWith(rep.getResult());
     idxOp.erase();
   });
   executeRegion->walk([&](NVVM::ThreadIdZOp idxOp) {
     OpBuilder rewriter(idxOp);
     auto rep = rewriter.create<arith::IndexCastUIOp>(
-        op.getLoc(), idxOp.getType(), par.getIVs()[5]);
+        op.getLoc(), idxOp.getType(), ids[5]);
     idxOp.replaceAllUsesWith(rep.getResult());
     idxOp.erase();
   });
   executeRegion->walk([&](gpu::ThreadIdOp idxOp) {
     Value val = nullptr;
     if (idxOp.getDimension() == gpu::Dimension::x)
-      val = par.getIVs()[3];
+      val = ids[3];
     else if (idxOp.getDimension() == gpu::Dimension::y)
-      val = par.getIVs()[4];
+      val = ids[4];
     else if (idxOp.getDimension() == gpu::Dimension::z)
-      val = par.getIVs()[5];
+      val = ids[5];
     else
       llvm_unreachable("illegal dimension");
     idxOp.replaceAllUsesWith(val);
     idxOp.erase();
   });
 
-  OpBuilder rewriter(kcall);
-  auto replacement = rewriter.create<enzymexla::JITCallOp>(
-      kcall.getLoc(), kcall.getResultTypes(),
-      mlir::FlatSymbolRefAttr::get(kcall.getContext(), callName),
-      kcall.getInputs(), kcall.getBackendConfigAttr(),
-      kcall.getOperandLayoutsAttr(), kcall.getResultLayoutsAttr(),
-      kcall.getArgAttrsAttr(), kcall.getResAttrsAttr(),
-      kcall.getOutputOperandAliasesAttr(), kcall.getXlaSideEffectFreeAttr());
-  kcall.replaceAllUsesWith(replacement);
-  kcall.erase();
+  if (hasBarrier && failed(splitAtBarriers(executeRegion, resumeAt, threadId,
+                                           numThreads, phases)))
+    return fail("Cannot lower a barrier nested in a region, or live across "
+                "one with a type which cannot be stored, to the cpu");
+
+  cache.insert(std::move(key), callName);
+  replaceWithJITCall(kcall, callName, sizeOperands);
   return true;
 };
 
@@ -417,10 +1006,9 @@ struct LowerKernelPass
   void runOnOperation() override {
     SymbolTableCollection symbolTable;
     symbolTable.getSymbolTable(getOperation());
+    KernelCallCache cache;
 
     getOperation()->walk([&](KernelCallOp op) {
-      size_t data[8];
-
       auto *symbolOp = symbolTable.lookupNearestSymbolFrom(op, op.getFnAttr());
       auto fn = cast<FunctionOpInterface>(symbolOp);
       if (fn.getArguments().size() != op.getInputs().size()) {
@@ -433,29 +1021,40 @@ struct LowerKernelPass
       Value vals[] = {op.getGridx(),  op.getGridy(),  op.getGridz(),
                       op.getBlockx(), op.getBlocky(), op.getBlockz(),
                       op.getShmem()};
+      LaunchSizes sizes;
       for (auto en : llvm::enumerate(vals)) {
         DenseIntElementsAttr stepAttr;
         if (!matchPattern(en.value(), m_Constant(&stepAttr))) {
-          op->emitError() << "Cannot lower kernel with a grid/block size which "
-                             "is not a constant integer tensor";
-          return;
+          // Dynamic sizes are loaded from their buffers as whole bytes.
+          auto type = dyn_cast<RankedTensorType>(en.value().getType());
+          auto elemType =
+              type ? dyn_cast<IntegerType>(type.getElementType()) : nullptr;
+          if (!type || !type.hasStaticShape() || type.getNumElements() != 1 ||
+              !elemType || elemType.getWidth() % 8 != 0 ||
+              elemType.getWidth() > 64) {
+            op->emitError() << "Cannot lower kernel with a dynamic grid/block "
+                               "size which is not an integer tensor of size 1 "
+                               "and 8 to 64 bits, got "
+                            << en.value().getType();
+            return;
+          }
+          sizes.runtime[en.index()] = en.value();
+          continue;
         }
         if (stepAttr.size() != 1) {
           op->emitError() << "Cannot lower kernel with a grid/block size which "
                              "is not a constant integer tensor of size 1";
           return;
         }
-        auto val = (*stepAttr.begin()).getZExtValue();
-        data[1 + en.index()] = val;
+        sizes.constants[en.index()] = (*stepAttr.begin()).getZExtValue();
       }
 
       // Compiled kernel goes here once ready
       if (backend == "cuda") {
-        CompileGPUKernel(symbolTable, op.getLoc(), fn, data[1], data[2],
-                         data[3], data[4], data[5], data[6], data[7], op);
+        CompileGPUKernel(symbolTable, op.getLoc(), fn, sizes, cache, op);
       } else if (backend == "cpu") {
-        CompileCPUKernel(symbolTable, op.getLoc(), fn, data[1], data[2],
-                         data[3], data[4], data[5], data[6], data[7], op);
+        CompileCPUKernel(symbolTable, op.getLoc(), fn, sizes, vector_width,
+                         cache, op);
       } else {
         op->emitError() << "Cannot lower kernel to unknown backend \""
                         << backend << "\"";
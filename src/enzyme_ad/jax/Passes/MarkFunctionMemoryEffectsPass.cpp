@@ -1,10 +1,15 @@
 #include "src/enzyme_ad/jax/Passes/Passes.h"
 
 #include "mlir/Analysis/CallGraph.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
 #include "mlir/IR/Builders.h"
 #include "mlir/IR/BuiltinOps.h"
+#include "mlir/Interfaces/CallInterfaces.h"
+#include "mlir/Interfaces/CastInterfaces.h"
 #include "mlir/Interfaces/FunctionInterfaces.h"
 #include "mlir/Pass/Pass.h"
+#include "src/enzyme_ad/jax/Utils.h"
 
 namespace mlir {
 namespace enzyme {
@@ -18,32 +23,85 @@ using namespace mlir::enzyme;
 
 namespace {
 
-enum class VisitState { NotVisited, Visiting, Visited };
+// Effects of a function on the memory reachable through one of its pointer
+// arguments.
+enum ArgEffect : uint8_t {
+  ArgRead = 1,
+  ArgWrite = 2,
+  // The pointer escapes the function (stored, returned, converted to an
+  // integer or passed to an unknown callee).
+  ArgCapture = 4,
+  ArgAll = ArgRead | ArgWrite | ArgCapture,
+};
+
+struct FunctionSummary {
+  // read / write / allocate / free
+  SmallVector<uint8_t, 4> effects = SmallVector<uint8_t, 4>(4, 0);
+  // One ArgEffect mask per function argument.
+  SmallVector<uint8_t> args;
+
+  bool operator==(const FunctionSummary &other) const {
+    return effects == other.effects && args == other.args;
+  }
+};
+
+static bool isPointerLike(Type type) {
+  return isa<BaseMemRefType, LLVM::LLVMPointerType>(type);
+}
+
+// Whether a value of `type` may hold a pointer, e.g. a memref descriptor
+// struct built with llvm.insertvalue.
+static bool mayHoldPointer(Type type) {
+  if (auto vectorType = dyn_cast<VectorType>(type))
+    return isPointerLike(vectorType.getElementType());
+  return isPointerLike(type) ||
+         isa<LLVM::LLVMStructType, LLVM::LLVMArrayType, TupleType>(type);
+}
 
 struct MarkFunctionMemoryEffectsPass
     : public enzyme::impl::MarkFunctionMemoryEffectsPassBase<
           MarkFunctionMemoryEffectsPass> {
   using Base::Base;
 
-  DenseMap<CallGraphNode *, VisitState> visitState;
-  SmallVector<CallGraphNode *> topoOrder;
+  DenseMap<SymbolRefAttr, FunctionSummary> summaries;
+  DenseMap<Operation *, SmallVector<uint8_t, 4>> directEffects;
+
+  // Tarjan's SCC state. SCCs are emitted callees first.
+  DenseMap<CallGraphNode *, unsigned> nodeIndex;
+  DenseMap<CallGraphNode *, unsigned> lowLink;
+  SmallVector<CallGraphNode *> sccStack;
+  DenseSet<CallGraphNode *> onStack;
+  SmallVector<SmallVector<CallGraphNode *>> sccs;
+
+  void strongConnect(CallGraphNode *node) {
+    unsigned index = nodeIndex.size();
+    nodeIndex[node] = index;
+    lowLink[node] = index;
+    sccStack.push_back(node);
+    onStack.insert(node);
 
-  bool dfs(CallGraphNode *node) {
-    auto it = visitState.find(node);
-    if (it != visitState.end()) {
-      if (it->second == VisitState::Visiting)
-        return true; // cycle detected
-      return false;
-    }
-    visitState[node] = VisitState::Visiting;
     for (auto &edge : *node) {
       CallGraphNode *target = edge.getTarget();
-      if (dfs(target))
-        return true;
+      if (!nodeIndex.count(target)) {
+        strongConnect(target);
+        unsigned targetLow = lowLink[target];
+        lowLink[node] = std::min(lowLink[node], targetLow);
+      } else if (onStack.contains(target)) {
+        unsigned targetIndex = nodeIndex[target];
+        lowLink[node] = std::min(lowLink[node], targetIndex);
+      }
     }
-    visitState[node] = VisitState::Visited;
-    topoOrder.push_back(node);
-    return false;
+
+    if (lowLink[node] != nodeIndex[node])
+      return;
+
+    auto &scc = sccs.emplace_back();
+    CallGraphNode *member;
+    do {
+      member = sccStack.pop_back_val();
+      onStack.erase(member);
+      scc.push_back(member);
+    } while (member != node);
   }
 
   void
@@ -73,156 +131,256 @@ struct MarkFunctionMemoryEffectsPass
     }
   }
 
-  int64_t getNumEffects(SmallVector<uint8_t, 4> &effects) {
-    int64_t numEffects = 0;
-    for (int i = 0; i < effects.size(); i++) {
-      if (effects[i])
-        numEffects++;
-    }
-    return numEffects;
-  }
-
-  void runOnOperation() override {
-    ModuleOp module = getOperation();
-    auto *ctx = module->getContext();
-    OpBuilder builder(ctx);
+  // Effects of the operations in `funcOp` itself, ignoring what its callees
+  // do.
+  SmallVector<uint8_t, 4> collectDirectEffects(FunctionOpInterface funcOp) {
+    SmallVector<uint8_t, 4> effects(4, 0);
+
+    funcOp.walk([&](Operation *op) {
+      if (op->hasTrait<OpTrait::HasRecursiveMemoryEffects>()) {
+        auto maybeEffects = getEffectsRecursively(op);
+        if (maybeEffects.has_value()) {
+          insertMemoryEffects(effects, maybeEffects.value());
+        } else {
+          insertMemoryEffects(effects);
+        }
 
-    DenseMap<SymbolRefAttr, SmallVector<uint8_t, 4>> funcEffects;
+        return WalkResult::skip();
+      }
 
-    CallGraph callGraph(module);
+      if (auto memOp = dyn_cast<MemoryEffectOpInterface>(op)) {
+        SmallVector<MemoryEffects::EffectInstance> memEffects;
+        memOp.getEffects(memEffects);
+        insertMemoryEffects(effects, memEffects);
+      } else if (!assume_no_memory_effects) { // Operation doesn't define
+                                              // memory effects
+        insertMemoryEffects(effects);
+      }
 
-    bool hasCycle = false;
-    for (CallGraphNode *node : callGraph) {
-      if (!visitState.count(node))
-        hasCycle |= dfs(node);
-    }
+      return WalkResult::advance();
+    });
 
-    // First pass: collect direct effects
-    for (CallGraphNode *node : topoOrder) {
-      if (node->isExternal())
-        continue;
+    return effects;
+  }
 
-      Region *region = node->getCallableRegion();
-      if (!region)
-        return signalPassFailure();
+  // Effects of `use` on the memory its value points to. Values derived from
+  // the pointer without touching memory are appended to `derived`.
+  uint8_t summarizeUse(OpOperand &use, SmallVectorImpl<Value> &derived) {
+    Operation *user = use.getOwner();
+    Value value = use.get();
+
+    if (auto callOp = dyn_cast<CallOpInterface>(user)) {
+      auto symRef = dyn_cast<SymbolRefAttr>(callOp.getCallableForCallee());
+      auto argOperands = callOp.getArgOperands();
+      unsigned operandNumber = use.getOperandNumber();
+      if (!symRef || argOperands.empty() ||
+          operandNumber < argOperands.getBeginOperandIndex() ||
+          operandNumber >=
+              argOperands.getBeginOperandIndex() + argOperands.size())
+        return ArgAll;
+
+      unsigned argNumber = operandNumber - argOperands.getBeginOperandIndex();
+      auto found = summaries.find(symRef);
+      if (found != summaries.end() && argNumber < found->second.args.size())
+        return found->second.args[argNumber];
+      if (getNonCapturingFunctions().count(
+              symRef.getLeafReference().getValue().str()))
+        return ArgRead | ArgWrite;
+      return ArgAll;
+    }
 
-      Operation *parentOp = region->getParentOp();
-      auto funcOp = dyn_cast<FunctionOpInterface>(parentOp);
-      if (!funcOp)
-        return signalPassFailure();
+    if (isa<LLVM::PtrToIntOp, memref::ExtractAlignedPointerAsIndexOp>(user))
+      return ArgCapture;
 
-      SmallVector<uint8_t, 4> effects(4, 0);
+    auto memOp = dyn_cast<MemoryEffectOpInterface>(user);
+    if (!memOp) {
+      if (assume_no_memory_effects &&
+          !user->hasTrait<OpTrait::HasRecursiveMemoryEffects>())
+        return ArgCapture;
+      return ArgAll;
+    }
 
-      funcOp.walk([&](Operation *op) {
-        if (op->hasTrait<OpTrait::HasRecursiveMemoryEffects>()) {
-          auto maybeEffects = getEffectsRecursively(op);
-          if (maybeEffects.has_value()) {
-            insertMemoryEffects(effects, maybeEffects.value());
-          } else {
-            insertMemoryEffects(effects);
-          }
+    SmallVector<MemoryEffects::EffectInstance> memEffects;
+    memOp.getEffects(memEffects);
 
-          return WalkResult::skip();
-        }
+    if (memEffects.empty()) {
+      if (user->hasTrait<OpTrait::IsTerminator>()) {
+        if (user->hasTrait<OpTrait::ReturnLike>() &&
+            isa<FunctionOpInterface>(user->getParentOp()))
+          return ArgCapture;
+        // Forwarded into another block or region, which we don't follow.
+        return ArgAll;
+      }
+      // Views, casts, pointer arithmetic and aggregates holding the pointer.
+      // A cast to a type which cannot hold a pointer, like ptrtoint, hides
+      // it from us.
+      uint8_t effects = 0;
+      for (Value result : user->getResults()) {
+        if (mayHoldPointer(result.getType()))
+          derived.push_back(result);
+        else if (isa<CastOpInterface>(user))
+          effects = ArgCapture;
+      }
+      return effects;
+    }
 
-        if (auto memOp = dyn_cast<MemoryEffectOpInterface>(op)) {
-          SmallVector<MemoryEffects::EffectInstance> memEffects;
-          memOp.getEffects(memEffects);
-          insertMemoryEffects(effects, memEffects);
-        } else if (!assume_no_memory_effects) { // Operation doesn't define
-                                                // memory effects
-          insertMemoryEffects(effects);
-        }
+    uint8_t result = 0;
+    bool accessesValue = false;
+    for (auto &effect : memEffects) {
+      Value target = effect.getValue();
+      if (target && target != value)
+        continue;
+      if (!target)
+        result |= ArgCapture;
+      else
+        accessesValue = true;
+
+      if (isa<MemoryEffects::Read>(effect.getEffect()))
+        result |= ArgRead;
+      else if (isa<MemoryEffects::Write>(effect.getEffect()))
+        result |= ArgWrite;
+      else
+        result |= ArgRead | ArgWrite;
+    }
 
-        return WalkResult::advance();
-      });
+    // The pointer is an operand, but not the memory being accessed, e.g. the
+    // value of a store.
+    if (!accessesValue)
+      result |= ArgCapture;
+    return result;
+  }
 
-      funcEffects[SymbolRefAttr::get(funcOp.getOperation())] =
-          std::move(effects);
+  uint8_t summarizeArgument(BlockArgument arg) {
+    uint8_t result = 0;
+    SmallVector<Value> todo = {arg};
+    DenseSet<Value> seen;
+    while (!todo.empty()) {
+      Value value = todo.pop_back_val();
+      if (!seen.insert(value).second)
+        continue;
+      for (OpOperand &use : value.getUses()) {
+        result |= summarizeUse(use, todo);
+        if (result == ArgAll)
+          return result;
+      }
     }
+    return result;
+  }
 
-    auto propagate = [&](FunctionOpInterface funcOp,
-                         SmallVector<uint8_t, 4> &effects) {
-      funcOp.walk([&](Operation *op) {
-        if (auto callOp = dyn_cast<CallOpInterface>(op)) {
-          if (auto calleeAttr = callOp.getCallableForCallee()) {
-            if (auto symRef = dyn_cast<SymbolRefAttr>(calleeAttr)) {
-
-              auto funcEffectsSymRef = funcEffects.lookup(symRef);
-              for (int i = 0; i < funcEffectsSymRef.size(); i++) {
-                if (funcEffectsSymRef[i])
-                  effects[i] = 1;
-              }
-            }
-          }
-        }
-      });
-    };
-
-    if (hasCycle) {
-      // Cycles: fixpoint iterate
-      bool changed = true;
-      int32_t iteration = 0;
-      while (changed && iteration < max_iterations) {
-        changed = false;
-        iteration++;
+  FunctionSummary summarize(FunctionOpInterface funcOp) {
+    FunctionSummary summary;
+    summary.effects = directEffects[funcOp];
+
+    funcOp.walk([&](CallOpInterface callOp) {
+      auto symRef = dyn_cast<SymbolRefAttr>(callOp.getCallableForCallee());
+      if (!symRef)
+        return;
+      auto found = summaries.find(symRef);
+      if (found == summaries.end())
+        return;
+      for (int i = 0; i < found->second.effects.size(); i++) {
+        if (found->second.effects[i])
+          summary.effects[i] = 1;
+      }
+    });
+
+    summary.args.resize(funcOp.getNumArguments(), 0);
+    if (funcOp.isExternal())
+      return summary;
+    for (BlockArgument arg : funcOp.getArguments()) {
+      if (isPointerLike(arg.getType()))
+        summary.args[arg.getArgNumber()] = summarizeArgument(arg);
+    }
+    return summary;
+  }
 
-        for (CallGraphNode *node : llvm::reverse(topoOrder)) {
-          if (node->isExternal())
-            continue;
+  void runOnOperation() override {
+    ModuleOp module = getOperation();
+    auto *ctx = module->getContext();
+    OpBuilder builder(ctx);
 
-          Region *region = node->getCallableRegion();
-          if (!region)
-            continue;
+    summaries.clear();
+    directEffects.clear();
+    nodeIndex.clear();
+    lowLink.clear();
+    sccs.clear();
 
-          Operation *parentOp = region->getParentOp();
-          auto funcOp = dyn_cast<FunctionOpInterface>(parentOp);
-          if (!funcOp)
-            continue;
+    CallGraph callGraph(module);
 
-          auto &effects =
-              funcEffects[SymbolRefAttr::get(ctx, funcOp.getName())];
-          size_t before = getNumEffects(effects);
-          propagate(funcOp, effects);
-          changed = getNumEffects(effects) != before;
-        }
-      }
+    for (CallGraphNode *node : callGraph) {
+      if (!nodeIndex.count(node))
+        strongConnect(node);
+    }
 
-      // At this point if we haven't converged, we assume effects for all
-      if (changed) {
-        for (auto &[symbol, effects] : funcEffects)
-          insertMemoryEffects(effects);
-      }
-    } else {
-      // No cycles: reverse topological order and propagate
-      for (CallGraphNode *node : llvm::reverse(topoOrder)) {
+    for (auto &scc : sccs) {
+      SmallVector<FunctionOpInterface> funcs;
+      bool recursive = scc.size() > 1;
+      for (CallGraphNode *node : scc) {
         if (node->isExternal())
           continue;
 
         Region *region = node->getCallableRegion();
         if (!region)
-          continue;
+          return signalPassFailure();
 
         Operation *parentOp = region->getParentOp();
         auto funcOp = dyn_cast<FunctionOpInterface>(parentOp);
         if (!funcOp)
-          continue;
+          return signalPassFailure();
+
+        for (auto &edge : *node)
+          recursive |= edge.getTarget() == node;
+
+        directEffects[funcOp] = collectDirectEffects(funcOp);
+        // Members of a recursive SCC start from the optimistic summary that
+        // only contains their own effects and are refined below.
+        FunctionSummary initial;
+        initial.effects = directEffects[funcOp];
+        initial.args.resize(funcOp.getNumArguments(), 0);
+        summaries[SymbolRefAttr::get(funcOp.getOperation())] =
+            std::move(initial);
+        funcs.push_back(funcOp);
+      }
 
-        auto &effects = funcEffects[SymbolRefAttr::get(ctx, funcOp.getName())];
-        propagate(funcOp, effects);
+      // Summaries only ever grow, so this converges. Give up and assume the
+      // worst if it takes more than max_iterations rounds.
+      bool changed = true;
+      int32_t iteration = 0;
+      while (changed && iteration < max_iterations) {
+        changed = false;
+        iteration++;
+        for (auto funcOp : funcs) {
+          auto &current = summaries[SymbolRefAttr::get(funcOp.getOperation())];
+          FunctionSummary updated = summarize(funcOp);
+          if (updated == current)
+            continue;
+          current = std::move(updated);
+          changed = true;
+        }
+        if (!recursive)
+          changed = false;
+      }
+
+      if (changed) {
+        for (auto funcOp : funcs) {
+          auto &summary = summaries[SymbolRefAttr::get(funcOp.getOperation())];
+          insertMemoryEffects(summary.effects);
+          for (auto &arg : summary.args)
+            arg = ArgAll;
+        }
       }
     }
 
     // Finally, attach attributes
-    for (auto &[symbol, effectsSet] : funcEffects) {
+    for (auto &[symbol, summary] : summaries) {
       auto funcOp = dyn_cast_or_null<FunctionOpInterface>(
           module.lookupSymbol(symbol.getLeafReference()));
       if (!funcOp)
         continue;
 
       SmallVector<Attribute> effectsAttrs;
-      for (int i = 0; i < effectsSet.size(); i++) {
-        if (effectsSet[i]) {
+      for (int i = 0; i < summary.effects.size(); i++) {
+        if (summary.effects[i]) {
           if (i == 0) {
             effectsAttrs.push_back(builder.getStringAttr("read"));
           } else if (i == 1) {
@@ -239,6 +397,31 @@ struct MarkFunctionMemoryEffectsPass
 
       funcOp->setAttr("enzymexla.memory_effects",
                       builder.getArrayAttr(effectsAttrs));
+
+      if (funcOp.isExternal())
+        continue;
+
+      for (BlockArgument arg : funcOp.getArguments()) {
+        if (!isPointerLike(arg.getType()))
+          continue;
+
+        unsigned argNumber = arg.getArgNumber();
+        uint8_t argEffects = summary.args[argNumber];
+
+        SmallVector<Attribute> argEffectsAttrs;
+        if (argEffects & ArgRead)
+          argEffectsAttrs.push_back(builder.getStringAttr("read"));
+        if (argEffects & ArgWrite)
+          argEffectsAttrs.push_back(builder.getStringAttr("write"));
+        funcOp.setArgAttr(argNumber, "enzymexla.memory_effects",
+                          builder.getArrayAttr(argEffectsAttrs));
+
+        if (argEffects & ArgCapture)
+          funcOp.removeArgAttr(argNumber, "enzymexla.nocapture");
+        else
+          funcOp.setArgAttr(argNumber, "enzymexla.nocapture",
+                            builder.getUnitAttr());
+      }
     }
   }
 };
@@ -27,6 +27,7 @@
 #include "src/enzyme_ad/jax/Dialect/Ops.h"
 #include "src/enzyme_ad/jax/Passes/Passes.h"
 #include "src/enzyme_ad/jax/Utils.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include <algorithm>
@@ -1925,9 +1926,50 @@ std::vector<std::vector<Offset>> getLastStored(mlir::Value AI) {
   return todo;
 }
 
+// The users of a candidate for promotion, looking through casts. Promotion
+// of a candidate only depends on its users and the memory effects in its
+// parent, so it is not attempted again until these users change.
+static SmallVector<Operation *> getUsersThroughCasts(mlir::Value AI) {
+  SmallVector<Operation *> users;
+  std::deque<mlir::Value> list = {AI};
+  while (list.size()) {
+    auto val = list.front();
+    list.pop_front();
+    for (auto *U : val.getUsers()) {
+      users.push_back(U);
+      if (isa<memref::CastOp, Memref2PointerOp, Pointer2MemrefOp>(U))
+        list.push_back(U->getResult(0));
+    }
+  }
+  return users;
+}
+
 void PolygeistMem2Reg::runOnOperation() {
   auto *f = getOperation();
 
+  // Promotion does not create new candidates, so collect them once.
+  SmallVector<mlir::Value> candidates, allocs, llvmAllocas, globals;
+  f->walk([&](Operation *op) {
+    if (isa<memref::AllocaOp>(op))
+      candidates.push_back(op->getResult(0));
+    else if (isa<memref::AllocOp>(op))
+      allocs.push_back(op->getResult(0));
+    else if (isa<LLVM::AllocaOp>(op))
+      llvmAllocas.push_back(op->getResult(0));
+    else if (isa<memref::GetGlobalOp>(op))
+      globals.push_back(op->getResult(0));
+  });
+  candidates.append(allocs);
+  candidates.append(llvmAllocas);
+  candidates.append(globals);
+
+  // The users of candidates that were last attempted without any change.
+  DenseMap<mlir::Value, SmallVector<Operation *>> settledUsers;
+
+  // The operations which may write to captured candidates. Promotion only
+  // erases such operations, so they are kept across iterations.
+  DenseMap<Operation *, SmallVector<Operation *>> capturedAliasing;
+
   // Variable indicating that a memref has had a load removed
   // and or been deleted. Because there can be memrefs of
   // memrefs etc, we may need to do multiple passes (first
@@ -1942,31 +1984,26 @@ void PolygeistMem2Reg::runOnOperation() {
     // Load op's whose results were replaced by those forwarded from stores.
     SmallVector<Operation *, 8> loadOpsToErase;
 
+    // Operations erased in this iteration, to drop from the caches.
+    DenseSet<Operation *> erasedOps;
+    DenseSet<mlir::Value> erasedCandidates;
+
     // Walk all load's and perform store to load forwarding.
     SmallVector<mlir::Value, 4> toPromote;
-    f->walk([&](mlir::memref::AllocaOp AI) {
-      if (isPromotable(AI)) {
-        toPromote.push_back(AI);
-      }
-    });
-    f->walk([&](mlir::memref::AllocOp AI) {
-      if (isPromotable(AI)) {
-        toPromote.push_back(AI);
-      }
-    });
-    f->walk([&](LLVM::AllocaOp AI) {
-      if (isPromotable(AI)) {
-        toPromote.push_back(AI);
-      }
-    });
-    f->walk([&](memref::GetGlobalOp AI) {
+    for (auto AI : candidates) {
+      auto settled = settledUsers.find(AI);
+      if (settled != settledUsers.end() &&
+          settled->second == getUsersThroughCasts(AI))
+        continue;
       if (isPromotable(AI)) {
         toPromote.push_back(AI);
+      } else {
+        settledUsers[AI] = getUsersThroughCasts(AI);
       }
-    });
-    DenseMap<Operation *, SmallVector<Operation *>> capturedAliasing;
+    }
     for (auto AI : toPromote) {
       LLVM_DEBUG(llvm::dbgs() << " attempting to promote " << AI << "\n");
+      bool promoted = false;
       auto lastStored = getLastStored(AI);
       for (const auto &vec : lastStored) {
         LLVM_DEBUG(llvm::dbgs() << " + forwarding vec to promote {";
@@ -1976,11 +2013,16 @@ void PolygeistMem2Reg::runOnOperation() {
                    llvm::dbgs() << "} of " << AI << "\n");
         // llvm::errs() << " PRE " << AI << "\n";
         // f.dump();
-        changed |=
+        promoted |=
             forwardStoreToLoad(AI, vec, loadOpsToErase, capturedAliasing);
         // llvm::errs() << " POST " << AI << "\n";
         // f.dump();
       }
+      changed |= promoted;
+      if (promoted)
+        settledUsers.erase(AI);
+      else
+        settledUsers[AI] = getUsersThroughCasts(AI);
       if (!AI.getDefiningOp<memref::GetGlobalOp>())
         memrefsToErase.insert(AI);
     }
@@ -1988,6 +2030,7 @@ void PolygeistMem2Reg::runOnOperation() {
     // Erase all load op's whose results were replaced with store fwd'ed ones.
     for (auto *loadOp : loadOpsToErase) {
       changed = true;
+      erasedOps.insert(loadOp);
       loadOp->erase();
     }
 
@@ -2054,13 +2097,34 @@ void PolygeistMem2Reg::runOnOperation() {
       if (!error) {
         std::reverse(toErase.begin(), toErase.end());
         for (auto *user : toErase) {
+          erasedOps.insert(user);
           user->erase();
         }
+        erasedOps.insert(defOp);
+        erasedCandidates.insert(memref);
+        settledUsers.erase(memref);
         defOp->erase();
         changed = true;
       } else {
         // llvm::errs() << " failed to remove: " << memref << "\n";
       }
     }
+
+    llvm::erase_if(candidates,
+                   [&](mlir::Value AI) { return erasedCandidates.count(AI); });
+
+    // Captured candidates may be promotable once writes they alias with are
+    // gone.
+    for (auto &[AIOp, effects] : capturedAliasing) {
+      if (erasedOps.count(AIOp))
+        continue;
+      size_t numEffects = effects.size();
+      llvm::erase_if(effects,
+                     [&](Operation *op) { return erasedOps.count(op); });
+      if (effects.size() != numEffects)
+        settledUsers.erase(AIOp->getResult(0));
+    }
+    for (auto *op : erasedOps)
+      capturedAliasing.erase(op);
   } while (changed);
 }
@@ -0,0 +1,258 @@
+//===- Rematerialization.cpp - Recompute cheap values to cap peak memory --===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a pass lowering the memory live at once in stablehlo
+// functions. Cheap producers such as broadcasts, iotas and elementwise chains
+// of function arguments, whose results stay live across the point of peak
+// memory, are computed again right before their late consumers.
+//
+//===----------------------------------------------------------------------===//
+
+#include "src/enzyme_ad/jax/Passes/Passes.h"
+
+#include "stablehlo/dialect/StablehloOps.h"
+
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/IRMapping.h"
+#include "mlir/IR/Matchers.h"
+#include "mlir/Interfaces/FunctionInterfaces.h"
+#include "mlir/Interfaces/SideEffectInterfaces.h"
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SetVector.h"
+
+#define DEBUG_TYPE "enzyme-hlo-remat"
+
+namespace mlir {
+namespace enzyme {
+#define GEN_PASS_DEF_REMATERIALIZATIONPASS
+#include "src/enzyme_ad/jax/Passes/Passes.h.inc"
+} // namespace enzyme
+} // namespace mlir
+
+using namespace mlir;
+using namespace mlir::enzyme;
+
+namespace {
+
+// Longest chain of producers recomputed for a single value.
+constexpr unsigned kMaxChainDepth = 8;
+
+static int64_t getSizeInBytes(Type type) {
+  auto tensorType = dyn_cast<RankedTensorType>(type);
+  if (!tensorType || !tensorType.hasStaticShape())
+    return 0;
+  Type elementType = tensorType.getElementType();
+  int64_t bits = 1;
+  if (auto complexType = dyn_cast<ComplexType>(elementType)) {
+    bits = 2;
+    elementType = complexType.getElementType();
+  }
+  bits *= elementType.isIntOrFloat() ? elementType.getIntOrFloatBitWidth() : 8;
+  return tensorType.getNumElements() * ((bits + 7) / 8);
+}
+
+// Function arguments are owned by the caller and constants are part of the
+// executable, so neither counts towards the live memory of a function.
+static bool isCounted(Value value) {
+  return !isa<BlockArgument>(value) && !matchPattern(value, m_Constant());
+}
+
+static bool isRematerializable(Operation *op) {
+  if (op->getNumResults() != 1 || op->getNumRegions() != 0 ||
+      !isa<stablehlo::StablehloDialect>(op->getDialect()) ||
+      !isMemoryEffectFree(op))
+    return false;
+  return op->hasTrait<OpTrait::Elementwise>() ||
+         isa<stablehlo::BroadcastInDimOp, stablehlo::IotaOp,
+             stablehlo::ReshapeOp>(op);
+}
+
+// Live ranges of the values defined in a block, in positions of the ops of
+// the block. Values are live from the op defining them to the op containing
+// their last use, and ops with regions count as a single step.
+class BlockLiveness {
+public:
+  explicit BlockLiveness(Block &block) {
+    for (Operation &op : block) {
+      positions[&op] = ops.size();
+      ops.push_back(&op);
+    }
+
+    SmallVector<int64_t> delta(ops.size() + 1, 0);
+    for (Operation *op : ops) {
+      for (Value result : op->getResults()) {
+        if (!isCounted(result))
+          continue;
+        int64_t def = positions[op], last = def;
+        for (Operation *user : result.getUsers())
+          if (Operation *ancestor = block.findAncestorOpInBlock(*user))
+            last = std::max(last, positions[ancestor]);
+        int64_t size = getSizeInBytes(result.getType());
+        delta[def] += size;
+        delta[last + 1] -= size;
+        lastUse[result] = last;
+      }
+    }
+
+    int64_t live = 0;
+    for (int64_t pos = 0, e = ops.size(); pos < e; pos++) {
+      live += delta[pos];
+      if (live > peak) {
+        peak = live;
+        peakPosition = pos;
+      }
+    }
+  }
+
+  int64_t getPeak() const { return peak; }
+  int64_t getPeakPosition() const { return peakPosition; }
+  ArrayRef<Operation *> getOps() const { return ops; }
+  int64_t getPosition(Operation *op) const { return positions.lookup(op); }
+
+  bool isLiveAt(Value value, int64_t pos) const {
+    auto it = lastUse.find(value);
+    if (it == lastUse.end())
+      return false;
+    return getPosition(value.getDefiningOp()) <= pos && it->second >= pos;
+  }
+
+private:
+  SmallVector<Operation *> ops;
+  DenseMap<Operation *, int64_t> positions;
+  DenseMap<Value, int64_t> lastUse;
+  int64_t peak = 0;
+  int64_t peakPosition = -1;
+};
+
+// Collects the producers to recompute for `value` after `pos`, operands first,
+// into `chain`. Returns the bytes of the values that are not live at `pos`
+// yet have to stay live until the recomputation.
+static int64_t collectChain(Value value, const BlockLiveness &liveness,
+                            int64_t pos, unsigned depth,
+                            llvm::SetVector<Operation *> &chain,
+                            DenseSet<Value> &leaves) {
+  Operation *op = value.getDefiningOp();
+  int64_t cost = 0;
+  for (Value operand : op->getOperands()) {
+    if (!isCounted(operand) || liveness.isLiveAt(operand, pos) ||
+        chain.contains(operand.getDefiningOp()) || leaves.contains(operand))
+      continue;
+    Operation *def = operand.getDefiningOp();
+    if (def && depth < kMaxChainDepth && isRematerializable(def) &&
+        def->getBlock() == op->getBlock()) {
+      cost += collectChain(operand, liveness, pos, depth + 1, chain, leaves);
+      continue;
+    }
+    leaves.insert(operand);
+    cost += getSizeInBytes(operand.getType());
+  }
+  chain.insert(op);
+  return cost;
+}
+
+// Recomputes values live across the peak of `block` before their uses after
+// it, as long as this lowers the peak, until it is at most `budget` bytes.
+// Returns the number of recomputed values.
+static unsigned rematerialize(Block &block, int64_t budget) {
+  unsigned numRematerialized = 0;
+  DenseSet<Value> unprofitable;
+  while (true) {
+    BlockLiveness liveness(block);
+    if (liveness.getPeak() <= budget)
+      break;
+    int64_t peakPos = liveness.getPeakPosition();
+
+    // Pick the value whose recomputation frees the most bytes at the peak.
+    Value best;
+    Operation *bestUser = nullptr;
+    llvm::SetVector<Operation *> bestChain;
+    int64_t bestBenefit = 0;
+    for (Operation *op : liveness.getOps().take_front(peakPos)) {
+      if (!isRematerializable(op))
+        continue;
+      Value value = op->getResult(0);
+      if (unprofitable.contains(value) || !liveness.isLiveAt(value, peakPos))
+        continue;
+
+      Operation *firstLateUser = nullptr;
+      bool usedAtPeak = false;
+      for (Operation *user : value.getUsers()) {
+        Operation *ancestor = block.findAncestorOpInBlock(*user);
+        int64_t pos = liveness.getPosition(ancestor);
+        usedAtPeak |= pos == peakPos;
+        if (pos > peakPos && (!firstLateUser ||
+                              pos < liveness.getPosition(firstLateUser)))
+          firstLateUser = ancestor;
+      }
+      if (usedAtPeak || !firstLateUser)
+        continue;
+
+      llvm::SetVector<Operation *> chain;
+      DenseSet<Value> leaves;
+      int64_t benefit =
+          getSizeInBytes(value.getType()) -
+          collectChain(value, liveness, peakPos, 0, chain, leaves);
+      if (benefit > bestBenefit) {
+        best = value;
+        bestUser = firstLateUser;
+        bestChain = std::move(chain);
+        bestBenefit = benefit;
+      }
+    }
+    if (!best)
+      break;
+
+    OpBuilder builder(bestUser);
+    IRMapping mapping;
+    for (Operation *op : bestChain)
+      builder.clone(*op, mapping);
+    Value recomputed = mapping.lookup(best);
+    best.replaceUsesWithIf(recomputed, [&](OpOperand &use) {
+      Operation *ancestor = block.findAncestorOpInBlock(*use.getOwner());
+      return liveness.getPosition(ancestor) > peakPos;
+    });
+
+    // The recomputed values may raise the memory live at the late uses
+    // above the old peak.
+    if (BlockLiveness(block).getPeak() < liveness.getPeak()) {
+      numRematerialized++;
+      continue;
+    }
+    recomputed.replaceAllUsesWith(best);
+    for (Operation *op : llvm::reverse(bestChain))
+      mapping.lookup(op)->erase();
+    unprofitable.insert(best);
+  }
+  return numRematerialized;
+}
+
+struct RematerializationPass
+    : public enzyme::impl::RematerializationPassBase<RematerializationPass> {
+  using RematerializationPassBase::RematerializationPassBase;
+
+  void runOnOperation() override {
+    bool changed = false;
+    getOperation()->walk([&](FunctionOpInterface func) {
+      if (func.isExternal() || !llvm::hasSingleElement(func.getFunctionBody()))
+        return;
+      Block &block = func.getFunctionBody().front();
+      int64_t peakBefore = BlockLiveness(block).getPeak();
+      unsigned numChanged = budget > 0 ? rematerialize(block, budget) : 0;
+      numRematerialized += numChanged;
+      changed |= numChanged != 0;
+      if (report)
+        func->emitRemark() << "peak live bytes: " << peakBefore << " -> "
+                           << BlockLiveness(block).getPeak();
+    });
+    if (!changed)
+      markAllAnalysesPreserved();
+  }
+};
+
+} // end anonymous namespace
@@ -18,9 +18,11 @@
 #include "mlir/Dialect/Math/IR/Math.h"
 #include "mlir/IR/IRMapping.h"
 #include "mlir/IR/SymbolTable.h"
+#include "mlir/IR/Threading.h"
 #include "mlir/Pass/PassManager.h"
 #include "mlir/Target/LLVMIR/Export.h"
 #include "mlir/Target/LLVMIR/ModuleImport.h"
+#include "mlir/Transforms/Passes.h"
 
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassBuilder.h"
@@ -37,6 +39,7 @@
 #include "mlir/Conversion/IndexToLLVM/IndexToLLVM.h"
 #include "mlir/Conversion/MathToLLVM/MathToLLVM.h"
 
+#include <mutex>
 #include <optional>
 
 #define DEBUG_TYPE "sroa-wrappers"
@@ -52,13 +55,86 @@ using namespace mlir::enzyme;
 
 namespace {
 
+// Functions and globals coming back from LLVM IR are private to the module,
+// except for external functions when `setPrivate` is not set.
+static void setImportedVisibility(mlir::Operation *op, bool setPrivate) {
+  if (auto func = llvm::dyn_cast<mlir::LLVM::LLVMFuncOp>(op)) {
+    if (setPrivate || func.getBody().empty() ||
+        func.getLinkage() == mlir::LLVM::Linkage::Internal) {
+      func.setVisibility(mlir::SymbolTable::Visibility::Private);
+    }
+  } else if (auto glob = llvm::dyn_cast<mlir::LLVM::GlobalOp>(op)) {
+    glob.setVisibility(mlir::SymbolTable::Visibility::Private);
+  }
+}
+
+// SROA alone leaves functions without allocas unchanged, unless they still
+// contain ops which the round trip converts to the LLVM dialect.
+static bool mayChangeWithSROA(mlir::LLVM::LLVMFuncOp func) {
+  return func
+      .walk([](mlir::Operation *op) {
+        if (llvm::isa<mlir::LLVM::AllocaOp>(op) ||
+            !llvm::isa<mlir::LLVM::LLVMDialect>(op->getDialect()))
+          return mlir::WalkResult::interrupt();
+        return mlir::WalkResult::advance();
+      })
+      .wasInterrupted();
+}
+
 struct SROAWrappersPass
     : public mlir::enzyme::impl::SROAWrappersPassBase<SROAWrappersPass> {
   using SROAWrappersPassBase::SROAWrappersPassBase;
 
-  void runOnOperation() override {
-    mlir::ModuleOp m = getOperation();
+  mlir::LogicalResult convertToLLVMDialect(mlir::ModuleOp m) {
+    mlir::PassManager pm(m.getContext());
+    pm.addPass(mlir::createConvertMathToLLVMPass());
+    pm.addPass(mlir::createArithToLLVMConversionPass());
+    pm.addPass(mlir::createConvertNVVMToLLVMPass());
+    return pm.run(m);
+  }
+
+  void optimizeLLVMModule(llvm::Module &llvmModule) {
+    using namespace llvm;
+    PipelineTuningOptions PTO;
+    PTO.LoopUnrolling = false;
+    PTO.LoopInterleaving = false;
+    PTO.LoopVectorization = false;
+    PTO.SLPVectorization = false;
+    PTO.MergeFunctions = false;
+    PTO.CallGraphProfile = false;
+    PTO.UnifiedLTO = false;
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+
+    PassInstrumentationCallbacks PIC;
+    PassBuilder PB(nullptr, PTO, std::nullopt, nullptr);
 
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM;
+    FunctionPassManager FPM;
+    if (sroa)
+      MPM.addPass(
+          createModuleToFunctionPassAdaptor(SROAPass(SROAOptions::ModifyCFG)));
+    if (instcombine)
+      MPM.addPass(createModuleToFunctionPassAdaptor(InstCombinePass()));
+    if (instsimplify)
+      MPM.addPass(createModuleToFunctionPassAdaptor(InstSimplifyPass()));
+    if (attributor)
+      MPM.addPass(llvm::AttributorPass());
+    MPM.run(llvmModule, MAM);
+  }
+
+  // Round trips the whole module through LLVM IR, as the attributor works
+  // across functions.
+  void runOnModule(mlir::ModuleOp m) {
     mlir::OpBuilder b(m);
 
     auto mToTranslate = b.cloneWithoutRegions(m);
@@ -88,12 +164,7 @@ struct SROAWrappersPass
       }
     }
 
-    mlir::PassManager pm(mToTranslate.getContext());
-    pm.addPass(mlir::createConvertMathToLLVMPass());
-    pm.addPass(mlir::createArithToLLVMConversionPass());
-    pm.addPass(mlir::createConvertNVVMToLLVMPass());
-    auto subres = pm.run(mToTranslate);
-    if (!subres.succeeded()) {
+    if (failed(convertToLLVMDialect(mToTranslate))) {
       return;
     }
 
@@ -102,44 +173,7 @@ struct SROAWrappersPass
 
     if (dump_prellvm)
       llvm::errs() << "sroa pre llvm\n" << *llvmModule << "\n";
-    {
-      using namespace llvm;
-      PipelineTuningOptions PTO;
-      PTO.LoopUnrolling = false;
-      PTO.LoopInterleaving = false;
-      PTO.LoopVectorization = false;
-      PTO.SLPVectorization = false;
-      PTO.MergeFunctions = false;
-      PTO.CallGraphProfile = false;
-      PTO.UnifiedLTO = false;
-
-      LoopAnalysisManager LAM;
-      FunctionAnalysisManager FAM;
-      CGSCCAnalysisManager CGAM;
-      ModuleAnalysisManager MAM;
-
-      PassInstrumentationCallbacks PIC;
-      PassBuilder PB(nullptr, PTO, std::nullopt, nullptr);
-
-      PB.registerModuleAnalyses(MAM);
-      PB.registerCGSCCAnalyses(CGAM);
-      PB.registerFunctionAnalyses(FAM);
-      PB.registerLoopAnalyses(LAM);
-      PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
-
-      ModulePassManager MPM;
-      FunctionPassManager FPM;
-      if (sroa)
-        MPM.addPass(createModuleToFunctionPassAdaptor(
-            SROAPass(SROAOptions::ModifyCFG)));
-      if (instcombine)
-        MPM.addPass(createModuleToFunctionPassAdaptor(InstCombinePass()));
-      if (instsimplify)
-        MPM.addPass(createModuleToFunctionPassAdaptor(InstSimplifyPass()));
-      if (attributor)
-        MPM.addPass(llvm::AttributorPass());
-      MPM.run(*llvmModule, MAM);
-    }
+    optimizeLLVMModule(*llvmModule);
     if (dump_postllvm)
       llvm::errs() << "sroa post_llvm\n" << *llvmModule << "\n";
     auto translatedFromLLVMIR = mlir::translateLLVMIRToModule(
@@ -168,14 +202,7 @@ struct SROAWrappersPass
           assert(op.hasTrait<mlir::OpTrait::IsIsolatedFromAbove>() ||
                  op.getNumRegions() == 0);
           assert(llvm::isa<mlir::LLVM::LLVMDialect>(op.getDialect()));
-          if (auto func = llvm::dyn_cast<mlir::LLVM::LLVMFuncOp>(op)) {
-            if (set_private || func.getBody().empty() ||
-                func.getLinkage() == mlir::LLVM::Linkage::Internal) {
-              func.setVisibility(mlir::SymbolTable::Visibility::Private);
-            }
-          } else if (auto glob = llvm::dyn_cast<mlir::LLVM::GlobalOp>(op)) {
-            glob.setVisibility(mlir::SymbolTable::Visibility::Private);
-          }
+          setImportedVisibility(&op, set_private);
           // There should be no need for mapping because all top level
           // operations in the module should be isolated from above
           b.clone(op);
@@ -185,6 +212,140 @@ struct SROAWrappersPass
 
     mToTranslate->erase();
   }
+
+  // Builds a module holding `func` and what it refers to: the globals it
+  // uses, and declarations of the functions it calls.
+  mlir::OwningOpRef<mlir::ModuleOp>
+  extractFunction(mlir::SymbolTable &symbolTable,
+                  mlir::LLVM::LLVMFuncOp func) {
+    mlir::ModuleOp m = getOperation();
+    mlir::OwningOpRef<mlir::ModuleOp> sub = mlir::ModuleOp::create(m.getLoc());
+    (*sub)->setAttrs(m->getAttrDictionary());
+    mlir::OpBuilder b = mlir::OpBuilder::atBlockEnd(sub->getBody());
+
+    llvm::SmallPtrSet<mlir::Operation *, 8> done = {func.getOperation()};
+    llvm::SmallVector<mlir::Operation *> worklist = {
+        b.clone(*func.getOperation())};
+    while (!worklist.empty()) {
+      mlir::Operation *cur = worklist.pop_back_val();
+      llvm::SmallVector<mlir::Operation *> uses;
+      cur->walk([&](mlir::Operation *op) {
+        op->getAttrDictionary().walk([&](mlir::SymbolRefAttr ref) {
+          if (auto *def = symbolTable.lookup(ref.getRootReference()))
+            uses.push_back(def);
+        });
+      });
+      for (mlir::Operation *def : uses) {
+        if (!done.insert(def).second ||
+            !llvm::isa<mlir::LLVM::LLVMDialect>(def->getDialect()) ||
+            llvm::isa<mlir::LLVM::ComdatOp>(def))
+          continue;
+        if (auto callee = llvm::dyn_cast<mlir::LLVM::LLVMFuncOp>(def)) {
+          auto decl =
+              llvm::cast<mlir::LLVM::LLVMFuncOp>(b.cloneWithoutRegions(*def));
+          decl.setLinkage(mlir::LLVM::Linkage::External);
+          decl.removeComdatAttr();
+          continue;
+        }
+        mlir::Operation *clone = b.clone(*def);
+        if (auto glob = llvm::dyn_cast<mlir::LLVM::GlobalOp>(clone))
+          glob.removeComdatAttr();
+        worklist.push_back(clone);
+      }
+    }
+    return sub;
+  }
+
+  // SROA and the instruction simplifications only change the function they
+  // run on. Every function is round tripped through LLVM IR on its own and in
+  // parallel. When SROA is the only pass, functions it cannot change are left
+  // alone.
+  void runPerFunction(mlir::ModuleOp m) {
+    mlir::MLIRContext *ctx = m.getContext();
+    mlir::SymbolTable symbolTable(m);
+    bool onlySROA = !instcombine && !instsimplify;
+
+    llvm::SmallVector<mlir::LLVM::LLVMFuncOp> funcs;
+    llvm::SmallVector<mlir::OwningOpRef<mlir::ModuleOp>> subs;
+    for (auto func : m.getOps<mlir::LLVM::LLVMFuncOp>()) {
+      if (func.getBody().empty() || (onlySROA && !mayChangeWithSROA(func)))
+        continue;
+      auto sub = extractFunction(symbolTable, func);
+      if (failed(convertToLLVMDialect(*sub)))
+        continue;
+      funcs.push_back(func);
+      subs.push_back(std::move(sub));
+    }
+
+    llvm::SmallVector<mlir::OwningOpRef<mlir::ModuleOp>> results(subs.size());
+    std::mutex dumpMutex;
+    mlir::parallelFor(ctx, 0, subs.size(), [&](size_t i) {
+      llvm::LLVMContext llvmCtx;
+      auto llvmModule = mlir::translateModuleToLLVMIR(*subs[i], llvmCtx);
+      if (!llvmModule)
+        return;
+      if (dump_prellvm) {
+        std::lock_guard<std::mutex> lock(dumpMutex);
+        llvm::errs() << "sroa pre llvm\n" << *llvmModule << "\n";
+      }
+      optimizeLLVMModule(*llvmModule);
+      if (dump_postllvm) {
+        std::lock_guard<std::mutex> lock(dumpMutex);
+        llvm::errs() << "sroa post_llvm\n" << *llvmModule << "\n";
+      }
+      results[i] = mlir::translateLLVMIRToModule(
+          std::move(llvmModule), ctx, /*emitExpensiveWarnings*/ true,
+          /*dropDICompositeTypeElements*/ false, /*loadAllDialects*/ false);
+    });
+
+    for (auto [func, newM] : llvm::zip(funcs, results)) {
+      if (!newM)
+        continue;
+      mlir::OpBuilder b(func);
+      mlir::Operation *newFunc = nullptr;
+      for (auto &op : *newM->getBody()) {
+        auto sym = llvm::dyn_cast<mlir::SymbolOpInterface>(op);
+        if (!sym || llvm::isa<mlir::LLVM::ComdatOp>(op))
+          continue;
+        if (sym.getNameAttr() == func.getSymNameAttr()) {
+          newFunc = &op;
+          continue;
+        }
+        // The optimizations may introduce calls to new library functions.
+        if (!symbolTable.lookup(sym.getNameAttr())) {
+          mlir::Operation *clone = b.clone(op);
+          setImportedVisibility(clone, set_private);
+          symbolTable.insert(clone);
+        }
+      }
+      if (!newFunc)
+        continue;
+      mlir::Operation *clone = b.clone(*newFunc);
+      setImportedVisibility(clone, set_private);
+      symbolTable.remove(func);
+      func.erase();
+      symbolTable.insert(clone);
+    }
+  }
+
+  void runOnOperation() override {
+    mlir::ModuleOp m = getOperation();
+
+    if (native) {
+      mlir::OpPassManager pm(mlir::ModuleOp::getOperationName());
+      pm.addPass(mlir::createSROA());
+      pm.addPass(mlir::createMem2Reg());
+      if (failed(runPipeline(pm, m)))
+        signalPassFailure();
+      return;
+    }
+
+    if (attributor) {
+      runOnModule(m);
+      return;
+    }
+    runPerFunction(m);
+  }
 };
 
 } // end anonymous namespace
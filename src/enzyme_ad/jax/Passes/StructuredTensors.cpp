@@ -5,6 +5,8 @@
 #include "src/enzyme_ad/jax/Utils.h"
 #include "stablehlo/dialect/StablehloOps.h"
 
+#include <limits>
+
 namespace mlir {
 namespace enzyme {
 
@@ -85,5 +87,373 @@ absl::Status detectDiagonalTensor(stablehlo::ScatterOp scatterOp,
   return absl::InvalidArgumentError("Not a diagonal tensor.");
 }
 
+namespace {
+
+constexpr unsigned kMaxBandDepth = 12;
+
+// Stands in for an unbounded end of a band before it is clamped to a matrix.
+constexpr int64_t kUnboundedBand = std::numeric_limits<int64_t>::max() / 4;
+
+MatrixBand getEmptyBand() { return MatrixBand{1, 0}; }
+
+MatrixBand getFullBand(RankedTensorType type) {
+  int64_t rows = type.getDimSize(type.getRank() - 2);
+  int64_t cols = type.getDimSize(type.getRank() - 1);
+  if (rows == 0 || cols == 0)
+    return getEmptyBand();
+  return MatrixBand{-(rows - 1), cols - 1};
+}
+
+MatrixBand clampBand(MatrixBand band, RankedTensorType type) {
+  MatrixBand full = getFullBand(type);
+  band.lower = std::max(band.lower, full.lower);
+  band.upper = std::min(band.upper, full.upper);
+  return band.isZero() ? getEmptyBand() : band;
+}
+
+MatrixBand joinBands(MatrixBand a, MatrixBand b) {
+  if (a.isZero())
+    return b;
+  if (b.isZero())
+    return a;
+  return MatrixBand{std::min(a.lower, b.lower), std::max(a.upper, b.upper)};
+}
+
+MatrixBand meetBands(MatrixBand a, MatrixBand b) {
+  return MatrixBand{std::max(a.lower, b.lower), std::min(a.upper, b.upper)};
+}
+
+MatrixBand getConstantBand(DenseElementsAttr attr, RankedTensorType type) {
+  MatrixBand full = getFullBand(type);
+  Type elemType = type.getElementType();
+  if (attr.isSplat()) {
+    if (isa<FloatType>(elemType))
+      return attr.getSplatValue<APFloat>().isZero() ? getEmptyBand() : full;
+    if (isa<IntegerType>(elemType))
+      return attr.getSplatValue<APInt>().isZero() ? getEmptyBand() : full;
+    return full;
+  }
+
+  // Scanning is linear in the size of the constant, only do it for small ones.
+  if (attr.getNumElements() > (1 << 16))
+    return full;
+
+  int64_t rows = type.getDimSize(type.getRank() - 2);
+  int64_t cols = type.getDimSize(type.getRank() - 1);
+  MatrixBand band = getEmptyBand();
+  auto visit = [&](int64_t idx) {
+    int64_t offset = idx % cols - (idx / cols) % rows;
+    band = joinBands(band, MatrixBand{offset, offset});
+  };
+  if (isa<FloatType>(elemType)) {
+    for (auto [idx, value] : llvm::enumerate(attr.getValues<APFloat>()))
+      if (!value.isZero())
+        visit(idx);
+    return band;
+  }
+  if (isa<IntegerType>(elemType)) {
+    for (auto [idx, value] : llvm::enumerate(attr.getValues<APInt>()))
+      if (!value.isZero())
+        visit(idx);
+    return band;
+  }
+  return full;
+}
+
+// The row (axis 0) or column (axis 1) index of the minor dimensions of a
+// tensor of the given rank, plus a constant offset.
+struct IotaIndex {
+  int axis;
+  int64_t offset;
+};
+
+std::optional<IotaIndex> getIotaIndex(Value value, int64_t rank) {
+  int64_t offset = 0;
+  while (true) {
+    auto type = cast<RankedTensorType>(value.getType());
+    Operation *def = value.getDefiningOp();
+
+    int64_t dim = -1;
+    if (auto iota = dyn_cast_or_null<stablehlo::IotaOp>(def)) {
+      dim = iota.getIotaDimension();
+    } else if (auto bcast =
+                   dyn_cast_or_null<stablehlo::BroadcastInDimOp>(def)) {
+      auto operandType = bcast.getOperand().getType();
+      if (operandType.getRank() != 1 ||
+          !bcast.getOperand().getDefiningOp<stablehlo::IotaOp>())
+        return std::nullopt;
+      dim = bcast.getBroadcastDimensions()[0];
+      if (operandType.getDimSize(0) != type.getDimSize(dim))
+        return std::nullopt;
+    }
+    if (dim >= 0) {
+      if (dim == rank - 2)
+        return IotaIndex{0, offset};
+      if (dim == rank - 1)
+        return IotaIndex{1, offset};
+      return std::nullopt;
+    }
+
+    if (isa_and_nonnull<stablehlo::AddOp, stablehlo::SubtractOp>(def)) {
+      APInt constant;
+      if (matchPattern(def->getOperand(1), m_ConstantInt(&constant))) {
+        offset += isa<stablehlo::AddOp>(def) ? constant.getSExtValue()
+                                              : -constant.getSExtValue();
+        value = def->getOperand(0);
+        continue;
+      }
+      if (isa<stablehlo::AddOp>(def) &&
+          matchPattern(def->getOperand(0), m_ConstantInt(&constant))) {
+        offset += constant.getSExtValue();
+        value = def->getOperand(1);
+        continue;
+      }
+      return std::nullopt;
+    }
+
+    if (auto convert = dyn_cast_or_null<stablehlo::ConvertOp>(def)) {
+      if (!isa<IntegerType>(convert.getOperand().getType().getElementType()))
+        return std::nullopt;
+      value = convert.getOperand();
+      continue;
+    }
+    return std::nullopt;
+  }
+}
+
+// The band where a mask comparing row and column iotas can be true, before
+// clamping. The mask is true on the whole band if `exact` is set, otherwise the
+// band is only known to contain the entries where it is true.
+struct MaskBand {
+  MatrixBand band;
+  bool exact;
+};
+
+std::optional<MaskBand> getMaskBand(Value pred, int64_t rank) {
+  if (auto andOp = pred.getDefiningOp<stablehlo::AndOp>()) {
+    auto lhs = getMaskBand(andOp.getLhs(), rank);
+    auto rhs = getMaskBand(andOp.getRhs(), rank);
+    if (lhs && rhs)
+      return MaskBand{meetBands(lhs->band, rhs->band),
+                      lhs->exact && rhs->exact};
+    // The unknown side may be false anywhere on the known band.
+    if (lhs || rhs)
+      return MaskBand{lhs ? lhs->band : rhs->band, false};
+    return std::nullopt;
+  }
+
+  auto compare = pred.getDefiningOp<stablehlo::CompareOp>();
+  if (!compare)
+    return std::nullopt;
+  auto lhs = getIotaIndex(compare.getLhs(), rank);
+  auto rhs = getIotaIndex(compare.getRhs(), rank);
+  if (!lhs || !rhs || lhs->axis == rhs->axis)
+    return std::nullopt;
+
+  // Normalize to `col - row <direction> threshold`.
+  using stablehlo::ComparisonDirection;
+  ComparisonDirection direction = compare.getComparisonDirection();
+  int64_t threshold;
+  if (lhs->axis == 0) {
+    // row + a <dir> col + b  <=>  col - row <flipped dir> a - b
+    threshold = lhs->offset - rhs->offset;
+    switch (direction) {
+    case ComparisonDirection::LT:
+      direction = ComparisonDirection::GT;
+      break;
+    case ComparisonDirection::LE:
+      direction = ComparisonDirection::GE;
+      break;
+    case ComparisonDirection::GT:
+      direction = ComparisonDirection::LT;
+      break;
+    case ComparisonDirection::GE:
+      direction = ComparisonDirection::LE;
+      break;
+    default:
+      break;
+    }
+  } else {
+    // col + a <dir> row + b  <=>  col - row <dir> b - a
+    threshold = rhs->offset - lhs->offset;
+  }
+
+  switch (direction) {
+  case ComparisonDirection::EQ:
+    return MaskBand{MatrixBand{threshold, threshold}, true};
+  case ComparisonDirection::GT:
+    return MaskBand{MatrixBand{threshold + 1, kUnboundedBand}, true};
+  case ComparisonDirection::GE:
+    return MaskBand{MatrixBand{threshold, kUnboundedBand}, true};
+  case ComparisonDirection::LT:
+    return MaskBand{MatrixBand{-kUnboundedBand, threshold - 1}, true};
+  case ComparisonDirection::LE:
+    return MaskBand{MatrixBand{-kUnboundedBand, threshold}, true};
+  default:
+    return std::nullopt;
+  }
+}
+
+// Entries outside of a half-open mask band, i.e. where the mask is false.
+std::optional<MatrixBand> getMaskComplement(MatrixBand mask) {
+  if (mask.lower <= -kUnboundedBand)
+    return MatrixBand{mask.upper + 1, kUnboundedBand};
+  if (mask.upper >= kUnboundedBand)
+    return MatrixBand{-kUnboundedBand, mask.lower - 1};
+  return std::nullopt;
+}
+
+MatrixBand getMatrixBandImpl(Value value, unsigned depth) {
+  auto type = cast<RankedTensorType>(value.getType());
+  int64_t rank = type.getRank();
+  MatrixBand full = getFullBand(type);
+  if (depth > kMaxBandDepth || full.isZero())
+    return full;
+
+  auto bandOf = [&](Value operand) {
+    return getMatrixBandImpl(operand, depth + 1);
+  };
+
+  DenseElementsAttr attr;
+  if (matchPattern(value, m_Constant(&attr)))
+    return getConstantBand(attr, type);
+
+  Operation *def = value.getDefiningOp();
+  if (!def)
+    return full;
+
+  if (auto scatter = dyn_cast<stablehlo::ScatterOp>(def)) {
+    Value updates;
+    if (detectDiagonalTensor(scatter, &updates).ok())
+      return clampBand(MatrixBand{0, 0}, type);
+    return full;
+  }
+
+  // Zero where any (multiply, and) or all (add, ...) operands are zero.
+  if (isa<stablehlo::AddOp, stablehlo::SubtractOp, stablehlo::OrOp,
+          stablehlo::XorOp, stablehlo::MaxOp, stablehlo::MinOp,
+          stablehlo::ComplexOp>(def))
+    return joinBands(bandOf(def->getOperand(0)), bandOf(def->getOperand(1)));
+  if (isa<stablehlo::MulOp, stablehlo::AndOp>(def))
+    return clampBand(
+        meetBands(bandOf(def->getOperand(0)), bandOf(def->getOperand(1))),
+        type);
+
+  // Unary ops mapping zero to zero.
+  if (isa<stablehlo::NegOp, stablehlo::ConvertOp, stablehlo::AbsOp,
+          stablehlo::SqrtOp, stablehlo::CbrtOp, stablehlo::SineOp,
+          stablehlo::TanOp, stablehlo::TanhOp, stablehlo::SignOp,
+          stablehlo::FloorOp, stablehlo::CeilOp, stablehlo::RoundOp,
+          stablehlo::RoundNearestEvenOp, stablehlo::Expm1Op,
+          stablehlo::Log1pOp, stablehlo::RealOp, stablehlo::ImagOp>(def))
+    return bandOf(def->getOperand(0));
+
+  if (auto select = dyn_cast<stablehlo::SelectOp>(def)) {
+    MatrixBand onTrue = bandOf(select.getOnTrue());
+    MatrixBand onFalse = bandOf(select.getOnFalse());
+    if (auto mask = getMaskBand(select.getPred(), rank)) {
+      onTrue = clampBand(meetBands(onTrue, mask->band), type);
+      // The complement of a superset of the mask may miss entries where the
+      // mask is false.
+      if (mask->exact)
+        if (auto complement = getMaskComplement(mask->band))
+          onFalse = clampBand(meetBands(onFalse, *complement), type);
+    }
+    return joinBands(onTrue, onFalse);
+  }
+
+  if (auto transpose = dyn_cast<stablehlo::TransposeOp>(def)) {
+    ArrayRef<int64_t> perm = transpose.getPermutation();
+    for (int64_t i = 0; i < rank - 2; i++)
+      if (perm[i] >= rank - 2)
+        return full;
+    MatrixBand band = bandOf(transpose.getOperand());
+    if (perm[rank - 2] == rank - 2)
+      return band;
+    return band.isZero() ? band : MatrixBand{-band.upper, -band.lower};
+  }
+
+  if (auto bcast = dyn_cast<stablehlo::BroadcastInDimOp>(def)) {
+    Value operand = bcast.getOperand();
+    auto operandType = cast<RankedTensorType>(operand.getType());
+    int64_t operandRank = operandType.getRank();
+    if (operandRank == 0)
+      return matchPattern(operand, m_AnyZeroFloat()) ||
+                     matchPattern(operand, m_Zero())
+                 ? getEmptyBand()
+                 : full;
+    ArrayRef<int64_t> dims = bcast.getBroadcastDimensions();
+    if (operandRank >= 2 && dims[operandRank - 2] == rank - 2 &&
+        dims[operandRank - 1] == rank - 1 &&
+        operandType.getDimSize(operandRank - 2) ==
+            type.getDimSize(rank - 2) &&
+        operandType.getDimSize(operandRank - 1) == type.getDimSize(rank - 1))
+      return bandOf(operand);
+    return full;
+  }
+
+  if (auto concat = dyn_cast<stablehlo::ConcatenateOp>(def)) {
+    if ((int64_t)concat.getDimension() >= rank - 2)
+      return full;
+    MatrixBand band = getEmptyBand();
+    for (Value operand : concat.getOperands())
+      band = joinBands(band, bandOf(operand));
+    return band;
+  }
+
+  return full;
+}
+
+} // namespace
+
+MatrixBand getMatrixBand(Value value) { return getMatrixBandImpl(value, 0); }
+
+std::optional<Value> detectOneHotRows(Value value) {
+  auto type = cast<RankedTensorType>(value.getType());
+  if (type.getRank() != 2)
+    return std::nullopt;
+
+  Value pred;
+  Operation *def = value.getDefiningOp();
+  if (auto convert = dyn_cast_or_null<stablehlo::ConvertOp>(def)) {
+    if (convert.getOperand().getType().getElementType().isInteger(1))
+      pred = convert.getOperand();
+  } else if (auto select = dyn_cast_or_null<stablehlo::SelectOp>(def)) {
+    if ((matchPattern(select.getOnTrue(), m_One()) ||
+         matchPattern(select.getOnTrue(), m_OneFloat())) &&
+        (matchPattern(select.getOnFalse(), m_Zero()) ||
+         matchPattern(select.getOnFalse(), m_AnyZeroFloat())))
+      pred = select.getPred();
+  }
+  if (!pred)
+    return std::nullopt;
+
+  auto compare = pred.getDefiningOp<stablehlo::CompareOp>();
+  if (!compare ||
+      compare.getComparisonDirection() != stablehlo::ComparisonDirection::EQ)
+    return std::nullopt;
+
+  std::pair<Value, Value> candidates[] = {{compare.getLhs(), compare.getRhs()},
+                                          {compare.getRhs(), compare.getLhs()}};
+  for (auto [iota, indices] : candidates) {
+    auto column = getIotaIndex(iota, 2);
+    if (!column || column->axis != 1 || column->offset != 0)
+      continue;
+    // The gather needs integer indices, one per row rather than a single
+    // index broadcast to all rows.
+    auto bcast = indices.getDefiningOp<stablehlo::BroadcastInDimOp>();
+    if (!bcast)
+      continue;
+    auto indicesType = bcast.getOperand().getType();
+    if (indicesType.getRank() != 1 ||
+        !isa<IntegerType>(indicesType.getElementType()) ||
+        indicesType.getDimSize(0) != type.getDimSize(0) ||
+        bcast.getBroadcastDimensions()[0] != 0)
+      continue;
+    return bcast.getOperand();
+  }
+  return std::nullopt;
+}
+
 } // namespace enzyme
 } // namespace mlir
@@ -5,6 +5,8 @@
 #include "src/enzyme_ad/jax/Utils.h"
 #include "stablehlo/dialect/StablehloOps.h"
 
+#include <optional>
+
 namespace mlir {
 namespace enzyme {
 
@@ -16,5 +18,30 @@ absl::Status detectConstantSetindexScatterOp(stablehlo::ScatterOp scatterOp,
 absl::Status detectDiagonalTensor(stablehlo::ScatterOp scatterOp,
                                   mlir::Value *outUpdates);
 
+/// Non-zero band of the two minor dimensions of a tensor: entry (row, col) can
+/// only be non-zero if lower <= col - row <= upper. Diagonal matrices have the
+/// band [0, 0], lower triangular ones [-(rows - 1), 0], and all-zero ones an
+/// empty band.
+struct MatrixBand {
+  int64_t lower;
+  int64_t upper;
+
+  bool isZero() const { return lower > upper; }
+  bool isDiagonal() const { return lower == 0 && upper == 0; }
+  int64_t getWidth() const { return isZero() ? 0 : upper - lower + 1; }
+};
+
+/// Tracks the band of `value`, a statically shaped tensor of rank >= 2,
+/// forward from constants, diagonal scatters and iota masks through
+/// elementwise ops, selects, transposes, broadcasts and concatenations.
+/// Returns the full band if nothing better is known.
+MatrixBand getMatrixBand(Value value);
+
+/// If `value` is a matrix with a single one in each row, at the column given
+/// by `indices` (or all zeros if that column is out of range), returns the
+/// rank-1 `indices`. This is the case for one-hot encodings and
+/// permutation matrices built as compare(iota, broadcast(indices)).
+std::optional<Value> detectOneHotRows(Value value);
+
 } // namespace enzyme
 } // namespace mlir
@@ -0,0 +1,152 @@
+//===- SymbolicShapes.cpp - Symbolic reasoning on dynamic shapes ----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "src/enzyme_ad/jax/Passes/SymbolicShapes.h"
+
+#include "mlir/IR/Matchers.h"
+#include "stablehlo/dialect/StablehloOps.h"
+
+using namespace mlir;
+using namespace mlir::enzyme;
+
+// Interprets the integer scalar `value`, e.g. an element of a shape tensor.
+static std::optional<SymbolicDim> getSymbolicDimFromScalar(Value value) {
+  while (true) {
+    DenseIntElementsAttr attr;
+    if (matchPattern(value, m_Constant(&attr))) {
+      if (attr.getNumElements() != 1)
+        return std::nullopt;
+      return SymbolicDim{(*attr.begin()).getSExtValue(), nullptr, -1};
+    }
+
+    Operation *def = value.getDefiningOp();
+    if (auto dimSize = dyn_cast_or_null<stablehlo::GetDimensionSizeOp>(def))
+      return getSymbolicDim(dimSize.getOperand(), dimSize.getDimension());
+
+    // Shape computations commonly convert between index types and reshape
+    // scalars to the 1-element tensors that are concatenated.
+    if (isa_and_nonnull<stablehlo::ConvertOp, stablehlo::ReshapeOp,
+                        stablehlo::BroadcastInDimOp>(def)) {
+      auto operandType = cast<RankedTensorType>(def->getOperand(0).getType());
+      if (operandType.getNumElements() != 1)
+        return std::nullopt;
+      value = def->getOperand(0);
+      continue;
+    }
+    return std::nullopt;
+  }
+}
+
+std::optional<SmallVector<SymbolicDim>>
+mlir::enzyme::getSymbolicShapeFromTensor(Value shape) {
+  auto type = dyn_cast<RankedTensorType>(shape.getType());
+  if (!type || type.getRank() != 1 || !type.hasStaticShape())
+    return std::nullopt;
+
+  DenseIntElementsAttr attr;
+  if (matchPattern(shape, m_Constant(&attr))) {
+    SmallVector<SymbolicDim> dims;
+    for (const APInt &size : attr.getValues<APInt>())
+      dims.push_back(SymbolicDim{size.getSExtValue(), nullptr, -1});
+    return dims;
+  }
+
+  Operation *def = shape.getDefiningOp();
+  if (auto convert = dyn_cast_or_null<stablehlo::ConvertOp>(def))
+    return getSymbolicShapeFromTensor(convert.getOperand());
+
+  if (auto concat = dyn_cast_or_null<stablehlo::ConcatenateOp>(def)) {
+    SmallVector<SymbolicDim> dims;
+    for (Value operand : concat.getOperands()) {
+      auto part = getSymbolicShapeFromTensor(operand);
+      if (!part)
+        return std::nullopt;
+      dims.append(*part);
+    }
+    return dims;
+  }
+
+  if (type.getNumElements() == 1) {
+    if (auto dim = getSymbolicDimFromScalar(shape))
+      return SmallVector<SymbolicDim>{*dim};
+  }
+  return std::nullopt;
+}
+
+SymbolicDim mlir::enzyme::getSymbolicDim(Value value, int64_t dim) {
+  while (true) {
+    auto type = cast<RankedTensorType>(value.getType());
+    if (!type.isDynamicDim(dim))
+      return SymbolicDim{type.getDimSize(dim), nullptr, -1};
+
+    Operation *def = value.getDefiningOp();
+    if (!def)
+      break;
+
+    // Ops whose result has the shape of their (non-scalar) operands.
+    if (def->hasTrait<OpTrait::Elementwise>() ||
+        def->hasTrait<OpTrait::SameOperandsAndResultShape>()) {
+      Value next;
+      for (Value operand : def->getOperands()) {
+        auto operandType = dyn_cast<RankedTensorType>(operand.getType());
+        if (!operandType || operandType.getRank() != type.getRank())
+          continue;
+        if (!operandType.isDynamicDim(dim))
+          return SymbolicDim{operandType.getDimSize(dim), nullptr, -1};
+        if (!next)
+          next = operand;
+      }
+      if (!next)
+        break;
+      value = next;
+      continue;
+    }
+
+    if (auto transpose = dyn_cast<stablehlo::TransposeOp>(def)) {
+      value = transpose.getOperand();
+      dim = transpose.getPermutation()[dim];
+      continue;
+    }
+
+    if (auto concat = dyn_cast<stablehlo::ConcatenateOp>(def)) {
+      if ((int64_t)concat.getDimension() == dim)
+        break;
+      value = concat.getOperand(0);
+      continue;
+    }
+
+    if (auto dus = dyn_cast<stablehlo::DynamicUpdateSliceOp>(def)) {
+      value = dus.getOperand();
+      continue;
+    }
+
+    // A dynamic operand dimension may be broadcast from size 1, so only the
+    // shape operands of the dynamic ops determine their result shapes.
+    Value shape;
+    if (auto reshape = dyn_cast<stablehlo::DynamicReshapeOp>(def))
+      shape = reshape.getOutputShape();
+    else if (auto bcast = dyn_cast<stablehlo::DynamicBroadcastInDimOp>(def))
+      shape = bcast.getOutputDimensions();
+    if (shape) {
+      auto dims = getSymbolicShapeFromTensor(shape);
+      if (!dims || (int64_t)dims->size() != type.getRank())
+        break;
+      return (*dims)[dim];
+    }
+    break;
+  }
+  return SymbolicDim{ShapedType::kDynamic, value, dim};
+}
+
+SmallVector<SymbolicDim> mlir::enzyme::getSymbolicShape(Value value) {
+  SmallVector<SymbolicDim> dims;
+  auto type = cast<RankedTensorType>(value.getType());
+  for (int64_t dim = 0; dim < type.getRank(); dim++)
+    dims.push_back(getSymbolicDim(value, dim));
+  return dims;
+}
@@ -0,0 +1,56 @@
+//===- SymbolicShapes.h - Symbolic reasoning on dynamic shapes --*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Helpers relating dynamic tensor dimensions to each other, so that patterns
+// can prove two dynamic shapes equal without knowing their sizes. Only
+// equality is tracked: patterns that compute with sizes, such as offsets of
+// slices or paddings, still require static shapes.
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "mlir/IR/BuiltinTypes.h"
+#include "mlir/IR/Value.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <optional>
+
+namespace mlir {
+namespace enzyme {
+
+/// The size of a tensor dimension: either a static size, or the runtime size
+/// of dimension `dim` of `source`. Dimensions that trace back to the same
+/// source and dimension are equal at runtime.
+struct SymbolicDim {
+  int64_t size = ShapedType::kDynamic;
+  Value source;
+  int64_t dim = -1;
+
+  bool isStatic() const { return !ShapedType::isDynamic(size); }
+
+  bool operator==(const SymbolicDim &other) const {
+    if (isStatic() || other.isStatic())
+      return size == other.size;
+    return source == other.source && dim == other.dim;
+  }
+  bool operator!=(const SymbolicDim &other) const { return !(*this == other); }
+};
+
+/// Traces dimension `dim` of the ranked tensor `value` through ops that
+/// forward the sizes of their operands, and through the shape operands of
+/// dynamic_reshape and dynamic_broadcast_in_dim.
+SymbolicDim getSymbolicDim(Value value, int64_t dim);
+
+SmallVector<SymbolicDim> getSymbolicShape(Value value);
+
+/// Interprets the 1-d integer tensor `shape`, e.g. the output shape operand of
+/// a dynamic_reshape, built from constants and stablehlo.get_dimension_size.
+std::optional<SmallVector<SymbolicDim>> getSymbolicShapeFromTensor(Value shape);
+
+} // namespace enzyme
+} // namespace mlir
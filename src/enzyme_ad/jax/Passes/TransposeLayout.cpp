@@ -0,0 +1,403 @@
+//===- TransposeLayout.cpp - Global layout assignment for transposes ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a pass choosing the dimension order in which groups of
+// elementwise stablehlo ops compute their results, so as to minimize the
+// number of bytes moved by transposes in the whole function. Unlike the
+// transpose propagation patterns, which push transposes in one fixed
+// direction, it accounts for every producer and consumer of a group at once.
+//
+//===----------------------------------------------------------------------===//
+
+#include "src/enzyme_ad/jax/Passes/ConstantFolding.h"
+#include "src/enzyme_ad/jax/Passes/Passes.h"
+
+#include "stablehlo/dialect/StablehloOps.h"
+
+#include "mlir/Dialect/Utils/IndexingUtils.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/IRMapping.h"
+#include "mlir/IR/Matchers.h"
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/EquivalenceClasses.h"
+
+#define DEBUG_TYPE "enzyme-hlo-transpose-layout"
+
+namespace mlir {
+namespace enzyme {
+#define GEN_PASS_DEF_TRANSPOSELAYOUTPASS
+#include "src/enzyme_ad/jax/Passes/Passes.h.inc"
+} // namespace enzyme
+} // namespace mlir
+
+using namespace mlir;
+using namespace mlir::enzyme;
+
+namespace {
+
+using Permutation = SmallVector<int64_t>;
+
+// transpose(transpose(x, a), b) == transpose(x, compose(a, b)).
+static Permutation compose(ArrayRef<int64_t> a, ArrayRef<int64_t> b) {
+  return applyPermutation(a, b);
+}
+
+static int64_t getSizeInBytes(Type type) {
+  auto tensorType = cast<RankedTensorType>(type);
+  Type elementType = tensorType.getElementType();
+  int64_t bits = 1;
+  if (auto complexType = dyn_cast<ComplexType>(elementType)) {
+    bits = 2;
+    elementType = complexType.getElementType();
+  }
+  bits *= elementType.isIntOrFloat() ? elementType.getIntOrFloatBitWidth() : 8;
+  return tensorType.getNumElements() * ((bits + 7) / 8);
+}
+
+// Elementwise ops whose operands all have the shape of the result compute
+// the same values in any dimension order.
+static bool isLayoutAgnostic(Operation *op) {
+  if (!op->hasTrait<OpTrait::Elementwise>() ||
+      !isa<stablehlo::StablehloDialect>(op->getDialect()) ||
+      op->getNumRegions() != 0 || op->getNumResults() != 1 ||
+      op->getNumOperands() == 0)
+    return false;
+  auto type = dyn_cast<RankedTensorType>(op->getResult(0).getType());
+  if (!type || !type.hasStaticShape() || type.getRank() < 2)
+    return false;
+  return llvm::all_of(op->getOperandTypes(), [&](Type operandType) {
+    auto tensorType = dyn_cast<RankedTensorType>(operandType);
+    return tensorType && tensorType.getShape() == type.getShape();
+  });
+}
+
+// A set of connected layout agnostic ops of one block, computing all their
+// results in the dimension order `layout`: every value v of the group is
+// stored as transpose(v, layout).
+struct Group {
+  SmallVector<Operation *> ops;
+  Permutation layout;
+  SmallVector<unsigned> sites;
+};
+
+// A value and the consumers that need it in a given dimension order. The
+// consumer groups (or -1 for ops outside of any group) read transpose(source,
+// perm). Each distinct permutation actually needed, after accounting for the
+// layouts of the source and consumer groups, costs one transpose.
+struct Site {
+  int src;
+  Permutation perm;
+  SmallVector<int> dsts;
+  int64_t bytes;
+};
+
+class LayoutSolver {
+public:
+  LayoutSolver(Operation *root) { collect(root); }
+
+  // Returns the number of groups whose layout changed.
+  unsigned solve();
+
+  void rewrite();
+
+private:
+  void collect(Operation *root);
+  void addSite(int src, ArrayRef<int64_t> perm, ArrayRef<int> dsts,
+               int64_t bytes);
+  int64_t getCost(const Site &site) const;
+  int64_t getCost(const Group &group) const;
+  void rewrite(Group &group);
+
+  SmallVector<Group> groups;
+  SmallVector<Site> sites;
+  DenseMap<Operation *, int> groupOf;
+};
+
+void LayoutSolver::addSite(int src, ArrayRef<int64_t> perm, ArrayRef<int> dsts,
+                           int64_t bytes) {
+  unsigned index = sites.size();
+  sites.push_back(Site{src, Permutation(perm), SmallVector<int>(dsts), bytes});
+  SmallVector<int> touched(dsts);
+  touched.push_back(src);
+  llvm::sort(touched);
+  touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+  for (int group : touched)
+    if (group >= 0)
+      groups[group].sites.push_back(index);
+}
+
+void LayoutSolver::collect(Operation *root) {
+  llvm::EquivalenceClasses<Operation *> classes;
+  SmallVector<Operation *> agnostic;
+  DenseSet<Operation *> isAgnostic;
+  root->walk([&](Operation *op) {
+    if (op == root || !isLayoutAgnostic(op))
+      return;
+    agnostic.push_back(op);
+    isAgnostic.insert(op);
+    classes.insert(op);
+    for (Value operand : op->getOperands()) {
+      Operation *def = operand.getDefiningOp();
+      if (def && def->getBlock() == op->getBlock() && isAgnostic.contains(def))
+        classes.unionSets(def, op);
+    }
+  });
+
+  DenseMap<Operation *, int> leaderGroup;
+  for (Operation *op : agnostic) {
+    Operation *leader = classes.getLeaderValue(op);
+    auto [it, inserted] = leaderGroup.try_emplace(leader, groups.size());
+    if (inserted) {
+      auto rank = cast<RankedTensorType>(op->getResult(0).getType()).getRank();
+      groups.push_back(
+          Group{{}, llvm::to_vector(llvm::seq<int64_t>(0, rank)), {}});
+    }
+    groups[it->second].ops.push_back(op);
+    groupOf[op] = it->second;
+  }
+  if (groups.empty())
+    return;
+
+  auto getGroup = [&](Operation *op) -> int {
+    auto it = groupOf.find(op);
+    return it == groupOf.end() ? -1 : it->second;
+  };
+
+  // Transposes feeding or fed by groups.
+  root->walk([&](stablehlo::TransposeOp transpose) {
+    int src = getGroup(transpose.getOperand().getDefiningOp());
+    SmallVector<int> dsts;
+    for (Operation *user : transpose->getUsers())
+      dsts.push_back(getGroup(user));
+    if (src < 0 && llvm::none_of(dsts, [](int dst) { return dst >= 0; }))
+      return;
+    addSite(src, transpose.getPermutation(), dsts,
+            getSizeInBytes(transpose.getType()));
+  });
+
+  for (auto [index, group] : llvm::enumerate(groups)) {
+    int self = index;
+    for (Operation *op : group.ops) {
+      Permutation identity = llvm::to_vector(llvm::seq<int64_t>(
+          0, cast<RankedTensorType>(op->getResult(0).getType()).getRank()));
+
+      // Operands from outside the group, including results of groups in
+      // other blocks. Constants are transposed for free.
+      for (Value operand : op->getOperands()) {
+        Operation *def = operand.getDefiningOp();
+        int src = getGroup(def);
+        if (src == self || isa_and_nonnull<stablehlo::TransposeOp>(def) ||
+            matchPattern(operand, m_Constant()))
+          continue;
+        addSite(src, identity, {self}, getSizeInBytes(operand.getType()));
+      }
+
+      // Results used by ops outside of any group, except by transposes.
+      Value result = op->getResult(0);
+      if (llvm::any_of(result.getUsers(), [&](Operation *user) {
+            return getGroup(user) < 0 && !isa<stablehlo::TransposeOp>(user);
+          }))
+        addSite(self, identity, {-1}, getSizeInBytes(result.getType()));
+    }
+  }
+}
+
+int64_t LayoutSolver::getCost(const Site &site) const {
+  SmallVector<Permutation, 2> needed;
+  Permutation srcToSite = site.perm;
+  if (site.src >= 0)
+    srcToSite =
+        compose(invertPermutationVector(groups[site.src].layout), site.perm);
+  for (int dst : site.dsts) {
+    Permutation perm = dst >= 0 ? compose(srcToSite, groups[dst].layout)
+                                : srcToSite;
+    if (!isIdentityPermutation(perm) && !llvm::is_contained(needed, perm))
+      needed.push_back(perm);
+  }
+  return site.bytes * needed.size();
+}
+
+int64_t LayoutSolver::getCost(const Group &group) const {
+  int64_t cost = 0;
+  for (unsigned site : group.sites)
+    cost += getCost(sites[site]);
+  return cost;
+}
+
+unsigned LayoutSolver::solve() {
+  // Local search from the current layouts: move one group at a time to the
+  // layout that makes one of its sites free, as long as this strictly
+  // reduces the total number of transposed bytes.
+  SmallVector<Permutation> initial;
+  for (auto &group : groups)
+    initial.push_back(group.layout);
+
+  bool changed = !groups.empty();
+  for (unsigned iter = 0; changed && iter < 4 * groups.size() + 4; iter++) {
+    changed = false;
+    for (auto [index, group] : llvm::enumerate(groups)) {
+      int self = index;
+      SmallVector<Permutation> candidates{
+          llvm::to_vector(llvm::seq<int64_t>(0, group.layout.size()))};
+      for (unsigned siteIndex : group.sites) {
+        const Site &site = sites[siteIndex];
+        Permutation srcToSite = site.perm;
+        if (site.src >= 0 && site.src != self)
+          srcToSite = compose(
+              invertPermutationVector(groups[site.src].layout), site.perm);
+        for (int dst : site.dsts) {
+          if (dst == self && site.src != self)
+            candidates.push_back(invertPermutationVector(srcToSite));
+          else if (site.src == self && dst != self)
+            candidates.push_back(
+                dst >= 0 ? compose(site.perm, groups[dst].layout) : site.perm);
+        }
+      }
+
+      Permutation best = group.layout;
+      int64_t bestCost = getCost(group);
+      for (auto &candidate : candidates) {
+        if (candidate == best)
+          continue;
+        Permutation previous = group.layout;
+        group.layout = candidate;
+        int64_t cost = getCost(group);
+        group.layout = previous;
+        if (cost < bestCost) {
+          bestCost = cost;
+          best = candidate;
+        }
+      }
+      if (best != group.layout) {
+        group.layout = best;
+        changed = true;
+      }
+    }
+  }
+
+  unsigned numChanged = 0;
+  for (auto [group, layout] : llvm::zip(groups, initial))
+    if (group.layout != layout)
+      numChanged++;
+  return numChanged;
+}
+
+void LayoutSolver::rewrite(Group &group) {
+  ArrayRef<int64_t> layout = group.layout;
+  Permutation inverse = invertPermutationVector(layout);
+  DenseSet<Operation *> members(group.ops.begin(), group.ops.end());
+  llvm::sort(group.ops,
+             [](Operation *a, Operation *b) { return a->isBeforeInBlock(b); });
+
+  OpBuilder builder(group.ops.front()->getContext());
+  IRMapping mapping;
+  SmallVector<std::pair<Operation *, Operation *>> replaced;
+  for (Operation *op : group.ops) {
+    builder.setInsertionPoint(op);
+    SmallVector<Value> operands;
+    for (Value operand : op->getOperands()) {
+      if (Value mapped = mapping.lookupOrNull(operand)) {
+        operands.push_back(mapped);
+        continue;
+      }
+      auto type = cast<RankedTensorType>(operand.getType());
+      auto newType = RankedTensorType::get(
+          applyPermutation(type.getShape(), layout), type.getElementType());
+      DenseElementsAttr attr;
+      if (matchPattern(operand, m_Constant(&attr))) {
+        DenseElementsAttr folded =
+            attr.isSplat() ? attr.resizeSplat(newType)
+                           : constFoldTranspose(attr, layout, newType);
+        if (folded) {
+          operands.push_back(builder.create<stablehlo::ConstantOp>(
+              operand.getLoc(), folded));
+          continue;
+        }
+      }
+      operands.push_back(builder.create<stablehlo::TransposeOp>(
+          operand.getLoc(), operand, layout));
+    }
+
+    Operation *newOp = builder.clone(*op);
+    newOp->setOperands(operands);
+    auto type = cast<RankedTensorType>(op->getResult(0).getType());
+    newOp->getResult(0).setType(RankedTensorType::get(
+        applyPermutation(type.getShape(), layout), type.getElementType()));
+    mapping.map(op->getResult(0), newOp->getResult(0));
+    replaced.emplace_back(op, newOp);
+  }
+
+  for (auto [op, newOp] : replaced) {
+    Value result = op->getResult(0);
+    if (llvm::all_of(result.getUsers(),
+                     [&](Operation *user) { return members.contains(user); }))
+      continue;
+    builder.setInsertionPointAfter(newOp);
+    Value restored = builder.create<stablehlo::TransposeOp>(
+        op->getLoc(), newOp->getResult(0), inverse);
+    result.replaceUsesWithIf(restored, [&](OpOperand &use) {
+      return !members.contains(use.getOwner());
+    });
+  }
+
+  for (auto &[op, newOp] : llvm::reverse(replaced))
+    op->erase();
+}
+
+void LayoutSolver::rewrite() {
+  for (auto &group : groups)
+    if (!isIdentityPermutation(group.layout))
+      rewrite(group);
+}
+
+// Folds transpose(transpose(x)) chains, which the rewrite creates at every
+// boundary of a group, and erases transposes left without users.
+static void foldTransposeChains(Operation *root) {
+  SmallVector<stablehlo::TransposeOp> transposes;
+  root->walk(
+      [&](stablehlo::TransposeOp transpose) { transposes.push_back(transpose); });
+
+  for (auto transpose : transposes) {
+    auto inner = transpose.getOperand().getDefiningOp<stablehlo::TransposeOp>();
+    if (!inner)
+      continue;
+    Permutation perm =
+        compose(inner.getPermutation(), transpose.getPermutation());
+    if (isIdentityPermutation(perm)) {
+      transpose.getResult().replaceAllUsesWith(inner.getOperand());
+    } else {
+      transpose.getOperandMutable().assign(inner.getOperand());
+      transpose.setPermutationAttr(
+          DenseI64ArrayAttr::get(transpose.getContext(), perm));
+    }
+  }
+
+  for (auto transpose : llvm::reverse(transposes))
+    if (transpose->use_empty())
+      transpose->erase();
+}
+
+struct TransposeLayoutPass
+    : public enzyme::impl::TransposeLayoutPassBase<TransposeLayoutPass> {
+  using TransposeLayoutPassBase::TransposeLayoutPassBase;
+
+  void runOnOperation() override {
+    LayoutSolver solver(getOperation());
+    unsigned numChanged = solver.solve();
+    if (numChanged == 0) {
+      markAllAnalysesPreserved();
+      return;
+    }
+    numLayoutsChanged += numChanged;
+    solver.rewrite();
+    foldTransposeChains(getOperation());
+  }
+};
+
+} // end anonymous namespace
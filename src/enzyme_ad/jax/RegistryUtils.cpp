@@ -313,6 +313,7 @@ void initializePasses() {
   // Transform dialect and extensions.
   mlir::transform::registerInterpreterPass();
   mlir::enzyme::registerGenerateApplyPatternsPass();
+  mlir::enzyme::registerApplyPatternsPass();
   mlir::enzyme::registerRemoveTransformPass();
 
   // shardy passes
@@ -14,8 +14,10 @@
 #include "mlir/Dialect/Transform/IR/TransformOps.h"
 #include "mlir/Dialect/Transform/IR/TransformTypes.h"
 #include "mlir/Pass/Pass.h"
+#include "mlir/Transforms/GreedyPatternRewriteDriver.h"
 #include "src/enzyme_ad/jax/Dialect/Dialect.h"
 #include "src/enzyme_ad/jax/Dialect/Ops.h"
+#include "src/enzyme_ad/jax/Passes/EnzymeHLOPatterns.h"
 #include "src/enzyme_ad/jax/TransformOps/TransformOps.h"
 
 using namespace mlir;
@@ -231,6 +233,67 @@ public:
   Option<bool> createModule{*this, "create-module", llvm::cl::init(false)};
 };
 
+// Applies the same pattern list as `enzyme-hlo-generate-td{patterns=...}`
+// followed by the transform interpreter, without materializing the transform
+// script. The frozen pattern set is built once per context and pattern list and
+// shared by every instance of this pass.
+class ApplyPatternsPass
+    : public PassWrapper<ApplyPatternsPass, OperationPass<>> {
+public:
+  MLIR_DEFINE_EXPLICIT_INTERNAL_INLINE_TYPE_ID(ApplyPatternsPass)
+
+  ApplyPatternsPass() = default;
+  ApplyPatternsPass(const ApplyPatternsPass &other)
+      : PassWrapper<ApplyPatternsPass, OperationPass<>>(other) {}
+
+  StringRef getArgument() const override { return "enzyme-hlo-apply-patterns"; }
+
+  void getDependentDialects(DialectRegistry &registry) const override {
+    registry.insert<transform::TransformDialect>();
+    registry.insert<enzymexla::EnzymeXLADialect>();
+    registry.insert<enzyme::EnzymeDialect>();
+  }
+
+  LogicalResult initialize(MLIRContext *context) override {
+    auto *dialect = context->getLoadedDialect<enzymexla::EnzymeXLADialect>();
+    frozenPatterns = dialect->getOrCreatePatternSet(
+        patterns.getValue(), [&]() -> FailureOr<FrozenRewritePatternSet> {
+          // Build the transform script in a scratch module and collect the
+          // patterns each descriptor op would populate.
+          OpBuilder builder(context);
+          OwningOpRef<ModuleOp> scratch =
+              ModuleOp::create(builder.getUnknownLoc());
+          builder.setInsertionPointToStart(scratch->getBody());
+          if (failed(parseTransform(builder, scratch->getLoc(), patterns)))
+            return failure();
+
+          RewritePatternSet patternSet(context);
+          scratch->walk([&](transform::PatternDescriptorOpInterface op) {
+            op.populatePatterns(patternSet);
+          });
+          return FrozenRewritePatternSet(std::move(patternSet));
+        });
+    return success(frozenPatterns != nullptr);
+  }
+
+  void runOnOperation() override {
+    SmallVector<func::FuncOp> funcs;
+    getOperation()->walk([&](func::FuncOp func) { funcs.push_back(func); });
+    for (auto func : funcs) {
+      mlir::enzyme::CheckedPatternScope scope(func);
+      if (failed(applyPatternsAndFoldGreedily(func, *frozenPatterns))) {
+        func->emitError() << "greedy pattern application failed";
+        return signalPassFailure();
+      }
+    }
+  }
+
+  Option<std::string> patterns{*this, "patterns", llvm::cl::init("")};
+
+private:
+  std::shared_ptr<const FrozenRewritePatternSet> frozenPatterns;
+};
+
 class RemoveTransform : public PassWrapper<RemoveTransform, OperationPass<>> {
 public:
   MLIR_DEFINE_EXPLICIT_INTERNAL_INLINE_TYPE_ID(RemoveTransform)
@@ -258,6 +321,10 @@ void mlir::enzyme::registerGenerateApplyPatternsPass() {
   PassRegistration<GenerateApplyPatternsPass>();
 }
 
+void mlir::enzyme::registerApplyPatternsPass() {
+  PassRegistration<ApplyPatternsPass>();
+}
+
 void mlir::enzyme::registerRemoveTransformPass() {
   PassRegistration<RemoveTransform>();
 }
@@ -76,6 +76,11 @@ void ApplyWhileLICMPatterns::populatePatterns(RewritePatternSet &patterns) {
   addWhileLICM(patterns, getParameter(), *getContext(),
                PatternBenefit(getBenefit().value_or(0)));
 }
+void ApplyWhileReduceScanPatterns::populatePatterns(
+    RewritePatternSet &patterns) {
+  addWhileReduceScan(patterns, getParameter(), *getContext(),
+                     PatternBenefit(getBenefit().value_or(1)));
+}
 void ApplySliceLICMPatterns::populatePatterns(RewritePatternSet &patterns) {
   addSliceLICM(patterns, getParameter(), *getContext(),
                PatternBenefit(getBenefit().value_or(1)));
@@ -120,6 +125,11 @@ void ApplyConcatConstPropPatterns::populatePatterns(
   addConcatConstProp(patterns, getParameter(), *getContext(),
                      PatternBenefit(getBenefit().value_or(1)));
 }
+void ApplyReduceConstPropPatterns::populatePatterns(
+    RewritePatternSet &patterns) {
+  addReduceConstProp(patterns, getParameter(), *getContext(),
+                     PatternBenefit(getBenefit().value_or(1)));
+}
 void ApplyPadSimplifyPatterns::populatePatterns(RewritePatternSet &patterns) {
   addPadSimplify(patterns, getParameter(), *getContext(),
                  PatternBenefit(getBenefit().value_or(1)));
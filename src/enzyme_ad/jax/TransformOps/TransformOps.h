@@ -21,6 +21,7 @@ void registerEnzymeJaxTransformExtension(mlir::DialectRegistry &registry);
 SmallVector<StringRef> getTransformOperationNames();
 
 void registerGenerateApplyPatternsPass();
+void registerApplyPatternsPass();
 void registerRemoveTransformPass();
 } // namespace enzyme
 } // namespace mlir
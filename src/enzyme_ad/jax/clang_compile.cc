@@ -11,13 +11,16 @@
 
 #include <cstring>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string>
 #include <sys/time.h>
 #include <unistd.h>
+#include <vector>
 
 #include "clang/CodeGen/CodeGenAction.h"
 #include "llvm-c/Core.h"
@@ -52,6 +55,7 @@
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/CompilerInvocation.h"
 #include "clang/Frontend/FrontendOptions.h"
+#include "clang/Frontend/PrecompiledPreamble.h"
 #include "clang/Frontend/TextDiagnosticBuffer.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
 #include "clang/Frontend/Utils.h"
@@ -167,6 +171,148 @@ static TargetMachine *GetTargetMachine(llvm::Triple TheTriple, StringRef CPUStr,
       codegen::getExplicitCodeModel(), level);
 }
 
+// Headers every C++ kernel is compiled against. These are parsed once into a
+// precompiled preamble per set of compiler flags and reused by later compiles.
+static constexpr const char EnzymePrelude[] = R"(#include <stdint.h>
+#include <cstdint>
+#include <tuple>
+#include <enzyme/tensor>
+#include <enzyme/utils>
+)";
+
+// Returns the cached precompiled preamble for the given cc1 arguments, building
+// it on first use. Returns nullptr if the preamble could not be built, in which
+// case the caller compiles without it.
+static std::shared_ptr<PrecompiledPreamble>
+getEnzymePreamble(const CompilerInvocation &Invocation,
+                  ArrayRef<const char *> Args, const llvm::MemoryBuffer &Main,
+                  PreambleBounds Bounds, DiagnosticsEngine &Diags,
+                  IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS) {
+  static std::mutex mutex;
+  static std::map<std::string, std::shared_ptr<PrecompiledPreamble>> cache;
+
+  // The input file name is the first argument and differs per kernel, it does
+  // not influence the preamble.
+  std::string key;
+  for (auto arg : Args.drop_front()) {
+    key += arg;
+    key += '\0';
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = cache.find(key);
+    if (found != cache.end()) {
+      if (!found->second ||
+          found->second->CanReuse(Invocation, Main.getMemBufferRef(), Bounds,
+                                   *VFS))
+        return found->second;
+      cache.erase(found);
+    }
+  }
+
+  // Build without holding the lock, so that compiles with other flags are not
+  // held up. Concurrent builds for the same flags keep the first result.
+  PreambleCallbacks Callbacks;
+  auto Preamble = PrecompiledPreamble::Build(
+      Invocation, &Main, Bounds, Diags, VFS,
+      std::make_shared<PCHContainerOperations>(),
+      /*StoreInMemory*/ true, /*StoragePath*/ "", Callbacks);
+  std::shared_ptr<PrecompiledPreamble> result;
+  if (Preamble)
+    result = std::make_shared<PrecompiledPreamble>(std::move(*Preamble));
+
+  std::lock_guard<std::mutex> lock(mutex);
+  return cache.try_emplace(key, result).first->second;
+}
+
+// A default<O3> pipeline for a given target. Pass managers cannot run several
+// modules at once, so pipelines are pooled per target: a compile takes a free
+// one (or builds a new one) and returns it when done, and concurrent compiles
+// only contend on the pool itself. Analysis managers are created per module.
+struct CachedO3Pipeline {
+  std::unique_ptr<TargetMachine> TM;
+  PipelineTuningOptions PTO;
+  PassInstrumentationCallbacks PIC;
+  std::unique_ptr<PassBuilder> PB;
+  ModulePassManager MPM;
+};
+
+static std::mutex O3PipelinesMutex;
+static std::map<std::string, std::vector<std::unique_ptr<CachedO3Pipeline>>>
+    O3Pipelines;
+
+static std::unique_ptr<CachedO3Pipeline>
+acquireO3Pipeline(const llvm::Triple &triple) {
+  {
+    std::lock_guard<std::mutex> lock(O3PipelinesMutex);
+    auto &pool = O3Pipelines[triple.str()];
+    if (!pool.empty()) {
+      auto pipeline = std::move(pool.back());
+      pool.pop_back();
+      return pipeline;
+    }
+  }
+
+  auto pipeline = std::make_unique<CachedO3Pipeline>();
+  auto ETM = llvm::orc::JITTargetMachineBuilder(triple).createTargetMachine();
+  if (!ETM) {
+    throw nanobind::value_error("failed to create targetmachine");
+  }
+  pipeline->TM = std::move(ETM.get());
+
+  std::optional<PGOOptions> PGOOpt;
+  pipeline->PB = std::make_unique<PassBuilder>(
+      pipeline->TM.get(), pipeline->PTO, PGOOpt, &pipeline->PIC);
+
+  augmentPassBuilder(*pipeline->PB);
+
+  if (Error Err =
+          pipeline->PB->parsePassPipeline(pipeline->MPM, "default<O3>")) {
+    throw nanobind::value_error(
+        (Twine("failed to parse pass pipeline: ") + toString(std::move(Err)))
+            .str()
+            .c_str());
+  }
+  return pipeline;
+}
+
+static void releaseO3Pipeline(const llvm::Triple &triple,
+                              std::unique_ptr<CachedO3Pipeline> pipeline) {
+  std::lock_guard<std::mutex> lock(O3PipelinesMutex);
+  O3Pipelines[triple.str()].push_back(std::move(pipeline));
+}
+
+// Whether the C++ source has an include directive for one of the in-memory
+// enzyme headers. Mentions elsewhere, e.g. in comments, do not count.
+static bool includesEnzymeHeader(StringRef source) {
+  SmallVector<StringRef> lines;
+  source.split(lines, '\n');
+  for (StringRef line : lines) {
+    line = line.ltrim();
+    if (!line.consume_front("#"))
+      continue;
+    line = line.ltrim();
+    if (!line.consume_front("include"))
+      continue;
+    line = line.ltrim();
+    if (line.starts_with("<enzyme/") || line.starts_with("\"enzyme/"))
+      return true;
+  }
+  return false;
+}
+
+// Escapes a file name for use in a string literal, e.g. a #line directive.
+static std::string escapeFileName(StringRef filename) {
+  std::string escaped;
+  for (char c : filename) {
+    if (c == '\\' || c == '"')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped;
+}
+
 std::unique_ptr<llvm::Module>
 GetLLVMFromJob(std::string filename, std::string filecontents, bool cpp,
                ArrayRef<std::string> pyargv, LLVMContext *Context,
@@ -260,12 +406,28 @@ GetLLVMFromJob(std::string filename, std::string filecontents, bool cpp,
   y2k.tm_mday = 1;
   time_t timer = mktime(&y2k);
 
+  // Kernels using the enzyme headers get them from a precompiled preamble. The
+  // prelude is prepended to the source and the line directive keeps
+  // diagnostics pointing at the user's code.
+  bool usePreamble = cpp && includesEnzymeHeader(filecontents);
+  std::string mainContents;
+  if (usePreamble) {
+    mainContents = EnzymePrelude;
+    mainContents += "#line 1 \"" + escapeFileName(filename) + "\"\n";
+  }
+  PreambleBounds Bounds(mainContents.size(),
+                        /*PreambleEndsAtStartOfLine*/ true);
+  mainContents += filecontents;
+
+  auto mainBuffer = llvm::MemoryBuffer::getMemBuffer(
+      mainContents, filename, /*RequiresNullTerminator*/ false);
   fs->addFile(filename, timer,
               llvm::MemoryBuffer::getMemBuffer(
-                  filecontents, filename, /*RequiresNullTerminator*/ false));
+                  mainContents, filename, /*RequiresNullTerminator*/ false));
   fs->addFile("/enzyme/enzyme/utils", timer,
               llvm::MemoryBuffer::getMemBuffer(
                   R"(
+#pragma once
 namespace enzyme {
   template<typename RT=void, typename... Args>
   RT __enzyme_fwddiff(Args...);
@@ -290,6 +452,7 @@ extern "C" int enzyme_allocated;
   fs->addFile("/enzyme/enzyme/tensor", timer,
               llvm::MemoryBuffer::getMemBuffer(
                   R"(
+#pragma once
 #include <stdint.h>
 #include <tuple>
 namespace enzyme {
@@ -481,8 +644,6 @@ struct tensor<T, n0, N...>
   fuseFS->pushOverlay(fs);
   fuseFS->pushOverlay(baseFS);
 
-  Clang->createFileManager(fuseFS);
-
   bool Success = CompilerInvocation::CreateFromArgs(
       Clang->getInvocation(), Argv.getArguments(), Diags, binary);
 
@@ -492,8 +653,19 @@ struct tensor<T, n0, N...>
     Clang->getHeaderSearchOpts().ResourceDir =
         CompilerInvocation::GetResourcesPath(binary, /*MainAddr*/ 0x0);
 
+  IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS = fuseFS;
+  if (Success && usePreamble) {
+    if (auto Preamble =
+            getEnzymePreamble(Clang->getInvocation(), Argv.getArguments(),
+                              *mainBuffer, Bounds, Diags0, VFS))
+      Preamble->AddImplicitPreamble(Clang->getInvocation(), VFS,
+                                    mainBuffer.get());
+  }
+
+  Clang->createFileManager(VFS);
+
   // Create the actual diagnostics engine.
-  Clang->createDiagnostics(*fuseFS);
+  Clang->createDiagnostics(*VFS);
   if (!Clang->hasDiagnostics()) {
     llvm::errs() << " failed create diag\n";
     return {};
@@ -533,7 +705,6 @@ struct tensor<T, n0, N...>
     f.setLinkage(Function::LinkageTypes::InternalLinkage);
   }
 
-  PipelineTuningOptions PTO;
   LoopAnalysisManager LAM;
   FunctionAnalysisManager FAM;
   CGSCCAnalysisManager CGAM;
@@ -546,24 +717,8 @@ struct tensor<T, n0, N...>
       llvm::driver::createTLII(triple, Clang->getCodeGenOpts().getVecLib()));
   FAM.registerPass([&] { return TargetLibraryAnalysis(*TLII); });
 
-  auto level = CodeGenOptLevel::Aggressive; // OptimizationLevel::O3;
-
-  Triple ModuleTriple(mod->getTargetTriple());
-  std::string CPUStr, FeaturesStr;
-
-  auto ETM =
-      llvm::orc::JITTargetMachineBuilder(llvm::Triple(mod->getTargetTriple()))
-          .createTargetMachine();
-  if (!ETM) {
-    throw nanobind::value_error("failed to create targetmachine");
-  }
-  auto TM = std::move(ETM.get());
-
-  std::optional<PGOOptions> PGOOpt;
-  PassInstrumentationCallbacks PIC;
-  PassBuilder PB(TM.get(), PTO, PGOOpt, &PIC);
-
-  augmentPassBuilder(PB);
+  auto pipeline = acquireO3Pipeline(triple);
+  auto &PB = *pipeline->PB;
 
   // Register all the basic analyses with the managers.
   PB.registerModuleAnalyses(MAM);
@@ -572,14 +727,8 @@ struct tensor<T, n0, N...>
   PB.registerLoopAnalyses(LAM);
   PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
 
-  ModulePassManager MPM;
-  if (Error Err = PB.parsePassPipeline(MPM, "default<O3>")) {
-    throw nanobind::value_error(
-        (Twine("failed to parse pass pipeline: ") + toString(std::move(Err)))
-            .str()
-            .c_str());
-  }
-  MPM.run(*mod, MAM);
+  pipeline->MPM.run(*mod, MAM);
+  releaseO3Pipeline(triple, std::move(pipeline));
 
   auto F = mod->getFunction("prevent_stores");
   if (F) {
@@ -1,6 +1,17 @@
+#include "xla/ffi/api/ffi.h"
+#include "xla/ffi/ffi_api.h"
 #include "xla/service/custom_call_status.h"
 #include "xla/service/custom_call_target_registry.h"
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #if (defined(_WIN32) || defined(__CYGWIN__)) &&                                \
     !defined(MLIR_CAPI_ENABLE_WINDOWS_DLL_DECLSPEC)
@@ -44,10 +55,255 @@ void forwarding_custom_call(void *out, const void **in, const void *opaque_ptr,
   }
 }
 
+namespace {
+
+// Workers running the asynchronous kernels. They are separate from the
+// threads of XLA, which keep executing the independent parts of the program
+// while a kernel runs.
+class KernelThreadPool {
+public:
+  static KernelThreadPool &get() {
+    // Leaked on purpose, the workers never exit.
+    static KernelThreadPool *pool = new KernelThreadPool(getNumThreads());
+    return *pool;
+  }
+
+  // The kernels already run their parallel loops on all cores with OpenMP,
+  // so a couple of workers overlap them with XLA without oversubscribing the
+  // cores. ENZYMEXLA_CPU_ASYNC_THREADS sets another number, up to the number
+  // of cores.
+  static unsigned getNumThreads() {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    if (const char *env = getenv("ENZYMEXLA_CPU_ASYNC_THREADS")) {
+      long requested = strtol(env, nullptr, 10);
+      if (requested > 0)
+        return std::min<unsigned long>(requested, cores);
+    }
+    return std::min(2u, cores);
+  }
+
+  void schedule(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+    }
+    available.notify_one();
+  }
+
+private:
+  explicit KernelThreadPool(unsigned numThreads) {
+    for (unsigned i = 0; i < numThreads; i++)
+      std::thread([this] { work(); }).detach();
+  }
+
+  void work() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return !tasks.empty(); });
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable available;
+  std::deque<std::function<void()>> tasks;
+};
+
+XLA_FFI_Error *skip_stage(XLA_FFI_CallFrame *call_frame) { return nullptr; }
+
+struct CpuKernelWrapper {
+  void *run;
+};
+
+void noop(void *) {}
+
+// The internal API, and so the execution state, is only compatible with the
+// XLA this library is linked with. Handlers registered with another one, such
+// as that of jaxlib, resolve the kernel from the backend config every time.
+bool isLinkedXla(XLA_FFI_CallFrame *call_frame) {
+  return call_frame->api == xla::ffi::GetXlaFfiApi();
+}
+
+xla::ffi::ExecutionState *getExecutionState(XLA_FFI_CallFrame *call_frame) {
+  auto internal_api = call_frame->api->internal_api;
+  return reinterpret_cast<xla::ffi::ExecutionState *>(
+      internal_api->XLA_FFI_INTERNAL_ExecutionState_Get(call_frame->ctx));
+}
+
+// If passed a call frame with the metadata extension, fills in the metadata
+// and returns true.
+bool getMetadata(XLA_FFI_CallFrame *call_frame) {
+  if (call_frame->extension_start == nullptr ||
+      call_frame->extension_start->type != XLA_FFI_Extension_Metadata)
+    return false;
+  auto extension = reinterpret_cast<XLA_FFI_Metadata_Extension *>(
+      call_frame->extension_start);
+  extension->metadata->api_version = XLA_FFI_Api_Version{
+      XLA_FFI_Api_Version_STRUCT_SIZE,
+      /*extension_start=*/nullptr,
+      XLA_FFI_API_MAJOR,
+      XLA_FFI_API_MINOR,
+  };
+  return true;
+}
+
+// Resolves the kernel from the backend config once per executable, instead
+// of on every execution.
+template <bool withError>
+decltype(CallInfo<withError>::run)
+getKernelFromConfig(XLA_FFI_CallFrame *call_frame) {
+  assert(call_frame->attrs.size == 1);
+  assert(call_frame->attrs.types[0] == XLA_FFI_AttrType_STRING);
+
+  auto *bspan =
+      reinterpret_cast<XLA_FFI_ByteSpan *>(call_frame->attrs.attrs[0]);
+  return reinterpret_cast<const CallInfo<withError> *>(bspan->ptr)->run;
+}
+
+template <bool withError>
+XLA_FFI_Error *instantiate(XLA_FFI_CallFrame *call_frame) {
+  if (!isLinkedXla(call_frame))
+    return nullptr;
+
+  (void)getExecutionState(call_frame)->Set(
+      xla::ffi::TypeIdRegistry::GetTypeId<CpuKernelWrapper>(),
+      (void *)getKernelFromConfig<withError>(call_frame), noop);
+  return nullptr;
+}
+
+template <bool withError>
+decltype(CallInfo<withError>::run) getKernel(XLA_FFI_CallFrame *call_frame) {
+  if (!isLinkedXla(call_frame))
+    return getKernelFromConfig<withError>(call_frame);
+  return (decltype(CallInfo<withError>::run))getExecutionState(call_frame)
+      ->Get<CpuKernelWrapper>()
+      .value();
+}
+
+XLA_FFI_Error *createError(const XLA_FFI_Api *api, char *err) {
+  XLA_FFI_Error_Create_Args error_args = {
+      XLA_FFI_Error_Create_Args_STRUCT_SIZE,
+      /*extension_start=*/nullptr,
+      /*message=*/err,
+      /*errc=*/XLA_FFI_Error_Code_INTERNAL};
+  return api->XLA_FFI_Error_Create(&error_args);
+}
+
+template <bool withError>
+XLA_FFI_Error *execute(XLA_FFI_CallFrame *call_frame) {
+  if (getMetadata(call_frame))
+    return nullptr;
+
+  auto run = getKernel<withError>(call_frame);
+
+  // Same layout as the inputs of the legacy custom call, the results alias
+  // the operands.
+  std::vector<const void *> ptrs(call_frame->args.size);
+  for (size_t i = 0; i < ptrs.size(); i++)
+    ptrs[i] =
+        reinterpret_cast<XLA_FFI_Buffer *>(call_frame->args.args[i])->data;
+
+  if constexpr (withError) {
+    char *err = run(ptrs.data());
+    if (err)
+      return createError(call_frame->api, err);
+  } else {
+    run(ptrs.data());
+  }
+  return nullptr;
+}
+
+template <bool withError>
+XLA_FFI_Error *execute_async(XLA_FFI_CallFrame *call_frame) {
+  if (getMetadata(call_frame))
+    return nullptr;
+
+  auto run = getKernel<withError>(call_frame);
+
+  std::vector<const void *> ptrs(call_frame->args.size);
+  for (size_t i = 0; i < ptrs.size(); i++)
+    ptrs[i] =
+        reinterpret_cast<XLA_FFI_Buffer *>(call_frame->args.args[i])->data;
+
+  const XLA_FFI_Api *api = call_frame->api;
+  XLA_FFI_Future_Create_Args future_args = {
+      XLA_FFI_Future_Create_Args_STRUCT_SIZE,
+      /*extension_start=*/nullptr,
+      /*future=*/nullptr};
+  if (XLA_FFI_Error *err = api->XLA_FFI_Future_Create(&future_args))
+    return err;
+  XLA_FFI_Future *future = future_args.future;
+
+  // XLA keeps the buffers alive until the future is completed.
+  KernelThreadPool::get().schedule([api, run, future, ptrs]() mutable {
+    if constexpr (withError) {
+      char *err = run(ptrs.data());
+      if (err) {
+        XLA_FFI_Future_SetError_Args set_args = {
+            XLA_FFI_Future_SetError_Args_STRUCT_SIZE,
+            /*extension_start=*/nullptr, future, createError(api, err)};
+        (void)api->XLA_FFI_Future_SetError(&set_args);
+        return;
+      }
+    } else {
+      run(ptrs.data());
+    }
+    XLA_FFI_Future_SetAvailable_Args set_args = {
+        XLA_FFI_Future_SetAvailable_Args_STRUCT_SIZE,
+        /*extension_start=*/nullptr, future};
+    (void)api->XLA_FFI_Future_SetAvailable(&set_args);
+  });
+
+  call_frame->future = future;
+  return nullptr;
+}
+
+struct NamedHandler {
+  const char *name;
+  XLA_FFI_Handler_Bundle bundle;
+};
+
+const NamedHandler handlers[] = {
+    {"enzymexla_compile_cpu",
+     {instantiate<false>, skip_stage, skip_stage, execute<false>}},
+    {"enzymexla_compile_cpu_with_error",
+     {instantiate<true>, skip_stage, skip_stage, execute<true>}},
+    {"enzymexla_compile_cpu_async",
+     {instantiate<false>, skip_stage, skip_stage, execute_async<false>}},
+    {"enzymexla_compile_cpu_async_with_error",
+     {instantiate<true>, skip_stage, skip_stage, execute_async<true>}},
+};
+
+} // namespace
+
 extern "C" MLIR_CAPI_EXPORTED void RegisterEnzymeXLACPUHandler() {
+  // The legacy targets still run modules lowered before the typed FFI ones.
   xla::CustomCallTargetRegistry::Global()->Register(
       "enzymexla_compile_cpu", (void *)&forwarding_custom_call<false>, "Host");
   xla::CustomCallTargetRegistry::Global()->Register(
       "enzymexla_compile_cpu_with_error", (void *)&forwarding_custom_call<true>,
       "Host");
+
+  for (const NamedHandler &handler : handlers)
+    xla::ffi::Ffi::RegisterStaticHandler(
+        xla::ffi::GetXlaFfiApi(), handler.name, "Host", handler.bundle,
+        /*XLA_FFI_Handler_Traits traits = */ 0);
+}
+
+// Returns the handlers of the typed FFI target `name`, for registering them
+// with another XLA, such as that of jaxlib.
+extern "C" MLIR_CAPI_EXPORTED bool
+GetEnzymeXLACPUHandler(const char *name, XLA_FFI_Handler_Bundle *bundle) {
+  for (const NamedHandler &handler : handlers) {
+    if (strcmp(handler.name, name) == 0) {
+      *bundle = handler.bundle;
+      return true;
+    }
+  }
+  return false;
 }
@@ -65,6 +65,7 @@
 #include "compile_with_xla.h"
 #include "xla/hlo/ir/hlo_casting_utils.h"
 #include "xla/hlo/ir/hlo_instructions.h"
+#include "xla/ffi/api/c_api.h"
 #include "xla/service/cpu/cpu_executable.h"
 
 #include "Enzyme/FunctionUtils.h"
@@ -1036,6 +1037,8 @@ void Callback(void *out, void **ins, void *opaque, size_t opaque_len,
 
 extern "C" void RegisterEnzymeXLAGPUHandler();
 extern "C" void RegisterEnzymeXLACPUHandler();
+extern "C" bool GetEnzymeXLACPUHandler(const char *name,
+                                       XLA_FFI_Handler_Bundle *bundle);
 
 NB_MODULE(enzyme_call, m) {
   llvm::InitializeAllTargets();
@@ -1066,6 +1069,7 @@ NB_MODULE(enzyme_call, m) {
   mlir::enzyme::registerenzymePasses();
   mlir::enzyme::registerenzymexlaPasses();
   mlir::enzyme::registerGenerateApplyPatternsPass();
+  mlir::enzyme::registerApplyPatternsPass();
   mlir::enzyme::registerRemoveTransformPass();
   mlir::stablehlo::registerPasses();
 
@@ -1266,6 +1270,22 @@ NB_MODULE(enzyme_call, m) {
   m.def("register_enzymexla_cpu_handler",
         []() { RegisterEnzymeXLACPUHandler(); });
 
+  // The handlers of a typed FFI cpu target, in the form expected by
+  // jax.ffi.register_ffi_target, to run them with the XLA of jaxlib.
+  m.def("get_enzymexla_cpu_handler", [](const std::string &name) {
+    XLA_FFI_Handler_Bundle bundle;
+    if (!GetEnzymeXLACPUHandler(name.c_str(), &bundle))
+      throw nanobind::value_error(
+          ("unknown enzymexla cpu target " + name).c_str());
+    nanobind::dict handlers;
+    handlers["instantiate"] =
+        nanobind::capsule(reinterpret_cast<void *>(bundle.instantiate),
+                          "xla._CUSTOM_CALL_TARGET");
+    handlers["execute"] = nanobind::capsule(
+        reinterpret_cast<void *>(bundle.execute), "xla._CUSTOM_CALL_TARGET");
+    return handlers;
+  });
+
   m.def("register_enzymexla_gpu_handler",
         []() { RegisterEnzymeXLAGPUHandler(); });
 
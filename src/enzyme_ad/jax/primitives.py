@@ -106,6 +106,8 @@ def optimization_passes(
     transpose_propagate: str = "up",
     reshape_propagate: str = "up",
     max_constant_threshold: int = 1024,
+    fft_convolution: bool = False,
+    reassociate: bool = False,
 ):
     transform_passes_list = [
         "compare_op_canon<16>",
@@ -118,6 +120,7 @@ def optimization_passes(
         "noop_reduce_op_canon<16>",
         "empty_reduce_op_canon<16>",
         "dynamic_reshape_op_canon<16>",
+        "noop_real_dynamic_slice<16>",
         "get_tuple_element_op_canon<16>",
         "real_op_canon<16>",
         "imag_op_canon<16>",
@@ -227,6 +230,7 @@ def optimization_passes(
         "unary_pad_push_exp<1>",
         "transpose_dot_reorder<1>",
         "dot_transpose<1>",
+        "dot_chain_reorder<1>",
         "transpose_convolution<1>",
         "convolution_transpose<1>",
         "convert_convert_float<1>",
@@ -279,6 +283,7 @@ def optimization_passes(
         "dus_concat",
         "slice_dus_to_concat",
         "while_induction_reduction",
+        "while_to_batch",
         "slice_licm(0)",
         "pad_licm(0)",
         "elementwise_licm(0)",
@@ -341,6 +346,7 @@ def optimization_passes(
         "reshape_insertions_broadcast_in_dim_simplify",
         "dot_general_reshape",
         "diagonal_tensor_dot_general_rewrite",
+        "structured_matrix_dot_general",
         "widen_wrap",
         "widen_extend",
         "elementwise_pad",
@@ -402,6 +408,7 @@ def optimization_passes(
         # other constant propagations
         "const_prop_through_barrier<16>",
         f"concat_const_prop<1>({max_constant_threshold})",
+        f"reduce_const_prop<1>({max_constant_threshold})",
         f"dynamic_update_slice_const_prop({max_constant_threshold})",
         "scatter_update_computation_const_prop",
         "gather_const_prop",
@@ -482,7 +489,7 @@ def optimization_passes(
             "reverse_transpose",
             "transpose_all_users_slice",
         ]
-    else:
+    elif transpose_propagate != "global":
         raise ValueError("Invalid value for transpose_propagate")
 
     if no_nan:
@@ -504,6 +511,13 @@ def optimization_passes(
             # "no_nan_zero_base_pow_simplify(0)",
         ]
 
+    # Rewriting accumulation loops into reductions reassociates floating point
+    # sums and products, integer ones and min/max are always rewritten.
+    if reassociate:
+        transform_passes_list += ["while_reduce_scan(1)"]
+    else:
+        transform_passes_list += ["while_reduce_scan(0)"]
+
     if all_finite:
         transform_passes_list += [
             "all_finite_is_finite",
@@ -512,15 +526,26 @@ def optimization_passes(
             "all_finite_is_neg_inf",
         ]
 
-    transform_passes = ",".join(
-        [
-            "enzyme-hlo-generate-td{patterns=" + ";".join(transform_passes_list) + "}",
-            "transform-interpreter",
-            "enzyme-hlo-remove-transform",
-        ]
+    # Spectral convolutions pay off for large kernels on CPU, GPUs have fast
+    # enough direct convolutions for them.
+    if fft_convolution:
+        transform_passes_list += ["convolution_to_fft"]
+
+    # The pattern set is frozen once per pattern list and reused by every
+    # occurrence of this pass in the pipeline.
+    transform_passes = (
+        "enzyme-hlo-apply-patterns{patterns=" + ";".join(transform_passes_list) + "}"
     )
 
-    func_passes = ",".join(["canonicalize", "cse", "canonicalize", transform_passes])
+    func_passes = ["canonicalize", "cse", "canonicalize", transform_passes]
+    if transpose_propagate == "global":
+        # Layouts are assigned over the whole function instead of pushing
+        # transposes in one direction; clean up the rewritten ops afterwards.
+        func_passes += ["enzyme-hlo-transpose-layout", transform_passes]
+    func_passes = ",".join(func_passes)
+    # Functions that went through this exact stage before and did not change
+    # since are skipped.
+    func_passes = 'incremental-pipeline{pipeline="' + func_passes + '"}'
 
     if inline:
         func_passes = (
@@ -538,6 +563,9 @@ def full_optimization_pass_pipeline(
     transpose_propagate: str = "up",
     reshape_propagate: str = "up",
     max_constant_threshold: int = 1024,
+    fft_convolution: bool = False,
+    reassociate: bool = False,
+    remat_budget: int = 0,
 ):
     opt_passes = optimization_passes(
         inline=inline,
@@ -545,6 +573,8 @@ def full_optimization_pass_pipeline(
         transpose_propagate=transpose_propagate,
         reshape_propagate=reshape_propagate,
         max_constant_threshold=max_constant_threshold,
+        fft_convolution=fft_convolution,
+        reassociate=reassociate,
     )
 
     enzyme_pass = 'enzyme{postpasses="arith-raise{stablehlo=true},canonicalize,cse,canonicalize,remove-unnecessary-enzyme-ops,enzyme-simplify-math,canonicalize,cse,canonicalize"}'
@@ -557,23 +587,27 @@ def full_optimization_pass_pipeline(
             transpose_propagate=transpose_propagate,
             reshape_propagate=reshape_propagate,
             max_constant_threshold=max_constant_threshold,
+            fft_convolution=fft_convolution,
+            reassociate=reassociate,
         )
 
-    return ",".join(
-        [
-            "mark-func-memory-effects",
-            opt_passes,
-            "enzyme-batch",
-            opt_passes,
-            enzyme_pass,
-            opt_passes,
-            "canonicalize",
-            "remove-unnecessary-enzyme-ops",
-            "enzyme-simplify-math",
-            opt_passes,
-            propagate_down_passes,
-        ]
-    )
+    passes = [
+        "mark-func-memory-effects",
+        opt_passes,
+        "enzyme-batch",
+        opt_passes,
+        enzyme_pass,
+        opt_passes,
+        "canonicalize",
+        "remove-unnecessary-enzyme-ops",
+        "enzyme-simplify-math",
+        opt_passes,
+        propagate_down_passes,
+    ]
+    # Recompute cheap values last, the optimizations above would CSE them.
+    if remat_budget > 0:
+        passes.append("enzyme-hlo-remat{budget=" + str(remat_budget) + "}")
+    return ",".join(p for p in passes if p)
 
 
 DefaultCPPPipeline = XLAPipeline()
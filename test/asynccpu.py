@@ -0,0 +1,100 @@
+import os
+
+os.environ.setdefault("ENZYMEXLA_CPU_ASYNC_THREADS", "2")
+
+from absl.testing import absltest
+import jax
+import jax.numpy as jnp
+from enzyme_ad.jax import hlo_call
+from enzyme_ad.jax import enzyme_call
+
+# jaxlib runs the program with its own XLA, so it needs the handlers of the
+# asynchronous targets registered with it too.
+for name in [
+    "enzymexla_compile_cpu_async",
+    "enzymexla_compile_cpu_async_with_error",
+]:
+    jax.ffi.register_ffi_target(
+        name, enzyme_call.get_enzymexla_cpu_handler(name), platform="cpu"
+    )
+
+ASYNC = "lower-jit{backend=cpu asyncCPU=true}"
+
+SQUARE = """
+module {
+  func.func private @square(%arg0: !llvm.ptr<1>) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c64 = arith.constant 64 : index
+    scf.for %i = %c0 to %c64 step %c1 {
+      %0 = arith.index_cast %i : index to i64
+      %1 = llvm.getelementptr inbounds %arg0[%0] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, f32
+      %2 = llvm.load %1 : !llvm.ptr<1> -> f32
+      %3 = llvm.fmul %2, %2 : f32
+      llvm.store %3, %1 : f32, !llvm.ptr<1>
+    }
+    return
+  }
+  func.func @main(%arg0: tensor<64xf32>) -> tensor<64xf32> {
+    %0 = enzymexla.jit_call @square (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xf32>) -> tensor<64xf32>
+    return %0 : tensor<64xf32>
+  }
+}
+"""
+
+CHECK = """
+module {
+  llvm.mlir.global external constant @negative_msg("negative input\\00") {addr_space = 0 : i32}
+  func.func private @check(%arg0: !llvm.ptr<1>) -> !llvm.ptr {
+    %0 = llvm.load %arg0 : !llvm.ptr<1> -> f32
+    %zero = llvm.mlir.constant(0.000000e+00 : f32) : f32
+    %1 = llvm.fcmp "olt" %0, %zero : f32
+    %2 = llvm.mlir.addressof @negative_msg : !llvm.ptr
+    %3 = llvm.mlir.zero : !llvm.ptr
+    %4 = llvm.select %1, %2, %3 : i1, !llvm.ptr
+    return %4 : !llvm.ptr
+  }
+  func.func @main(%arg0: tensor<4xf32>) -> tensor<4xf32> {
+    %0 = enzymexla.jit_call @check (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<4xf32>) -> tensor<4xf32>
+    return %0 : tensor<4xf32>
+  }
+}
+"""
+
+
+@jax.jit
+def square(x):
+    return hlo_call(x, source=SQUARE, passes=ASYNC)
+
+
+@jax.jit
+def check(x):
+    return hlo_call(x, source=CHECK, passes=ASYNC)
+
+
+class AsyncCPU(absltest.TestCase):
+    def test_square(self):
+        x = jnp.arange(64, dtype=jnp.float32)
+        self.assertTrue((jax.block_until_ready(square(x)) == x * x).all())
+
+    def test_concurrent(self):
+        # Several kernels in flight at once, more than there are workers.
+        xs = [jnp.full((64,), i, dtype=jnp.float32) for i in range(8)]
+        outs = [square(x) for x in xs]
+        for x, out in zip(xs, outs):
+            self.assertTrue((jax.block_until_ready(out) == x * x).all())
+
+    def test_error(self):
+        x = jnp.ones((4,), dtype=jnp.float32)
+        self.assertTrue((jax.block_until_ready(check(x)) == x).all())
+
+        with self.assertRaisesRegex(Exception, "negative input"):
+            jax.block_until_ready(check(-x))
+
+
+if __name__ == "__main__":
+    from test_utils import fix_paths
+
+    fix_paths()
+
+    absltest.main()
@@ -0,0 +1,85 @@
+"""Compares two benchmark result files written by the EnzymeJaxTest harness
+(see ENZYMEJAX_BENCH_RESULTS in test_utils.py) and flags regressions.
+
+A measurement regresses when its median run time grows by more than the
+threshold and the new median is also slower than the old 95th percentile, so
+that changes within the noise of the baseline are not reported. Compile times
+are sampled several times as well and compared the same way.
+
+    python bench_compare.py base.json new.json --threshold 0.1
+
+Exits with a non-zero status if any measurement regressed.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return {
+        (r["test"], r["pipeline"], r["backend"], r["mode"]): r
+        for r in data["results"]
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("base")
+    parser.add_argument("new")
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=0.1,
+        help="relative slowdown above which a change is a regression",
+    )
+    parser.add_argument(
+        "--no-compile",
+        action="store_true",
+        help="do not flag compile time regressions",
+    )
+    args = parser.parse_args()
+
+    base = load(args.base)
+    new = load(args.new)
+
+    regressions = 0
+    print(
+        "{:<20}\t{:<20}\t{:<10}\t{:<10}\t{:>12}\t{:>12}\t{:>8}\t{:>8}".format(
+            "test", "pipeline", "backend", "mode", "base", "new", "run", "compile"
+        )
+    )
+    for key in sorted(base.keys() & new.keys()):
+        old, cur = base[key], new[key]
+        run = cur["median"] / old["median"] - 1
+        comp = cur["compile"] / old["compile"] - 1
+        flags = []
+        if run > args.threshold and cur["median"] > old["p95"]:
+            flags.append("RUN REGRESSION")
+        if (
+            not args.no_compile
+            and comp > args.threshold
+            and cur["compile"] > old["compile_p95"]
+        ):
+            flags.append("COMPILE REGRESSION")
+        regressions += len(flags) != 0
+        print(
+            "{:<20}\t{:<20}\t{:<10}\t{:<10}\t{:>12.3e}\t{:>12.3e}\t{:>+8.1%}\t{:>+8.1%}\t{}".format(
+                *key, old["median"], cur["median"], run, comp, " ".join(flags)
+            )
+        )
+
+    for key in sorted(base.keys() - new.keys()):
+        print("missing in new results:", *key)
+    for key in sorted(new.keys() - base.keys()):
+        print("missing in base results:", *key)
+
+    if regressions:
+        print(regressions, "regression(s) above", "{:.0%}".format(args.threshold))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,315 @@
+//===- compile_bench.cpp - Compile time benchmarks of the passes ----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file times pass pipelines of enzymexlamlir-opt on synthetic modules of
+// growing size, and fits how their compile time scales. Run with e.g.
+//
+//   bazel run -c opt //test:compile_bench -- --benchmark_filter=EnzymeHLOOpt
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/DialectRegistry.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+#include "mlir/Pass/PassRegistry.h"
+#include "src/enzyme_ad/jax/RegistryUtils.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "benchmark/benchmark.h"
+
+#include <string>
+
+using namespace mlir;
+
+namespace {
+
+// A context with all the dialects, interfaces and passes of
+// enzymexlamlir-opt. Multithreading is disabled for stable timings.
+MLIRContext &getContext() {
+  static MLIRContext *context = [] {
+    DialectRegistry registry;
+    enzyme::prepareRegistry(registry);
+    enzyme::registerDialects(registry);
+    enzyme::registerInterfaces(registry);
+    enzyme::initializePasses();
+    auto *context = new MLIRContext(registry);
+    context->disableMultithreading();
+    context->loadAllAvailableDialects();
+    return context;
+  }();
+  return *context;
+}
+
+// Times `pipeline` on the module parsed from `source`. Parsing is not timed.
+void runPipeline(benchmark::State &state, StringRef pipeline,
+                 const std::string &source) {
+  MLIRContext &context = getContext();
+  PassManager pm(&context);
+  if (failed(parsePassPipeline(pipeline, pm, llvm::errs()))) {
+    state.SkipWithError("invalid pass pipeline");
+    return;
+  }
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    OwningOpRef<ModuleOp> module =
+        parseSourceString<ModuleOp>(source, ParserConfig(&context));
+    if (!module) {
+      state.SkipWithError("invalid module");
+      return;
+    }
+    state.ResumeTiming();
+
+    if (failed(pm.run(*module))) {
+      state.SkipWithError("pipeline failed");
+      return;
+    }
+  }
+  state.SetComplexityN(state.range(0));
+}
+
+// A function with `numOps` elementwise ops, slices with concatenates and
+// transposes, in chains of `depth` ops.
+std::string generateStableHLO(int64_t numOps, int64_t depth) {
+  std::string source;
+  llvm::raw_string_ostream os(source);
+  os << "func.func @main(%arg0: tensor<64x64xf32>) -> tensor<64x64xf32> {\n";
+  os << "  %v0 = stablehlo.add %arg0, %arg0 : tensor<64x64xf32>\n";
+  int64_t last = 0;
+  for (int64_t i = 1; i < numOps; i++) {
+    int64_t prev = i % depth == 0 ? 0 : i - 1;
+    switch (i % 4) {
+    case 0:
+      os << "  %v" << i << " = stablehlo.multiply %v" << prev << ", %v"
+         << prev << " : tensor<64x64xf32>\n";
+      break;
+    case 1:
+      os << "  %s" << i << " = stablehlo.slice %v" << prev
+         << " [0:32, 0:64] : (tensor<64x64xf32>) -> tensor<32x64xf32>\n";
+      os << "  %t" << i << " = stablehlo.slice %v" << prev
+         << " [32:64, 0:64] : (tensor<64x64xf32>) -> tensor<32x64xf32>\n";
+      os << "  %v" << i << " = stablehlo.concatenate %t" << i << ", %s" << i
+         << ", dim = 0 : (tensor<32x64xf32>, tensor<32x64xf32>) -> "
+            "tensor<64x64xf32>\n";
+      break;
+    case 2:
+      os << "  %v" << i << " = stablehlo.transpose %v" << prev
+         << ", dims = [1, 0] : (tensor<64x64xf32>) -> tensor<64x64xf32>\n";
+      break;
+    default:
+      os << "  %v" << i << " = stablehlo.add %v" << prev << ", %v" << last
+         << " : tensor<64x64xf32>\n";
+      break;
+    }
+    last = i;
+  }
+  os << "  return %v" << last << " : tensor<64x64xf32>\n}\n";
+  return source;
+}
+
+// A function on an array sharded over `numDevices` devices, with `numOps`
+// slices along the sharded axis that are extended back to its size.
+std::string generateSharded(int64_t numOps, int64_t numDevices) {
+  std::string source;
+  llvm::raw_string_ostream os(source);
+  int64_t size = 20 * numDevices;
+  std::string type = "tensor<8x" + std::to_string(size) + "xf64>";
+  std::string sharding = "#sdy.sharding<@mesh, [{}, {\"x\"}]>";
+  std::string perValue =
+      "{sdy.sharding = #sdy.sharding_per_value<[<@mesh, [{}, {\"x\"}]>]>}";
+  os << "sdy.mesh @mesh = <[\"x\"=" << numDevices << "]>\n";
+  os << "func.func @main(%v0: " << type << " {sdy.sharding = " << sharding
+     << "}) -> (" << type << " {sdy.sharding = " << sharding << "}) {\n";
+  std::string sliceType = "tensor<8x" + std::to_string(size - 2) + "xf64>";
+  for (int64_t i = 1; i < numOps; i++) {
+    os << "  %s" << i << " = stablehlo.slice %v" << i - 1 << " [0:8, 1:"
+       << size - 1 << "] " << perValue << " : (" << type << ") -> "
+       << sliceType << "\n";
+    os << "  %v" << i << " = \"enzymexla.extend\"(%s" << i
+       << ") <{dimension = 1 : i64, lhs = 1 : i64, rhs = 1 : i64}> "
+       << perValue << " : (" << sliceType << ") -> " << type << "\n";
+  }
+  os << "  return %v" << numOps - 1 << " : " << type << "\n}\n";
+  return source;
+}
+
+// A kernel with `numNests` parallel loop nests of `depth` dimensions.
+std::string generateAffine(int64_t numNests, int64_t depth) {
+  std::string source;
+  llvm::raw_string_ostream os(source);
+  std::string shape, ivs, zeros, bounds, indices;
+  for (int64_t d = 0; d < depth; d++) {
+    std::string sep = d ? ", " : "";
+    shape += "16x";
+    ivs += sep + "%i" + std::to_string(d);
+    zeros += sep + "0";
+    bounds += sep + "16";
+    indices += sep + "%i" + std::to_string(d);
+  }
+  std::string type = "memref<" + shape + "f64, 1>";
+  os << "func.func private @kernel(%arg0: " << type << ", %arg1: " << type
+     << ") {\n";
+  for (int64_t n = 0; n < numNests; n++) {
+    std::string src = n % 2 ? "%arg1" : "%arg0";
+    std::string dst = n % 2 ? "%arg0" : "%arg1";
+    os << "  affine.parallel (" << ivs << ") = (" << zeros << ") to ("
+       << bounds << ") {\n";
+    os << "    %a = affine.load " << src << "[" << indices << "] : " << type
+       << "\n";
+    os << "    %b = affine.load " << dst << "[" << indices << "] : " << type
+       << "\n";
+    os << "    %c = arith.mulf %a, %b : f64\n";
+    os << "    %d = arith.addf %c, %a : f64\n";
+    os << "    affine.store %d, " << dst << "[" << indices << "] : " << type
+       << "\n";
+    os << "  }\n";
+  }
+  os << "  return\n}\n";
+  return source;
+}
+
+// A function with `numAllocas` scalar allocas, each stored in and loaded
+// from in `depth` nested conditionals.
+std::string generateAllocas(int64_t numAllocas, int64_t depth) {
+  std::string source;
+  llvm::raw_string_ostream os(source);
+  os << "func.func @main(%arg0: f64, %cond: i1) -> f64 {\n";
+  os << "  %v0 = arith.addf %arg0, %arg0 : f64\n";
+  for (int64_t i = 1; i < numAllocas; i++) {
+    os << "  %m" << i << " = memref.alloca() : memref<f64>\n";
+    os << "  memref.store %v" << i - 1 << ", %m" << i << "[] : memref<f64>\n";
+    for (int64_t d = 0; d < depth; d++)
+      os << "  scf.if %cond {\n";
+    os << "  %x" << i << " = memref.load %m" << i << "[] : memref<f64>\n";
+    os << "  %y" << i << " = arith.mulf %x" << i << ", %x" << i << " : f64\n";
+    os << "  memref.store %y" << i << ", %m" << i << "[] : memref<f64>\n";
+    for (int64_t d = 0; d < depth; d++)
+      os << "  }\n";
+    os << "  %v" << i << " = memref.load %m" << i << "[] : memref<f64>\n";
+  }
+  os << "  return %v" << numAllocas - 1 << " : f64\n}\n";
+  return source;
+}
+
+// `numKernels` jit_calls of distinct cpu kernels.
+std::string generateJITCalls(int64_t numKernels) {
+  std::string source;
+  llvm::raw_string_ostream os(source);
+  for (int64_t i = 0; i < numKernels; i++) {
+    os << "func.func private @kern" << i << "(%arg0: !llvm.ptr<1>) {\n";
+    os << "  %0 = llvm.load %arg0 : !llvm.ptr<1> -> i64\n";
+    os << "  %1 = llvm.mul %0, %0 : i64\n";
+    os << "  llvm.store %1, %arg0 : i64, !llvm.ptr<1>\n";
+    os << "  return\n}\n";
+  }
+  std::string alias = "{output_operand_aliases = "
+                      "[#stablehlo.output_operand_alias<output_tuple_indices "
+                      "= [], operand_index = 0, operand_tuple_indices = []>]}";
+  os << "func.func @main(%v0: tensor<64xi64>) -> tensor<64xi64> {\n";
+  for (int64_t i = 0; i < numKernels; i++)
+    os << "  %v" << i + 1 << " = enzymexla.jit_call @kern" << i << " (%v" << i
+       << ") " << alias << " : (tensor<64xi64>) -> tensor<64xi64>\n";
+  os << "  return %v" << numKernels << " : tensor<64xi64>\n}\n";
+  return source;
+}
+
+void BM_EnzymeHLOOpt(benchmark::State &state, int64_t depth) {
+  runPipeline(state, "enzyme-hlo-opt",
+              generateStableHLO(state.range(0), depth));
+}
+
+// The same module with an additional function that disables the patterns, so
+// every match attempt has to look up its enclosing function. The difference
+// to BM_EnzymeHLOOpt is the cost of the checks CheckedPatternScope precomputes.
+void BM_EnzymeHLOOptDisabled(benchmark::State &state, int64_t depth) {
+  runPipeline(state, "enzyme-hlo-opt",
+              generateStableHLO(state.range(0), depth) +
+                  "func.func @disabled(%arg0: tensor<f32>) -> tensor<f32> "
+                  "attributes {enzymexla.disable_hlo_opts} {\n"
+                  "  return %arg0 : tensor<f32>\n}\n");
+}
+
+void BM_OptimizeCommunication(benchmark::State &state, int64_t numDevices) {
+  runPipeline(state, "optimize-communication",
+              generateSharded(state.range(0), numDevices));
+}
+
+void BM_RaiseAffineToStableHLO(benchmark::State &state, int64_t depth) {
+  runPipeline(state, "raise-affine-to-stablehlo",
+              generateAffine(state.range(0), depth));
+}
+
+void BM_PolygeistMem2Reg(benchmark::State &state, int64_t depth) {
+  runPipeline(state, "func.func(polygeist-mem2reg)",
+              generateAllocas(state.range(0), depth));
+}
+
+void BM_LowerJIT(benchmark::State &state) {
+  runPipeline(state, "lower-jit{jit=false backend=cpu}",
+              generateJITCalls(state.range(0)));
+}
+
+// The complexity is fitted to the size argument, separately for every
+// nesting depth.
+BENCHMARK_CAPTURE(BM_EnzymeHLOOpt, depth4, 4)
+    ->RangeMultiplier(4)
+    ->Range(64, 4096)
+    ->Unit(benchmark::kMillisecond)
+    ->Complexity();
+BENCHMARK_CAPTURE(BM_EnzymeHLOOpt, depth64, 64)
+    ->RangeMultiplier(4)
+    ->Range(64, 4096)
+    ->Unit(benchmark::kMillisecond)
+    ->Complexity();
+BENCHMARK_CAPTURE(BM_EnzymeHLOOptDisabled, depth4, 4)
+    ->RangeMultiplier(4)
+    ->Range(64, 4096)
+    ->Unit(benchmark::kMillisecond)
+    ->Complexity();
+BENCHMARK_CAPTURE(BM_OptimizeCommunication, devices4, 4)
+    ->RangeMultiplier(4)
+    ->Range(16, 1024)
+    ->Unit(benchmark::kMillisecond)
+    ->Complexity();
+BENCHMARK_CAPTURE(BM_OptimizeCommunication, devices16, 16)
+    ->RangeMultiplier(4)
+    ->Range(16, 1024)
+    ->Unit(benchmark::kMillisecond)
+    ->Complexity();
+BENCHMARK_CAPTURE(BM_RaiseAffineToStableHLO, depth1, 1)
+    ->RangeMultiplier(4)
+    ->Range(4, 256)
+    ->Unit(benchmark::kMillisecond)
+    ->Complexity();
+BENCHMARK_CAPTURE(BM_RaiseAffineToStableHLO, depth3, 3)
+    ->RangeMultiplier(4)
+    ->Range(4, 256)
+    ->Unit(benchmark::kMillisecond)
+    ->Complexity();
+BENCHMARK_CAPTURE(BM_PolygeistMem2Reg, depth1, 1)
+    ->RangeMultiplier(4)
+    ->Range(16, 1024)
+    ->Unit(benchmark::kMillisecond)
+    ->Complexity();
+BENCHMARK_CAPTURE(BM_PolygeistMem2Reg, depth4, 4)
+    ->RangeMultiplier(4)
+    ->Range(16, 1024)
+    ->Unit(benchmark::kMillisecond)
+    ->Complexity();
+BENCHMARK(BM_LowerJIT)
+    ->RangeMultiplier(4)
+    ->Range(4, 256)
+    ->Unit(benchmark::kMillisecond)
+    ->Complexity();
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,29 @@
+// RUN: enzymexlamlir-opt --enzyme-hlo-generate-td="patterns=convolution_to_fft" --transform-interpreter --enzyme-hlo-remove-transform %s | FileCheck %s
+
+// A 256-wide kernel over 1024 points is cheaper through the FFT.
+func.func @long_kernel(%x: tensor<1x1x1024xf32>, %w: tensor<1x1x256xf32>) -> tensor<1x1x769xf32> {
+  %0 = stablehlo.convolution(%x, %w) dim_numbers = [b, f, 0]x[o, i, 0]->[b, f, 0], window = {} {batch_group_count = 1 : i64, feature_group_count = 1 : i64} : (tensor<1x1x1024xf32>, tensor<1x1x256xf32>) -> tensor<1x1x769xf32>
+  return %0 : tensor<1x1x769xf32>
+}
+
+// CHECK-LABEL: func.func @long_kernel
+// CHECK-NOT:     stablehlo.convolution
+// CHECK:         %[[REV:.+]] = stablehlo.reverse %arg1, dims = [2] : tensor<1x1x256xf32>
+// CHECK-NEXT:    %[[W:.+]] = stablehlo.pad %[[REV]], %{{.+}}, low = [0, 0, 0], high = [0, 0, 768], interior = [0, 0, 0] : (tensor<1x1x256xf32>, tensor<f32>) -> tensor<1x1x1024xf32>
+// CHECK-NEXT:    %[[XF:.+]] = stablehlo.fft %arg0, type =  RFFT, length = [1024] : (tensor<1x1x1024xf32>) -> tensor<1x1x513xcomplex<f32>>
+// CHECK-NEXT:    %[[WF:.+]] = stablehlo.fft %[[W]], type =  RFFT, length = [1024] : (tensor<1x1x1024xf32>) -> tensor<1x1x513xcomplex<f32>>
+// CHECK-NEXT:    %[[PROD:.+]] = stablehlo.dot_general %[[XF]], %[[WF]], batching_dims = [2] x [2], contracting_dims = [1] x [1] : (tensor<1x1x513xcomplex<f32>>, tensor<1x1x513xcomplex<f32>>) -> tensor<513x1x1xcomplex<f32>>
+// CHECK-NEXT:    %[[T:.+]] = stablehlo.transpose %[[PROD]], dims = [1, 2, 0] : (tensor<513x1x1xcomplex<f32>>) -> tensor<1x1x513xcomplex<f32>>
+// CHECK-NEXT:    %[[Y:.+]] = stablehlo.fft %[[T]], type =  IRFFT, length = [1024] : (tensor<1x1x513xcomplex<f32>>) -> tensor<1x1x1024xf32>
+// CHECK-NEXT:    %[[RES:.+]] = stablehlo.slice %[[Y]] [0:1, 0:1, 255:1024] : (tensor<1x1x1024xf32>) -> tensor<1x1x769xf32>
+// CHECK-NEXT:    return %[[RES]]
+
+// Small kernels stay direct convolutions.
+func.func @short_kernel(%x: tensor<1x1x1024xf32>, %w: tensor<1x1x3xf32>) -> tensor<1x1x1022xf32> {
+  %0 = stablehlo.convolution(%x, %w) dim_numbers = [b, f, 0]x[o, i, 0]->[b, f, 0], window = {} {batch_group_count = 1 : i64, feature_group_count = 1 : i64} : (tensor<1x1x1024xf32>, tensor<1x1x3xf32>) -> tensor<1x1x1022xf32>
+  return %0 : tensor<1x1x1022xf32>
+}
+
+// CHECK-LABEL: func.func @short_kernel
+// CHECK-NOT:     stablehlo.fft
+// CHECK:         stablehlo.convolution
@@ -0,0 +1,47 @@
+// RUN: enzymexlamlir-opt --pass-pipeline="builtin.module(enzyme-hlo-generate-td{patterns=dot_chain_reorder},transform-interpreter,enzyme-hlo-remove-transform)" %s | FileCheck %s
+
+func.func @matvec(%a: tensor<64x64xf32>, %b: tensor<64x64xf32>, %v: tensor<64xf32>) -> tensor<64xf32> {
+  %0 = stablehlo.dot_general %a, %b, contracting_dims = [1] x [0] : (tensor<64x64xf32>, tensor<64x64xf32>) -> tensor<64x64xf32>
+  %1 = stablehlo.dot_general %0, %v, contracting_dims = [1] x [0] : (tensor<64x64xf32>, tensor<64xf32>) -> tensor<64xf32>
+  return %1 : tensor<64xf32>
+}
+
+// CHECK-LABEL: func.func @matvec
+// CHECK-NEXT:    %0 = stablehlo.dot_general %arg1, %arg2, contracting_dims = [1] x [0] : (tensor<64x64xf32>, tensor<64xf32>) -> tensor<64xf32>
+// CHECK-NEXT:    %1 = stablehlo.dot_general %arg0, %0, contracting_dims = [1] x [0] : (tensor<64x64xf32>, tensor<64xf32>) -> tensor<64xf32>
+// CHECK-NEXT:    return %1 : tensor<64xf32>
+
+func.func @transposed(%a: tensor<64x32xf32>, %b: tensor<16x64xf32>, %v: tensor<16xf32>) -> tensor<32xf32> {
+  %0 = stablehlo.transpose %b, dims = [1, 0] : (tensor<16x64xf32>) -> tensor<64x16xf32>
+  %1 = stablehlo.dot_general %a, %0, contracting_dims = [0] x [0] : (tensor<64x32xf32>, tensor<64x16xf32>) -> tensor<32x16xf32>
+  %2 = stablehlo.dot_general %1, %v, contracting_dims = [1] x [0] : (tensor<32x16xf32>, tensor<16xf32>) -> tensor<32xf32>
+  return %2 : tensor<32xf32>
+}
+
+// CHECK-LABEL: func.func @transposed
+// CHECK-NEXT:    %0 = stablehlo.dot_general %arg1, %arg2, contracting_dims = [0] x [0] : (tensor<16x64xf32>, tensor<16xf32>) -> tensor<64xf32>
+// CHECK-NEXT:    %1 = stablehlo.dot_general %arg0, %0, contracting_dims = [0] x [0] : (tensor<64x32xf32>, tensor<64xf32>) -> tensor<32xf32>
+// CHECK-NEXT:    return %1 : tensor<32xf32>
+
+func.func @batched(%a: tensor<4x8x128xf32>, %b: tensor<4x128x128xf32>, %c: tensor<4x128x2xf32>) -> tensor<4x8x2xf32> {
+  %0 = stablehlo.dot_general %a, %b, batching_dims = [0] x [0], contracting_dims = [2] x [1] : (tensor<4x8x128xf32>, tensor<4x128x128xf32>) -> tensor<4x8x128xf32>
+  %1 = stablehlo.dot_general %0, %c, batching_dims = [0] x [0], contracting_dims = [2] x [1] : (tensor<4x8x128xf32>, tensor<4x128x2xf32>) -> tensor<4x8x2xf32>
+  return %1 : tensor<4x8x2xf32>
+}
+
+// CHECK-LABEL: func.func @batched
+// CHECK-NEXT:    %0 = stablehlo.dot_general %arg1, %arg2, batching_dims = [0] x [0], contracting_dims = [2] x [1] : (tensor<4x128x128xf32>, tensor<4x128x2xf32>) -> tensor<4x128x2xf32>
+// CHECK-NEXT:    %1 = stablehlo.dot_general %arg0, %0, batching_dims = [0] x [0], contracting_dims = [2] x [1] : (tensor<4x8x128xf32>, tensor<4x128x2xf32>) -> tensor<4x8x2xf32>
+// CHECK-NEXT:    return %1 : tensor<4x8x2xf32>
+
+// Already optimal, left alone.
+func.func @optimal(%a: tensor<8x64xf32>, %b: tensor<64x64xf32>, %c: tensor<64x64xf32>) -> tensor<8x64xf32> {
+  %0 = stablehlo.dot_general %a, %b, contracting_dims = [1] x [0] : (tensor<8x64xf32>, tensor<64x64xf32>) -> tensor<8x64xf32>
+  %1 = stablehlo.dot_general %0, %c, contracting_dims = [1] x [0] : (tensor<8x64xf32>, tensor<64x64xf32>) -> tensor<8x64xf32>
+  return %1 : tensor<8x64xf32>
+}
+
+// CHECK-LABEL: func.func @optimal
+// CHECK-NEXT:    %0 = stablehlo.dot_general %arg0, %arg1, contracting_dims = [1] x [0]
+// CHECK-NEXT:    %1 = stablehlo.dot_general %0, %arg2, contracting_dims = [1] x [0]
+// CHECK-NEXT:    return %1
@@ -0,0 +1,120 @@
+// RUN: enzymexlamlir-opt --enzyme-hlo-opt %s | FileCheck %s
+
+func.func @transpose_transpose(%arg0: tensor<?x4xf32>) -> tensor<?x4xf32> {
+  %0 = stablehlo.transpose %arg0, dims = [1, 0] : (tensor<?x4xf32>) -> tensor<4x?xf32>
+  %1 = stablehlo.transpose %0, dims = [1, 0] : (tensor<4x?xf32>) -> tensor<?x4xf32>
+  return %1 : tensor<?x4xf32>
+}
+
+// CHECK-LABEL: func.func @transpose_transpose
+// CHECK-NEXT:    return %arg0 : tensor<?x4xf32>
+
+func.func @dimension_size(%arg0: tensor<?x4xf32>) -> (tensor<i32>, tensor<i32>, tensor<i32>) {
+  %0 = stablehlo.exponential %arg0 : tensor<?x4xf32>
+  %1 = stablehlo.transpose %0, dims = [1, 0] : (tensor<?x4xf32>) -> tensor<4x?xf32>
+  %2 = stablehlo.get_dimension_size %1, dim = 1 : (tensor<4x?xf32>) -> tensor<i32>
+  %3 = stablehlo.get_dimension_size %arg0, dim = 0 : (tensor<?x4xf32>) -> tensor<i32>
+  %4 = stablehlo.get_dimension_size %1, dim = 0 : (tensor<4x?xf32>) -> tensor<i32>
+  return %2, %3, %4 : tensor<i32>, tensor<i32>, tensor<i32>
+}
+
+// CHECK-LABEL: func.func @dimension_size
+// CHECK-DAG:     %[[C4:.+]] = stablehlo.constant dense<4> : tensor<i32>
+// CHECK-DAG:     %[[D:.+]] = stablehlo.get_dimension_size %arg0, dim = 0 : (tensor<?x4xf32>) -> tensor<i32>
+// CHECK:         return %[[D]], %[[D]], %[[C4]] : tensor<i32>, tensor<i32>, tensor<i32>
+
+func.func @reshape_to_self(%arg0: tensor<?x?xf32>) -> tensor<?x?xf32> {
+  %0 = stablehlo.get_dimension_size %arg0, dim = 0 : (tensor<?x?xf32>) -> tensor<i32>
+  %1 = stablehlo.reshape %0 : (tensor<i32>) -> tensor<1xi32>
+  %2 = stablehlo.get_dimension_size %arg0, dim = 1 : (tensor<?x?xf32>) -> tensor<i32>
+  %3 = stablehlo.reshape %2 : (tensor<i32>) -> tensor<1xi32>
+  %4 = stablehlo.concatenate %1, %3, dim = 0 : (tensor<1xi32>, tensor<1xi32>) -> tensor<2xi32>
+  %5 = stablehlo.dynamic_reshape %arg0, %4 : (tensor<?x?xf32>, tensor<2xi32>) -> tensor<?x?xf32>
+  %6 = stablehlo.negate %5 : tensor<?x?xf32>
+  %7 = stablehlo.dynamic_broadcast_in_dim %6, %4, dims = [0, 1] : (tensor<?x?xf32>, tensor<2xi32>) -> tensor<?x?xf32>
+  return %7 : tensor<?x?xf32>
+}
+
+// CHECK-LABEL: func.func @reshape_to_self
+// CHECK-NEXT:    %[[NEG:.+]] = stablehlo.negate %arg0 : tensor<?x?xf32>
+// CHECK-NEXT:    return %[[NEG]] : tensor<?x?xf32>
+
+func.func @dus_full(%arg0: tensor<?x4xf32>, %arg1: tensor<?x?xf32>) -> tensor<?x4xf32> {
+  %c = stablehlo.constant dense<0> : tensor<i32>
+  %c4 = stablehlo.constant dense<4> : tensor<1xi32>
+  %0 = stablehlo.get_dimension_size %arg0, dim = 0 : (tensor<?x4xf32>) -> tensor<i32>
+  %1 = stablehlo.reshape %0 : (tensor<i32>) -> tensor<1xi32>
+  %2 = stablehlo.concatenate %1, %c4, dim = 0 : (tensor<1xi32>, tensor<1xi32>) -> tensor<2xi32>
+  %3 = stablehlo.dynamic_reshape %arg1, %2 : (tensor<?x?xf32>, tensor<2xi32>) -> tensor<?x4xf32>
+  %4 = stablehlo.dynamic_update_slice %arg0, %3, %c, %c : (tensor<?x4xf32>, tensor<?x4xf32>, tensor<i32>, tensor<i32>) -> tensor<?x4xf32>
+  return %4 : tensor<?x4xf32>
+}
+
+// The update has the size of the operand, so it replaces all of it.
+// CHECK-LABEL: func.func @dus_full
+// CHECK:         %[[UPD:.+]] = stablehlo.dynamic_reshape %arg1
+// CHECK-NOT:     stablehlo.dynamic_update_slice
+// CHECK:         return %[[UPD]] : tensor<?x4xf32>
+
+func.func @dus_partial(%arg0: tensor<?x4xf32>, %arg1: tensor<?x4xf32>) -> tensor<?x4xf32> {
+  %c = stablehlo.constant dense<0> : tensor<i32>
+  %0 = stablehlo.dynamic_update_slice %arg0, %arg1, %c, %c : (tensor<?x4xf32>, tensor<?x4xf32>, tensor<i32>, tensor<i32>) -> tensor<?x4xf32>
+  return %0 : tensor<?x4xf32>
+}
+
+// Equal types do not imply equal dynamic sizes.
+// CHECK-LABEL: func.func @dus_partial
+// CHECK:         stablehlo.dynamic_update_slice
+
+func.func @pad_noop(%arg0: tensor<?x4xf32>) -> tensor<?x4xf32> {
+  %z = stablehlo.constant dense<0.0> : tensor<f32>
+  %0 = stablehlo.pad %arg0, %z, low = [0, 0], high = [0, 0], interior = [0, 0] : (tensor<?x4xf32>, tensor<f32>) -> tensor<?x4xf32>
+  return %0 : tensor<?x4xf32>
+}
+
+// CHECK-LABEL: func.func @pad_noop
+// CHECK-NEXT:    return %arg0 : tensor<?x4xf32>
+
+func.func @pad_noop_cast(%arg0: tensor<3x4xf32>) -> tensor<?x4xf32> {
+  %z = stablehlo.constant dense<0.0> : tensor<f32>
+  %0 = stablehlo.pad %arg0, %z, low = [0, 0], high = [0, 0], interior = [0, 0] : (tensor<3x4xf32>, tensor<f32>) -> tensor<?x4xf32>
+  return %0 : tensor<?x4xf32>
+}
+
+// CHECK-LABEL: func.func @pad_noop_cast
+// CHECK-NEXT:    %[[CAST:.+]] = tensor.cast %arg0 : tensor<3x4xf32> to tensor<?x4xf32>
+// CHECK-NEXT:    return %[[CAST]] : tensor<?x4xf32>
+
+func.func @pad_dynamic(%arg0: tensor<?x4xf32>) -> tensor<?x6xf32> {
+  %z = stablehlo.constant dense<0.0> : tensor<f32>
+  %1 = stablehlo.pad %arg0, %z, low = [0, 1], high = [0, 1], interior = [0, 0] : (tensor<?x4xf32>, tensor<f32>) -> tensor<?x6xf32>
+  return %1 : tensor<?x6xf32>
+}
+
+// CHECK-LABEL: func.func @pad_dynamic
+// CHECK:         stablehlo.pad
+// CHECK-SAME:    low = [0, 1], high = [0, 1], interior = [0, 0]
+
+func.func @real_dynamic_slice_noop(%arg0: tensor<?x4xf32>) -> tensor<?x4xf32> {
+  %c0 = stablehlo.constant dense<0> : tensor<2xi32>
+  %c1 = stablehlo.constant dense<1> : tensor<2xi32>
+  %c4 = stablehlo.constant dense<4> : tensor<1xi32>
+  %0 = stablehlo.get_dimension_size %arg0, dim = 0 : (tensor<?x4xf32>) -> tensor<i32>
+  %1 = stablehlo.reshape %0 : (tensor<i32>) -> tensor<1xi32>
+  %2 = stablehlo.concatenate %1, %c4, dim = 0 : (tensor<1xi32>, tensor<1xi32>) -> tensor<2xi32>
+  %3 = "stablehlo.real_dynamic_slice"(%arg0, %c0, %2, %c1) : (tensor<?x4xf32>, tensor<2xi32>, tensor<2xi32>, tensor<2xi32>) -> tensor<?x4xf32>
+  return %3 : tensor<?x4xf32>
+}
+
+// CHECK-LABEL: func.func @real_dynamic_slice_noop
+// CHECK-NEXT:    return %arg0 : tensor<?x4xf32>
+
+func.func @reshape_reshape(%arg0: tensor<?x?xf32>, %arg1: tensor<1xi32>, %arg2: tensor<3xi32>) -> tensor<?x?x?xf32> {
+  %0 = stablehlo.dynamic_reshape %arg0, %arg1 : (tensor<?x?xf32>, tensor<1xi32>) -> tensor<?xf32>
+  %1 = stablehlo.dynamic_reshape %0, %arg2 : (tensor<?xf32>, tensor<3xi32>) -> tensor<?x?x?xf32>
+  return %1 : tensor<?x?x?xf32>
+}
+
+// CHECK-LABEL: func.func @reshape_reshape
+// CHECK-NEXT:    %[[R:.+]] = stablehlo.dynamic_reshape %arg0, %arg2 : (tensor<?x?xf32>, tensor<3xi32>) -> tensor<?x?x?xf32>
+// CHECK-NEXT:    return %[[R]]
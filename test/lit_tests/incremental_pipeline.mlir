@@ -0,0 +1,24 @@
+// RUN: enzymexlamlir-opt %s --pass-pipeline='builtin.module(incremental-pipeline{pipeline="canonicalize"},incremental-pipeline{pipeline="canonicalize"},incremental-pipeline{pipeline="canonicalize"})' | FileCheck %s
+// RUN: enzymexlamlir-opt %s --pass-pipeline='builtin.module(incremental-pipeline{pipeline="canonicalize"},incremental-pipeline{pipeline="canonicalize"},incremental-pipeline{pipeline="canonicalize"})' --mlir-pass-statistics --mlir-pass-statistics-display=list 2>&1 >/dev/null | FileCheck %s --check-prefix=STATS
+
+// CHECK-LABEL: func.func @fold
+// CHECK-NEXT: %[[C:.+]] = arith.constant 3.000000e+00 : f32
+// CHECK-NEXT: return %[[C]]
+func.func @fold() -> f32 {
+  %0 = arith.constant 1.000000e+00 : f32
+  %1 = arith.constant 2.000000e+00 : f32
+  %2 = arith.addf %0, %1 : f32
+  return %2 : f32
+}
+
+// CHECK-LABEL: func.func @identity
+// CHECK-NEXT: return %arg0
+func.func @identity(%arg0: f32) -> f32 {
+  return %arg0 : f32
+}
+
+// The first stage changes @fold, so the second stage runs on it again and
+// only skips @identity. The third stage finds both functions unchanged.
+// STATS: IncrementalPipelinePass
+// STATS-DAG: (S) 3 num-run
+// STATS-DAG: (S) 3 num-skipped
@@ -0,0 +1,19 @@
+// RUN: enzymexlamlir-opt %s --pass-pipeline='builtin.module(incremental-pipeline{pipeline="canonicalize"},func.func(cse),incremental-pipeline{pipeline="canonicalize"})' --mlir-pass-statistics --mlir-pass-statistics-display=list 2>&1 >/dev/null | FileCheck %s
+
+func.func @callee(%arg0: f32, %arg1: f32) -> f32 {
+  %0 = arith.addf %arg0, %arg1 : f32
+  %1 = arith.addf %arg0, %arg1 : f32
+  %2 = arith.mulf %0, %1 : f32
+  return %2 : f32
+}
+
+func.func @caller(%arg0: f32, %arg1: f32) -> f32 {
+  %0 = call @callee(%arg0, %arg1) : (f32, f32) -> f32
+  return %0 : f32
+}
+
+// CSE only changes @callee, but @caller is not skipped either since its
+// fingerprint includes the one of its callee.
+// CHECK: IncrementalPipelinePass
+// CHECK-DAG: (S) 4 num-run
+// CHECK-DAG: (S) 0 num-skipped
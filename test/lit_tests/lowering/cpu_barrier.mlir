@@ -0,0 +1,107 @@
+// RUN: enzymexlamlir-opt %s --pass-pipeline="builtin.module(lower-kernel{backend=cpu})" | FileCheck %s
+// RUN: enzymexlamlir-opt %s --pass-pipeline="builtin.module(lower-kernel{backend=cpu},lower-jit{backend=cpu})" | FileCheck %s --check-prefix=JIT
+// RUN: enzymexlamlir-opt %s --pass-pipeline="builtin.module(lower-kernel{backend=cpu},lower-jit{backend=cpu openmp=false})" | FileCheck %s --check-prefix=JIT
+
+module {
+  llvm.mlir.global internal @buf() {addr_space = 3 : i32} : !llvm.array<64 x f32>
+  llvm.func internal @exchange(%val: f32, %idx: i64) -> f32 {
+    %buf = llvm.mlir.addressof @buf : !llvm.ptr<3>
+    %0 = llvm.getelementptr inbounds %buf[%idx] : (!llvm.ptr<3>, i64) -> !llvm.ptr<3>, f32
+    llvm.store %val, %0 : f32, !llvm.ptr<3>
+    nvvm.barrier0
+    %c63 = llvm.mlir.constant(63 : i64) : i64
+    %1 = llvm.sub %c63, %idx : i64
+    %2 = llvm.getelementptr inbounds %buf[%1] : (!llvm.ptr<3>, i64) -> !llvm.ptr<3>, f32
+    %3 = llvm.load %2 : !llvm.ptr<3> -> f32
+    llvm.return %3 : f32
+  }
+  llvm.func internal ptx_kernelcc @reverse(%arg0: !llvm.ptr<1>) {
+    %0 = nvvm.read.ptx.sreg.tid.x : i32
+    %1 = llvm.zext %0 : i32 to i64
+    %2 = llvm.getelementptr inbounds %arg0[%1] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, f32
+    %3 = llvm.load %2 : !llvm.ptr<1> -> f32
+    %4 = llvm.call @exchange(%3, %1) : (f32, i64) -> f32
+    llvm.store %4, %2 : f32, !llvm.ptr<1>
+    llvm.return
+  }
+  llvm.func internal ptx_kernelcc @partial(%arg0: !llvm.ptr<1>) {
+    %0 = nvvm.read.ptx.sreg.tid.x : i32
+    %c32 = llvm.mlir.constant(32 : i32) : i32
+    %1 = llvm.icmp "ult" %0, %c32 : i32
+    llvm.cond_br %1, ^bb1, ^bb2
+  ^bb1:
+    %2 = llvm.zext %0 : i32 to i64
+    %3 = llvm.getelementptr inbounds %arg0[%2] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, f32
+    %4 = llvm.load %3 : !llvm.ptr<1> -> f32
+    %5 = llvm.call @exchange(%4, %2) : (f32, i64) -> f32
+    llvm.store %5, %3 : f32, !llvm.ptr<1>
+    llvm.return
+  ^bb2:
+    llvm.return
+  }
+  func.func @main(%arg0: tensor<64xf32>) -> tensor<64xf32> {
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    %c64 = stablehlo.constant dense<64> : tensor<i64>
+    %0 = enzymexla.kernel_call @reverse blocks in (%c1, %c1, %c1) threads in (%c64, %c1, %c1) shmem=%c1 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xf32>) -> tensor<64xf32>
+    %1 = enzymexla.kernel_call @partial blocks in (%c1, %c1, %c1) threads in (%c64, %c1, %c1) shmem=%c1 (%0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xf32>) -> tensor<64xf32>
+    return %1 : tensor<64xf32>
+  }
+}
+
+// The callee using the barrier and shared memory is inlined into the kernel,
+// which stops after the store to shared memory and resumes at the load.
+// CHECK-LABEL: func.func private @reverse$par0(%arg0: !llvm.ptr<1>) {
+// CHECK:         %[[BUF:.+]] = llvm.alloca %{{.+}} x !llvm.array<64 x f32> {alignment = 16 : i64} : (i64) -> !llvm.ptr
+// CHECK:         scf.while : () -> () {
+// CHECK:           %{{.+}} = scf.execute_region -> i32 {
+// CHECK-NEXT:        cf.switch %{{.+}} : i32, [
+// CHECK-NEXT:          default: ^[[START:.+]],
+// CHECK-NEXT:          -1: ^{{.+}},
+// CHECK-NEXT:          1: ^[[AFTER:.+]]
+// CHECK-NEXT:        ]
+// CHECK-NEXT:      ^[[START]]:
+// CHECK:             %{{.+}} = llvm.addrspacecast %[[BUF]] : !llvm.ptr to !llvm.ptr<3>
+// CHECK:             llvm.store %{{.+}}, %{{.+}} : f32, !llvm.ptr<3>
+// CHECK-NEXT:        %[[ONE:.+]] = arith.constant 1 : i32
+// CHECK-NEXT:        scf.yield %[[ONE]] : i32
+// CHECK-NEXT:      ^[[AFTER]]:
+// CHECK:             llvm.sub
+// CHECK:             llvm.load %{{.+}} : !llvm.ptr<3> -> f32
+// CHECK-NEXT:        llvm.store %{{.+}}, %{{.+}} : f32, !llvm.ptr<1>
+// CHECK-NOT:         llvm.call
+// CHECK-NOT:         barrier
+// CHECK-LABEL: llvm.func internal ptx_kernelcc @reverse(
+
+// Threads past the first 32 return before the barrier, the others after it.
+// Threads which returned in an earlier phase yield -1 again without running
+// any of the kernel while the others finish.
+// CHECK-LABEL: func.func private @partial$par0(%arg0: !llvm.ptr<1>) {
+// CHECK:         scf.while : () -> () {
+// CHECK:           %[[STOP:.+]] = scf.execute_region -> i32 {
+// CHECK-NEXT:        cf.switch %{{.+}} : i32, [
+// CHECK-NEXT:          default: ^[[START:.+]],
+// CHECK-NEXT:          -1: ^[[RETURNED:.+]],
+// CHECK-NEXT:          1: ^[[AFTER:.+]]
+// CHECK-NEXT:        ]
+// CHECK-NEXT:      ^[[START]]:
+// CHECK:             llvm.cond_br %{{.+}}, ^{{.+}}, ^[[EARLY:.+]]
+// CHECK:             llvm.store %{{.+}}, %{{.+}} : f32, !llvm.ptr<3>
+// CHECK-NEXT:        %[[ONE:.+]] = arith.constant 1 : i32
+// CHECK-NEXT:        scf.yield %[[ONE]] : i32
+// CHECK-NEXT:      ^[[AFTER]]:
+// CHECK:             llvm.store %{{.+}}, %{{.+}} : f32, !llvm.ptr<1>
+// CHECK-NEXT:        %[[LATE:.+]] = arith.constant -1 : i32
+// CHECK-NEXT:        scf.yield %[[LATE]] : i32
+// CHECK-NEXT:      ^[[EARLY]]:
+// CHECK-NEXT:        %[[EARLYDONE:.+]] = arith.constant -1 : i32
+// CHECK-NEXT:        scf.yield %[[EARLYDONE]] : i32
+// CHECK-NEXT:      ^[[RETURNED]]:
+// CHECK-NEXT:        %[[AGAIN:.+]] = arith.constant -1 : i32
+// CHECK-NEXT:        scf.yield %[[AGAIN]] : i32
+// CHECK-NEXT:      }
+// CHECK-NEXT:      memref.store %[[STOP]], %{{.+}}[%{{.+}}] : memref<?xi32>
+
+// The kernel compiles for the cpu, with no barrier left to lower.
+// JIT-LABEL: func.func @main
+// JIT:         %[[REV:.+]] = stablehlo.custom_call @enzymexla_compile_cpu(%arg0)
+// JIT:         %{{.+}} = stablehlo.custom_call @enzymexla_compile_cpu(%[[REV]])
@@ -0,0 +1,37 @@
+// RUN: enzymexlamlir-opt %s --pass-pipeline="builtin.module(lower-kernel{backend=cpu},canonicalize)" | FileCheck %s
+
+module {
+  llvm.func internal ptx_kernelcc @kern(%arg0: !llvm.ptr<1>) {
+    %1 = nvvm.read.ptx.sreg.tid.x : i32
+    %4 = llvm.zext %1 : i32 to i64
+    %5 = llvm.getelementptr inbounds %arg0[%4] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    %6 = llvm.load %5 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    %7 = llvm.mul %6, %6 : i64
+    llvm.store %7, %5 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+  func.func @main(%arg0: tensor<64xi64>) -> tensor<64xi64> {
+    %c0 = stablehlo.constant dense<0> : tensor<i64>
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    %c16 = stablehlo.constant dense<16> : tensor<i64>
+    %c32 = stablehlo.constant dense<32> : tensor<i64>
+    %c64 = stablehlo.constant dense<64> : tensor<i64>
+    %0 = enzymexla.kernel_call @kern blocks in (%c1, %c1, %c1) threads in (%c64, %c1, %c1) shmem=%c0 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    %1 = enzymexla.kernel_call @kern blocks in (%c1, %c1, %c1) threads in (%c32, %c1, %c1) shmem=%c0 (%0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    %2 = enzymexla.kernel_call @kern blocks in (%c1, %c1, %c1) threads in (%c64, %c1, %c1) shmem=%c16 (%1) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    return %2 : tensor<64xi64>
+  }
+}
+
+// Calls with the same grid and block sizes share a function, whatever their
+// shared memory size.
+// CHECK:      func.func private @kern$par0(%arg0: !llvm.ptr<1>) {
+// CHECK:        affine.parallel ({{.+}}) = (0, 0, 0, 0, 0, 0) to (1, 1, 1, 64, 1, 1) {
+// CHECK:      func.func private @kern$par1(%arg0: !llvm.ptr<1>) {
+// CHECK:        affine.parallel ({{.+}}) = (0, 0, 0, 0, 0, 0) to (1, 1, 1, 32, 1, 1) {
+// CHECK-NOT:  func.func private @kern$par2
+// CHECK:      func.func @main(%arg0: tensor<64xi64>) -> tensor<64xi64> {
+// CHECK-NEXT:   %0 = enzymexla.jit_call @kern$par0 (%arg0)
+// CHECK-NEXT:   %1 = enzymexla.jit_call @kern$par1 (%0)
+// CHECK-NEXT:   %2 = enzymexla.jit_call @kern$par0 (%1)
+// CHECK-NEXT:   return %2 : tensor<64xi64>
@@ -0,0 +1,97 @@
+// RUN: enzymexlamlir-opt %s --pass-pipeline="builtin.module(lower-kernel{backend=cpu})" | FileCheck %s
+
+module {
+  llvm.mlir.global internal @tile() {addr_space = 3 : i32} : !llvm.array<32 x f32>
+  llvm.mlir.global external @dynshmem() {addr_space = 3 : i32} : !llvm.array<0 x i8>
+  llvm.func internal ptx_kernelcc @kern(%arg0: !llvm.ptr<1>) {
+    %tile = llvm.mlir.addressof @tile : !llvm.ptr<3>
+    %dyn = llvm.mlir.addressof @dynshmem : !llvm.ptr<3>
+    %0 = nvvm.read.ptx.sreg.tid.x : i32
+    %1 = llvm.zext %0 : i32 to i64
+    %2 = llvm.getelementptr inbounds %arg0[%1] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, f32
+    %3 = llvm.load %2 : !llvm.ptr<1> -> f32
+    %4 = llvm.getelementptr inbounds %tile[%1] : (!llvm.ptr<3>, i64) -> !llvm.ptr<3>, f32
+    llvm.store %3, %4 : f32, !llvm.ptr<3>
+    %5 = llvm.getelementptr inbounds %dyn[%1] : (!llvm.ptr<3>, i64) -> !llvm.ptr<3>, f32
+    llvm.store %3, %5 : f32, !llvm.ptr<3>
+    nvvm.barrier0
+    %6 = llvm.sub %1, %1 : i64
+    %7 = llvm.getelementptr inbounds %tile[%6] : (!llvm.ptr<3>, i64) -> !llvm.ptr<3>, f32
+    %8 = llvm.load %7 : !llvm.ptr<3> -> f32
+    llvm.store %8, %2 : f32, !llvm.ptr<1>
+    llvm.return
+  }
+  func.func @main(%arg0: tensor<64xf32>) -> tensor<64xf32> {
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    %c2 = stablehlo.constant dense<2> : tensor<i64>
+    %c32 = stablehlo.constant dense<32> : tensor<i64>
+    %c128 = stablehlo.constant dense<128> : tensor<i64>
+    %0 = enzymexla.kernel_call @kern blocks in (%c2, %c1, %c1) threads in (%c32, %c1, %c1) shmem=%c128 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xf32>) -> tensor<64xf32>
+    return %0 : tensor<64xf32>
+  }
+}
+
+// Each block gets its own copy of the shared memory, allocated on the stack
+// before its threads run. The threads run in phases up to their next barrier,
+// keeping the values used after it in slots of each thread.
+// CHECK-LABEL: func.func private @kern$par0(%arg0: !llvm.ptr<1>) {
+// CHECK:         %[[SHMEM:.+]] = arith.constant 128 : index
+// CHECK:         affine.parallel (%{{.+}}, %{{.+}}, %{{.+}}) = (0, 0, 0) to (symbol(%{{.+}}), symbol(%{{.+}}), symbol(%{{.+}})) {
+// CHECK-NEXT:      memref.alloca_scope {
+// CHECK-NEXT:        %[[ONE:.+]] = llvm.mlir.constant(1 : i64) : i64
+// CHECK-NEXT:        %[[TILE:.+]] = llvm.alloca %[[ONE]] x !llvm.array<32 x f32> {alignment = 16 : i64} : (i64) -> !llvm.ptr
+// CHECK-NEXT:        %[[BYTES:.+]] = arith.index_castui %[[SHMEM]] : index to i64
+// CHECK-NEXT:        %[[DYN:.+]] = llvm.alloca %[[BYTES]] x i8 {alignment = 16 : i64} : (i64) -> !llvm.ptr
+// CHECK:             %[[RESUME:.+]] = memref.alloca(%[[N:.+]]) : memref<?xi32>
+// CHECK-NEXT:        affine.parallel
+// CHECK:               memref.store %{{.+}}, %[[RESUME]][%{{.+}}] : memref<?xi32>
+// CHECK-NEXT:        }
+// CHECK-NEXT:        %[[SLOT0:.+]] = memref.alloca(%[[N]]) : memref<?x!llvm.ptr<3>>
+// CHECK-NEXT:        %[[SLOT1:.+]] = memref.alloca(%[[N]]) : memref<?xi64>
+// CHECK-NEXT:        %[[SLOT2:.+]] = memref.alloca(%[[N]]) : memref<?x!llvm.ptr<1>>
+// CHECK-NEXT:        scf.while : () -> () {
+// CHECK-NEXT:          %[[RUNNING:.+]] = affine.parallel (%{{.+}}, %{{.+}}, %{{.+}}) = (0, 0, 0) to (symbol(%{{.+}}), symbol(%{{.+}}), symbol(%{{.+}})) reduce ("ori") -> (i1) {
+// CHECK:                 %[[TID:.+]] = arith.addi %{{.+}}, %{{.+}} : index
+// CHECK-NEXT:            %[[AT:.+]] = memref.load %[[RESUME]][%[[TID]]] : memref<?xi32>
+// CHECK-NEXT:            %[[STOP:.+]] = scf.execute_region -> i32 {
+// CHECK-NEXT:              cf.switch %[[AT]] : i32, [
+// CHECK-NEXT:                default: ^[[START:.+]],
+// CHECK-NEXT:                -1: ^[[RETURNED:.+]],
+// CHECK-NEXT:                1: ^[[AFTER:.+]]
+// CHECK-NEXT:              ]
+// CHECK-NEXT:            ^[[START]]:
+// CHECK-NEXT:              %[[TILEPTR:.+]] = llvm.addrspacecast %[[TILE]] : !llvm.ptr to !llvm.ptr<3>
+// CHECK-NEXT:              memref.store %[[TILEPTR]], %[[SLOT0]][%[[TID]]] : memref<?x!llvm.ptr<3>>
+// CHECK-NEXT:              %{{.+}} = llvm.addrspacecast %[[DYN]] : !llvm.ptr to !llvm.ptr<3>
+// CHECK:                   %[[IDX:.+]] = llvm.zext %{{.+}} : i32 to i64
+// CHECK-NEXT:              memref.store %[[IDX]], %[[SLOT1]][%[[TID]]] : memref<?xi64>
+// CHECK-NEXT:              %[[PTR:.+]] = llvm.getelementptr inbounds %arg0[%[[IDX]]] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, f32
+// CHECK-NEXT:              memref.store %[[PTR]], %[[SLOT2]][%[[TID]]] : memref<?x!llvm.ptr<1>>
+// CHECK-NOT:               enzymexla.barrier
+// CHECK:                   %[[BARRIER:.+]] = arith.constant 1 : i32
+// CHECK-NEXT:              scf.yield %[[BARRIER]] : i32
+// CHECK-NEXT:            ^[[AFTER]]:
+// CHECK-NEXT:              %[[PTR2:.+]] = memref.load %[[SLOT2]][%[[TID]]] : memref<?x!llvm.ptr<1>>
+// CHECK-NEXT:              %[[IDX2:.+]] = memref.load %[[SLOT1]][%[[TID]]] : memref<?xi64>
+// CHECK-NEXT:              %[[TILEPTR2:.+]] = memref.load %[[SLOT0]][%[[TID]]] : memref<?x!llvm.ptr<3>>
+// CHECK-NEXT:              %[[ZERO:.+]] = llvm.sub %[[IDX2]], %[[IDX2]] : i64
+// CHECK-NEXT:              %{{.+}} = llvm.getelementptr inbounds %[[TILEPTR2]][%[[ZERO]]] : (!llvm.ptr<3>, i64) -> !llvm.ptr<3>, f32
+// CHECK:                   llvm.store %{{.+}}, %[[PTR2]] : f32, !llvm.ptr<1>
+// CHECK-NEXT:              %[[DONE:.+]] = arith.constant -1 : i32
+// CHECK-NEXT:              scf.yield %[[DONE]] : i32
+// CHECK-NEXT:            ^[[RETURNED]]:
+// CHECK-NEXT:              %[[AGAIN:.+]] = arith.constant -1 : i32
+// CHECK-NEXT:              scf.yield %[[AGAIN]] : i32
+// CHECK-NEXT:            }
+// CHECK-NEXT:            memref.store %[[STOP]], %[[RESUME]][%[[TID]]] : memref<?xi32>
+// CHECK-NEXT:            %[[NOTDONE:.+]] = arith.constant -1 : i32
+// CHECK-NEXT:            %[[RUN:.+]] = arith.cmpi ne, %[[STOP]], %[[NOTDONE]] : i32
+// CHECK-NEXT:            affine.yield %[[RUN]] : i1
+// CHECK-NEXT:          }
+// CHECK-NEXT:          scf.condition(%[[RUNNING]])
+// CHECK-NEXT:        } do {
+// CHECK-NEXT:          scf.yield
+// CHECK-NEXT:        }
+// CHECK-NEXT:      }
+// CHECK-NEXT:    }
+// CHECK-NEXT:    return
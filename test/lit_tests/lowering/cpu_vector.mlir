@@ -0,0 +1,93 @@
+// RUN: enzymexlamlir-opt %s --split-input-file --pass-pipeline="builtin.module(lower-kernel{backend=cpu vector_width=8},canonicalize)" | FileCheck %s
+
+module {
+  llvm.func internal ptx_kernelcc @kern(%arg0: !llvm.ptr<1>) {
+    %1 = nvvm.read.ptx.sreg.tid.x : i32
+    %4 = llvm.zext %1 : i32 to i64
+    %5 = llvm.getelementptr inbounds %arg0[%4] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    %6 = llvm.load %5 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    %7 = llvm.mul %6, %6 : i64
+    llvm.store %7, %5 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+  func.func @main(%arg0: tensor<64xi64>) -> tensor<64xi64> {
+    %c0 = stablehlo.constant dense<0> : tensor<i64>
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    %c36 = stablehlo.constant dense<36> : tensor<i64>
+    %0 = enzymexla.kernel_call @kern blocks in (%c1, %c1, %c1) threads in (%c36, %c1, %c1) shmem=%c0 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    return %0 : tensor<64xi64>
+  }
+}
+
+// 36 threads along x run as 5 groups of 8 lanes, the last 4 lanes masked off.
+// CHECK:   func.func private @kern$par0(%arg0: !llvm.ptr<1>) {
+// CHECK-DAG:      %[[C0:.+]] = arith.constant 0 : index
+// CHECK-DAG:      %[[C1:.+]] = arith.constant 1 : index
+// CHECK-DAG:      %[[C8:.+]] = arith.constant 8 : index
+// CHECK-DAG:      %[[C36:.+]] = arith.constant 36 : index
+// CHECK:          affine.parallel (%arg1, %arg2, %arg3, %arg4, %arg5, %arg6) = (0, 0, 0, 0, 0, 0) to (1, 1, 1, 5, 1, 1) {
+// CHECK-NEXT:       scf.for %[[LANE:.+]] = %[[C0]] to %[[C8]] step %[[C1]] {
+// CHECK-NEXT:         %[[BASE:.+]] = arith.muli %arg4, %[[C8]] : index
+// CHECK-NEXT:         %[[TID:.+]] = arith.addi %[[BASE]], %[[LANE]] : index
+// CHECK-NEXT:         %[[IN:.+]] = arith.cmpi ult, %[[TID]], %[[C36]] : index
+// CHECK-NEXT:         scf.if %[[IN]] {
+// CHECK-NEXT:           scf.execute_region {
+// CHECK-NEXT:             %{{.+}} = arith.index_castui %[[TID]] : index to i32
+// CHECK:                  llvm.store
+// CHECK:            } {llvm.loop_annotation = #llvm.loop_annotation<vectorize = <disable = false, predicateEnable = true, width = 8 : i32>>}
+
+// -----
+
+// A warp synchronization needs the threads of a warp to run concurrently.
+module {
+  llvm.func internal ptx_kernelcc @kern(%arg0: !llvm.ptr<1>) {
+    %c = llvm.mlir.constant(-1 : i32) : i32
+    %1 = nvvm.read.ptx.sreg.tid.x : i32
+    %4 = llvm.zext %1 : i32 to i64
+    %5 = llvm.getelementptr inbounds %arg0[%4] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    %6 = llvm.load %5 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    nvvm.bar.warp.sync %c : i32
+    llvm.store %6, %5 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+  func.func @main(%arg0: tensor<64xi64>) -> tensor<64xi64> {
+    %c0 = stablehlo.constant dense<0> : tensor<i64>
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    %c36 = stablehlo.constant dense<36> : tensor<i64>
+    %0 = enzymexla.kernel_call @kern blocks in (%c1, %c1, %c1) threads in (%c36, %c1, %c1) shmem=%c0 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    return %0 : tensor<64xi64>
+  }
+}
+
+// CHECK-LABEL: func.func private @kern$par0
+// CHECK:         affine.parallel (%arg1, %arg2, %arg3, %arg4, %arg5, %arg6) = (0, 0, 0, 0, 0, 0) to (1, 1, 1, 36, 1, 1) {
+// CHECK-NOT:     vectorize
+// CHECK:       func.func @main
+
+// -----
+
+// The external function may synchronize the threads.
+module {
+  llvm.func @opaque()
+  llvm.func internal ptx_kernelcc @kern(%arg0: !llvm.ptr<1>) {
+    %1 = nvvm.read.ptx.sreg.tid.x : i32
+    %4 = llvm.zext %1 : i32 to i64
+    %5 = llvm.getelementptr inbounds %arg0[%4] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    %6 = llvm.load %5 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    llvm.call @opaque() : () -> ()
+    llvm.store %6, %5 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+  func.func @main(%arg0: tensor<64xi64>) -> tensor<64xi64> {
+    %c0 = stablehlo.constant dense<0> : tensor<i64>
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    %c36 = stablehlo.constant dense<36> : tensor<i64>
+    %0 = enzymexla.kernel_call @kern blocks in (%c1, %c1, %c1) threads in (%c36, %c1, %c1) shmem=%c0 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    return %0 : tensor<64xi64>
+  }
+}
+
+// CHECK-LABEL: func.func private @kern$par0
+// CHECK:         affine.parallel (%arg1, %arg2, %arg3, %arg4, %arg5, %arg6) = (0, 0, 0, 0, 0, 0) to (1, 1, 1, 36, 1, 1) {
+// CHECK-NOT:     vectorize
+// CHECK:       func.func @main
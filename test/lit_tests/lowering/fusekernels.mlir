@@ -0,0 +1,164 @@
+// RUN: enzymexlamlir-opt %s --pass-pipeline="builtin.module(fuse-kernel-calls)" | FileCheck %s
+
+module {
+  llvm.func internal ptx_kernelcc @square(%arg0: !llvm.ptr<1>) {
+    %0 = nvvm.read.ptx.sreg.tid.x : i32
+    %1 = llvm.zext %0 : i32 to i64
+    %2 = llvm.getelementptr inbounds %arg0[%1] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    %3 = llvm.load %2 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    %4 = llvm.mul %3, %3 : i64
+    llvm.store %4, %2 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+  llvm.func internal ptx_kernelcc @copy(%arg0: !llvm.ptr<1>, %arg1: !llvm.ptr<1>) {
+    %0 = nvvm.read.ptx.sreg.tid.x : i32
+    %1 = llvm.zext %0 : i32 to i64
+    %2 = llvm.getelementptr inbounds %arg0[%1] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    %3 = llvm.load %2 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    %4 = llvm.getelementptr inbounds %arg1[%1] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    llvm.store %3, %4 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+  llvm.func internal ptx_kernelcc @shift(%arg0: !llvm.ptr<1>, %arg1: !llvm.ptr<1>) {
+    %c1 = llvm.mlir.constant(1 : i64) : i64
+    %0 = nvvm.read.ptx.sreg.tid.x : i32
+    %1 = llvm.zext %0 : i32 to i64
+    %2 = llvm.add %1, %c1 : i64
+    %3 = llvm.getelementptr inbounds %arg0[%2] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    %4 = llvm.load %3 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    %5 = llvm.getelementptr inbounds %arg1[%1] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    llvm.store %4, %5 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+
+  llvm.func internal ptx_kernelcc @square_first(%arg0: !llvm.ptr<1>) {
+    %0 = llvm.load %arg0 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    %1 = llvm.mul %0, %0 : i64
+    llvm.store %1, %arg0 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+  llvm.func internal ptx_kernelcc @copy_first(%arg0: !llvm.ptr<1>, %arg1: !llvm.ptr<1>) {
+    %0 = llvm.load %arg0 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    llvm.store %0, %arg1 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+  llvm.func internal ptx_kernelcc @square_block(%arg0: !llvm.ptr<1>) {
+    %0 = nvvm.read.ptx.sreg.ctaid.x : i32
+    %1 = llvm.zext %0 : i32 to i64
+    %2 = llvm.getelementptr inbounds %arg0[%1] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    %3 = llvm.load %2 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    %4 = llvm.mul %3, %3 : i64
+    llvm.store %4, %2 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+  llvm.func internal ptx_kernelcc @copy_block(%arg0: !llvm.ptr<1>, %arg1: !llvm.ptr<1>) {
+    %0 = nvvm.read.ptx.sreg.ctaid.x : i32
+    %1 = llvm.zext %0 : i32 to i64
+    %2 = llvm.getelementptr inbounds %arg0[%1] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    %3 = llvm.load %2 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    %4 = llvm.getelementptr inbounds %arg1[%1] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    llvm.store %3, %4 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+  llvm.func internal ptx_kernelcc @square_global(%arg0: !llvm.ptr<1>) {
+    %0 = nvvm.read.ptx.sreg.tid.x : i32
+    %1 = nvvm.read.ptx.sreg.ctaid.x : i32
+    %2 = nvvm.read.ptx.sreg.ntid.x : i32
+    %3 = llvm.mul %1, %2 : i32
+    %4 = llvm.add %3, %0 : i32
+    %5 = llvm.zext %4 : i32 to i64
+    %6 = llvm.getelementptr inbounds %arg0[%5] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    %7 = llvm.load %6 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    %8 = llvm.mul %7, %7 : i64
+    llvm.store %8, %6 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+  llvm.func internal ptx_kernelcc @copy_global(%arg0: !llvm.ptr<1>, %arg1: !llvm.ptr<1>) {
+    %0 = nvvm.read.ptx.sreg.tid.x : i32
+    %1 = nvvm.read.ptx.sreg.ctaid.x : i32
+    %2 = nvvm.read.ptx.sreg.ntid.x : i32
+    %3 = llvm.mul %1, %2 : i32
+    %4 = llvm.add %3, %0 : i32
+    %5 = llvm.zext %4 : i32 to i64
+    %6 = llvm.getelementptr inbounds %arg0[%5] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    %7 = llvm.load %6 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    %8 = llvm.getelementptr inbounds %arg1[%5] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    llvm.store %7, %8 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+
+  // CHECK-LABEL: func.func @fused(
+  // CHECK: %[[R:.+]]:2 = enzymexla.kernel_call @square$fused$copy blocks in({{.*}}) threads in({{.*}}) shmem = %{{.*}} (%arg0, %arg1) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [0], operand_index = 0, operand_tuple_indices = []>, #stablehlo.output_operand_alias<output_tuple_indices = [1], operand_index = 1, operand_tuple_indices = []>]} : (tensor<64xi64>, tensor<64xi64>) -> (tensor<64xi64>, tensor<64xi64>)
+  // CHECK-NEXT: return %[[R]]#0, %[[R]]#1
+  func.func @fused(%arg0: tensor<64xi64>, %arg1: tensor<64xi64>) -> (tensor<64xi64>, tensor<64xi64>) {
+    %c0 = stablehlo.constant dense<0> : tensor<i64>
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    %c64 = stablehlo.constant dense<64> : tensor<i64>
+    %0 = enzymexla.kernel_call @square blocks in (%c1, %c1, %c1) threads in (%c64, %c1, %c1) shmem=%c0 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    %1 = enzymexla.kernel_call @copy blocks in (%c1, %c1, %c1) threads in (%c64, %c1, %c1) shmem=%c0 (%0, %arg1) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 1, operand_tuple_indices = []>]} : (tensor<64xi64>, tensor<64xi64>) -> tensor<64xi64>
+    return %0, %1 : tensor<64xi64>, tensor<64xi64>
+  }
+
+  // Reading a neighbouring element written by another thread prevents fusion.
+  // CHECK-LABEL: func.func @neighbour(
+  // CHECK: enzymexla.kernel_call @square blocks
+  // CHECK: enzymexla.kernel_call @shift blocks
+  func.func @neighbour(%arg0: tensor<64xi64>, %arg1: tensor<64xi64>) -> tensor<64xi64> {
+    %c0 = stablehlo.constant dense<0> : tensor<i64>
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    %c64 = stablehlo.constant dense<64> : tensor<i64>
+    %0 = enzymexla.kernel_call @square blocks in (%c1, %c1, %c1) threads in (%c64, %c1, %c1) shmem=%c0 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    %1 = enzymexla.kernel_call @shift blocks in (%c1, %c1, %c1) threads in (%c64, %c1, %c1) shmem=%c0 (%0, %arg1) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 1, operand_tuple_indices = []>]} : (tensor<64xi64>, tensor<64xi64>) -> tensor<64xi64>
+    return %1 : tensor<64xi64>
+  }
+
+  // The global thread id blockIdx.x * blockDim.x + threadIdx.x differs
+  // between all threads.
+  // CHECK-LABEL: func.func @global_id(
+  // CHECK: enzymexla.kernel_call @square_global$fused$copy_global blocks
+  // CHECK-NOT: enzymexla.kernel_call
+  func.func @global_id(%arg0: tensor<64xi64>, %arg1: tensor<64xi64>) -> tensor<64xi64> {
+    %c0 = stablehlo.constant dense<0> : tensor<i64>
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    %c4 = stablehlo.constant dense<4> : tensor<i64>
+    %c16 = stablehlo.constant dense<16> : tensor<i64>
+    %0 = enzymexla.kernel_call @square_global blocks in (%c4, %c1, %c1) threads in (%c16, %c1, %c1) shmem=%c0 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    %1 = enzymexla.kernel_call @copy_global blocks in (%c4, %c1, %c1) threads in (%c16, %c1, %c1) shmem=%c0 (%0, %arg1) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 1, operand_tuple_indices = []>]} : (tensor<64xi64>, tensor<64xi64>) -> tensor<64xi64>
+    return %1 : tensor<64xi64>
+  }
+
+  // All threads access the same element.
+  // CHECK-LABEL: func.func @constant_index(
+  // CHECK: enzymexla.kernel_call @square_first blocks
+  // CHECK: enzymexla.kernel_call @copy_first blocks
+  func.func @constant_index(%arg0: tensor<64xi64>, %arg1: tensor<64xi64>) -> tensor<64xi64> {
+    %c0 = stablehlo.constant dense<0> : tensor<i64>
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    %c64 = stablehlo.constant dense<64> : tensor<i64>
+    %0 = enzymexla.kernel_call @square_first blocks in (%c1, %c1, %c1) threads in (%c64, %c1, %c1) shmem=%c0 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    %1 = enzymexla.kernel_call @copy_first blocks in (%c1, %c1, %c1) threads in (%c64, %c1, %c1) shmem=%c0 (%0, %arg1) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 1, operand_tuple_indices = []>]} : (tensor<64xi64>, tensor<64xi64>) -> tensor<64xi64>
+    return %1 : tensor<64xi64>
+  }
+
+  // The threads of a block share the element of their block.
+  // CHECK-LABEL: func.func @block_index(
+  // CHECK: enzymexla.kernel_call @square_block blocks
+  // CHECK: enzymexla.kernel_call @copy_block blocks
+  func.func @block_index(%arg0: tensor<64xi64>, %arg1: tensor<64xi64>) -> tensor<64xi64> {
+    %c0 = stablehlo.constant dense<0> : tensor<i64>
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    %c64 = stablehlo.constant dense<64> : tensor<i64>
+    %0 = enzymexla.kernel_call @square_block blocks in (%c64, %c1, %c1) threads in (%c64, %c1, %c1) shmem=%c0 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    %1 = enzymexla.kernel_call @copy_block blocks in (%c64, %c1, %c1) threads in (%c64, %c1, %c1) shmem=%c0 (%0, %arg1) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 1, operand_tuple_indices = []>]} : (tensor<64xi64>, tensor<64xi64>) -> tensor<64xi64>
+    return %1 : tensor<64xi64>
+  }
+}
+
+// CHECK: llvm.func internal ptx_kernelcc @square$fused$copy(%arg0: !llvm.ptr<1>, %arg1: !llvm.ptr<1>) {
+// CHECK-NEXT:   llvm.br ^bb1
+// CHECK-NEXT: ^bb1:
+// CHECK:        llvm.mul
+// CHECK:        llvm.br ^bb2
+// CHECK-NEXT: ^bb2:
+// CHECK:        llvm.load %{{.+}} {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+// CHECK:        llvm.return
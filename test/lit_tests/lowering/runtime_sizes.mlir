@@ -0,0 +1,38 @@
+// RUN: enzymexlamlir-opt %s --pass-pipeline="builtin.module(lower-kernel{backend=cpu},canonicalize)" | FileCheck %s --check-prefix=CPU
+// RUN: enzymexlamlir-opt %s --pass-pipeline="builtin.module(lower-kernel,canonicalize)" | FileCheck %s --check-prefix=CUDA
+
+module {
+  llvm.func internal ptx_kernelcc @kern(%arg0: !llvm.ptr<1>) {
+    %1 = nvvm.read.ptx.sreg.tid.x : i32
+    %4 = llvm.zext %1 : i32 to i64
+    %5 = llvm.getelementptr inbounds %arg0[%4] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, i64
+    %6 = llvm.load %5 {alignment = 1 : i64} : !llvm.ptr<1> -> i64
+    %7 = llvm.mul %6, %6 : i64
+    llvm.store %7, %5 {alignment = 1 : i64} : i64, !llvm.ptr<1>
+    llvm.return
+  }
+  func.func @main(%arg0: tensor<64xi64>, %n: tensor<i64>) -> tensor<64xi64> {
+    %c0 = stablehlo.constant dense<0> : tensor<i64>
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    %0 = enzymexla.kernel_call @kern blocks in (%c1, %c1, %c1) threads in (%n, %c1, %c1) shmem=%c0 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    return %0 : tensor<64xi64>
+  }
+}
+
+// CPU:  func.func private @kern$par0(%arg0: !llvm.ptr<1>, %arg1: !llvm.ptr) {
+// CPU-NEXT:    %[[N:.+]] = llvm.load %arg1 : !llvm.ptr -> i64
+// CPU-NEXT:    %[[NIDX:.+]] = arith.index_castui %[[N]] : i64 to index
+// CPU-NEXT:    affine.parallel (%{{.+}}, %{{.+}}, %{{.+}}, %{{.+}}, %{{.+}}, %{{.+}}) = (0, 0, 0, 0, 0, 0) to (1, 1, 1, symbol(%[[NIDX]]), 1, 1) {
+
+// CPU:  func.func @main(%arg0: tensor<64xi64>, %arg1: tensor<i64>) -> tensor<64xi64> {
+// CPU-NEXT:    %0 = enzymexla.jit_call @kern$par0 (%arg0, %arg1) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>, tensor<i64>) -> tensor<64xi64>
+
+// CUDA:  func.func private @kern$call$1(%arg0: !llvm.ptr<1>, %arg1: !llvm.ptr<1>) {
+// CUDA:         %[[DEV:.+]] = "enzymexla.pointer2memref"(%arg1) : (!llvm.ptr<1>) -> memref<1xi64, 1>
+// CUDA-NEXT:    %[[HOST:.+]] = memref.alloca() : memref<1xi64>
+// CUDA-NEXT:    enzymexla.memcpy  %[[HOST]], %[[DEV]], %{{.+}} : memref<1xi64>, memref<1xi64, 1>
+// CUDA-NEXT:    %[[N:.+]] = memref.load %[[HOST]][%{{.+}}] : memref<1xi64>
+// CUDA:         gpu.launch_func async [%{{.+}}] @gpumod_kern::@kern blocks in (%{{.+}}, %{{.+}}, %{{.+}}) threads in (%[[N]], %{{.+}}, %{{.+}}) : i64 dynamic_shared_memory_size %{{.+}} args(%arg0 : !llvm.ptr<1>)
+
+// CUDA:  func.func @main(%arg0: tensor<64xi64>, %arg1: tensor<i64>) -> tensor<64xi64> {
+// CUDA-NEXT:    %0 = enzymexla.jit_call @kern$call$1 (%arg0, %arg1)
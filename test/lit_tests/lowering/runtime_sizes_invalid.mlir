@@ -0,0 +1,14 @@
+// RUN: enzymexlamlir-opt %s --pass-pipeline="builtin.module(lower-kernel{backend=cpu})" --verify-diagnostics
+
+module {
+  llvm.func internal ptx_kernelcc @kern(%arg0: !llvm.ptr<1>) {
+    llvm.return
+  }
+  func.func @main(%arg0: tensor<64xi64>, %n: tensor<2xi64>) -> tensor<64xi64> {
+    %c0 = stablehlo.constant dense<0> : tensor<i64>
+    %c1 = stablehlo.constant dense<1> : tensor<i64>
+    // expected-error @+1 {{Cannot lower kernel with a dynamic grid/block size which is not an integer tensor of size 1 and 8 to 64 bits, got 'tensor<2xi64>'}}
+    %0 = enzymexla.kernel_call @kern blocks in (%c1, %c1, %c1) threads in (%n, %c1, %c1) shmem=%c0 (%arg0) {output_operand_aliases = [#stablehlo.output_operand_alias<output_tuple_indices = [], operand_index = 0, operand_tuple_indices = []>]} : (tensor<64xi64>) -> tensor<64xi64>
+    return %0 : tensor<64xi64>
+  }
+}
@@ -0,0 +1,106 @@
+// RUN: enzymexlamlir-opt --pass-pipeline="builtin.module(mark-func-memory-effects)" %s | FileCheck %s
+// RUN: enzymexlamlir-opt --pass-pipeline="builtin.module(mark-func-memory-effects,canonicalize)" %s | FileCheck %s --check-prefix=CANON
+
+module {
+  // CHECK-LABEL: func.func @escape(
+  // CHECK-SAME: %arg0: !llvm.ptr {enzymexla.memory_effects = []},
+  // CHECK-SAME: %arg1: !llvm.ptr {enzymexla.memory_effects = ["write"], enzymexla.nocapture})
+  func.func @escape(%p: !llvm.ptr, %slot: !llvm.ptr) {
+    llvm.store %p, %slot : !llvm.ptr, !llvm.ptr
+    return
+  }
+
+  // CHECK-LABEL: func.func @rec(
+  // CHECK-SAME: %arg0: memref<?xf32> {enzymexla.memory_effects = ["read"], enzymexla.nocapture},
+  // CHECK-SAME: %arg1: index)
+  func.func @rec(%m: memref<?xf32>, %i: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %v = memref.load %m[%i] : memref<?xf32>
+    %cond = arith.cmpi sgt, %i, %c0 : index
+    scf.if %cond {
+      %j = arith.subi %i, %c1 : index
+      func.call @rec(%m, %j) : (memref<?xf32>, index) -> ()
+    }
+    return
+  }
+
+  // CHECK-LABEL: llvm.func @copy(
+  // CHECK-SAME: %arg0: !llvm.ptr<1> {enzymexla.memory_effects = ["read"], enzymexla.nocapture},
+  // CHECK-SAME: %arg1: !llvm.ptr<1> {enzymexla.memory_effects = ["write"], enzymexla.nocapture})
+  llvm.func @copy(%src: !llvm.ptr<1>, %dst: !llvm.ptr<1>) {
+    %c1 = llvm.mlir.constant(1 : index) : i64
+    %ptr = llvm.getelementptr %src[%c1] : (!llvm.ptr<1>, i64) -> !llvm.ptr<1>, f32
+    %val = llvm.load %ptr : !llvm.ptr<1> -> f32
+    llvm.store %val, %dst : f32, !llvm.ptr<1>
+    llvm.return
+  }
+
+  // The pointer escapes through the struct stored to the second argument.
+  // CHECK-LABEL: func.func @escape_struct(
+  // CHECK-SAME: %arg0: !llvm.ptr {enzymexla.memory_effects = []},
+  // CHECK-SAME: %arg1: !llvm.ptr {enzymexla.memory_effects = ["write"], enzymexla.nocapture})
+  func.func @escape_struct(%p: !llvm.ptr, %slot: !llvm.ptr) {
+    %u = llvm.mlir.undef : !llvm.struct<(ptr, ptr, i64)>
+    %s = llvm.insertvalue %p, %u[0] : !llvm.struct<(ptr, ptr, i64)>
+    llvm.store %s, %slot : !llvm.struct<(ptr, ptr, i64)>, !llvm.ptr
+    return
+  }
+
+  // CHECK-LABEL: func.func @escape_cast(
+  // CHECK-SAME: %arg0: !llvm.ptr {enzymexla.memory_effects = []},
+  func.func @escape_cast(%p: !llvm.ptr, %slot: !llvm.ptr) {
+    %i = builtin.unrealized_conversion_cast %p : !llvm.ptr to i64
+    llvm.store %i, %slot : i64, !llvm.ptr
+    return
+  }
+
+  // CHECK-LABEL: func.func @write_through_struct(
+  // CHECK-SAME: %arg0: !llvm.ptr {enzymexla.memory_effects = ["write"], enzymexla.nocapture},
+  func.func @write_through_struct(%p: !llvm.ptr, %v: f32) {
+    %u = llvm.mlir.undef : !llvm.struct<(ptr, i64)>
+    %s = llvm.insertvalue %p, %u[0] : !llvm.struct<(ptr, i64)>
+    %q = llvm.extractvalue %s[0] : !llvm.struct<(ptr, i64)>
+    llvm.store %v, %q : f32, !llvm.ptr
+    return
+  }
+
+  llvm.func @stash(%src: !llvm.ptr<1>, %dst: !llvm.ptr<1>) {
+    %u = llvm.mlir.undef : !llvm.struct<(ptr<1>, i64)>
+    %s = llvm.insertvalue %src, %u[0] : !llvm.struct<(ptr<1>, i64)>
+    llvm.store %s, %dst : !llvm.struct<(ptr<1>, i64)>, !llvm.ptr<1>
+    llvm.return
+  }
+
+  // The pointer stashed by the kernel may be written through later, so the
+  // source keeps aliasing its result.
+  // CANON-LABEL: func.func @main_stash(
+  // CANON: %[[RES:.+]]:2 = enzymexla.jit_call @stash (%arg0, %arg1) {
+  // CANON-SAME: operand_index = 0
+  // CANON-SAME: operand_index = 1
+  // CANON: return %[[RES]]#0, %[[RES]]#1
+  func.func @main_stash(%a: tensor<4xf32>, %b: tensor<4xf32>) -> (tensor<4xf32>, tensor<4xf32>) {
+    %0:2 = enzymexla.jit_call @stash (%a, %b) {
+        output_operand_aliases = [
+          #stablehlo.output_operand_alias<output_tuple_indices = [0], operand_index = 0, operand_tuple_indices = []>,
+          #stablehlo.output_operand_alias<output_tuple_indices = [1], operand_index = 1, operand_tuple_indices = []>]
+      } : (tensor<4xf32>, tensor<4xf32>) -> (tensor<4xf32>, tensor<4xf32>)
+    return %0#0, %0#1 : tensor<4xf32>, tensor<4xf32>
+  }
+
+  // The source operand is never written, so it no longer needs to alias a
+  // result of the call.
+  // CANON-LABEL: func.func @main(
+  // CANON: %[[RES:.+]] = enzymexla.jit_call @copy (%arg0, %arg1) {
+  // CANON-SAME: operand_index = 1
+  // CANON-SAME: -> tensor<4xf32>
+  // CANON: return %arg0, %[[RES]]
+  func.func @main(%a: tensor<4xf32>, %b: tensor<4xf32>) -> (tensor<4xf32>, tensor<4xf32>) {
+    %0:2 = enzymexla.jit_call @copy (%a, %b) {
+        output_operand_aliases = [
+          #stablehlo.output_operand_alias<output_tuple_indices = [0], operand_index = 0, operand_tuple_indices = []>,
+          #stablehlo.output_operand_alias<output_tuple_indices = [1], operand_index = 1, operand_tuple_indices = []>]
+      } : (tensor<4xf32>, tensor<4xf32>) -> (tensor<4xf32>, tensor<4xf32>)
+    return %0#0, %0#1 : tensor<4xf32>, tensor<4xf32>
+  }
+}
@@ -2,8 +2,8 @@
 // RUN: enzymexlamlir-opt --pass-pipeline="builtin.module(mark-func-memory-effects{assume_no_memory_effects=false},canonicalize)" %s | FileCheck %s --check-prefix=NOASSUME
 
 module {
-  // ASSUME: llvm.func ptx_kernelcc @foo(%arg0: !llvm.ptr<1> {llvm.align = 32 : i64, llvm.nocapture, llvm.nofree}) attributes {enzymexla.memory_effects = ["read", "write"]} {
-  // NOASSUME: llvm.func ptx_kernelcc @foo(%arg0: !llvm.ptr<1> {llvm.align = 32 : i64, llvm.nocapture, llvm.nofree}) attributes {enzymexla.memory_effects = ["read", "write", "allocate", "free"]} {
+  // ASSUME: llvm.func ptx_kernelcc @foo(%arg0: !llvm.ptr<1> {enzymexla.memory_effects = ["read", "write"], enzymexla.nocapture, llvm.align = 32 : i64, llvm.nocapture, llvm.nofree}) attributes {enzymexla.memory_effects = ["read", "write"]} {
+  // NOASSUME: llvm.func ptx_kernelcc @foo(%arg0: !llvm.ptr<1> {enzymexla.memory_effects = ["read", "write"], enzymexla.nocapture, llvm.align = 32 : i64, llvm.nocapture, llvm.nofree}) attributes {enzymexla.memory_effects = ["read", "write", "allocate", "free"]} {
   llvm.func ptx_kernelcc @foo(%arg0: !llvm.ptr<1> {llvm.align = 32, llvm.nocapture, llvm.nofree}) {
     %c1 = llvm.mlir.constant(1 : index) : i64
     %ptr = llvm.getelementptr %arg0[%c1, %c1] : (!llvm.ptr<1>, i64, i64) -> !llvm.ptr<1>, !llvm.array<8 x i64>
@@ -0,0 +1,152 @@
+// RUN: enzymexlamlir-opt %s --enzyme-hlo-opt | FileCheck %s
+
+module {
+  // CHECK-LABEL: func.func @add_f16
+  // CHECK-NEXT: stablehlo.constant dense<[1.750000e+00, 6.550400e+04]> : tensor<2xf16>
+  func.func @add_f16() -> tensor<2xf16> {
+    %a = stablehlo.constant dense<[1.5, 2.0]> : tensor<2xf16>
+    %b = stablehlo.constant dense<[0.25, 65504.0]> : tensor<2xf16>
+    %0 = stablehlo.add %a, %b : tensor<2xf16>
+    return %0 : tensor<2xf16>
+  }
+
+  // Ties round to even in the storage type.
+  // CHECK-LABEL: func.func @add_f16_rounding
+  // CHECK-NEXT: stablehlo.constant dense<[2.048000e+03, 2.052000e+03]> : tensor<2xf16>
+  func.func @add_f16_rounding() -> tensor<2xf16> {
+    %a = stablehlo.constant dense<[2048.0, 2050.0]> : tensor<2xf16>
+    %b = stablehlo.constant dense<1.0> : tensor<2xf16>
+    %0 = stablehlo.add %a, %b : tensor<2xf16>
+    return %0 : tensor<2xf16>
+  }
+
+  // CHECK-LABEL: func.func @add_bf16_rounding
+  // CHECK-NEXT: stablehlo.constant dense<[2.560000e+02, 2.600000e+02]> : tensor<2xbf16>
+  func.func @add_bf16_rounding() -> tensor<2xbf16> {
+    %a = stablehlo.constant dense<[256.0, 258.0]> : tensor<2xbf16>
+    %b = stablehlo.constant dense<1.0> : tensor<2xbf16>
+    %0 = stablehlo.add %a, %b : tensor<2xbf16>
+    return %0 : tensor<2xbf16>
+  }
+
+  // Division by zero yields -1 and overflow wraps, per the StableHLO spec.
+  // CHECK-LABEL: func.func @div_i8
+  // CHECK-NEXT: stablehlo.constant dense<[3, -128, -1]> : tensor<3xi8>
+  func.func @div_i8() -> tensor<3xi8> {
+    %a = stablehlo.constant dense<[7, -128, 5]> : tensor<3xi8>
+    %b = stablehlo.constant dense<[2, -1, 0]> : tensor<3xi8>
+    %0 = stablehlo.divide %a, %b : tensor<3xi8>
+    return %0 : tensor<3xi8>
+  }
+
+  // CHECK-LABEL: func.func @div_ui8
+  // CHECK-NEXT: stablehlo.constant dense<[255, 3]> : tensor<2xui8>
+  func.func @div_ui8() -> tensor<2xui8> {
+    %a = stablehlo.constant dense<[200, 7]> : tensor<2xui8>
+    %b = stablehlo.constant dense<[0, 2]> : tensor<2xui8>
+    %0 = stablehlo.divide %a, %b : tensor<2xui8>
+    return %0 : tensor<2xui8>
+  }
+
+  // The remainder of a division by zero is the dividend.
+  // CHECK-LABEL: func.func @rem_i32
+  // CHECK-NEXT: stablehlo.constant dense<[1, -1, 5, 0]> : tensor<4xi32>
+  func.func @rem_i32() -> tensor<4xi32> {
+    %a = stablehlo.constant dense<[7, -7, 5, -2147483648]> : tensor<4xi32>
+    %b = stablehlo.constant dense<[3, 3, 0, -1]> : tensor<4xi32>
+    %0 = stablehlo.remainder %a, %b : tensor<4xi32>
+    return %0 : tensor<4xi32>
+  }
+
+  // CHECK-LABEL: func.func @pad_interior
+  // CHECK-NEXT: stablehlo.constant dense<[0, 1, 0, 2, 0]> : tensor<5xi32>
+  func.func @pad_interior() -> tensor<5xi32> {
+    %a = stablehlo.constant dense<[1, 2]> : tensor<2xi32>
+    %z = stablehlo.constant dense<0> : tensor<i32>
+    %0 = stablehlo.pad %a, %z, low = [1], high = [1], interior = [1] : (tensor<2xi32>, tensor<i32>) -> tensor<5xi32>
+    return %0 : tensor<5xi32>
+  }
+
+  // CHECK-LABEL: func.func @pad_negative
+  // CHECK-NEXT: stablehlo.constant dense<[2, 3, 4, 0]> : tensor<4xi32>
+  func.func @pad_negative() -> tensor<4xi32> {
+    %a = stablehlo.constant dense<[1, 2, 3, 4]> : tensor<4xi32>
+    %z = stablehlo.constant dense<0> : tensor<i32>
+    %0 = stablehlo.pad %a, %z, low = [-1], high = [1], interior = [0] : (tensor<4xi32>, tensor<i32>) -> tensor<4xi32>
+    return %0 : tensor<4xi32>
+  }
+
+  // CHECK-LABEL: func.func @pad_2d_f16
+  // CHECK-NEXT{LITERAL}: stablehlo.constant dense<[[5.000000e-01, 5.000000e-01, 5.000000e-01], [1.000000e+00, 2.000000e+00, 5.000000e-01]]> : tensor<2x3xf16>
+  func.func @pad_2d_f16() -> tensor<2x3xf16> {
+    %a = stablehlo.constant dense<[[1.0, 2.0]]> : tensor<1x2xf16>
+    %p = stablehlo.constant dense<0.5> : tensor<f16>
+    %0 = stablehlo.pad %a, %p, low = [1, 0], high = [0, 1], interior = [0, 0] : (tensor<1x2xf16>, tensor<f16>) -> tensor<2x3xf16>
+    return %0 : tensor<2x3xf16>
+  }
+
+  // CHECK-LABEL: func.func @concat_splat
+  // CHECK-NEXT{LITERAL}: stablehlo.constant dense<[[1, 2, 9], [3, 4, 9]]> : tensor<2x3xi32>
+  func.func @concat_splat() -> tensor<2x3xi32> {
+    %a = stablehlo.constant dense<[[1, 2], [3, 4]]> : tensor<2x2xi32>
+    %b = stablehlo.constant dense<9> : tensor<2x1xi32>
+    %0 = stablehlo.concatenate %a, %b, dim = 1 : (tensor<2x2xi32>, tensor<2x1xi32>) -> tensor<2x3xi32>
+    return %0 : tensor<2x3xi32>
+  }
+
+  // CHECK-LABEL: func.func @strided_slice
+  // CHECK-NEXT: stablehlo.constant dense<[0, 2, 4]> : tensor<3xi64>
+  func.func @strided_slice() -> tensor<3xi64> {
+    %a = stablehlo.constant dense<[0, 1, 2, 3, 4, 5]> : tensor<6xi64>
+    %0 = stablehlo.slice %a [0:6:2] : (tensor<6xi64>) -> tensor<3xi64>
+    return %0 : tensor<3xi64>
+  }
+
+  // CHECK-LABEL: func.func @reduce_sum
+  // CHECK-NEXT: stablehlo.constant dense<[6.000000e+00, 1.500000e+01]> : tensor<2xf32>
+  func.func @reduce_sum() -> tensor<2xf32> {
+    %a = stablehlo.constant dense<[[1.0, 2.0, 3.0], [4.0, 5.0, 6.0]]> : tensor<2x3xf32>
+    %z = stablehlo.constant dense<0.0> : tensor<f32>
+    %0 = stablehlo.reduce(%a init: %z) applies stablehlo.add across dimensions = [1] : (tensor<2x3xf32>, tensor<f32>) -> tensor<2xf32>
+    return %0 : tensor<2xf32>
+  }
+
+  // CHECK-LABEL: func.func @reduce_splat
+  // CHECK-NEXT: stablehlo.constant dense<3000001> : tensor<2xi32>
+  func.func @reduce_splat() -> tensor<2xi32> {
+    %a = stablehlo.constant dense<3> : tensor<2x1000000xi32>
+    %z = stablehlo.constant dense<1> : tensor<i32>
+    %0 = stablehlo.reduce(%a init: %z) applies stablehlo.add across dimensions = [1] : (tensor<2x1000000xi32>, tensor<i32>) -> tensor<2xi32>
+    return %0 : tensor<2xi32>
+  }
+
+  // CHECK-LABEL: func.func @reduce_splat_mul
+  // CHECK-NEXT: stablehlo.constant dense<3072> : tensor<i32>
+  func.func @reduce_splat_mul() -> tensor<i32> {
+    %a = stablehlo.constant dense<2> : tensor<10xi32>
+    %z = stablehlo.constant dense<3> : tensor<i32>
+    %0 = stablehlo.reduce(%a init: %z) applies stablehlo.multiply across dimensions = [0] : (tensor<10xi32>, tensor<i32>) -> tensor<i32>
+    return %0 : tensor<i32>
+  }
+
+  // Float sums of a splat are not reassociated: adding 1 to 256 rounds back to
+  // 256 in bf16, so the sequential sum stops there instead of reaching 512.
+  // CHECK-LABEL: func.func @reduce_splat_bf16
+  // CHECK-NEXT: stablehlo.constant dense<2.560000e+02> : tensor<bf16>
+  func.func @reduce_splat_bf16() -> tensor<bf16> {
+    %a = stablehlo.constant dense<1.0> : tensor<512xbf16>
+    %z = stablehlo.constant dense<0.0> : tensor<bf16>
+    %0 = stablehlo.reduce(%a init: %z) applies stablehlo.add across dimensions = [0] : (tensor<512xbf16>, tensor<bf16>) -> tensor<bf16>
+    return %0 : tensor<bf16>
+  }
+
+  // The result of a subtraction depends on the unspecified reduction order.
+  // CHECK-LABEL: func.func @reduce_subtract
+  // CHECK: stablehlo.reduce
+  func.func @reduce_subtract() -> tensor<f32> {
+    %a = stablehlo.constant dense<[1.0, 2.0, 3.0]> : tensor<3xf32>
+    %z = stablehlo.constant dense<0.0> : tensor<f32>
+    %0 = stablehlo.reduce(%a init: %z) applies stablehlo.subtract across dimensions = [0] : (tensor<3xf32>, tensor<f32>) -> tensor<f32>
+    return %0 : tensor<f32>
+  }
+}
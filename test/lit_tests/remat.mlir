@@ -0,0 +1,41 @@
+// RUN: enzymexlamlir-opt --enzyme-hlo-remat="budget=1" %s | FileCheck %s
+// RUN: enzymexlamlir-opt --enzyme-hlo-remat="budget=1 report=true" %s 2>&1 >/dev/null | FileCheck %s --check-prefix=REPORT
+
+// The broadcast is live across the peak: recompute it for its last use.
+func.func @late_broadcast(%a: tensor<f32>, %x: tensor<1024xf32>) -> tensor<1024xf32> {
+  %b = stablehlo.broadcast_in_dim %a, dims = [] : (tensor<f32>) -> tensor<1024xf32>
+  %0 = stablehlo.add %x, %b : tensor<1024xf32>
+  %1 = stablehlo.sine %0 : tensor<1024xf32>
+  %2 = stablehlo.cosine %0 : tensor<1024xf32>
+  %3 = stablehlo.add %1, %2 : tensor<1024xf32>
+  %4 = stablehlo.multiply %3, %b : tensor<1024xf32>
+  return %4 : tensor<1024xf32>
+}
+
+// CHECK-LABEL: func.func @late_broadcast
+// CHECK-NEXT:    %[[B:.+]] = stablehlo.broadcast_in_dim %arg0, dims = [] : (tensor<f32>) -> tensor<1024xf32>
+// CHECK-NEXT:    %{{.+}} = stablehlo.add %arg1, %[[B]] : tensor<1024xf32>
+// CHECK:         %[[SUM:.+]] = stablehlo.add %{{.+}}, %{{.+}} : tensor<1024xf32>
+// CHECK-NEXT:    %[[B2:.+]] = stablehlo.broadcast_in_dim %arg0, dims = [] : (tensor<f32>) -> tensor<1024xf32>
+// CHECK-NEXT:    %[[RES:.+]] = stablehlo.multiply %[[SUM]], %[[B2]] : tensor<1024xf32>
+// CHECK-NEXT:    return %[[RES]]
+
+// REPORT: remark: peak live bytes: 16384 -> 12288
+
+// Recomputing the broadcast would not lower the peak, which is reached again
+// at its last use.
+func.func @keep(%a: tensor<f32>, %x: tensor<1024xf32>) -> tensor<1024xf32> {
+  %b = stablehlo.broadcast_in_dim %a, dims = [] : (tensor<f32>) -> tensor<1024xf32>
+  %0 = stablehlo.add %x, %b : tensor<1024xf32>
+  %1 = stablehlo.sine %0 : tensor<1024xf32>
+  %2 = stablehlo.cosine %1 : tensor<1024xf32>
+  %3 = stablehlo.multiply %2, %b : tensor<1024xf32>
+  return %3 : tensor<1024xf32>
+}
+
+// CHECK-LABEL: func.func @keep
+// CHECK-COUNT-1: stablehlo.broadcast_in_dim
+// CHECK-NOT:     stablehlo.broadcast_in_dim
+// CHECK:         return
+
+// REPORT: remark: peak live bytes: 12288 -> 12288
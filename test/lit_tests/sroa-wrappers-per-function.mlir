@@ -0,0 +1,42 @@
+// RUN: enzymexlamlir-opt %s --pass-pipeline="builtin.module(sroa-wrappers{set_private=false attributor=false})" | FileCheck %s
+// RUN: enzymexlamlir-opt %s --pass-pipeline="builtin.module(sroa-wrappers{set_private=false attributor=false instsimplify=false})" | FileCheck %s --check-prefix=SROA
+// RUN: enzymexlamlir-opt %s --pass-pipeline="builtin.module(sroa-wrappers{native=true})" | FileCheck %s --check-prefix=NATIVE
+
+module {
+  llvm.func @callee(i64)
+  llvm.func @wrapper(%arg0: i64) {
+    %0 = llvm.mlir.constant(1 : i64) : i64
+    %1 = llvm.alloca %0 x i64 : (i64) -> !llvm.ptr
+    llvm.store %arg0, %1 : i64, !llvm.ptr
+    %2 = llvm.load %1 : !llvm.ptr -> i64
+    llvm.call @callee(%2) : (i64) -> ()
+    llvm.return
+  }
+  llvm.func @noalloca(%arg0: i64) -> i64 {
+    %0 = llvm.mlir.constant(0 : i64) : i64
+    %1 = llvm.add %arg0, %0 : i64
+    llvm.return %1 : i64
+  }
+}
+
+// Every function is simplified, with or without allocas.
+// CHECK-LABEL: llvm.func @wrapper(%arg0: i64) {
+// CHECK-NEXT:    llvm.call @callee(%arg0) : (i64) -> ()
+// CHECK-NEXT:    llvm.return
+// CHECK-LABEL: llvm.func @noalloca(%arg0: i64) -> i64 {
+// CHECK-NEXT:    llvm.return %arg0 : i64
+
+// With only SROA, functions without allocas do not go through LLVM IR.
+// SROA-LABEL: llvm.func @wrapper(%arg0: i64) {
+// SROA-NEXT:    llvm.call @callee(%arg0) : (i64) -> ()
+// SROA-NEXT:    llvm.return
+// SROA-LABEL: llvm.func @noalloca(%arg0: i64) -> i64 {
+// SROA-NEXT:    %0 = llvm.mlir.constant(0 : i64) : i64
+// SROA-NEXT:    %1 = llvm.add %arg0, %0 : i64
+// SROA-NEXT:    llvm.return %1 : i64
+
+// NATIVE-LABEL: llvm.func @wrapper(%arg0: i64) {
+// NATIVE-NOT:     llvm.alloca
+// NATIVE:         llvm.call @callee(%arg0) : (i64) -> ()
+// NATIVE-LABEL: llvm.func @noalloca(%arg0: i64) -> i64 {
+// NATIVE-NEXT:    %0 = llvm.mlir.constant(0 : i64) : i64
@@ -0,0 +1,125 @@
+// RUN: enzymexlamlir-opt --pass-pipeline="builtin.module(enzyme-hlo-generate-td{patterns=structured_matrix_dot_general},transform-interpreter,enzyme-hlo-remove-transform)" %s | FileCheck %s
+
+// Diagonal matrix built from an iota mask, on the right: scale the columns.
+func.func @diagonal(%x: tensor<32x16xf32>, %v: tensor<16x16xf32>) -> tensor<32x16xf32> {
+  %zero = stablehlo.constant dense<0.000000e+00> : tensor<16x16xf32>
+  %row = stablehlo.iota dim = 0 : tensor<16x16xi64>
+  %col = stablehlo.iota dim = 1 : tensor<16x16xi64>
+  %eq = stablehlo.compare  EQ, %row, %col : (tensor<16x16xi64>, tensor<16x16xi64>) -> tensor<16x16xi1>
+  %d = stablehlo.select %eq, %v, %zero : tensor<16x16xi1>, tensor<16x16xf32>
+  %r = stablehlo.dot_general %x, %d, contracting_dims = [1] x [0] : (tensor<32x16xf32>, tensor<16x16xf32>) -> tensor<32x16xf32>
+  return %r : tensor<32x16xf32>
+}
+
+// CHECK-LABEL: func.func @diagonal
+// CHECK-NOT:     stablehlo.dot_general
+// CHECK:         %[[DIAG:.+]] = stablehlo.reduce(%{{.+}} init: %{{.+}}) applies stablehlo.add across dimensions = [0] : (tensor<16x16xf32>, tensor<f32>) -> tensor<16xf32>
+// CHECK-NEXT:    %[[SCALE:.+]] = stablehlo.broadcast_in_dim %[[DIAG]], dims = [1] : (tensor<16xf32>) -> tensor<32x16xf32>
+// CHECK-NEXT:    %[[MUL:.+]] = stablehlo.multiply %[[SCALE]], %arg0 : tensor<32x16xf32>
+// CHECK-NEXT:    return %[[MUL]]
+
+// Tridiagonal matrix on the left: three shifted products.
+func.func @tridiagonal(%t: tensor<16x16xf32>, %x: tensor<16x64xf32>) -> tensor<16x64xf32> {
+  %zero = stablehlo.constant dense<0.000000e+00> : tensor<16x16xf32>
+  %one = stablehlo.constant dense<1> : tensor<16x16xi64>
+  %row = stablehlo.iota dim = 0 : tensor<16x16xi64>
+  %col = stablehlo.iota dim = 1 : tensor<16x16xi64>
+  %row1 = stablehlo.add %row, %one : tensor<16x16xi64>
+  %col1 = stablehlo.add %col, %one : tensor<16x16xi64>
+  %upper = stablehlo.compare  LE, %col, %row1 : (tensor<16x16xi64>, tensor<16x16xi64>) -> tensor<16x16xi1>
+  %lower = stablehlo.compare  LE, %row, %col1 : (tensor<16x16xi64>, tensor<16x16xi64>) -> tensor<16x16xi1>
+  %mask = stablehlo.and %upper, %lower : tensor<16x16xi1>
+  %band = stablehlo.select %mask, %t, %zero : tensor<16x16xi1>, tensor<16x16xf32>
+  %r = stablehlo.dot_general %band, %x, contracting_dims = [1] x [0] : (tensor<16x16xf32>, tensor<16x64xf32>) -> tensor<16x64xf32>
+  return %r : tensor<16x64xf32>
+}
+
+// CHECK-LABEL: func.func @tridiagonal
+// CHECK-NOT:     stablehlo.dot_general
+// CHECK:         stablehlo.pad %arg1, %{{.+}}, low = [1, 0], high = [-1, 0], interior = [0, 0] : (tensor<16x64xf32>, tensor<f32>) -> tensor<16x64xf32>
+// CHECK:         stablehlo.multiply
+// CHECK:         stablehlo.multiply %{{.+}}, %arg1 : tensor<16x64xf32>
+// CHECK:         stablehlo.add
+// CHECK:         stablehlo.pad %arg1, %{{.+}}, low = [-1, 0], high = [1, 0], interior = [0, 0] : (tensor<16x64xf32>, tensor<f32>) -> tensor<16x64xf32>
+// CHECK:         stablehlo.multiply
+// CHECK:         %[[SUM:.+]] = stablehlo.add
+// CHECK-NOT:     stablehlo.dot_general
+// CHECK:         return %[[SUM]]
+
+// The band of a triangular matrix is too wide to be worth rewriting.
+func.func @lower_triangular_matvec(%t: tensor<16x16xf32>, %x: tensor<16xf32>) -> tensor<16xf32> {
+  %zero = stablehlo.constant dense<0.000000e+00> : tensor<16x16xf32>
+  %row = stablehlo.iota dim = 0 : tensor<16x16xi64>
+  %col = stablehlo.iota dim = 1 : tensor<16x16xi64>
+  %mask = stablehlo.compare  GE, %row, %col : (tensor<16x16xi64>, tensor<16x16xi64>) -> tensor<16x16xi1>
+  %tril = stablehlo.select %mask, %t, %zero : tensor<16x16xi1>, tensor<16x16xf32>
+  %r = stablehlo.dot_general %tril, %x, contracting_dims = [1] x [0] : (tensor<16x16xf32>, tensor<16xf32>) -> tensor<16xf32>
+  return %r : tensor<16xf32>
+}
+
+// CHECK-LABEL: func.func @lower_triangular_matvec
+// CHECK:         stablehlo.dot_general
+
+// One-hot rows: gather the selected rows.
+func.func @one_hot(%idx: tensor<4xi64>, %x: tensor<8x16xf32>) -> tensor<4x16xf32> {
+  %iota = stablehlo.iota dim = 1 : tensor<4x8xi64>
+  %b = stablehlo.broadcast_in_dim %idx, dims = [0] : (tensor<4xi64>) -> tensor<4x8xi64>
+  %eq = stablehlo.compare  EQ, %iota, %b : (tensor<4x8xi64>, tensor<4x8xi64>) -> tensor<4x8xi1>
+  %oh = stablehlo.convert %eq : (tensor<4x8xi1>) -> tensor<4x8xf32>
+  %r = stablehlo.dot_general %oh, %x, contracting_dims = [1] x [0] : (tensor<4x8xf32>, tensor<8x16xf32>) -> tensor<4x16xf32>
+  return %r : tensor<4x16xf32>
+}
+
+// CHECK-LABEL: func.func @one_hot
+// CHECK-NOT:     stablehlo.dot_general
+// CHECK:         %[[IDX:.+]] = stablehlo.reshape %arg0 : (tensor<4xi64>) -> tensor<4x1xi64>
+// CHECK-NEXT:    %[[G:.+]] = "stablehlo.gather"(%arg1, %[[IDX]]) <{dimension_numbers = #stablehlo.gather<offset_dims = [1], collapsed_slice_dims = [0], start_index_map = [0], index_vector_dim = 1>, indices_are_sorted = false, slice_sizes = array<i64: 1, 16>}> : (tensor<8x16xf32>, tensor<4x1xi64>) -> tensor<4x16xf32>
+// CHECK:         %[[SEL:.+]] = stablehlo.select %{{.+}}, %[[G]], %{{.+}} : tensor<4x16xi1>, tensor<4x16xf32>
+// CHECK-NEXT:    return %[[SEL]]
+
+// The mask is only known to be false above the diagonal, where %p is false
+// the diagonal of %d is kept.
+func.func @mask_and_unknown(%p: tensor<16x16xi1>, %t: tensor<16x16xf32>, %x: tensor<32x16xf32>) -> tensor<32x16xf32> {
+  %zero = stablehlo.constant dense<0.000000e+00> : tensor<16x16xf32>
+  %row = stablehlo.iota dim = 0 : tensor<16x16xi64>
+  %col = stablehlo.iota dim = 1 : tensor<16x16xi64>
+  %eq = stablehlo.compare  EQ, %row, %col : (tensor<16x16xi64>, tensor<16x16xi64>) -> tensor<16x16xi1>
+  %d = stablehlo.select %eq, %t, %zero : tensor<16x16xi1>, tensor<16x16xf32>
+  %ge = stablehlo.compare  GE, %row, %col : (tensor<16x16xi64>, tensor<16x16xi64>) -> tensor<16x16xi1>
+  %mask = stablehlo.and %ge, %p : tensor<16x16xi1>
+  %s = stablehlo.select %mask, %zero, %d : tensor<16x16xi1>, tensor<16x16xf32>
+  %r = stablehlo.dot_general %x, %s, contracting_dims = [1] x [0] : (tensor<32x16xf32>, tensor<16x16xf32>) -> tensor<32x16xf32>
+  return %r : tensor<32x16xf32>
+}
+
+// CHECK-LABEL: func.func @mask_and_unknown
+// CHECK-NOT:     stablehlo.dot_general
+// CHECK:         stablehlo.reduce
+// CHECK:         %[[MUL:.+]] = stablehlo.multiply %{{.+}}, %arg2 : tensor<32x16xf32>
+// CHECK-NEXT:    return %[[MUL]]
+
+// Floating point indices cannot be gathered with.
+func.func @one_hot_float(%idx: tensor<4xf32>, %x: tensor<8x16xf32>) -> tensor<4x16xf32> {
+  %iota = stablehlo.iota dim = 1 : tensor<4x8xf32>
+  %b = stablehlo.broadcast_in_dim %idx, dims = [0] : (tensor<4xf32>) -> tensor<4x8xf32>
+  %eq = stablehlo.compare  EQ, %iota, %b : (tensor<4x8xf32>, tensor<4x8xf32>) -> tensor<4x8xi1>
+  %oh = stablehlo.convert %eq : (tensor<4x8xi1>) -> tensor<4x8xf32>
+  %r = stablehlo.dot_general %oh, %x, contracting_dims = [1] x [0] : (tensor<4x8xf32>, tensor<8x16xf32>) -> tensor<4x16xf32>
+  return %r : tensor<4x16xf32>
+}
+
+// CHECK-LABEL: func.func @one_hot_float
+// CHECK:         stablehlo.dot_general
+
+// A single index broadcast to all rows.
+func.func @one_hot_broadcast_row(%idx: tensor<1xi64>, %x: tensor<8x16xf32>) -> tensor<4x16xf32> {
+  %iota = stablehlo.iota dim = 1 : tensor<4x8xi64>
+  %b = stablehlo.broadcast_in_dim %idx, dims = [0] : (tensor<1xi64>) -> tensor<4x8xi64>
+  %eq = stablehlo.compare  EQ, %iota, %b : (tensor<4x8xi64>, tensor<4x8xi64>) -> tensor<4x8xi1>
+  %oh = stablehlo.convert %eq : (tensor<4x8xi1>) -> tensor<4x8xf32>
+  %r = stablehlo.dot_general %oh, %x, contracting_dims = [1] x [0] : (tensor<4x8xf32>, tensor<8x16xf32>) -> tensor<4x16xf32>
+  return %r : tensor<4x16xf32>
+}
+
+// CHECK-LABEL: func.func @one_hot_broadcast_row
+// CHECK:         stablehlo.dot_general
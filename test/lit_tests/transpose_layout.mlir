@@ -0,0 +1,50 @@
+// RUN: enzymexlamlir-opt --enzyme-hlo-transpose-layout %s | FileCheck %s
+
+// Two transposed inputs and one output: computing in the input order leaves a
+// single transpose.
+func.func @inputs(%x: tensor<4x8xf32>, %y: tensor<4x8xf32>) -> tensor<8x4xf32> {
+  %0 = stablehlo.transpose %x, dims = [1, 0] : (tensor<4x8xf32>) -> tensor<8x4xf32>
+  %1 = stablehlo.transpose %y, dims = [1, 0] : (tensor<4x8xf32>) -> tensor<8x4xf32>
+  %2 = stablehlo.add %0, %1 : tensor<8x4xf32>
+  %3 = stablehlo.sine %2 : tensor<8x4xf32>
+  return %3 : tensor<8x4xf32>
+}
+
+// CHECK-LABEL: func.func @inputs
+// CHECK-NEXT:    %0 = stablehlo.add %arg0, %arg1 : tensor<4x8xf32>
+// CHECK-NEXT:    %1 = stablehlo.sine %0 : tensor<4x8xf32>
+// CHECK-NEXT:    %2 = stablehlo.transpose %1, dims = [1, 0] : (tensor<4x8xf32>) -> tensor<8x4xf32>
+// CHECK-NEXT:    return %2 : tensor<8x4xf32>
+
+// Every value of the group fans out to a transpose back to the input order.
+func.func @fanout(%x: tensor<2x3x4xf32>, %y: tensor<2x3x4xf32>) -> (tensor<2x3x4xf32>, tensor<2x3x4xf32>) {
+  %cst = stablehlo.constant dense<2.000000e+00> : tensor<4x2x3xf32>
+  %0 = stablehlo.transpose %x, dims = [2, 0, 1] : (tensor<2x3x4xf32>) -> tensor<4x2x3xf32>
+  %1 = stablehlo.transpose %y, dims = [2, 0, 1] : (tensor<2x3x4xf32>) -> tensor<4x2x3xf32>
+  %2 = stablehlo.multiply %0, %1 : tensor<4x2x3xf32>
+  %3 = stablehlo.add %2, %cst : tensor<4x2x3xf32>
+  %4 = stablehlo.transpose %2, dims = [1, 2, 0] : (tensor<4x2x3xf32>) -> tensor<2x3x4xf32>
+  %5 = stablehlo.transpose %3, dims = [1, 2, 0] : (tensor<4x2x3xf32>) -> tensor<2x3x4xf32>
+  return %4, %5 : tensor<2x3x4xf32>, tensor<2x3x4xf32>
+}
+
+// CHECK-LABEL: func.func @fanout
+// CHECK-NOT:     stablehlo.transpose
+// CHECK:         %[[MUL:.+]] = stablehlo.multiply %arg0, %arg1 : tensor<2x3x4xf32>
+// CHECK-NEXT:    %[[CST:.+]] = stablehlo.constant dense<2.000000e+00> : tensor<2x3x4xf32>
+// CHECK-NEXT:    %[[ADD:.+]] = stablehlo.add %[[MUL]], %[[CST]] : tensor<2x3x4xf32>
+// CHECK-NEXT:    return %[[MUL]], %[[ADD]] : tensor<2x3x4xf32>, tensor<2x3x4xf32>
+
+// Changing the order would need two transposes instead of one.
+func.func @keep(%x: tensor<4x8xf32>) -> (tensor<8x4xf32>, tensor<8x4xf32>) {
+  %0 = stablehlo.transpose %x, dims = [1, 0] : (tensor<4x8xf32>) -> tensor<8x4xf32>
+  %1 = stablehlo.exponential %0 : tensor<8x4xf32>
+  %2 = stablehlo.negate %0 : tensor<8x4xf32>
+  return %1, %2 : tensor<8x4xf32>, tensor<8x4xf32>
+}
+
+// CHECK-LABEL: func.func @keep
+// CHECK-NEXT:    %0 = stablehlo.transpose %arg0, dims = [1, 0] : (tensor<4x8xf32>) -> tensor<8x4xf32>
+// CHECK-NEXT:    %1 = stablehlo.exponential %0 : tensor<8x4xf32>
+// CHECK-NEXT:    %2 = stablehlo.negate %0 : tensor<8x4xf32>
+// CHECK-NEXT:    return %1, %2
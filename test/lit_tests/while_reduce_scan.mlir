@@ -0,0 +1,119 @@
+// RUN: enzymexlamlir-opt --enzyme-hlo-generate-td="patterns=while_reduce_scan(1)" --transform-interpreter --enzyme-hlo-remove-transform %s | FileCheck %s
+// RUN: enzymexlamlir-opt --enzyme-hlo-generate-td="patterns=while_reduce_scan(0)" --transform-interpreter --enzyme-hlo-remove-transform %s | FileCheck %s --check-prefix=STRICT
+
+func.func @sum_squares(%x: tensor<12x4xf32>, %init: tensor<4xf32>) -> tensor<4xf32> {
+  %c0 = stablehlo.constant dense<0> : tensor<i64>
+  %c1 = stablehlo.constant dense<1> : tensor<i64>
+  %c11 = stablehlo.constant dense<11> : tensor<i64>
+  %0:2 = stablehlo.while(%i = %c1, %acc = %init) : tensor<i64>, tensor<4xf32>
+   cond {
+    %1 = stablehlo.compare  LT, %i, %c11 : (tensor<i64>, tensor<i64>) -> tensor<i1>
+    stablehlo.return %1 : tensor<i1>
+  } do {
+    %2 = stablehlo.dynamic_slice %x, %i, %c0, sizes = [1, 4] : (tensor<12x4xf32>, tensor<i64>, tensor<i64>) -> tensor<1x4xf32>
+    %3 = stablehlo.reshape %2 : (tensor<1x4xf32>) -> tensor<4xf32>
+    %4 = stablehlo.multiply %3, %3 : tensor<4xf32>
+    %5 = stablehlo.add %acc, %4 : tensor<4xf32>
+    %6 = stablehlo.add %i, %c1 : tensor<i64>
+    stablehlo.return %6, %5 : tensor<i64>, tensor<4xf32>
+  }
+  return %0#1 : tensor<4xf32>
+}
+
+// CHECK-LABEL: func.func @sum_squares
+// CHECK:         %[[X:.+]] = stablehlo.slice %arg0 [1:11, 0:4] : (tensor<12x4xf32>) -> tensor<10x4xf32>
+// CHECK-NEXT:    %[[SQ:.+]] = stablehlo.multiply %[[X]], %[[X]] : tensor<10x4xf32>
+// CHECK:         %[[RED:.+]] = stablehlo.reduce(%[[SQ]] init: %{{.+}}) applies stablehlo.add across dimensions = [0] : (tensor<10x4xf32>, tensor<f32>) -> tensor<4xf32>
+// CHECK-NEXT:    %[[SUM:.+]] = stablehlo.add %arg1, %[[RED]] : tensor<4xf32>
+// CHECK:         stablehlo.while
+// CHECK:         return %[[SUM]] : tensor<4xf32>
+
+func.func @cumsum(%x: tensor<10xf32>, %init: tensor<f32>, %buf: tensor<10xf32>) -> (tensor<10xf32>, tensor<f32>) {
+  %c0 = stablehlo.constant dense<0> : tensor<i64>
+  %c1 = stablehlo.constant dense<1> : tensor<i64>
+  %c8 = stablehlo.constant dense<8> : tensor<i64>
+  %0:3 = stablehlo.while(%i = %c0, %acc = %init, %out = %buf) : tensor<i64>, tensor<f32>, tensor<10xf32>
+   cond {
+    %1 = stablehlo.compare  LT, %i, %c8 : (tensor<i64>, tensor<i64>) -> tensor<i1>
+    stablehlo.return %1 : tensor<i1>
+  } do {
+    %2 = stablehlo.dynamic_slice %x, %i, sizes = [1] : (tensor<10xf32>, tensor<i64>) -> tensor<1xf32>
+    %3 = stablehlo.reshape %2 : (tensor<1xf32>) -> tensor<f32>
+    %4 = stablehlo.add %acc, %3 : tensor<f32>
+    %5 = stablehlo.reshape %4 : (tensor<f32>) -> tensor<1xf32>
+    %6 = stablehlo.add %i, %c1 : tensor<i64>
+    %7 = stablehlo.dynamic_update_slice %out, %5, %6 : (tensor<10xf32>, tensor<1xf32>, tensor<i64>) -> tensor<10xf32>
+    stablehlo.return %6, %4, %7 : tensor<i64>, tensor<f32>, tensor<10xf32>
+  }
+  return %0#2, %0#1 : tensor<10xf32>, tensor<f32>
+}
+
+// CHECK-LABEL: func.func @cumsum
+// CHECK:         %[[X:.+]] = stablehlo.slice %arg0 [0:8] : (tensor<10xf32>) -> tensor<8xf32>
+// CHECK:         %[[RED:.+]] = stablehlo.reduce(%[[X]] init: %{{.+}}) applies stablehlo.add across dimensions = [0] : (tensor<8xf32>, tensor<f32>) -> tensor<f32>
+// CHECK-NEXT:    %[[TOTAL:.+]] = stablehlo.add %arg1, %[[RED]] : tensor<f32>
+// CHECK-NEXT:    %[[SCAN:.+]] = "stablehlo.reduce_window"(%[[X]], %{{.+}}) <{padding = dense<{{\[\[}}7, 0]]> : tensor<1x2xi64>, window_dimensions = array<i64: 8>}>
+// CHECK:         %[[INIT:.+]] = stablehlo.broadcast_in_dim %arg1, dims = [] : (tensor<f32>) -> tensor<8xf32>
+// CHECK-NEXT:    %[[PARTIALS:.+]] = stablehlo.add %[[INIT]], %[[SCAN]] : tensor<8xf32>
+// CHECK:         %[[OUT:.+]] = stablehlo.dynamic_update_slice %arg2, %[[PARTIALS]], %{{.+}} : (tensor<10xf32>, tensor<8xf32>, tensor<i64>) -> tensor<10xf32>
+// CHECK:         stablehlo.while
+// CHECK:         return %[[OUT]], %[[TOTAL]] : tensor<10xf32>, tensor<f32>
+
+// The accumulator depends on itself through a multiplication: not a reduction.
+func.func @recurrence(%x: tensor<8xf32>, %init: tensor<f32>) -> tensor<f32> {
+  %c0 = stablehlo.constant dense<0> : tensor<i64>
+  %c1 = stablehlo.constant dense<1> : tensor<i64>
+  %c8 = stablehlo.constant dense<8> : tensor<i64>
+  %0:2 = stablehlo.while(%i = %c0, %acc = %init) : tensor<i64>, tensor<f32>
+   cond {
+    %1 = stablehlo.compare  LT, %i, %c8 : (tensor<i64>, tensor<i64>) -> tensor<i1>
+    stablehlo.return %1 : tensor<i1>
+  } do {
+    %2 = stablehlo.dynamic_slice %x, %i, sizes = [1] : (tensor<8xf32>, tensor<i64>) -> tensor<1xf32>
+    %3 = stablehlo.reshape %2 : (tensor<1xf32>) -> tensor<f32>
+    %4 = stablehlo.multiply %acc, %acc : tensor<f32>
+    %5 = stablehlo.add %4, %3 : tensor<f32>
+    %6 = stablehlo.add %i, %c1 : tensor<i64>
+    stablehlo.return %6, %5 : tensor<i64>, tensor<f32>
+  }
+  return %0#1 : tensor<f32>
+}
+
+// CHECK-LABEL: func.func @recurrence
+// CHECK-NOT:     stablehlo.reduce
+// CHECK:         %[[RES:.+]]:2 = stablehlo.while
+// CHECK:         return %[[RES]]#1
+
+// Integer sums are rewritten without reassociating floating point math.
+func.func @sum_ints(%x: tensor<8xi32>, %init: tensor<i32>) -> tensor<i32> {
+  %c0 = stablehlo.constant dense<0> : tensor<i64>
+  %c1 = stablehlo.constant dense<1> : tensor<i64>
+  %c8 = stablehlo.constant dense<8> : tensor<i64>
+  %0:2 = stablehlo.while(%i = %c0, %acc = %init) : tensor<i64>, tensor<i32>
+   cond {
+    %1 = stablehlo.compare  LT, %i, %c8 : (tensor<i64>, tensor<i64>) -> tensor<i1>
+    stablehlo.return %1 : tensor<i1>
+  } do {
+    %2 = stablehlo.dynamic_slice %x, %i, sizes = [1] : (tensor<8xi32>, tensor<i64>) -> tensor<1xi32>
+    %3 = stablehlo.reshape %2 : (tensor<1xi32>) -> tensor<i32>
+    %4 = stablehlo.add %acc, %3 : tensor<i32>
+    %5 = stablehlo.add %i, %c1 : tensor<i64>
+    stablehlo.return %5, %4 : tensor<i64>, tensor<i32>
+  }
+  return %0#1 : tensor<i32>
+}
+
+// CHECK-LABEL: func.func @sum_ints
+// CHECK:         %[[X:.+]] = stablehlo.slice %arg0 [0:8] : (tensor<8xi32>) -> tensor<8xi32>
+// CHECK:         %[[RED:.+]] = stablehlo.reduce(%[[X]] init: %{{.+}}) applies stablehlo.add across dimensions = [0] : (tensor<8xi32>, tensor<i32>) -> tensor<i32>
+// CHECK-NEXT:    %[[SUM:.+]] = stablehlo.add %arg1, %[[RED]] : tensor<i32>
+
+// Floating point sums keep their loop order unless reassociation is allowed.
+// STRICT-LABEL: func.func @sum_squares
+// STRICT-NOT:     stablehlo.reduce
+// STRICT:         stablehlo.while
+// STRICT-LABEL: func.func @cumsum
+// STRICT-NOT:     stablehlo.reduce
+// STRICT:         stablehlo.while
+// STRICT-LABEL: func.func @sum_ints
+// STRICT:         stablehlo.reduce(%{{.+}} init: %{{.+}}) applies stablehlo.add
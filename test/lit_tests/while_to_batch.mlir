@@ -0,0 +1,94 @@
+// RUN: enzymexlamlir-opt --enzyme-hlo-generate-td="patterns=while_to_batch" --transform-interpreter --enzyme-hlo-remove-transform %s | FileCheck %s
+
+// Each batched loop is outlined into its own function.
+// CHECK-DAG: func.func private @enzymexla_unbatched_WhileToBatch(
+// CHECK-DAG: func.func private @enzymexla_unbatched_WhileToBatch_0(
+
+// Each iteration only writes row i of the output: all rows are computed at once.
+func.func @rows(%x: tensor<8x4xf32>, %scale: tensor<f32>, %buf: tensor<10x4xf32>) -> tensor<10x4xf32> {
+  %c0 = stablehlo.constant dense<0> : tensor<i64>
+  %c1 = stablehlo.constant dense<1> : tensor<i64>
+  %c8 = stablehlo.constant dense<8> : tensor<i64>
+  %0:2 = stablehlo.while(%i = %c0, %out = %buf) : tensor<i64>, tensor<10x4xf32>
+   cond {
+    %1 = stablehlo.compare  LT, %i, %c8 : (tensor<i64>, tensor<i64>) -> tensor<i1>
+    stablehlo.return %1 : tensor<i1>
+  } do {
+    %2 = stablehlo.dynamic_slice %x, %i, %c0, sizes = [1, 4] : (tensor<8x4xf32>, tensor<i64>, tensor<i64>) -> tensor<1x4xf32>
+    %3 = stablehlo.sine %2 : tensor<1x4xf32>
+    %4 = stablehlo.broadcast_in_dim %scale, dims = [] : (tensor<f32>) -> tensor<1x4xf32>
+    %5 = stablehlo.multiply %3, %4 : tensor<1x4xf32>
+    %6 = stablehlo.add %i, %c1 : tensor<i64>
+    %7 = stablehlo.add %i, %c1 : tensor<i64>
+    %8 = stablehlo.dynamic_update_slice %out, %5, %7, %c0 : (tensor<10x4xf32>, tensor<1x4xf32>, tensor<i64>, tensor<i64>) -> tensor<10x4xf32>
+    stablehlo.return %6, %8 : tensor<i64>, tensor<10x4xf32>
+  }
+  return %0#1 : tensor<10x4xf32>
+}
+
+// CHECK-LABEL: func.func @rows
+// CHECK:         stablehlo.broadcast_in_dim %arg1, dims = [] : (tensor<f32>) -> tensor<8xf32>
+// CHECK:         %[[X:.+]] = stablehlo.slice %arg0 [0:8, 0:4] : (tensor<8x4xf32>) -> tensor<8x4xf32>
+// CHECK:         stablehlo.reshape %[[X]] : (tensor<8x4xf32>) -> tensor<8x1x4xf32>
+// CHECK:         %[[ROWS:.+]] = stablehlo.reshape %{{.+}} : (tensor<8x1x4xf32>) -> tensor<8x4xf32>
+// CHECK:         %[[OUT:.+]] = stablehlo.dynamic_update_slice %arg2, %[[ROWS]], %{{.+}}, %{{.+}} : (tensor<10x4xf32>, tensor<8x4xf32>, tensor<i64>, tensor<i64>) -> tensor<10x4xf32>
+// CHECK:         stablehlo.while
+// CHECK:         return %[[OUT]] : tensor<10x4xf32>
+
+// The output is read by later iterations: not independent.
+func.func @prefix(%x: tensor<8xf32>, %buf: tensor<9xf32>) -> tensor<9xf32> {
+  %c0 = stablehlo.constant dense<0> : tensor<i64>
+  %c1 = stablehlo.constant dense<1> : tensor<i64>
+  %c8 = stablehlo.constant dense<8> : tensor<i64>
+  %0:2 = stablehlo.while(%i = %c0, %out = %buf) : tensor<i64>, tensor<9xf32>
+   cond {
+    %1 = stablehlo.compare  LT, %i, %c8 : (tensor<i64>, tensor<i64>) -> tensor<i1>
+    stablehlo.return %1 : tensor<i1>
+  } do {
+    %2 = stablehlo.dynamic_slice %out, %i, sizes = [1] : (tensor<9xf32>, tensor<i64>) -> tensor<1xf32>
+    %3 = stablehlo.dynamic_slice %x, %i, sizes = [1] : (tensor<8xf32>, tensor<i64>) -> tensor<1xf32>
+    %4 = stablehlo.add %2, %3 : tensor<1xf32>
+    %5 = stablehlo.add %i, %c1 : tensor<i64>
+    %6 = stablehlo.dynamic_update_slice %out, %4, %5 : (tensor<9xf32>, tensor<1xf32>, tensor<i64>) -> tensor<9xf32>
+    stablehlo.return %5, %6 : tensor<i64>, tensor<9xf32>
+  }
+  return %0#1 : tensor<9xf32>
+}
+
+// CHECK-LABEL: func.func @prefix
+// CHECK-NOT:     enzyme.batch
+// CHECK:         %[[RES:.+]]:2 = stablehlo.while
+// CHECK:         return %[[RES]]#1
+
+// Two loops batched in the same module.
+func.func @two_loops(%x: tensor<8xf32>, %buf: tensor<8xf32>) -> (tensor<8xf32>, tensor<8xf32>) {
+  %c0 = stablehlo.constant dense<0> : tensor<i64>
+  %c1 = stablehlo.constant dense<1> : tensor<i64>
+  %c8 = stablehlo.constant dense<8> : tensor<i64>
+  %0:2 = stablehlo.while(%i = %c0, %out = %buf) : tensor<i64>, tensor<8xf32>
+   cond {
+    %1 = stablehlo.compare  LT, %i, %c8 : (tensor<i64>, tensor<i64>) -> tensor<i1>
+    stablehlo.return %1 : tensor<i1>
+  } do {
+    %2 = stablehlo.dynamic_slice %x, %i, sizes = [1] : (tensor<8xf32>, tensor<i64>) -> tensor<1xf32>
+    %3 = stablehlo.sine %2 : tensor<1xf32>
+    %4 = stablehlo.dynamic_update_slice %out, %3, %i : (tensor<8xf32>, tensor<1xf32>, tensor<i64>) -> tensor<8xf32>
+    %5 = stablehlo.add %i, %c1 : tensor<i64>
+    stablehlo.return %5, %4 : tensor<i64>, tensor<8xf32>
+  }
+  %6:2 = stablehlo.while(%i = %c0, %out = %buf) : tensor<i64>, tensor<8xf32>
+   cond {
+    %7 = stablehlo.compare  LT, %i, %c8 : (tensor<i64>, tensor<i64>) -> tensor<i1>
+    stablehlo.return %7 : tensor<i1>
+  } do {
+    %8 = stablehlo.dynamic_slice %x, %i, sizes = [1] : (tensor<8xf32>, tensor<i64>) -> tensor<1xf32>
+    %9 = stablehlo.cosine %8 : tensor<1xf32>
+    %10 = stablehlo.dynamic_update_slice %out, %9, %i : (tensor<8xf32>, tensor<1xf32>, tensor<i64>) -> tensor<8xf32>
+    %11 = stablehlo.add %i, %c1 : tensor<i64>
+    stablehlo.return %11, %10 : tensor<i64>, tensor<8xf32>
+  }
+  return %0#1, %6#1 : tensor<8xf32>, tensor<8xf32>
+}
+
+// CHECK-LABEL: func.func @two_loops
+// CHECK-COUNT-2: stablehlo.dynamic_update_slice %arg1
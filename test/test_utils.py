@@ -349,6 +349,7 @@ dynamic_broadcast_in_dim_all_dims_non_expanding<16>;
 noop_reduce_op_canon<16>;
 empty_reduce_op_canon<16>;
 dynamic_reshape_op_canon<16>;
+noop_real_dynamic_slice<16>;
 get_tuple_element_op_canon<16>;
 real_op_canon<16>;
 imag_op_canon<16>;
@@ -410,6 +411,7 @@ slice_elementwise<1>;
 slice_pad<1>;
 dot_reshape_dot<1>;
 concat_const_prop<1>(1024);
+reduce_const_prop<1>(1024);
 concat_fuse<1>;
 pad_reshape_pad<1>;
 pad_pad<1>;
@@ -615,6 +617,156 @@ def pretty_print_table(name, pname, backend, key, time):
     )
 
 
+def bench_setting(name, default):
+    import os
+
+    return type(default)(os.environ.get("ENZYMEJAX_BENCH_" + name, default))
+
+
+# Calls run before timing, to settle caches and lazy initialization.
+bench_warmup = bench_setting("WARMUP", 3)
+# Keep repeating until this many seconds were spent in the timed calls...
+bench_min_time = bench_setting("MIN_TIME", 0.2)
+# ... but time at least and at most this many repetitions.
+bench_min_repeats = bench_setting("MIN_REPEATS", 5)
+bench_max_repeats = bench_setting("MAX_REPEATS", 100)
+# Times the first call is repeated, with the jax caches cleared in between.
+bench_compile_repeats = bench_setting("COMPILE_REPEATS", 3)
+
+bench_results = []
+
+
+def percentile(samples, p):
+    import math
+
+    ordered = sorted(samples)
+    return ordered[max(0, math.ceil(p / 100 * len(ordered)) - 1)]
+
+
+def first_call(fn, *args):
+    """Calls a jitted function for the first time, returning its result and
+    statistics of the seconds taken to trace, compile and run it once. The
+    first call is repeated `bench_compile_repeats` times, clearing the jax
+    caches before each repetition so that it compiles again."""
+    import statistics
+    import time
+    import jax
+
+    samples = []
+    for i in range(max(1, bench_compile_repeats)):
+        if i:
+            jax.clear_caches()
+        start = time.perf_counter()
+        res = jax.block_until_ready(fn(*args))
+        samples.append(time.perf_counter() - start)
+    return res, {
+        "compile": statistics.median(samples),
+        "compile_p95": percentile(samples, 95),
+    }
+
+
+def measure(timer, max_calls):
+    """Times the statement of a timeit.Timer, returning statistics in seconds
+    per call. Calls are batched so each repetition lasts long enough to be
+    timed reliably, and repetitions continue until `bench_min_time` is reached
+    or `max_calls` calls were made. `max_calls` is not a hard limit: the
+    `bench_warmup` calls, the calls sizing the batches and at least
+    `bench_min_repeats` repetitions always run."""
+    import statistics
+
+    timer.timeit(bench_warmup)
+
+    number = 1
+    max_number = max(1, max_calls // bench_min_repeats)
+    target = bench_min_time / bench_min_repeats
+    while number < max_number and timer.timeit(number) < target:
+        number = min(number * 2, max_number)
+
+    samples = []
+    total = 0.0
+    while len(samples) < bench_max_repeats:
+        if len(samples) >= bench_min_repeats and (
+            total >= bench_min_time or len(samples) * number >= max_calls
+        ):
+            break
+        t = timer.timeit(number)
+        total += t
+        samples.append(t / number)
+
+    return {
+        "median": statistics.median(samples),
+        "p95": percentile(samples, 95),
+        "min": min(samples),
+        "mean": statistics.mean(samples),
+        "stdev": statistics.stdev(samples) if len(samples) > 1 else 0.0,
+        "repeats": len(samples),
+        "number": number,
+    }
+
+
+def bench_results_path():
+    import os
+
+    path = os.environ.get("ENZYMEJAX_BENCH_RESULTS")
+    if path is None and "TEST_UNDECLARED_OUTPUTS_DIR" in os.environ:
+        path = os.path.join(
+            os.environ["TEST_UNDECLARED_OUTPUTS_DIR"], "bench_results.json"
+        )
+    return path
+
+
+def bench_key(result):
+    return (result["test"], result["pipeline"], result["backend"], result["mode"])
+
+
+def write_bench_results():
+    """Merges all results measured so far into the JSON results file, see
+    bench_compare.py. Results written by other test processes are kept, earlier
+    results of the same measurement are replaced."""
+    import fcntl
+    import json
+    import platform
+    import jax
+
+    path = bench_results_path()
+    if path is None:
+        return
+    with open(path, "a+") as f:
+        # Test processes may run concurrently, serialize their updates.
+        fcntl.flock(f, fcntl.LOCK_EX)
+        f.seek(0)
+        content = f.read()
+        results = json.loads(content)["results"] if content else []
+        measured = {bench_key(r) for r in bench_results}
+        results = [r for r in results if bench_key(r) not in measured]
+        f.seek(0)
+        f.truncate()
+        json.dump(
+            {
+                "jax": jax.__version__,
+                "machine": platform.machine(),
+                "processor": platform.processor(),
+                "results": results + bench_results,
+            },
+            f,
+            indent=2,
+        )
+
+
+def record_result(name, pname, backend, key, compile_stats, stats):
+    pretty_print_table(name, pname, backend, key, stats["median"])
+    bench_results.append(
+        {
+            "test": name.strip(),
+            "pipeline": pname.strip(),
+            "backend": backend,
+            "mode": key,
+        }
+        | compile_stats
+        | stats
+    )
+
+
 class EnzymeJaxTest(absltest.TestCase):
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
@@ -726,25 +878,28 @@ class EnzymeJaxTest(absltest.TestCase):
                         ),
                         backend=backend,
                     )
-                    ao = rfn_enzyme(*ins_backend)
+                    ao, compile_stats = first_call(rfn_enzyme, *ins_backend)
                     if primres is None:
                         primres = ao
                     else:
                         recursive_check(self, ao, primres, self.tol, "Primal " + pname)
 
-                    pretty_print_table(
+                    record_result(
                         name,
                         pname,
                         backend,
                         "Primal",
-                        timeit.Timer(
-                            primalstr,
-                            globals={
-                                "fn": rfn_enzyme,
-                            }
-                            | primalins,
-                        ).timeit(self.count)
-                        / self.count,
+                        compile_stats,
+                        measure(
+                            timeit.Timer(
+                                primalstr,
+                                globals={
+                                    "fn": rfn_enzyme,
+                                }
+                                | primalins,
+                            ),
+                            self.count,
+                        ),
                     )
 
             # assert primres is not None
@@ -767,7 +922,9 @@ class EnzymeJaxTest(absltest.TestCase):
                         )
                         fwd_enzyme = jax.jit(splatjvp(rfn_enzyme), backend=backend)
 
-                        primals, tangents = fwd_enzyme(*(ins_backend + dins_backend))
+                        (primals, tangents), compile_stats = first_call(
+                            fwd_enzyme, *(ins_backend + dins_backend)
+                        )
 
                         recursive_check(
                             self, primals, primres, self.tol, "Primal " + pname
@@ -780,19 +937,22 @@ class EnzymeJaxTest(absltest.TestCase):
                                 self, tangents, fwdres, self.tol, "Forward " + pname
                             )
 
-                        pretty_print_table(
+                        record_result(
                             name,
                             pname,
                             backend,
                             "Forward",
-                            timeit.Timer(
-                                fwdstr,
-                                globals={
-                                    "fwd": fwd_enzyme,
-                                }
-                                | fwdins,
-                            ).timeit(self.count)
-                            / self.count,
+                            compile_stats,
+                            measure(
+                                timeit.Timer(
+                                    fwdstr,
+                                    globals={
+                                        "fwd": fwd_enzyme,
+                                    }
+                                    | fwdins,
+                                ),
+                                self.count,
+                            ),
                         )
 
             # assert fwdres is not None
@@ -818,10 +978,13 @@ class EnzymeJaxTest(absltest.TestCase):
                                 revtransform(rfn_enzyme), backend=backend
                             )
 
+                            res, compile_stats = first_call(
+                                rev_enzyme, adout, *ins_backend
+                            )
                             if self.revprimal:
-                                primals, grads = rev_enzyme(adout, *ins_backend)
+                                primals, grads = res
                             else:
-                                grads = rev_enzyme(adout, *ins_backend)
+                                grads = res
                                 assert grads is not None
 
                             if self.revprimal and primres is not None:
@@ -836,19 +999,22 @@ class EnzymeJaxTest(absltest.TestCase):
                                     self, grads, revres, self.tol, "Reverse " + pname
                                 )
 
-                            pretty_print_table(
+                            record_result(
                                 name,
                                 pname,
                                 backend,
                                 "PreRev",
-                                timeit.Timer(
-                                    revstr,
-                                    globals={
-                                        "rev": rev_enzyme,
-                                    }
-                                    | revins,
-                                ).timeit(self.count)
-                                / self.count,
+                                compile_stats,
+                                measure(
+                                    timeit.Timer(
+                                        revstr,
+                                        globals={
+                                            "rev": rev_enzyme,
+                                        }
+                                        | revins,
+                                    ),
+                                    self.count,
+                                ),
                             )
 
                         rfn_enzyme = in_fn
@@ -865,10 +1031,11 @@ class EnzymeJaxTest(absltest.TestCase):
                             backend=backend,
                         )
 
+                        res, compile_stats = first_call(rev_enzyme, adout, *ins_backend)
                         if self.revprimal:
-                            primals, grads = rev_enzyme(adout, *ins_backend)
+                            primals, grads = res
                         else:
-                            grads = rev_enzyme(adout, *ins_backend)
+                            grads = res
                             assert grads is not None
 
                         if self.revprimal and primres is not None:
@@ -879,19 +1046,22 @@ class EnzymeJaxTest(absltest.TestCase):
                         else:
                             recursive_check(self, grads, revres, self.tol)
 
-                        pretty_print_table(
+                        record_result(
                             name,
                             pname,
                             backend,
                             "PostRev",
-                            timeit.Timer(
-                                revstr,
-                                globals={
-                                    "rev": rev_enzyme,
-                                }
-                                | revins,
-                            ).timeit(self.count)
-                            / self.count,
+                            compile_stats,
+                            measure(
+                                timeit.Timer(
+                                    revstr,
+                                    globals={
+                                        "rev": rev_enzyme,
+                                    }
+                                    | revins,
+                                ),
+                                self.count,
+                            ),
                         )
 
                     if pipeline is None or (pipeline.mlir_ad() and self.mlirad_rev):
@@ -915,10 +1085,11 @@ class EnzymeJaxTest(absltest.TestCase):
                             backend=backend,
                         )
 
+                        res, compile_stats = first_call(rev_enzyme, adout, *ins_backend)
                         if self.revprimal:
-                            primals, grads = rev_enzyme(adout, *ins_backend)
+                            primals, grads = res
                         else:
-                            grads = rev_enzyme(adout, *ins_backend)
+                            grads = res
                             assert grads is not None
 
                         if self.revprimal and primres is not None:
@@ -929,17 +1100,22 @@ class EnzymeJaxTest(absltest.TestCase):
                         else:
                             recursive_check(self, grads, revres, self.tol)
 
-                        pretty_print_table(
+                        record_result(
                             name,
                             pname,
                             backend,
                             "BothRev",
-                            timeit.Timer(
-                                revstr,
-                                globals={
-                                    "rev": rev_enzyme,
-                                }
-                                | revins,
-                            ).timeit(self.count)
-                            / self.count,
+                            compile_stats,
+                            measure(
+                                timeit.Timer(
+                                    revstr,
+                                    globals={
+                                        "rev": rev_enzyme,
+                                    }
+                                    | revins,
+                                ),
+                                self.count,
+                            ),
                         )
+
+        write_bench_results()